@@ -0,0 +1,222 @@
+//
+//  allocator.c
+//
+
+#include "allocator.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+
+// Size classes are per thread, same as the pool stack. Blocks have to be freed on the
+// thread that allocated them, the runtime keeps objects on their thread (see runtime.h).
+
+typedef struct AllocatorBlock {
+    struct AllocatorBlock *next;
+} AllocatorBlock;
+
+// first granule of every page, blocks start after it so they keep their alignment.
+typedef struct AllocatorPage {
+    struct AllocatorPage *next;
+} AllocatorPage;
+
+typedef struct AllocatorSizeClass {
+    AllocatorBlock  *freeList;
+    char            *cursor;    // unused tail of the newest page
+    char            *end;
+    AllocatorPage   *pages;
+    struct AllocatorSizeClass *next; // orphans only
+    AllocatorSizeClassStats stats;
+} AllocatorSizeClass;
+
+static _Thread_local AllocatorSizeClass sizeClasses[AR_ALLOCATOR_SIZE_CLASSES];
+static _Thread_local AllocatorStats allocatorStats;
+
+// classes of exited threads that still had blocks in use (leaks, constants), the next thread
+// to run out of blocks in the same class takes them over instead of going to the system.
+static AllocatorSizeClass *orphans[AR_ALLOCATOR_SIZE_CLASSES];
+static pthread_mutex_t orphansLock = PTHREAD_MUTEX_INITIALIZER;
+
+int AllocatorSizeClassIndex(size_t size) {
+    if (size == 0 || size > AR_ALLOCATOR_MAX_SIZE) {
+        return -1;
+    }
+    return (int)((size - 1) / AR_ALLOCATOR_GRANULARITY);
+}
+
+static void *allocatorRefill(AllocatorSizeClass *sizeClass, size_t blockSize) {
+    AllocatorPage *page = ar_malloc(AR_ALLOCATOR_PAGE_SIZE);
+    allocatorStats.systemAllocations++;
+
+    page->next = sizeClass->pages;
+    sizeClass->pages = page;
+
+    size_t blocks = (AR_ALLOCATOR_PAGE_SIZE - AR_ALLOCATOR_GRANULARITY) / blockSize;
+    sizeClass->cursor = (char *)page + AR_ALLOCATOR_GRANULARITY;
+    sizeClass->end = sizeClass->cursor + blocks * blockSize;
+    sizeClass->stats.pages++;
+    sizeClass->stats.capacity += blocks;
+
+    return page;
+}
+
+// true if it left free blocks to hand out.
+static bool allocatorAdopt(AllocatorSizeClass *sizeClass, int index) {
+    pthread_mutex_lock(&orphansLock);
+    AllocatorSizeClass *orphan = orphans[index];
+    orphans[index] = NULL;
+    pthread_mutex_unlock(&orphansLock);
+
+    while (orphan) {
+        // orphans only have a free list, their unused tail was added to it on the way out.
+        AllocatorBlock **freeTail = &orphan->freeList;
+        while (*freeTail) {
+            freeTail = &(*freeTail)->next;
+        }
+        *freeTail = sizeClass->freeList;
+        sizeClass->freeList = orphan->freeList;
+
+        AllocatorPage **pageTail = &orphan->pages;
+        while (*pageTail) {
+            pageTail = &(*pageTail)->next;
+        }
+        *pageTail = sizeClass->pages;
+        sizeClass->pages = orphan->pages;
+
+        sizeClass->stats.pages += orphan->stats.pages;
+        sizeClass->stats.capacity += orphan->stats.capacity;
+        sizeClass->stats.inUse += orphan->stats.inUse;
+
+        AllocatorSizeClass *next = orphan->next;
+        free(orphan);
+        orphan = next;
+    }
+
+    return sizeClass->freeList != NULL;
+}
+
+void *AllocatorAlloc(size_t size) {
+    assert(size > 0);
+    allocatorStats.allocations++;
+
+    int index = AR_ALLOCATOR_ENABLED ? AllocatorSizeClassIndex(size) : -1;
+    if (index < 0) {
+        allocatorStats.systemAllocations++;
+        allocatorStats.bytesInUse += size;
+        allocatorStats.bytesAllocated += size;
+        return ar_calloc(1, size);
+    }
+
+    AllocatorSizeClass *sizeClass = &sizeClasses[index];
+    size_t blockSize = (index + 1) * AR_ALLOCATOR_GRANULARITY;
+    if (!sizeClass->freeList && sizeClass->cursor == sizeClass->end && !allocatorAdopt(sizeClass, index)) {
+        allocatorRefill(sizeClass, blockSize);
+    }
+
+    void *block = sizeClass->freeList;
+    if (block) {
+        sizeClass->freeList = sizeClass->freeList->next;
+
+    } else {
+        block = sizeClass->cursor;
+        sizeClass->cursor += blockSize;
+    }
+
+    sizeClass->stats.inUse++;
+    sizeClass->stats.allocations++;
+    allocatorStats.bytesInUse += blockSize;
+    allocatorStats.bytesAllocated += blockSize;
+
+    return memset(block, 0, blockSize);
+}
+
+void AllocatorFree(void *ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    allocatorStats.frees++;
+
+    int index = AR_ALLOCATOR_ENABLED ? AllocatorSizeClassIndex(size) : -1;
+    if (index < 0) {
+        allocatorStats.systemFrees++;
+        allocatorStats.bytesInUse -= size;
+        free(ptr);
+        return;
+    }
+
+    AllocatorSizeClass *sizeClass = &sizeClasses[index];
+    assert(sizeClass->stats.inUse > 0);
+
+    AllocatorBlock *block = ptr;
+    block->next = sizeClass->freeList;
+    sizeClass->freeList = block;
+
+    sizeClass->stats.inUse--;
+    allocatorStats.bytesInUse -= (index + 1) * AR_ALLOCATOR_GRANULARITY;
+}
+
+void AllocatorThreadExit(void) {
+    for (int i = 0; i < AR_ALLOCATOR_SIZE_CLASSES; i++) {
+        AllocatorSizeClass *sizeClass = &sizeClasses[i];
+        if (!sizeClass->pages) {
+            continue;
+        }
+
+        if (sizeClass->stats.inUse == 0) {
+            while (sizeClass->pages) {
+                AllocatorPage *next = sizeClass->pages->next;
+                free(sizeClass->pages);
+                allocatorStats.systemFrees++;
+                sizeClass->pages = next;
+            }
+
+        } else {
+            size_t blockSize = (i + 1) * AR_ALLOCATOR_GRANULARITY;
+            for (; sizeClass->cursor < sizeClass->end; sizeClass->cursor += blockSize) {
+                AllocatorBlock *block = (AllocatorBlock *)sizeClass->cursor;
+                block->next = sizeClass->freeList;
+                sizeClass->freeList = block;
+            }
+
+            AllocatorSizeClass *orphan = ar_malloc(sizeof(AllocatorSizeClass));
+            *orphan = *sizeClass;
+            pthread_mutex_lock(&orphansLock);
+            orphan->next = orphans[i];
+            orphans[i] = orphan;
+            pthread_mutex_unlock(&orphansLock);
+        }
+        *sizeClass = (AllocatorSizeClass){ 0 };
+    }
+}
+
+AllocatorSizeClassStats AllocatorSizeClassStatsAt(int index) {
+    assert(index >= 0 && index < AR_ALLOCATOR_SIZE_CLASSES);
+    AllocatorSizeClassStats stats = sizeClasses[index].stats;
+    stats.blockSize = (index + 1) * AR_ALLOCATOR_GRANULARITY;
+    return stats;
+}
+
+AllocatorStats AllocatorGetStats(void) {
+    return allocatorStats;
+}
+
+void AllocatorPrintReport(FILE *out) {
+    fprintf(out, "%8s %8s %10s %10s %8s %12s\n", "size", "pages", "capacity", "in use", "used%", "allocations");
+    for (int i = 0; i < AR_ALLOCATOR_SIZE_CLASSES; i++) {
+        AllocatorSizeClassStats stats = AllocatorSizeClassStatsAt(i);
+        if (!stats.pages) {
+            continue;
+        }
+
+        fprintf(out, "%8zu %8llu %10llu %10llu %7.1f%% %12llu\n",
+                stats.blockSize, stats.pages, stats.capacity, stats.inUse,
+                100.0 * stats.inUse / stats.capacity, stats.allocations);
+    }
+
+    fprintf(out, "allocations: %llu, frees: %llu, system allocations: %llu, system frees: %llu, bytes in use: %llu\n",
+            allocatorStats.allocations, allocatorStats.frees,
+            allocatorStats.systemAllocations, allocatorStats.systemFrees, allocatorStats.bytesInUse);
+}
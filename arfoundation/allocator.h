@@ -0,0 +1,53 @@
+//
+//  allocator.h
+//
+//  Size class allocator for small runtime objects. Requests up to AR_ALLOCATOR_MAX_SIZE bytes
+//  are rounded up to a multiple of AR_ALLOCATOR_GRANULARITY and served from per-class free lists
+//  carved out of page sized chunks, anything bigger goes straight to calloc/free.
+//  Freed blocks are reused by the next allocation of the same class, pages go back to the
+//  system when the thread that owns them exits, see AllocatorThreadExit.
+
+#ifndef _allocator_h_
+#define _allocator_h_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// set to 0 to route everything through calloc/free, handy for leak checkers and sanitizers.
+#ifndef AR_ALLOCATOR_ENABLED
+#define AR_ALLOCATOR_ENABLED 1
+#endif
+
+#define AR_ALLOCATOR_PAGE_SIZE 4096
+#define AR_ALLOCATOR_GRANULARITY 16
+#define AR_ALLOCATOR_MAX_SIZE 256
+#define AR_ALLOCATOR_SIZE_CLASSES (AR_ALLOCATOR_MAX_SIZE / AR_ALLOCATOR_GRANULARITY)
+
+typedef struct {
+    size_t      blockSize;
+    uint64_t    pages;      // chunks owned by this class
+    uint64_t    capacity;   // blocks carved out of those pages
+    uint64_t    inUse;      // blocks currently handed out
+    uint64_t    allocations;// total requests served
+} AllocatorSizeClassStats;
+
+typedef struct {
+    uint64_t    allocations;        // all requests, small and large
+    uint64_t    frees;
+    uint64_t    systemAllocations;  // calls into malloc/calloc: pages + large requests
+    uint64_t    systemFrees;
+    uint64_t    bytesInUse;         // requested (rounded) bytes currently handed out
+    uint64_t    bytesAllocated;     // requested (rounded) bytes ever handed out
+} AllocatorStats;
+
+void *AllocatorAlloc(size_t size);              // zero filled, like calloc(1, size)
+void AllocatorFree(void *ptr, size_t size);     // size must match the one passed to AllocatorAlloc, same thread
+void AllocatorThreadExit(void);                 // frees the thread's empty classes, the rest are left for the next thread
+
+int AllocatorSizeClassIndex(size_t size);       // -1 for sizes that bypass the size classes
+AllocatorSizeClassStats AllocatorSizeClassStatsAt(int index);
+AllocatorStats AllocatorGetStats(void);
+void AllocatorPrintReport(FILE *out);
+
+#endif /* _allocator_h_ */
@@ -1,8 +1,10 @@
+#include "allocator.h"
 #include "autoreleasepool.h"
 #include "common.h"
 #include "macros.h"
 #include "runtime.h"
 #include "string.h"
 #include "containers.h"
+#include "hash.h"
 #include "range.h"
 #include "stb_ds_x.h"
@@ -9,50 +9,109 @@
 #include <stdio.h>
 #include <pthread.h>
 
-#include "stb_ds_x.h"
+#include "common.h"
+
+// Autoreleased objects of every pool on a thread live in a single stack made of 4k pages.
+// A pool is just a marker, the position the stack was at when it was created, draining
+// releases everything above its marker.
+#define AR_POOL_PAGE_SIZE 4096
+
+typedef struct AutoreleasePoolPage {
+    struct AutoreleasePoolPage *parent;
+    struct AutoreleasePoolPage *child;  // spare page kept after a pop, avoids malloc/free at page boundaries
+    RCTypeRef *next;                    // first empty slot
+    RCTypeRef slots[];
+} AutoreleasePoolPage;
+
+#define AR_POOL_PAGE_SLOTS ((AR_POOL_PAGE_SIZE - sizeof(AutoreleasePoolPage)) / sizeof(RCTypeRef))
 
 struct AutoreleasePool {
-    uint64_t threadID;
-    // maybe instead of an array use a dict, with the id being "alloc id" so you can't add an entry twice...?
-    RCTypeRef *objects;
+    pthread_t thread; // owner, objects may only be added from it
+    AutoreleasePoolRef parent; // next pool down this thread's stack
+    AutoreleasePoolPage *page; // marker
+    RCTypeRef *start;
 };
 
 static RuntimeClassID ARAutoreleasePoolClassID = { 0 };
-static AutoreleasePoolRef *activePools = NULL;
+static _Thread_local AutoreleasePoolRef activePool = NULL; // top of this thread's stack
+static _Thread_local AutoreleasePoolPage *hotPage = NULL; // top of this thread's object stack
+
+static AutoreleasePoolPage *AutoreleasePoolPageCreate(AutoreleasePoolPage *parent) {
+    AutoreleasePoolPage *page = ar_malloc(AR_POOL_PAGE_SIZE);
+    page->parent = parent;
+    page->child = NULL;
+    page->next = page->slots;
+    if (parent) {
+        parent->child = page;
+    }
+    return page;
+}
+
+static void AutoreleasePoolPagesFree(AutoreleasePoolPage *page) {
+    while (page) {
+        AutoreleasePoolPage *child = page->child;
+        free(page);
+        page = child;
+    }
+}
+
+static AutoreleasePoolPage *AutoreleasePoolPageGrow(void) {
+    if (hotPage->child) {
+        hotPage = hotPage->child;
+        hotPage->next = hotPage->slots;
+
+    } else {
+        hotPage = AutoreleasePoolPageCreate(hotPage);
+    }
+    return hotPage;
+}
+
+static void AutoreleasePoolCheckOwner(AutoreleasePoolRef pool) {
+    if (!pthread_equal(pool->thread, pthread_self())) {
+        ar_fatal("Pool %p is owned by another thread\n", pool);
+    }
 
-static uint64_t currentThreadID() {
-    return pthread_mach_thread_np(pthread_self());
+    if (pool != activePool) {
+        ar_fatal("Pool %p is not the innermost pool, pools must be used and released in the reverse order they were created\n", pool);
+    }
 }
 
 static RCTypeRef ARAutoreleasePoolConstructor(RCTypeRef obj) {
     assert(obj);
-    
+
     AutoreleasePoolRef pool = obj;
-    pool->threadID = currentThreadID();
-    
-    // TODO: check if current thread has a pool stack, if not add 'obj' and set it 
-    
-    // add to stack
-    arrput(activePools, pool);
+    pool->thread = pthread_self();
+
+    if (!hotPage) {
+        hotPage = AutoreleasePoolPageCreate(NULL);
+    }
+
+    // push
+    pool->page = hotPage;
+    pool->start = hotPage->next;
+    pool->parent = activePool;
+    activePool = pool;
     return pool;
 }
 
 static void ARAutoreleasePoolDestructor(RCTypeRef obj) {
     assert(obj);
-    
+
     // drain
     AutoreleasePoolRef pool = obj;
     AutoreleasePoolDrain(pool);
-    
-    // remove from stack
-    for (int i = 0; i < arrlen(activePools); i++) {
-        if (activePools[i] == pool) {
-            arrdel(activePools, i);
-            break;
+
+    // pop
+    activePool = pool->parent;
+    if (!activePool) {
+        // outermost pool on this thread, nothing left to hold on to.
+        AutoreleasePoolPage *base = hotPage;
+        while (base->parent) {
+            base = base->parent;
         }
+        AutoreleasePoolPagesFree(base);
+        hotPage = NULL;
     }
-    
-    arrfree(pool->objects);
 }
 
 static RuntimeClassDescriptor ARAutoreleasePoolClass = {
@@ -74,38 +133,42 @@ void AutoreleasePoolAddObject(AutoreleasePoolRef pool, RCTypeRef obj) {
     assert(pool);
     assert(obj);
     assert(pool != obj);
-    
-    // check if poolid and threadid match
-    
-    arrput(pool->objects, obj);
+
+    AutoreleasePoolCheckOwner(pool);
+
+    AutoreleasePoolPage *page = hotPage;
+    if (page->next == page->slots + AR_POOL_PAGE_SLOTS) {
+        page = AutoreleasePoolPageGrow();
+    }
+    *page->next++ = obj;
 }
 
 void AutoreleasePoolDrain(AutoreleasePoolRef pool) {
     assert(pool);
-    
-    if (!pool->objects) {
-        return;
-    }
-    
+    AutoreleasePoolCheckOwner(pool);
+
 #if RC_RUNTIME_VERBOSE && RC_PRINT_RETAIN_RELEASE
     fprintf(stderr, "--- draining ---\n");
 #endif
-    
-    for (int i = 0; i < arrlen(pool->objects); i++) {
-        RCRelease(pool->objects[(arrlen(pool->objects) - 1) - i]);
+
+    // releasing can autorelease more objects into this pool, those get released too.
+    while (hotPage != pool->page || hotPage->next != pool->start) {
+        if (hotPage->next == hotPage->slots) {
+            // keep the page we're leaving as a spare, drop anything past it.
+            AutoreleasePoolPagesFree(hotPage->child);
+            hotPage->child = NULL;
+            hotPage = hotPage->parent;
+            continue;
+        }
+
+        RCRelease(*--hotPage->next);
     }
-    
+
 #if RC_RUNTIME_VERBOSE && RC_PRINT_RETAIN_RELEASE
     fprintf(stderr, "----------------\n");
 #endif
-    
-    arrclear(pool->objects);
 }
 
 AutoreleasePoolRef CurrentAutoreleasePool(void) {
-    if (activePools && arrlen(activePools) > 0) {
-        return arrlast(activePools);
-    }
-    
-    return NULL;
+    return activePool;
 }
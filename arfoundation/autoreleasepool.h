@@ -2,7 +2,7 @@
 //  arautoreleasepool.h
 //  Created by Alex Restrepo on 1/16/23.
 //
-//  Naive implementation, a real one should have a pool/stack per thread.
+//  Every thread has its own stack of pools, RCAutorelease uses the top one of the calling thread.
 
 #ifndef _autoreleasepool_h_
 #define _autoreleasepool_h_
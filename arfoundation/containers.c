@@ -6,7 +6,10 @@
 #include "containers.h"
 
 #include <assert.h>
+#include <string.h>
 
+#include "common.h"
+#include "hash.h"
 #include "string.h"
 #include "stb_ds_x.h"
 
@@ -30,13 +33,21 @@ static StringRef PairDescription(RCTypeRef obj) {
                             CString(RuntimeDescription(self->second)));
 }
 
+static void PairTraverse(RCTypeRef obj, visitor_fn *visit, void *context) {
+    ObjectPairRef self = obj;
+    visit(self->first, context);
+    visit(self->second, context);
+}
+
 static RuntimeClassID ARObjectPairClassID = { 0 };
 static RuntimeClassDescriptor ARObjectPairClass = {
     "Pair",
     sizeof(struct ObjectPair),
     NULL, // const
     PairDealloc, // dest
-    PairDescription  // desc
+    PairDescription, // desc
+    NULL, // hash
+    PairTraverse
 };
 
 void ObjectPairInitialize(void) {
@@ -60,20 +71,257 @@ RCTypeRef objectPairSecond(ObjectPairRef pair) {
 
 #pragma mark - array
 
+// Persistent vector (Clojure style bit partitioned trie): elements live in the leaves of a 32 way trie
+// of refcounted nodes, plus a tail of up to 32 elements owned by the array itself. Copies share the trie,
+// a node is only written in place while a single array holds it, shared ones are copied on the way down.
+// Copying, appending and dropping leading elements (ArrayCreateWithRest) don't depend on the length,
+// slicing (ArrayCreateWithRange) copies the two edges of the trie, log32 n nodes.
+// Short arrays are all tail, its first elements are stored in the array object so they need no buffer.
+#define AR_ARRAY_BITS 5
+#define AR_ARRAY_WIDTH (1 << AR_ARRAY_BITS)
+#define AR_ARRAY_MASK (AR_ARRAY_WIDTH - 1)
+#define AR_ARRAY_INLINE_CAPACITY 8
+
+typedef struct ArrayNode {
+    RCTypeRef slots[AR_ARRAY_WIDTH]; // child nodes, elements in the leaves
+} *ArrayNodeRef;
+
 struct ARArray {
-    RCTypeRef *storage;
+    ArrayNodeRef root;
+    RCTypeRef *tail;   // the elements after the trie's: inlineTail, or a buffer of 32 once they outgrow it
+    size_t tailCount;
+    size_t trieCount;  // a multiple of 32
+    size_t start;      // elements before it were dropped
+    size_t trimmed;    // leaves before it are gone from the trie, a multiple of 32
+    unsigned shift;    // of the root's level, leaves are at 0
+    RCTypeRef inlineTail[AR_ARRAY_INLINE_CAPACITY];
 };
 
 static RuntimeClassID ARArrayClassID = { 0 };
+static RuntimeClassID ARArrayNodeClassID = { 0 };
+
+static void ARArrayNodeDestructor(RCTypeRef obj) {
+    ArrayNodeRef self = obj;
+    for (int i = 0; i < AR_ARRAY_WIDTH; i++) {
+        RCRelease(self->slots[i]);
+    }
+}
+
+static void ARArrayNodeTraverse(RCTypeRef obj, visitor_fn *visit, void *context) {
+    ArrayNodeRef self = obj;
+    for (int i = 0; i < AR_ARRAY_WIDTH; i++) {
+        if (self->slots[i]) {
+            visit(self->slots[i], context);
+        }
+    }
+}
+
+static RuntimeClassDescriptor ARArrayNodeClass = {
+    "ArrayNode",
+    sizeof(struct ArrayNode),
+    NULL, // const
+    ARArrayNodeDestructor, // dest
+    NULL, // desc
+    NULL, // hash
+    ARArrayNodeTraverse
+};
+
+// a node this array can write to: the one it has if nothing else holds it, a copy otherwise.
+static ArrayNodeRef ArrayNodeUnique(ArrayNodeRef node) {
+    if (!node) {
+        return RuntimeCreateInstance(ARArrayNodeClassID);
+    }
+
+    if (RuntimeRefCount(node) == 1) {
+        return node;
+    }
+
+    ArrayNodeRef copy = RuntimeCreateInstance(ARArrayNodeClassID);
+    for (int i = 0; i < AR_ARRAY_WIDTH; i++) {
+        copy->slots[i] = RCRetain(node->slots[i]);
+    }
+    RCRelease(node);
+    return copy;
+}
+
+static ArrayNodeRef ArrayNodeInsertLeaf(ArrayNodeRef node, unsigned level, size_t index, ArrayNodeRef leaf) {
+    node = ArrayNodeUnique(node);
+    size_t slot = (index >> level) & AR_ARRAY_MASK;
+    if (level == AR_ARRAY_BITS) {
+        node->slots[slot] = leaf;
+    } else {
+        node->slots[slot] = ArrayNodeInsertLeaf(node->slots[slot], level - AR_ARRAY_BITS, index, leaf);
+    }
+    return node;
+}
+
+// leaf goes after the trie's last one.
+static void ArrayPushLeaf(ArrayRef array, ArrayNodeRef leaf) {
+    if (!array->root) {
+        array->root = leaf;
+        array->shift = 0;
+
+    } else {
+        if (array->trieCount == (size_t)1 << (array->shift + AR_ARRAY_BITS)) {
+            ArrayNodeRef root = RuntimeCreateInstance(ARArrayNodeClassID);
+            root->slots[0] = array->root;
+            array->root = root;
+            array->shift += AR_ARRAY_BITS;
+        }
+        array->root = ArrayNodeInsertLeaf(array->root, array->shift, array->trieCount, leaf);
+    }
+    array->trieCount += AR_ARRAY_WIDTH;
+}
+
+// a full tail becomes the trie's next leaf, its references move along.
+static void ArrayPushTail(ArrayRef array) {
+    ArrayNodeRef leaf = RuntimeCreateInstance(ARArrayNodeClassID);
+    memcpy(leaf->slots, array->tail, sizeof(leaf->slots));
+    array->tailCount = 0;
+    ArrayPushLeaf(array, leaf);
+}
+
+// moves the tail out of line if `count` elements won't fit in the array.
+static void ArrayTailReserve(ArrayRef array, size_t count) {
+    if (count > AR_ARRAY_INLINE_CAPACITY && array->tail == array->inlineTail) {
+        array->tail = ar_malloc(AR_ARRAY_WIDTH * sizeof(RCTypeRef));
+        memcpy(array->tail, array->inlineTail, array->tailCount * sizeof(RCTypeRef));
+    }
+}
+
+// obj's reference moves in.
+static void ArrayTailAppend(ArrayRef array, RCTypeRef obj) {
+    if (array->tailCount == AR_ARRAY_WIDTH) {
+        ArrayPushTail(array);
+    }
+    ArrayTailReserve(array, array->tailCount + 1);
+    array->tail[array->tailCount++] = obj;
+}
+
+// the references move in. Whole leaves go straight into the trie, the rest is copied into the tail.
+static void ArrayTailAppendObjects(ArrayRef array, RCTypeRef *objects, size_t count) {
+    while (count > 0) {
+        if (array->tailCount == AR_ARRAY_WIDTH) {
+            ArrayPushTail(array);
+        }
+
+        if (array->tailCount == 0 && count > AR_ARRAY_WIDTH) {
+            ArrayNodeRef leaf = RuntimeCreateInstance(ARArrayNodeClassID);
+            memcpy(leaf->slots, objects, sizeof(leaf->slots));
+            ArrayPushLeaf(array, leaf);
+            objects += AR_ARRAY_WIDTH;
+            count -= AR_ARRAY_WIDTH;
+            continue;
+        }
+
+        size_t chunk = MIN(count, AR_ARRAY_WIDTH - array->tailCount);
+        ArrayTailReserve(array, array->tailCount + chunk);
+        memcpy(array->tail + array->tailCount, objects, chunk * sizeof(RCTypeRef));
+        array->tailCount += chunk;
+        objects += chunk;
+        count -= chunk;
+    }
+}
+
+static void ArrayRelease(ArrayRef array) {
+    RCRelease(array->root);
+    array->root = NULL;
+    for (size_t i = 0; i < array->tailCount; i++) {
+        RCRelease(array->tail[i]);
+    }
+    array->tailCount = 0;
+    array->trieCount = 0;
+    array->start = 0;
+    array->trimmed = 0;
+    array->shift = 0;
+}
+
+// the leaf holding a position in the trie.
+static RCTypeRef *ArrayLeafFor(ArrayRef array, size_t position) {
+    ArrayNodeRef node = array->root;
+    for (unsigned level = array->shift; level > 0; level -= AR_ARRAY_BITS) {
+        node = node->slots[(position >> level) & AR_ARRAY_MASK];
+    }
+    return node->slots;
+}
+
+// a copy of node with only the leaves for positions from..<to (multiples of 32, relative to the node), the rest is let go.
+static ArrayNodeRef ArrayNodeTrim(ArrayNodeRef node, unsigned level, size_t from, size_t to) {
+    ArrayNodeRef copy = RuntimeCreateInstance(ARArrayNodeClassID);
+    size_t span = (size_t)1 << level;
+    for (size_t i = from / span; i * span < to; i++) {
+        size_t first = i * span;
+        if (from <= first && first + span <= to) {
+            copy->slots[i] = RCRetain(node->slots[i]);
+        } else {
+            copy->slots[i] = ArrayNodeTrim(node->slots[i], level - AR_ARRAY_BITS,
+                                           from > first ? from - first : 0, MIN(to - first, span));
+        }
+    }
+    return copy;
+}
+
+// position counts dropped elements.
+static RCTypeRef ArrayElementAt(ArrayRef array, size_t position) {
+    if (position >= array->trieCount) {
+        return array->tail[position - array->trieCount];
+    }
+    return ArrayLeafFor(array, position)[position & AR_ARRAY_MASK];
+}
+
+// positions from..<to (counting dropped elements) into objects, a leaf at a time.
+static void ArrayCopyPositions(ArrayRef array, size_t from, size_t to, RCTypeRef *objects) {
+    while (from < to) {
+        if (from >= array->trieCount) {
+            memcpy(objects, array->tail + (from - array->trieCount), (to - from) * sizeof(RCTypeRef));
+            return;
+        }
+
+        size_t chunk = MIN(to, (from | AR_ARRAY_MASK) + 1) - from;
+        memcpy(objects, ArrayLeafFor(array, from) + (from & AR_ARRAY_MASK), chunk * sizeof(RCTypeRef));
+        objects += chunk;
+        from += chunk;
+    }
+}
+
+// appends source's positions from..<to, at most a leaf's worth.
+static void ArrayAppendPositions(ArrayRef array, ArrayRef source, size_t from, size_t to) {
+    RCTypeRef objects[AR_ARRAY_WIDTH];
+    assert(to - from <= AR_ARRAY_WIDTH);
+    ArrayCopyPositions(source, from, to, objects);
+    RCRetainObjects(objects, to - from);
+    ArrayTailAppendObjects(array, objects, to - from);
+}
+
+// rebuilds the array from its elements, skipping `skip` (an index, SIZE_MAX for none).
+static void ArrayRebuild(ArrayRef array, size_t skip) {
+    size_t count = ArrayCount(array);
+    RCTypeRef *elements = ar_malloc(MAX(count, 1) * sizeof(RCTypeRef));
+    ArrayCopyPositions(array, array->start, array->start + count, elements);
+    if (skip < count) {
+        memmove(elements + skip, elements + skip + 1, (count - skip - 1) * sizeof(RCTypeRef));
+        count--;
+    }
+
+    RCRetainObjects(elements, count);
+    ArrayRelease(array);
+    ArrayTailAppendObjects(array, elements, count);
+    free(elements);
+}
+
+static RCTypeRef ARArrayConstructor(RCTypeRef array) {
+    ArrayRef self = array;
+    self->tail = self->inlineTail;
+    return self;
+}
 
 static void ARArrayDestructor(RCTypeRef array) {
     ArrayRef self = array;
-    
-    for (size_t i = 0; i < arrlen(self->storage); i++) {
-        RCRelease(self->storage[i]);
+    ArrayRelease(self);
+    if (self->tail != self->inlineTail) {
+        free(self->tail);
+        self->tail = self->inlineTail;
     }
-    
-    arrfree(self->storage);
 }
 
 static StringRef ARArrayDescription(RCTypeRef array) {
@@ -81,24 +329,39 @@ static StringRef ARArrayDescription(RCTypeRef array) {
     
     StringRef description = StringWithString(RuntimeDescription(self));
     StringAppendChars(description, " [\n");
-    for (size_t i = 0; i < arrlen(self->storage); i++) {
-        StringAppendFormat(description, "\t%s", CString(RuntimeDescription(self->storage[i])));
+    ArrayIterator iterator = ArrayIteratorMake(self);
+    RCTypeRef obj;
+    while (ArrayIteratorNext(&iterator, &obj)) {
+        StringAppendFormat(description, "\t%s", CString(RuntimeDescription(obj)));
     }
     StringAppendChars(description, "\n]\n");
     
     return description;
 }
 
+static void ARArrayTraverse(RCTypeRef array, visitor_fn *visit, void *context) {
+    ArrayRef self = array;
+    if (self->root) {
+        visit(self->root, context);
+    }
+    for (size_t i = 0; i < self->tailCount; i++) {
+        visit(self->tail[i], context);
+    }
+}
+
 static RuntimeClassDescriptor ARArrayClass = {
     "Array",
     sizeof(struct ARArray),
-    NULL, // const
+    ARArrayConstructor, // const
     ARArrayDestructor, // dest
-    ARArrayDescription  // desc
+    ARArrayDescription, // desc
+    NULL, // hash
+    ARArrayTraverse
 };
 
 void ArrayInitialize(void) {
     ARArrayClassID = RuntimeRegisterClass(&ARArrayClass);
+    ARArrayNodeClassID = RuntimeRegisterClass(&ARArrayNodeClass);
 }
 
 ArrayRef ArrayCreate(void) {
@@ -106,16 +369,91 @@ ArrayRef ArrayCreate(void) {
     return instance;
 }
 
+ArrayRef ArrayCreateWithCapacity(size_t capacity) {
+    ArrayRef instance = ArrayCreate();
+    ArrayTailReserve(instance, capacity);
+    return instance;
+}
+
 ArrayRef Array(void) {
     ArrayRef instance = ArrayCreate();
     return RCAutorelease(instance);
 }
 
+ArrayRef ArrayCreateWithArray(ArrayRef array) {
+    assert(array);
+
+    ArrayRef copy = ArrayCreate();
+    copy->root = RCRetain(array->root);
+    copy->trieCount = array->trieCount;
+    copy->start = array->start;
+    copy->trimmed = array->trimmed;
+    copy->shift = array->shift;
+    ArrayTailAppendObjects(copy, array->tail, array->tailCount);
+    RCRetainObjects(copy->tail, copy->tailCount);
+    return copy;
+}
+
+ArrayRef ArrayCreateWithRest(ArrayRef array, size_t start) {
+    return ArrayCreateWithRange(array, start, SIZE_MAX);
+}
+
+// Shares the trie, copying its edges (log32 n nodes) to let go of the leaves outside the range: always past
+// its end, before its start once they outnumber its elements. Repeated rests then only copy a log of times.
+ArrayRef ArrayCreateWithRange(ArrayRef array, size_t start, size_t length) {
+    assert(array);
+
+    size_t count = ArrayCount(array);
+    if (start >= count || length == 0) {
+        return ArrayCreate();
+    }
+    length = MIN(length, count - start);
+
+    ArrayRef range = ArrayCreate();
+    size_t first = array->start + start;
+    size_t end = first + length;
+    if (first >= array->trieCount) {
+        // all of it in the tail.
+        ArrayAppendPositions(range, array, first, end);
+        return range;
+    }
+
+    size_t leaf = first & ~(size_t)AR_ARRAY_MASK;
+    range->start = first;
+    range->trimmed = leaf - array->trimmed > AR_ARRAY_WIDTH && leaf - array->trimmed > length ? leaf : array->trimmed;
+    range->trieCount = MIN(end, array->trieCount) & ~(size_t)AR_ARRAY_MASK;
+    range->shift = array->shift;
+    if (leaf >= range->trieCount) {
+        // all of it in one leaf, or that leaf and the tail: they become the tail.
+        range->start = first & AR_ARRAY_MASK;
+        range->trieCount = range->trimmed = range->shift = 0;
+        ArrayAppendPositions(range, array, leaf, end);
+        return range;
+    }
+
+    if (range->trimmed == array->trimmed && range->trieCount == array->trieCount) {
+        range->root = RCRetain(array->root);
+    } else {
+        range->root = ArrayNodeTrim(array->root, array->shift, range->trimmed, range->trieCount);
+    }
+
+    // a root with a single child is one level too many.
+    while (range->root && range->shift > 0 && range->trieCount <= (size_t)1 << range->shift) {
+        ArrayNodeRef root = range->root;
+        range->root = RCRetain(root->slots[0]);
+        range->shift -= AR_ARRAY_BITS;
+        RCRelease(root);
+    }
+
+    ArrayAppendPositions(range, array, range->trieCount, end);
+    return range;
+}
+
 RCTypeRef ArrayObjectAt(ArrayRef array, size_t index) {
     assert(array);
     
-    if (index < arrlen(array->storage)) {
-        return array->storage[index];
+    if (index < ArrayCount(array)) {
+        return ArrayElementAt(array, array->start + index);
     }
     return NULL;
 }
@@ -123,54 +461,315 @@ RCTypeRef ArrayObjectAt(ArrayRef array, size_t index) {
 void ArrayRemoveAt(ArrayRef array, size_t index) {
     assert(array);
     
-    if (index < arrlen(array->storage)) {
-        RCRelease(array->storage[index]);
-        arrdel(array, index);
+    size_t count = ArrayCount(array);
+    if (index >= count) {
+        return;
     }
+
+    if (index == count - 1 && array->tailCount > 0) {
+        RCRelease(array->tail[--array->tailCount]);
+        return;
+    }
+    ArrayRebuild(array, index);
 }
 
 void ArrayAppend(ArrayRef array, RCTypeRef obj) {
     assert(array);
     assert(obj);
     
+    ArrayTailAppend(array, RCRetain(obj));
+}
+
+void ArraySetObjectAt(ArrayRef array, size_t index, RCTypeRef obj) {
+    assert(array);
+    assert(obj);
+    assert(index < ArrayCount(array));
+
     RCRetain(obj);
-    arrput(array->storage, obj);
+    size_t position = array->start + index;
+    if (position >= array->trieCount) {
+        RCTypeRef *slot = &array->tail[position - array->trieCount];
+        RCRelease(*slot);
+        *slot = obj;
+        return;
+    }
+
+    array->root = ArrayNodeUnique(array->root);
+    ArrayNodeRef node = array->root;
+    for (unsigned level = array->shift; level > 0; level -= AR_ARRAY_BITS) {
+        RCTypeRef *child = &node->slots[(position >> level) & AR_ARRAY_MASK];
+        node = ArrayNodeUnique(*child);
+        *child = node;
+    }
+    RCRelease(node->slots[position & AR_ARRAY_MASK]);
+    node->slots[position & AR_ARRAY_MASK] = obj;
 }
 
-void ArrayRemoveAll(ArrayRef array) {
+void ArrayAppendObjects(ArrayRef array, RCTypeRef *objects, size_t count) {
     assert(array);
-    
-    for (size_t i = 0; i < arrlen(array->storage); i++) {
-        RCRelease(array->storage[i]);
+    assert(objects || count == 0);
+
+    RCRetainObjects(objects, count);
+    ArrayTailAppendObjects(array, objects, count);
+}
+
+size_t ArrayCopyRange(ArrayRef array, size_t start, size_t length, RCTypeRef *objects) {
+    size_t count = ArrayCount(array);
+    if (start >= count) {
+        return 0;
     }
-    arrclear(array->storage);
+
+    length = MIN(length, count - start);
+    ArrayCopyPositions(array, array->start + start, array->start + start + length, objects);
+    return length;
+}
+
+void ArrayRemoveAll(ArrayRef array) {
+    assert(array);
+    ArrayRelease(array);
 }
 
 size_t ArrayCount(ArrayRef array) {
     if (array) {
-        return arrlen(array->storage);
+        return array->trieCount + array->tailCount - array->start;
     }
     return 0;
 }
 
 RCTypeRef ArrayFirst(ArrayRef array) {
-    if (array && array->storage && arrlen(array->storage)) {
-        return array->storage[0];
+    if (ArrayCount(array)) {
+        return ArrayElementAt(array, array->start);
     }
     return NULL;
 }
 
+ArrayIterator ArrayIteratorMake(ArrayRef array) {
+    return (ArrayIterator){ array, array ? array->start : 0, NULL };
+}
+
+// one lookup per leaf, then the elements are read straight out of it.
+bool ArrayIteratorNext(ArrayIterator *iterator, RCTypeRef *obj) {
+    assert(iterator);
+    assert(obj);
+
+    ArrayRef array = iterator->array;
+    if (!array || iterator->position >= array->trieCount + array->tailCount) {
+        return false;
+    }
+
+    size_t position = iterator->position++;
+    if (position >= array->trieCount) {
+        *obj = array->tail[position - array->trieCount];
+        return true;
+    }
+
+    if (!iterator->leaf || (position & AR_ARRAY_MASK) == 0) {
+        iterator->leaf = ArrayLeafFor(array, position);
+    }
+    *obj = iterator->leaf[position & AR_ARRAY_MASK];
+    return true;
+}
+
+void ArrayForEach(ArrayRef array, array_visitor_fn *visit, void *context) {
+    assert(visit);
+
+    ArrayIterator iterator = ArrayIteratorMake(array);
+    RCTypeRef obj;
+    for (size_t index = 0; ArrayIteratorNext(&iterator, &obj); index++) {
+        visit(obj, index, context);
+    }
+}
+
 #pragma mark - dictionary
 
+// Swiss table: open addressing with one control byte per slot, probed a group of slots at a time.
+// A full slot's control byte holds the low 7 bits of its hash, so a single compare over the group finds
+// the few slots worth checking, and a key is only compared (RuntimeEquals) when the full hashes match.
+// Entries are kept dense and in insertion order (removing swaps the last one in, like stb's hmdel did),
+// the table maps slots to entry indices so DictionaryKeyValueAtIndex stays O(1).
+// Small dictionaries have no table: comparing a handful of hashes in the entries is cheaper than probing one.
+#define AR_DICT_GROUP_SIZE 16
+#define AR_DICT_MIN_CAPACITY 16
+#define AR_DICT_LINEAR_COUNT 8 // entries looked up without a table
+#define AR_DICT_CTRL_EMPTY ((uint8_t)0x80)
+#define AR_DICT_CTRL_DELETED ((uint8_t)0xfe)
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 typedef struct {
-    RuntimeHashValue key;
+    uint64_t hash;
     struct ObjectPair value; // used as a struct, not an obj
 } DictType;
 
 struct ARDictionary {
-    DictType *storage;
+    DictType *entries;  // stb array
+    uint32_t *slots;    // entry index per slot
+    uint8_t *ctrl;      // capacity + AR_DICT_GROUP_SIZE bytes, the tail mirrors the first group so a probe never wraps
+    size_t capacity;    // power of 2, 0 while the entries are few enough to scan
+    size_t deleted;
 };
 
+typedef uint32_t DictGroupMask; // bit i set: slot i of the group matched
+
+static inline DictGroupMask DictGroupMatch(const uint8_t *ctrl, uint8_t byte) {
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return (DictGroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    static const uint8_t bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x16_t matches = vandq_u8(vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(byte)), vld1q_u8(bits));
+    return (DictGroupMask)vaddv_u8(vget_low_u8(matches)) | ((DictGroupMask)vaddv_u8(vget_high_u8(matches)) << 8);
+#else
+    DictGroupMask mask = 0;
+    for (int i = 0; i < AR_DICT_GROUP_SIZE; i++) {
+        mask |= (DictGroupMask)(ctrl[i] == byte) << i;
+    }
+    return mask;
+#endif
+}
+
+// empty and deleted are the only control bytes with the high bit set.
+static inline DictGroupMask DictGroupMatchFree(const uint8_t *ctrl) {
+#if defined(__SSE2__)
+    return (DictGroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    static const uint8_t bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x16_t matches = vandq_u8(vcltzq_s8(vld1q_s8((const int8_t *)ctrl)), vld1q_u8(bits));
+    return (DictGroupMask)vaddv_u8(vget_low_u8(matches)) | ((DictGroupMask)vaddv_u8(vget_high_u8(matches)) << 8);
+#else
+    DictGroupMask mask = 0;
+    for (int i = 0; i < AR_DICT_GROUP_SIZE; i++) {
+        mask |= (DictGroupMask)(ctrl[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+// class hashes can be weak (integers hash to themselves) or predictable, run them through the
+// process keyed mix so nobody can pick keys that land on the same probe sequence.
+static inline uint64_t DictHash(RCTypeRef key) {
+    RuntimeHashValue value = RuntimeHash(key);
+    return HashInteger(value.hash, value.id.classID);
+}
+
+#define DictH1(hash) ((size_t)((hash) >> 7))
+#define DictH2(hash) ((uint8_t)((hash) & 0x7f))
+
+static void DictSetCtrl(DictionaryRef dict, size_t slot, uint8_t byte) {
+    dict->ctrl[slot] = byte;
+    if (slot < AR_DICT_GROUP_SIZE) {
+        dict->ctrl[dict->capacity + slot] = byte;
+    }
+}
+
+// first empty or deleted slot on hash's probe sequence. There always is one, the table is never full.
+static size_t DictFindFreeSlot(DictionaryRef dict, uint64_t hash) {
+    size_t mask = dict->capacity - 1;
+    size_t pos = DictH1(hash) & mask;
+    for (size_t stride = AR_DICT_GROUP_SIZE; ; stride += AR_DICT_GROUP_SIZE) {
+        DictGroupMask match = DictGroupMatchFree(dict->ctrl + pos);
+        if (match) {
+            return (pos + __builtin_ctz(match)) & mask;
+        }
+        pos = (pos + stride) & mask;
+    }
+}
+
+// slot holding key, or -1. When index isn't -1 it looks for the slot pointing at that entry instead.
+static ptrdiff_t DictFindSlot(DictionaryRef dict, RCTypeRef key, uint64_t hash, ptrdiff_t index) {
+    if (dict->capacity == 0) {
+        return -1;
+    }
+
+    size_t mask = dict->capacity - 1;
+    size_t pos = DictH1(hash) & mask;
+    for (size_t stride = AR_DICT_GROUP_SIZE; ; stride += AR_DICT_GROUP_SIZE) {
+        const uint8_t *group = dict->ctrl + pos;
+        for (DictGroupMask match = DictGroupMatch(group, DictH2(hash)); match; match &= match - 1) {
+            size_t slot = (pos + __builtin_ctz(match)) & mask;
+            uint32_t entry = dict->slots[slot];
+            if (index >= 0) {
+                if (entry == index) {
+                    return slot;
+                }
+
+            } else if (dict->entries[entry].hash == hash && RuntimeEquals(dict->entries[entry].value.first, key)) {
+                return slot;
+            }
+        }
+
+        if (DictGroupMatch(group, AR_DICT_CTRL_EMPTY)) {
+            return -1;
+        }
+        pos = (pos + stride) & mask;
+    }
+}
+
+static void DictFreeTable(DictionaryRef dict) {
+    free(dict->slots); // ctrl lives in the same block
+    dict->slots = NULL;
+    dict->ctrl = NULL;
+    dict->capacity = 0;
+    dict->deleted = 0;
+}
+
+static void DictRehash(DictionaryRef dict, size_t capacity) {
+    DictFreeTable(dict);
+
+    uint8_t *table = ar_malloc(capacity * sizeof(uint32_t) + capacity + AR_DICT_GROUP_SIZE);
+    dict->slots = (uint32_t *)table;
+    dict->ctrl = table + capacity * sizeof(uint32_t);
+    dict->capacity = capacity;
+    memset(dict->ctrl, AR_DICT_CTRL_EMPTY, capacity + AR_DICT_GROUP_SIZE);
+
+    for (size_t i = 0; i < arrlen(dict->entries); i++) {
+        size_t slot = DictFindFreeSlot(dict, dict->entries[i].hash);
+        DictSetCtrl(dict, slot, DictH2(dict->entries[i].hash));
+        dict->slots[slot] = (uint32_t)i;
+    }
+}
+
+// entry index of key, or -1. slot, when given, gets the table's slot for it.
+static ptrdiff_t DictFindEntry(DictionaryRef dict, RCTypeRef key, uint64_t hash, ptrdiff_t *slot) {
+    if (dict->capacity == 0) {
+        for (size_t i = 0; i < arrlen(dict->entries); i++) {
+            if (dict->entries[i].hash == hash && RuntimeEquals(dict->entries[i].value.first, key)) {
+                return (ptrdiff_t)i;
+            }
+        }
+        return -1;
+    }
+
+    ptrdiff_t found = DictFindSlot(dict, key, hash, -1);
+    if (slot) {
+        *slot = found;
+    }
+    return found < 0 ? -1 : (ptrdiff_t)dict->slots[found];
+}
+
+// keeps the load, tombstones included, under 7/8. No table until there are more than a few entries.
+static void DictReserveOne(DictionaryRef dict) {
+    if (dict->capacity == 0 && arrlen(dict->entries) < AR_DICT_LINEAR_COUNT) {
+        return;
+    }
+
+    size_t used = arrlen(dict->entries) + dict->deleted + 1;
+    if (used <= dict->capacity - dict->capacity / 8) {
+        return;
+    }
+
+    size_t needed = arrlen(dict->entries) + 1;
+    size_t capacity = AR_DICT_MIN_CAPACITY;
+    while (needed > capacity / 2) {
+        capacity *= 2;
+    }
+    DictRehash(dict, capacity);
+}
+
 static RuntimeClassID ARDictClassID = { 0 };
 
 static void ARDictDestructor(RCTypeRef dict) {
@@ -178,28 +777,38 @@ static void ARDictDestructor(RCTypeRef dict) {
     DictionaryRemoveAll(self);
 }
 
+// shared with the map's description.
+static void DescribeEntry(RCTypeRef key, RCTypeRef value, void *context) {
+    StringAppendFormat(context, "\t%s : %s,\n", CString(RuntimeDescription(key)), CString(RuntimeDescription(value)));
+}
+
 static StringRef ARDictDescription(RCTypeRef dict) {
     DictionaryRef self = dict;
     
     StringRef description = StringWithString(RuntimeDescription(self));
     StringAppendChars(description, " {\n");
-    for (size_t i = 0; i < hmlen(self->storage); i++) {
-        DictType obj = self->storage[i];
-        StringAppendFormat(description, "\t%s : %s,\n",
-                           CString(RuntimeDescription(obj.value.first)),
-                           CString(RuntimeDescription(obj.value.second)));
-    }
+    DictionaryForEach(self, DescribeEntry, description);
     StringAppendChars(description, "\n}\n");
     
     return description;
 }
 
+static void ARDictTraverse(RCTypeRef dict, visitor_fn *visit, void *context) {
+    DictionaryRef self = dict;
+    for (size_t i = 0; i < arrlen(self->entries); i++) {
+        visit(self->entries[i].value.first, context);
+        visit(self->entries[i].value.second, context);
+    }
+}
+
 static RuntimeClassDescriptor ARDictClass = {
     "Dictionary",
     sizeof(struct ARDictionary),
     NULL, // const
     ARDictDestructor, // dest
-    ARDictDescription  // desc
+    ARDictDescription, // desc
+    NULL, // hash
+    ARDictTraverse
 };
 
 void DictionaryInitialize(void) {
@@ -227,26 +836,36 @@ void DictionarySetObjectForKey(DictionaryRef dict, RCTypeRef key, RCTypeRef valu
     RCRetain(key);
     RCRetain(value);
     
-    RuntimeHashValue hashKey = RuntimeHash(key);
-    DictType *previous = hmgetp_null(dict->storage, hashKey);
-    if (previous) {
+    uint64_t hash = DictHash(key);
+    ptrdiff_t index = DictFindEntry(dict, key, hash, NULL);
+    if (index >= 0) {
+        DictType *previous = &dict->entries[index];
         RCRelease(previous->value.first);
         RCRelease(previous->value.second);
         previous->value = (struct ObjectPair){key, value};
         
     } else {
-        struct ObjectPair kv = {key, value};
-        hmput(dict->storage, hashKey, kv);
+        DictReserveOne(dict);
+        if (dict->capacity) {
+            size_t freeSlot = DictFindFreeSlot(dict, hash);
+            if (dict->ctrl[freeSlot] == AR_DICT_CTRL_DELETED) {
+                dict->deleted--;
+            }
+            DictSetCtrl(dict, freeSlot, DictH2(hash));
+            dict->slots[freeSlot] = (uint32_t)arrlen(dict->entries);
+        }
+        
+        DictType entry = { hash, {key, value} };
+        arrput(dict->entries, entry);
     }
 }
 
 RCTypeRef DictionaryObjectForKey(DictionaryRef dict, RCTypeRef key) {
     assert(dict);
     if (key) {
-        RuntimeHashValue hashKey = RuntimeHash(key);
-        DictType *value = hmgetp_null(dict->storage, hashKey);
-        if (value) {
-            return value->value.second;
+        ptrdiff_t index = DictFindEntry(dict, key, DictHash(key), NULL);
+        if (index >= 0) {
+            return dict->entries[index].value.second;
         }
     }
     return NULL;
@@ -254,15 +873,34 @@ RCTypeRef DictionaryObjectForKey(DictionaryRef dict, RCTypeRef key) {
 
 void DictionaryRemoveObjectForKey(DictionaryRef dict, RCTypeRef key) {
     assert(dict);
-    if (key) {
-        RuntimeHashValue hashKey = RuntimeHash(key);
-        DictType *value = hmgetp_null(dict->storage, hashKey);
-        if (value) {
-            RCRelease(value->value.first);
-            RCRelease(value->value.second);
-            hmdel(dict->storage, hashKey);
-        }
+    if (!key) {
+        return;
+    }
+    
+    ptrdiff_t slot = -1;
+    ptrdiff_t found = DictFindEntry(dict, key, DictHash(key), &slot);
+    if (found < 0) {
+        return;
     }
+    
+    uint32_t index = (uint32_t)found;
+    DictType removed = dict->entries[index];
+    if (slot >= 0) {
+        DictSetCtrl(dict, slot, AR_DICT_CTRL_DELETED);
+        dict->deleted++;
+    }
+    
+    // the last entry takes the removed one's place.
+    uint32_t last = (uint32_t)arrlen(dict->entries) - 1;
+    if (index != last && dict->capacity) {
+        ptrdiff_t lastSlot = DictFindSlot(dict, NULL, dict->entries[last].hash, last);
+        assert(lastSlot >= 0);
+        dict->slots[lastSlot] = index;
+    }
+    arrdelswap(dict->entries, index);
+    
+    RCRelease(removed.value.first);
+    RCRelease(removed.value.second);
 }
 
 ObjectPairRef pairWithPairStruct(struct ObjectPair pair) {
@@ -271,25 +909,615 @@ ObjectPairRef pairWithPairStruct(struct ObjectPair pair) {
 
 ObjectPairRef DictionaryKeyValueAtIndex(DictionaryRef dict,size_t index) {
     assert(dict);
-    if (index < hmlen(dict->storage)) {
-        return pairWithPairStruct(dict->storage[index].value);
+    if (index < arrlen(dict->entries)) {
+        return pairWithPairStruct(dict->entries[index].value);
     }
     return NULL;
 }
 
+bool DictionaryNext(DictionaryRef dict, size_t *cursor, RCTypeRef *key, RCTypeRef *value) {
+    assert(cursor);
+    if (!dict || *cursor >= arrlen(dict->entries)) {
+        return false;
+    }
+
+    DictType *entry = &dict->entries[(*cursor)++];
+    if (key) {
+        *key = entry->value.first;
+    }
+    if (value) {
+        *value = entry->value.second;
+    }
+    return true;
+}
+
+void DictionaryForEach(DictionaryRef dict, pair_visitor_fn *visit, void *context) {
+    assert(visit);
+    for (size_t i = 0; i < DictionaryCount(dict); i++) {
+        visit(dict->entries[i].value.first, dict->entries[i].value.second, context);
+    }
+}
+
 size_t DictionaryCount(DictionaryRef dict) {
     if (dict) {
-        return hmlen(dict->storage);
+        return arrlen(dict->entries);
     }
     return 0;
 }
 
 void DictionaryRemoveAll(DictionaryRef self) {
-    for (size_t i = 0; i < hmlen(self->storage); i++) {
-        DictType obj = self->storage[i];
-        RCRelease(obj.value.first);
-        RCRelease(obj.value.second);
+    // the dictionary is empty before anything gets released, releasing can call back into it.
+    DictType *entries = self->entries;
+    self->entries = NULL;
+    DictFreeTable(self);
+    
+    for (size_t i = 0; i < arrlen(entries); i++) {
+        RCRelease(entries[i].value.first);
+        RCRelease(entries[i].value.second);
+    }
+    arrfree(entries);
+}
+
+#pragma mark - map
+
+// Hash array mapped trie (Bagwell's HAMT, with CHAMP's separate bitmaps for entries and children):
+// each level takes 5 bits of the key's hash, a node packs the entries and the child nodes of its 32
+// slots in two lists. Nodes are shared between maps like the array's and only written in place while
+// a single map holds them, so a copy plus a set or a remove costs a path of log32 n new nodes.
+// Keys whose 64 bit hashes are all equal end up together in a node past the last level, in a plain list.
+// Small maps are just such a list, in insertion order and with room to grow in place, and become a trie
+// once they outgrow it.
+#define AR_MAP_BITS 5
+#define AR_MAP_MASK ((1 << AR_MAP_BITS) - 1)
+#define AR_MAP_HASH_BITS 64
+#define AR_MAP_FLAT_COUNT 8 // entries a map keeps in a list before it becomes a trie
+
+typedef struct {
+    RCTypeRef key;
+    RCTypeRef value;
+    uint64_t hash;
+    uint64_t order; // insertion stamp, enumeration goes by it
+} MapEntry;
+
+typedef struct MapNode {
+    uint32_t dataMap; // slots holding an entry
+    uint32_t nodeMap; // slots holding a child
+    uint32_t entryCount;
+    uint32_t childCount;
+    MapEntry entries[]; // then the children
+} *MapNodeRef;
+
+struct ARMap {
+    MapNodeRef root;
+    size_t count;
+    uint64_t order; // next stamp
+    bool flat;      // root is a list, not a trie
+};
+
+static RuntimeClassID ARMapClassID = { 0 };
+static RuntimeClassID ARMapNodeClassID = { 0 };
+
+static inline MapNodeRef *MapNodeChildren(MapNodeRef node) {
+    return (MapNodeRef *)(node->entries + node->entryCount);
+}
+
+static inline uint32_t MapIndex(uint32_t bitmap, uint32_t bit) {
+    return (uint32_t)__builtin_popcount(bitmap & (bit - 1));
+}
+
+static inline bool MapEntryMatches(const MapEntry *entry, RCTypeRef key, uint64_t hash) {
+    return entry->hash == hash && (entry->key == key || RuntimeEquals(entry->key, key));
+}
+
+static void ARMapNodeDestructor(RCTypeRef obj) {
+    MapNodeRef self = obj;
+    for (uint32_t i = 0; i < self->entryCount; i++) {
+        RCRelease(self->entries[i].key);
+        RCRelease(self->entries[i].value);
+    }
+    for (uint32_t i = 0; i < self->childCount; i++) {
+        RCRelease(MapNodeChildren(self)[i]);
+    }
+}
+
+static void ARMapNodeTraverse(RCTypeRef obj, visitor_fn *visit, void *context) {
+    MapNodeRef self = obj;
+    for (uint32_t i = 0; i < self->entryCount; i++) {
+        visit(self->entries[i].key, context);
+        visit(self->entries[i].value, context);
+    }
+    for (uint32_t i = 0; i < self->childCount; i++) {
+        visit(MapNodeChildren(self)[i], context);
+    }
+}
+
+static RuntimeClassDescriptor ARMapNodeClass = {
+    "MapNode",
+    sizeof(struct MapNode),
+    NULL, // const
+    ARMapNodeDestructor, // dest
+    NULL, // desc
+    NULL, // hash
+    ARMapNodeTraverse
+};
+
+static MapNodeRef MapNodeCreate(uint32_t entryCount, uint32_t childCount) {
+    size_t size = sizeof(struct MapNode) + entryCount * sizeof(MapEntry) + childCount * sizeof(MapNodeRef);
+    MapNodeRef node = RuntimeRCAlloc(size, ARMapNodeClassID);
+    node->entryCount = entryCount;
+    node->childCount = childCount;
+    return node;
+}
+
+// `copy` replaces `node`: it takes over node's references to everything node held and node is released.
+// Whatever the copy left out has to be released once more by the caller.
+static MapNodeRef MapNodeAdopt(MapNodeRef copy, MapNodeRef node) {
+    if (RuntimeRefCount(node) == 1) {
+        // node goes away with this release, its references move as they are. Retaining them all only for
+        // node's destructor to release them again would also buffer every child as a possible cycle root.
+        node->entryCount = node->childCount = 0;
+
+    } else {
+        for (uint32_t i = 0; i < node->entryCount; i++) {
+            RCRetain(node->entries[i].key);
+            RCRetain(node->entries[i].value);
+        }
+        for (uint32_t i = 0; i < node->childCount; i++) {
+            RCRetain(MapNodeChildren(node)[i]);
+        }
+    }
+    RCRelease(node);
+    return copy;
+}
+
+// a node this map can write to: the one it has if nothing else holds it, a copy otherwise.
+static MapNodeRef MapNodeEditable(MapNodeRef node) {
+    if (RuntimeRefCount(node) == 1) {
+        return node;
+    }
+
+    MapNodeRef copy = MapNodeCreate(node->entryCount, node->childCount);
+    copy->dataMap = node->dataMap;
+    copy->nodeMap = node->nodeMap;
+    memcpy(copy->entries, node->entries, node->entryCount * sizeof(MapEntry));
+    memcpy(MapNodeChildren(copy), MapNodeChildren(node), node->childCount * sizeof(MapNodeRef));
+    return MapNodeAdopt(copy, node);
+}
+
+// the smallest subtree holding both entries, their references move in.
+static MapNodeRef MapNodeWithEntries(MapEntry first, MapEntry second, unsigned shift) {
+    if (shift >= AR_MAP_HASH_BITS) {
+        MapNodeRef node = MapNodeCreate(2, 0);
+        node->entries[0] = first;
+        node->entries[1] = second;
+        return node;
+    }
+
+    uint32_t firstSlot = (first.hash >> shift) & AR_MAP_MASK;
+    uint32_t secondSlot = (second.hash >> shift) & AR_MAP_MASK;
+    if (firstSlot == secondSlot) {
+        MapNodeRef node = MapNodeCreate(0, 1);
+        node->nodeMap = 1u << firstSlot;
+        MapNodeChildren(node)[0] = MapNodeWithEntries(first, second, shift + AR_MAP_BITS);
+        return node;
+    }
+
+    MapNodeRef node = MapNodeCreate(2, 0);
+    node->dataMap = (1u << firstSlot) | (1u << secondSlot);
+    node->entries[firstSlot < secondSlot ? 0 : 1] = first;
+    node->entries[firstSlot < secondSlot ? 1 : 0] = second;
+    return node;
+}
+
+// entry goes in at `index` of the entries, `bit` of the bitmap (0 past the last level).
+static MapNodeRef MapNodeInsertEntry(MapNodeRef node, uint32_t bit, uint32_t index, MapEntry entry) {
+    MapNodeRef copy = MapNodeCreate(node->entryCount + 1, node->childCount);
+    copy->dataMap = node->dataMap | bit;
+    copy->nodeMap = node->nodeMap;
+    memcpy(copy->entries, node->entries, index * sizeof(MapEntry));
+    copy->entries[index] = entry;
+    memcpy(copy->entries + index + 1, node->entries + index, (node->entryCount - index) * sizeof(MapEntry));
+    memcpy(MapNodeChildren(copy), MapNodeChildren(node), node->childCount * sizeof(MapNodeRef));
+    return MapNodeAdopt(copy, node);
+}
+
+static MapNodeRef MapNodeRemoveEntry(MapNodeRef node, uint32_t bit, uint32_t index) {
+    MapEntry removed = node->entries[index];
+    MapNodeRef copy = MapNodeCreate(node->entryCount - 1, node->childCount);
+    copy->dataMap = node->dataMap & ~bit;
+    copy->nodeMap = node->nodeMap;
+    memcpy(copy->entries, node->entries, index * sizeof(MapEntry));
+    memcpy(copy->entries + index, node->entries + index + 1, (node->entryCount - index - 1) * sizeof(MapEntry));
+    memcpy(MapNodeChildren(copy), MapNodeChildren(node), node->childCount * sizeof(MapNodeRef));
+    MapNodeAdopt(copy, node);
+    RCRelease(removed.key);
+    RCRelease(removed.value);
+    return copy;
+}
+
+// the entry at `bit` moves down into a new child together with `entry`.
+static MapNodeRef MapNodePushDown(MapNodeRef node, uint32_t bit, MapEntry entry, unsigned shift) {
+    uint32_t index = MapIndex(node->dataMap, bit);
+    MapEntry moved = node->entries[index];
+    RCRetain(moved.key);
+    RCRetain(moved.value);
+    MapNodeRef child = MapNodeWithEntries(moved, entry, shift + AR_MAP_BITS);
+
+    uint32_t childIndex = MapIndex(node->nodeMap, bit);
+    MapNodeRef copy = MapNodeCreate(node->entryCount - 1, node->childCount + 1);
+    copy->dataMap = node->dataMap & ~bit;
+    copy->nodeMap = node->nodeMap | bit;
+    memcpy(copy->entries, node->entries, index * sizeof(MapEntry));
+    memcpy(copy->entries + index, node->entries + index + 1, (node->entryCount - index - 1) * sizeof(MapEntry));
+    MapNodeRef *children = MapNodeChildren(node), *copyChildren = MapNodeChildren(copy);
+    memcpy(copyChildren, children, childIndex * sizeof(MapNodeRef));
+    copyChildren[childIndex] = child;
+    memcpy(copyChildren + childIndex + 1, children + childIndex, (node->childCount - childIndex) * sizeof(MapNodeRef));
+    MapNodeAdopt(copy, node);
+    RCRelease(moved.key);
+    RCRelease(moved.value);
+    return copy;
+}
+
+// the child at `bit` is down to a single entry, which moves up here.
+static MapNodeRef MapNodePullUp(MapNodeRef node, uint32_t bit) {
+    uint32_t childIndex = MapIndex(node->nodeMap, bit);
+    MapNodeRef child = MapNodeChildren(node)[childIndex];
+    MapEntry entry = child->entries[0];
+    RCRetain(entry.key);
+    RCRetain(entry.value);
+
+    uint32_t index = MapIndex(node->dataMap, bit);
+    MapNodeRef copy = MapNodeCreate(node->entryCount + 1, node->childCount - 1);
+    copy->dataMap = node->dataMap | bit;
+    copy->nodeMap = node->nodeMap & ~bit;
+    memcpy(copy->entries, node->entries, index * sizeof(MapEntry));
+    copy->entries[index] = entry;
+    memcpy(copy->entries + index + 1, node->entries + index, (node->entryCount - index) * sizeof(MapEntry));
+    MapNodeRef *children = MapNodeChildren(node), *copyChildren = MapNodeChildren(copy);
+    memcpy(copyChildren, children, childIndex * sizeof(MapNodeRef));
+    memcpy(copyChildren + childIndex, children + childIndex + 1, (node->childCount - childIndex - 1) * sizeof(MapNodeRef));
+    MapNodeAdopt(copy, node);
+    RCRelease(child);
+    return copy;
+}
+
+// puts entry (its references move in) under node, which the caller hands over, returns the node to keep instead.
+static MapNodeRef MapNodeSet(MapNodeRef node, unsigned shift, MapEntry entry, bool *added) {
+    if (shift >= AR_MAP_HASH_BITS) {
+        for (uint32_t i = 0; i < node->entryCount; i++) {
+            if (MapEntryMatches(&node->entries[i], entry.key, entry.hash)) {
+                node = MapNodeEditable(node);
+                RCRelease(node->entries[i].value);
+                node->entries[i].value = entry.value;
+                RCRelease(entry.key);
+                return node;
+            }
+        }
+        *added = true;
+        return MapNodeInsertEntry(node, 0, node->entryCount, entry);
+    }
+
+    uint32_t bit = 1u << ((entry.hash >> shift) & AR_MAP_MASK);
+    if (node->dataMap & bit) {
+        uint32_t index = MapIndex(node->dataMap, bit);
+        if (MapEntryMatches(&node->entries[index], entry.key, entry.hash)) {
+            node = MapNodeEditable(node);
+            RCRelease(node->entries[index].value);
+            node->entries[index].value = entry.value;
+            RCRelease(entry.key);
+            return node;
+        }
+        *added = true;
+        return MapNodePushDown(node, bit, entry, shift);
+    }
+
+    if (node->nodeMap & bit) {
+        uint32_t index = MapIndex(node->nodeMap, bit);
+        node = MapNodeEditable(node);
+        MapNodeRef *children = MapNodeChildren(node);
+        children[index] = MapNodeSet(children[index], shift + AR_MAP_BITS, entry, added);
+        return node;
+    }
+
+    *added = true;
+    return MapNodeInsertEntry(node, bit, MapIndex(node->dataMap, bit), entry);
+}
+
+// key has to be in the subtree. Children always hold two entries or more, a lone one moves up.
+static MapNodeRef MapNodeRemove(MapNodeRef node, unsigned shift, RCTypeRef key, uint64_t hash) {
+    if (shift >= AR_MAP_HASH_BITS) {
+        uint32_t index = 0;
+        while (!MapEntryMatches(&node->entries[index], key, hash)) {
+            index++;
+        }
+        return MapNodeRemoveEntry(node, 0, index);
+    }
+
+    uint32_t bit = 1u << ((hash >> shift) & AR_MAP_MASK);
+    if (node->dataMap & bit) {
+        return MapNodeRemoveEntry(node, bit, MapIndex(node->dataMap, bit));
+    }
+
+    uint32_t index = MapIndex(node->nodeMap, bit);
+    node = MapNodeEditable(node);
+    MapNodeRef *children = MapNodeChildren(node);
+    children[index] = MapNodeRemove(children[index], shift + AR_MAP_BITS, key, hash);
+    if (children[index]->entryCount == 1 && children[index]->childCount == 0) {
+        return MapNodePullUp(node, bit);
+    }
+    return node;
+}
+
+// flat nodes are allocated for 4 or AR_MAP_FLAT_COUNT entries, one holding `count` has room for at least this many.
+static inline uint32_t MapFlatCapacity(uint32_t count) {
+    return count <= 4 ? 4 : AR_MAP_FLAT_COUNT;
+}
+
+static MapNodeRef MapFlatCreate(uint32_t capacity) {
+    MapNodeRef node = MapNodeCreate(capacity, 0);
+    node->entryCount = 0;
+    return node;
+}
+
+// like MapNodeEditable, a copy keeps the room to grow.
+static MapNodeRef MapFlatEditable(MapNodeRef node) {
+    if (RuntimeRefCount(node) == 1) {
+        return node;
+    }
+
+    MapNodeRef copy = MapFlatCreate(MapFlatCapacity(node->entryCount));
+    memcpy(copy->entries, node->entries, node->entryCount * sizeof(MapEntry));
+    copy->entryCount = node->entryCount;
+    return MapNodeAdopt(copy, node);
+}
+
+static MapNodeRef MapFlatSet(MapNodeRef node, MapEntry entry, bool *added) {
+    for (uint32_t i = 0; i < node->entryCount; i++) {
+        if (MapEntryMatches(&node->entries[i], entry.key, entry.hash)) {
+            node = MapFlatEditable(node);
+            RCRelease(node->entries[i].value);
+            node->entries[i].value = entry.value;
+            RCRelease(entry.key);
+            return node;
+        }
+    }
+
+    *added = true;
+    if (node->entryCount == MapFlatCapacity(node->entryCount)) {
+        MapNodeRef grown = MapFlatCreate(MapFlatCapacity(node->entryCount + 1));
+        memcpy(grown->entries, node->entries, node->entryCount * sizeof(MapEntry));
+        grown->entryCount = node->entryCount;
+        node = MapNodeAdopt(grown, node);
+    } else {
+        node = MapFlatEditable(node);
+    }
+    node->entries[node->entryCount++] = entry;
+    return node;
+}
+
+static MapNodeRef MapFlatRemove(MapNodeRef node, RCTypeRef key, uint64_t hash) {
+    uint32_t index = 0;
+    while (!MapEntryMatches(&node->entries[index], key, hash)) {
+        index++;
+    }
+
+    node = MapFlatEditable(node);
+    MapEntry removed = node->entries[index];
+    memmove(node->entries + index, node->entries + index + 1, (node->entryCount - index - 1) * sizeof(MapEntry));
+    node->entryCount--;
+    RCRelease(removed.key);
+    RCRelease(removed.value);
+    return node;
+}
+
+// a trie holding the list's entries, which is released.
+static MapNodeRef MapFlatPromote(MapNodeRef node) {
+    MapNodeRef root = MapNodeCreate(0, 0);
+    for (uint32_t i = 0; i < node->entryCount; i++) {
+        MapEntry entry = node->entries[i];
+        RCRetain(entry.key);
+        RCRetain(entry.value);
+        bool added = false;
+        root = MapNodeSet(root, 0, entry, &added);
+    }
+    RCRelease(node);
+    return root;
+}
+
+static void MapNodeCollect(MapNodeRef node, MapEntry ***entries) {
+    for (uint32_t i = 0; i < node->entryCount; i++) {
+        arrput(*entries, &node->entries[i]);
+    }
+    for (uint32_t i = 0; i < node->childCount; i++) {
+        MapNodeCollect(MapNodeChildren(node)[i], entries);
+    }
+}
+
+static void MapNodeForEach(MapNodeRef node, pair_visitor_fn *visit, void *context) {
+    for (uint32_t i = 0; i < node->entryCount; i++) {
+        visit(node->entries[i].key, node->entries[i].value, context);
+    }
+    for (uint32_t i = 0; i < node->childCount; i++) {
+        MapNodeForEach(MapNodeChildren(node)[i], visit, context);
+    }
+}
+
+static int MapEntryOrderCompare(const void *a, const void *b) {
+    uint64_t first = (*(MapEntry * const *)a)->order;
+    uint64_t second = (*(MapEntry * const *)b)->order;
+    return first < second ? -1 : first > second;
+}
+
+static void ARMapDestructor(RCTypeRef map) {
+    MapRef self = map;
+    RCRelease(self->root);
+    self->root = NULL;
+}
+
+static StringRef ARMapDescription(RCTypeRef map) {
+    MapRef self = map;
+
+    StringRef description = StringWithString(RuntimeDescription(self));
+    StringAppendChars(description, " {\n");
+    MapEnumerate(self, DescribeEntry, description);
+    StringAppendChars(description, "\n}\n");
+
+    return description;
+}
+
+static void ARMapTraverse(RCTypeRef map, visitor_fn *visit, void *context) {
+    MapRef self = map;
+    if (self->root) {
+        visit(self->root, context);
+    }
+}
+
+static RuntimeClassDescriptor ARMapClass = {
+    "Map",
+    sizeof(struct ARMap),
+    NULL, // const
+    ARMapDestructor, // dest
+    ARMapDescription, // desc
+    NULL, // hash
+    ARMapTraverse
+};
+
+void MapInitialize(void) {
+    ARMapClassID = RuntimeRegisterClass(&ARMapClass);
+    ARMapNodeClassID = RuntimeRegisterClass(&ARMapNodeClass);
+}
+
+MapRef MapCreate(void) {
+    return RuntimeCreateInstance(ARMapClassID);
+}
+
+MapRef Map(void) {
+    return RCAutorelease(MapCreate());
+}
+
+MapRef MapCreateWithMap(MapRef map) {
+    assert(map);
+
+    MapRef copy = MapCreate();
+    copy->root = RCRetain(map->root);
+    copy->count = map->count;
+    copy->order = map->order;
+    copy->flat = map->flat;
+    return copy;
+}
+
+RCTypeRef MapObjectForKey(MapRef map, RCTypeRef key) {
+    assert(map);
+    assert(key);
+
+    MapNodeRef node = map->root;
+    if (!node) {
+        return NULL;
+    }
+
+    uint64_t hash = DictHash(key);
+    for (unsigned shift = map->flat ? AR_MAP_HASH_BITS : 0; shift < AR_MAP_HASH_BITS; shift += AR_MAP_BITS) {
+        uint32_t bit = 1u << ((hash >> shift) & AR_MAP_MASK);
+        if (node->dataMap & bit) {
+            MapEntry *entry = &node->entries[MapIndex(node->dataMap, bit)];
+            return MapEntryMatches(entry, key, hash) ? entry->value : NULL;
+        }
+
+        if (!(node->nodeMap & bit)) {
+            return NULL;
+        }
+        node = MapNodeChildren(node)[MapIndex(node->nodeMap, bit)];
+    }
+
+    for (uint32_t i = 0; i < node->entryCount; i++) {
+        if (MapEntryMatches(&node->entries[i], key, hash)) {
+            return node->entries[i].value;
+        }
+    }
+    return NULL;
+}
+
+size_t MapCount(MapRef map) {
+    if (map) {
+        return map->count;
+    }
+    return 0;
+}
+
+void MapSetObjectForKey(MapRef map, RCTypeRef key, RCTypeRef value) {
+    assert(map);
+    assert(key);
+    assert(value);
+
+    if (!map->root) {
+        map->root = MapFlatCreate(MapFlatCapacity(0));
+        map->flat = true;
+    }
+
+    MapEntry entry = { RCRetain(key), RCRetain(value), DictHash(key), map->order };
+    bool added = false;
+    if (map->flat && map->count == AR_MAP_FLAT_COUNT && !MapObjectForKey(map, key)) {
+        map->root = MapFlatPromote(map->root);
+        map->flat = false;
+    }
+    if (map->flat) {
+        map->root = MapFlatSet(map->root, entry, &added);
+    } else {
+        map->root = MapNodeSet(map->root, 0, entry, &added);
+    }
+    if (added) {
+        map->count++;
+        map->order++;
+    }
+}
+
+void MapRemoveObjectForKey(MapRef map, RCTypeRef key) {
+    assert(map);
+
+    if (!MapObjectForKey(map, key)) {
+        return;
+    }
+
+    if (map->flat) {
+        map->root = MapFlatRemove(map->root, key, DictHash(key));
+    } else {
+        map->root = MapNodeRemove(map->root, 0, key, DictHash(key));
+    }
+    if (--map->count == 0) {
+        RCRelease(map->root);
+        map->root = NULL;
+    }
+}
+
+void MapEnumerate(MapRef map, pair_visitor_fn *visit, void *context) {
+    assert(map);
+    if (!map->root) {
+        return;
+    }
+
+    if (map->flat) {
+        // already in insertion order.
+        for (uint32_t i = 0; i < map->root->entryCount; i++) {
+            visit(map->root->entries[i].key, map->root->entries[i].value, context);
+        }
+        return;
+    }
+
+    MapEntry **entries = NULL;
+    arrsetcap(entries, map->count);
+    MapNodeCollect(map->root, &entries);
+    qsort(entries, arrlen(entries), sizeof(MapEntry *), MapEntryOrderCompare);
+    for (size_t i = 0; i < arrlen(entries); i++) {
+        visit(entries[i]->key, entries[i]->value, context);
+    }
+    arrfree(entries);
+}
+
+void MapForEach(MapRef map, pair_visitor_fn *visit, void *context) {
+    assert(map);
+    assert(visit);
+    if (map->root) {
+        MapNodeForEach(map->root, visit, context);
     }
-    hmfree(self->storage);
-    self->storage = NULL;
 }
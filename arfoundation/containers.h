@@ -18,20 +18,44 @@ ObjectPairRef objectPairWithObjects(RCTypeRef first, RCTypeRef second);
 RCTypeRef objectPairFirst(ObjectPairRef pair);
 RCTypeRef objectPairSecond(ObjectPairRef pair);
 
+#pragma mark - iteration
+
+// ForEach and the iterators hand out the container's own pointers: nothing is retained, copied or autoreleased.
+// The container must stay alive and unchanged while it's being walked.
+typedef void array_visitor_fn(RCTypeRef obj, size_t index, void *context);
+typedef void pair_visitor_fn(RCTypeRef key, RCTypeRef value, void *context);
+
 #pragma mark - array
 typedef struct ARArray *ArrayRef;
 
 void ArrayInitialize(void);
 ArrayRef Array(void);
 ArrayRef ArrayCreate(void);
+ArrayRef ArrayCreateWithCapacity(size_t capacity); // room for that many appends before the tail has to move out of line
+ArrayRef ArrayCreateWithArray(ArrayRef array); // shares the elements' storage, cheap at any length
+ArrayRef ArrayCreateWithRest(ArrayRef array, size_t start); // elements from start on, also shared
+ArrayRef ArrayCreateWithRange(ArrayRef array, size_t start, size_t length); // a slice, shared the same way
 
 RCTypeRef ArrayObjectAt(ArrayRef array, size_t index);
 size_t ArrayCount(ArrayRef array);
 void ArrayAppend(ArrayRef array, RCTypeRef obj);
+void ArraySetObjectAt(ArrayRef array, size_t index, RCTypeRef obj); // index < count, copies the path to it if shared
+void ArrayAppendObjects(ArrayRef array, RCTypeRef *objects, size_t count); // retains them all, fills a leaf at a time
+size_t ArrayCopyRange(ArrayRef array, size_t start, size_t length, RCTypeRef *objects); // not retained, returns how many were copied
 void ArrayRemoveAll(ArrayRef array);
 void ArrayRemoveAt(ArrayRef array, size_t index);
 RCTypeRef ArrayFirst(ArrayRef array);
 
+typedef struct {
+    ArrayRef array;
+    size_t position;  // of the next element, counting dropped ones
+    RCTypeRef *leaf;  // slots it's in, NULL until looked up
+} ArrayIterator;
+
+ArrayIterator ArrayIteratorMake(ArrayRef array); // array can be NULL
+bool ArrayIteratorNext(ArrayIterator *iterator, RCTypeRef *obj); // false once past the last element
+void ArrayForEach(ArrayRef array, array_visitor_fn *visit, void *context);
+
 #pragma mark - dictionary
 
 typedef struct ARDictionary *DictionaryRef;
@@ -44,6 +68,25 @@ RCTypeRef DictionaryObjectForKey(DictionaryRef dict, RCTypeRef key);
 size_t DictionaryCount(DictionaryRef dict);
 void DictionarySetObjectForKey(DictionaryRef dict, RCTypeRef key, RCTypeRef value);
 void DictionaryRemoveObjectForKey(DictionaryRef dict, RCTypeRef key);
-ObjectPairRef DictionaryKeyValueAtIndex(DictionaryRef dict, size_t index);
+ObjectPairRef DictionaryKeyValueAtIndex(DictionaryRef dict, size_t index); // a new autoreleased pair, prefer DictionaryNext
+bool DictionaryNext(DictionaryRef dict, size_t *cursor, RCTypeRef *key, RCTypeRef *value); // cursor starts at 0
+void DictionaryForEach(DictionaryRef dict, pair_visitor_fn *visit, void *context); // in insertion order until a remove
 void DictionaryRemoveAll(DictionaryRef dict);
+
+#pragma mark - map
+
+// Persistent hash map: copies share their storage, a set or a remove on a copy only copies the path to the key.
+typedef struct ARMap *MapRef;
+
+void MapInitialize(void);
+MapRef MapCreate(void);
+MapRef Map(void);
+MapRef MapCreateWithMap(MapRef map);
+
+RCTypeRef MapObjectForKey(MapRef map, RCTypeRef key);
+size_t MapCount(MapRef map);
+void MapSetObjectForKey(MapRef map, RCTypeRef key, RCTypeRef value);
+void MapRemoveObjectForKey(MapRef map, RCTypeRef key);
+void MapEnumerate(MapRef map, pair_visitor_fn *visit, void *context); // in insertion order, sorts a list of the entries
+void MapForEach(MapRef map, pair_visitor_fn *visit, void *context); // in no particular order, allocates nothing
 #endif /* containers_h */
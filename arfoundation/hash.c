@@ -0,0 +1,397 @@
+//
+//  hash.c
+//
+//  Short inputs: wyhash (final version 4). Long inputs: xxh3's accumulate/scramble loop,
+//  a stripe of 64 bytes feeds 8 64 bit lanes, every 16 stripes the lanes get scrambled.
+//  The vector paths only replace the accumulate step, the math is the same as the portable one.
+//  The multipliers, the secret and a hidden seed are the hash keys, HashInitialize replaces them
+//  with random ones (the Go runtime does the same with its wyhash/aeshash keys).
+
+#include "hash.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__APPLE__) || defined(__linux__)
+#include <sys/random.h>
+#endif
+
+#if AR_HASH_SIMD_ENABLED && defined(__SSE2__)
+#include <emmintrin.h>
+#define AR_HASH_SSE2 1
+#endif
+
+#if AR_HASH_SIMD_ENABLED && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define AR_HASH_AVX2 1 // compiled for avx2 on its own, used when the cpu has it
+#endif
+
+#if AR_HASH_SIMD_ENABLED && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define AR_HASH_NEON 1
+#endif
+
+#define AR_HASH_STRIPE 64
+#define AR_HASH_STRIPES_PER_BLOCK 16
+#define AR_HASH_SECRET_SIZE 192
+
+static uint64_t HashSeed = 0; // mixed into every seed
+static uint64_t HashPrimes[4] = { 0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull };
+
+// splitmix64 output, bytes so the lanes read the same keys on any endianness.
+static uint8_t HashSecret[AR_HASH_SECRET_SIZE] = {
+    0x92, 0x8c, 0xc1, 0xa7, 0x81, 0x0d, 0xcf, 0x0d, 0x92, 0x9f, 0x0d, 0x00, 0xba, 0x42, 0xf6, 0xde,
+    0xb7, 0x4a, 0x45, 0xa5, 0x1b, 0x01, 0x9f, 0x02, 0xe5, 0x61, 0x31, 0x66, 0x83, 0x97, 0x2d, 0xd8,
+    0xba, 0xef, 0xf1, 0xaa, 0x84, 0xaf, 0x28, 0xfe, 0x61, 0xf0, 0x3f, 0x81, 0x36, 0x82, 0xc2, 0x1c,
+    0x9b, 0xad, 0x30, 0x46, 0x0a, 0xc7, 0xf9, 0x21, 0x89, 0x54, 0x9f, 0x40, 0xbe, 0x8f, 0x67, 0x28,
+    0x3a, 0x12, 0x3a, 0x7a, 0x99, 0x26, 0x42, 0x0f, 0x45, 0xad, 0x0f, 0x95, 0xb8, 0x08, 0x61, 0x80,
+    0xf9, 0xba, 0x0e, 0x7b, 0x98, 0x8c, 0xd0, 0x83, 0xb7, 0xa7, 0x02, 0xcc, 0x91, 0x8b, 0x47, 0xea,
+    0xd7, 0x93, 0x27, 0x7d, 0x8c, 0xd3, 0xd4, 0xaf, 0xe4, 0x7e, 0xac, 0x7f, 0x8f, 0x43, 0x98, 0x11,
+    0xb5, 0x5c, 0x75, 0x70, 0x48, 0xdd, 0x42, 0x25, 0x40, 0x8c, 0x7c, 0x7d, 0x11, 0x70, 0xaf, 0x7f,
+    0xf1, 0x16, 0x6d, 0x9a, 0xc8, 0x7c, 0xd0, 0x9a, 0xf7, 0xdf, 0x83, 0xc1, 0xe9, 0x14, 0x81, 0xa1,
+    0x11, 0x14, 0x8e, 0x5e, 0xe0, 0x84, 0xb6, 0x3f, 0x54, 0x36, 0x72, 0x24, 0x14, 0x4d, 0x46, 0x4c,
+    0xea, 0xca, 0xf8, 0x1d, 0x84, 0xa3, 0x23, 0x8f, 0xe8, 0x64, 0xa5, 0x99, 0xce, 0x79, 0xcd, 0x84,
+    0x9a, 0x56, 0x11, 0xe8, 0x63, 0x8d, 0x1e, 0xa9, 0x81, 0x72, 0x9a, 0xfb, 0x77, 0x4c, 0xb3, 0xb5,
+};
+
+static inline uint64_t HashRead64(const uint8_t *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+static inline void HashWrite64(uint8_t *p, uint64_t value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    memcpy(p, &value, sizeof(value));
+}
+
+static inline uint64_t HashRead32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+static inline void HashMultiply(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = (__uint128_t)*a * *b;
+    *a = (uint64_t)product;
+    *b = (uint64_t)(product >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t high = ha * hb, middle0 = ha * lb, middle1 = hb * la, low = la * lb;
+    uint64_t t = low + (middle0 << 32);
+    uint64_t carry = t < low;
+    uint64_t lo = t + (middle1 << 32);
+    carry += lo < t;
+    *a = lo;
+    *b = high + (middle0 >> 32) + (middle1 >> 32) + carry;
+#endif
+}
+
+static inline uint64_t HashMix(uint64_t a, uint64_t b) {
+    HashMultiply(&a, &b);
+    return a ^ b;
+}
+
+static uint64_t HashShort(const uint8_t *p, size_t length, uint64_t seed) {
+    seed ^= HashMix(seed ^ HashPrimes[0], HashPrimes[1]);
+
+    uint64_t a, b;
+    if (length <= 16) {
+        if (length >= 4) {
+            size_t offset = (length >> 3) << 2;
+            a = (HashRead32(p) << 32) | HashRead32(p + offset);
+            b = (HashRead32(p + length - 4) << 32) | HashRead32(p + length - 4 - offset);
+        } else if (length > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) | p[length - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+
+    } else {
+        size_t remaining = length;
+        if (remaining > 48) {
+            uint64_t seed1 = seed, seed2 = seed;
+            do {
+                seed = HashMix(HashRead64(p) ^ HashPrimes[1], HashRead64(p + 8) ^ seed);
+                seed1 = HashMix(HashRead64(p + 16) ^ HashPrimes[2], HashRead64(p + 24) ^ seed1);
+                seed2 = HashMix(HashRead64(p + 32) ^ HashPrimes[3], HashRead64(p + 40) ^ seed2);
+                p += 48;
+                remaining -= 48;
+            } while (remaining > 48);
+            seed ^= seed1 ^ seed2;
+        }
+
+        while (remaining > 16) {
+            seed = HashMix(HashRead64(p) ^ HashPrimes[1], HashRead64(p + 8) ^ seed);
+            remaining -= 16;
+            p += 16;
+        }
+        a = HashRead64(p + remaining - 16);
+        b = HashRead64(p + remaining - 8);
+    }
+
+    a ^= HashPrimes[1];
+    b ^= seed;
+    HashMultiply(&a, &b);
+    return HashMix(a ^ HashPrimes[0] ^ length, b ^ HashPrimes[1]);
+}
+
+#pragma mark - accumulators
+
+typedef void HashAccumulateFn(uint64_t *acc, const uint8_t *input, const uint8_t *secret, size_t stripes);
+
+// each stripe uses the secret 8 bytes further along than the previous one.
+static void HashAccumulatePortable(uint64_t *acc, const uint8_t *input, const uint8_t *secret, size_t stripes) {
+    for (size_t n = 0; n < stripes; n++) {
+        const uint8_t *stripe = input + n * AR_HASH_STRIPE;
+        const uint8_t *key = secret + n * 8;
+        for (int i = 0; i < 8; i++) {
+            uint64_t value = HashRead64(stripe + 8 * i);
+            uint64_t keyed = value ^ HashRead64(key + 8 * i);
+            acc[i ^ 1] += value;
+            acc[i] += (keyed & 0xffffffff) * (keyed >> 32);
+        }
+    }
+}
+
+#if AR_HASH_SSE2
+static void HashAccumulateSSE2(uint64_t *acc, const uint8_t *input, const uint8_t *secret, size_t stripes) {
+    __m128i lanes[4];
+    for (int i = 0; i < 4; i++) {
+        lanes[i] = _mm_loadu_si128((const __m128i *)(acc + 2 * i));
+    }
+
+    for (size_t n = 0; n < stripes; n++) {
+        const uint8_t *stripe = input + n * AR_HASH_STRIPE;
+        const uint8_t *key = secret + n * 8;
+        for (int i = 0; i < 4; i++) {
+            __m128i value = _mm_loadu_si128((const __m128i *)(stripe + 16 * i));
+            __m128i keyed = _mm_xor_si128(value, _mm_loadu_si128((const __m128i *)(key + 16 * i)));
+            __m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+            __m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+            lanes[i] = _mm_add_epi64(lanes[i], _mm_add_epi64(product, swapped));
+        }
+    }
+
+    for (int i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i *)(acc + 2 * i), lanes[i]);
+    }
+}
+#endif
+
+#if AR_HASH_AVX2
+__attribute__((target("avx2")))
+static void HashAccumulateAVX2(uint64_t *acc, const uint8_t *input, const uint8_t *secret, size_t stripes) {
+    __m256i lanes[2];
+    for (int i = 0; i < 2; i++) {
+        lanes[i] = _mm256_loadu_si256((const __m256i *)(acc + 4 * i));
+    }
+
+    for (size_t n = 0; n < stripes; n++) {
+        const uint8_t *stripe = input + n * AR_HASH_STRIPE;
+        const uint8_t *key = secret + n * 8;
+        for (int i = 0; i < 2; i++) {
+            __m256i value = _mm256_loadu_si256((const __m256i *)(stripe + 32 * i));
+            __m256i keyed = _mm256_xor_si256(value, _mm256_loadu_si256((const __m256i *)(key + 32 * i)));
+            __m256i product = _mm256_mul_epu32(keyed, _mm256_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+            __m256i swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+            lanes[i] = _mm256_add_epi64(lanes[i], _mm256_add_epi64(product, swapped));
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        _mm256_storeu_si256((__m256i *)(acc + 4 * i), lanes[i]);
+    }
+}
+#endif
+
+#if AR_HASH_NEON
+static void HashAccumulateNEON(uint64_t *acc, const uint8_t *input, const uint8_t *secret, size_t stripes) {
+    uint64x2_t lanes[4];
+    for (int i = 0; i < 4; i++) {
+        lanes[i] = vld1q_u64(acc + 2 * i);
+    }
+
+    for (size_t n = 0; n < stripes; n++) {
+        const uint8_t *stripe = input + n * AR_HASH_STRIPE;
+        const uint8_t *key = secret + n * 8;
+        for (int i = 0; i < 4; i++) {
+            uint64x2_t value = vreinterpretq_u64_u8(vld1q_u8(stripe + 16 * i));
+            uint64x2_t keyed = veorq_u64(value, vreinterpretq_u64_u8(vld1q_u8(key + 16 * i)));
+            uint64x2_t product = vmull_u32(vmovn_u64(keyed), vshrn_n_u64(keyed, 32));
+            lanes[i] = vaddq_u64(lanes[i], vaddq_u64(product, vextq_u64(value, value, 1)));
+        }
+    }
+
+    for (int i = 0; i < 4; i++) {
+        vst1q_u64(acc + 2 * i, lanes[i]);
+    }
+}
+#endif
+
+#if AR_HASH_SSE2
+static HashAccumulateFn *HashAccumulate = HashAccumulateSSE2;
+static const char *HashAccumulateName = "sse2";
+#elif AR_HASH_NEON
+static HashAccumulateFn *HashAccumulate = HashAccumulateNEON;
+static const char *HashAccumulateName = "neon";
+#else
+static HashAccumulateFn *HashAccumulate = HashAccumulatePortable;
+static const char *HashAccumulateName = "portable";
+#endif
+
+#if AR_HASH_AVX2
+__attribute__((constructor))
+static void HashSelectAccumulate(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        HashAccumulate = HashAccumulateAVX2;
+        HashAccumulateName = "avx2";
+    }
+}
+#endif
+
+#pragma mark - long inputs
+
+static void HashScramble(uint64_t *acc, const uint8_t *key) {
+    for (int i = 0; i < 8; i++) {
+        uint64_t lane = acc[i];
+        lane ^= lane >> 47;
+        lane ^= HashRead64(key + 8 * i);
+        acc[i] = lane * 0x9e3779b1ull;
+    }
+}
+
+static uint64_t HashLong(const uint8_t *p, size_t length, uint64_t seed, HashAccumulateFn *accumulate) {
+    // a seed shifts the secret, like xxh3 does, so it changes every lane's keys.
+    uint8_t seeded[AR_HASH_SECRET_SIZE];
+    const uint8_t *secret = HashSecret;
+    if (seed) {
+        for (size_t i = 0; i < AR_HASH_SECRET_SIZE; i += 16) {
+            HashWrite64(seeded + i, HashRead64(HashSecret + i) + seed);
+            HashWrite64(seeded + i + 8, HashRead64(HashSecret + i + 8) - seed);
+        }
+        secret = seeded;
+    }
+
+    uint64_t acc[8] = {
+        0x00000000c2b2ae3dull, 0x9e3779b185ebca87ull, 0xc2b2ae3d27d4eb4full, 0x165667b19e3779f9ull,
+        0x85ebca77c2b2ae63ull, 0x0000000085ebca77ull, 0x27d4eb2f165667c5ull, 0x000000009e3779b1ull,
+    };
+
+    const size_t blockLength = AR_HASH_STRIPE * AR_HASH_STRIPES_PER_BLOCK;
+    size_t blocks = (length - 1) / blockLength;
+    for (size_t block = 0; block < blocks; block++) {
+        accumulate(acc, p + block * blockLength, secret, AR_HASH_STRIPES_PER_BLOCK);
+        HashScramble(acc, secret + AR_HASH_SECRET_SIZE - AR_HASH_STRIPE);
+    }
+
+    // what's left of the last block, then the last 64 bytes (overlapping) with their own keys.
+    size_t stripes = ((length - 1) - blocks * blockLength) / AR_HASH_STRIPE;
+    accumulate(acc, p + blocks * blockLength, secret, stripes);
+    accumulate(acc, p + length - AR_HASH_STRIPE, secret + AR_HASH_SECRET_SIZE - AR_HASH_STRIPE - 7, 1);
+
+    uint64_t result = length * 0x9e3779b185ebca87ull;
+    for (int i = 0; i < 4; i++) {
+        result += HashMix(acc[2 * i] ^ HashRead64(secret + 11 + 16 * i), acc[2 * i + 1] ^ HashRead64(secret + 19 + 16 * i));
+    }
+
+    result ^= result >> 37;
+    result *= 0x165667919e3779f9ull;
+    result ^= result >> 32;
+    return result;
+}
+
+uint64_t HashBytes(const void *bytes, size_t length, uint64_t seed) {
+    seed ^= HashSeed;
+    if (length < AR_HASH_LONG_LENGTH) {
+        return HashShort(bytes, length, seed);
+    }
+    return HashLong(bytes, length, seed, HashAccumulate);
+}
+
+uint64_t HashBytesPortable(const void *bytes, size_t length, uint64_t seed) {
+    seed ^= HashSeed;
+    if (length < AR_HASH_LONG_LENGTH) {
+        return HashShort(bytes, length, seed);
+    }
+    return HashLong(bytes, length, seed, HashAccumulatePortable);
+}
+
+uint64_t HashInteger(uint64_t value, uint64_t seed) {
+    seed ^= HashSeed;
+    uint64_t mixed = HashMix(value ^ HashPrimes[0], seed ^ HashPrimes[1]);
+    return HashMix(mixed ^ HashPrimes[2], value ^ HashPrimes[3]);
+}
+
+const char *HashImplementationName(void) {
+    return HashAccumulateName;
+}
+
+#pragma mark - keys
+
+static uint64_t HashSplitMix(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static void HashRandomBytes(void *bytes, size_t length) {
+#if defined(__APPLE__) || defined(__linux__)
+    if (getentropy(bytes, length) == 0) {
+        return;
+    }
+#endif
+    FILE *urandom = fopen("/dev/urandom", "rb");
+    if (urandom) {
+        size_t count = fread(bytes, 1, length, urandom);
+        fclose(urandom);
+        if (count == length) {
+            return;
+        }
+    }
+
+    // last resort, better than fixed keys.
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t state = ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec ^ ((uint64_t)getpid() << 16) ^ (uintptr_t)bytes;
+    for (size_t i = 0; i < length; i += 8) {
+        uint64_t value = HashSplitMix(&state);
+        memcpy((uint8_t *)bytes + i, &value, length - i < 8 ? length - i : 8);
+    }
+}
+
+// a multiplier needs to be odd with about as many ones as zeros, or products lose bits.
+static uint64_t HashMakePrime(uint64_t value) {
+    value |= 1;
+    while (__builtin_popcountll(value) < 28 || __builtin_popcountll(value) > 36) {
+        value = HashSplitMix(&value) | 1;
+    }
+    return value;
+}
+
+void HashInitialize(void) {
+#if AR_HASH_RANDOMIZED
+    uint64_t keys[1 + 4 + AR_HASH_SECRET_SIZE / 8];
+    HashRandomBytes(keys, sizeof(keys));
+
+    HashSeed = keys[0];
+    for (int i = 0; i < 4; i++) {
+        HashPrimes[i] = HashMakePrime(keys[1 + i]);
+    }
+    memcpy(HashSecret, keys + 5, AR_HASH_SECRET_SIZE);
+#endif
+}
@@ -0,0 +1,34 @@
+//
+//  hash.h
+//
+//  64 bit hash for strings and raw object bytes. Short inputs are mixed 16 bytes at a time with
+//  128 bit multiplies (wyhash style), long ones go through 8 parallel accumulators (xxh3 style)
+//  that run on SSE2, AVX2 or NEON when available. Every code path gives the same result.
+//  Not cryptographic, but keyed: HashInitialize (called by RuntimeInitialize) picks random keys
+//  for the process, so colliding inputs can't be worked out ahead of time.
+
+#ifndef _arhash_h_
+#define _arhash_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// set to 0 to always use the portable code.
+#ifndef AR_HASH_SIMD_ENABLED
+#define AR_HASH_SIMD_ENABLED 1
+#endif
+
+// set to 0 to keep the built in keys, every run then hashes the same.
+#ifndef AR_HASH_RANDOMIZED
+#define AR_HASH_RANDOMIZED 1
+#endif
+
+#define AR_HASH_LONG_LENGTH 256 // inputs this long or longer use the accumulators
+
+void HashInitialize(void); // before anything is hashed, hashes change with the keys.
+uint64_t HashBytes(const void *bytes, size_t length, uint64_t seed);
+uint64_t HashInteger(uint64_t value, uint64_t seed); // keyed mix of a 64 bit value, e.g. an integer or another hash
+uint64_t HashBytesPortable(const void *bytes, size_t length, uint64_t seed); // same result, no SIMD. For tests and benchmarks.
+const char *HashImplementationName(void); // the long input path picked for this cpu
+
+#endif /* _arhash_h_ */
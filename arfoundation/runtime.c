@@ -5,10 +5,12 @@
 
 #include "runtime.h"
 
+#include "allocator.h"
 #include "common.h"
 #include "string.h"
 #include "autoreleasepool.h"
 #include "containers.h"
+#include "hash.h"
 
 #ifndef STB_DS_IMPLEMENTATION
 #define STB_DS_IMPLEMENTATION
@@ -16,6 +18,8 @@
 #include "stb_ds_x.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 
 typedef enum {
     AR_RUNTIME_NOT_INITIALIZED,
@@ -35,23 +39,64 @@ static RCATOMIC uint64_t runtimeRegisteredClassCount;
 static RCATOMIC uint64_t allocid = 0;
 static RCATOMIC uint64_t deallocid = 0;
 static RCATOMIC uint64_t constants = 0;
-static RuntimeRegisteredClassInfo *runtimeClasses;      // TODO: make thread safe?
+static RuntimeRegisteredClassInfo *runtimeClasses;      // capacity reserved up front, readers never see it move
+static pthread_mutex_t runtimeClassesLock = PTHREAD_MUTEX_INITIALIZER;
+static RuntimeClassID taggedPointerClasses[AR_RUNTIME_TAG_MASK + 1];
 
+#define AR_RUNTIME_MAX_CLASSES 256
 #define RC_RUNTIME_ALLOC_TRACK 0
+#define RC_RUNTIME_ALLOC_REPORT 0 // per size class occupancy at exit
 #if RC_RUNTIME_ALLOC_TRACK
-struct alloc_track { uint64_t key; uint64_t value; };
-static struct alloc_track *allocationTracking = NULL;
+struct alloc_track { RCTypeRef key; uint64_t value; };
+static struct alloc_track *allocationTracking = NULL; // all threads
+static pthread_mutex_t allocationTrackingLock = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
 #define ar_object_header(obj)  ((RuntimeObjectBase *) (obj) - 1)
+#define ar_header_object(base) ((RCTypeRef) ((RuntimeObjectBase *) (base) + 1))
+#define ar_header_size(base)   ((size_t *) (base) - 1)
+
+typedef enum {
+    RC_OBJECT_SIZED     = 1 << 0, // payload size stored in front of the header
+    RC_OBJECT_HASHED    = 1 << 1, // has an entry in hashCache
+} RuntimeObjectFlags;
+
+// hashes are only cached for objects that get hashed, most never are.
+// objects don't leave the thread that allocates them, so the cache is per thread. constants are
+// shared, they aren't cached.
+struct hash_cache { RCTypeRef key; uint64_t value; };
+static _Thread_local struct hash_cache *hashCache = NULL;
+
+typedef enum {
+    RC_CYCLE_BLACK,     // in use, or never looked at
+    RC_CYCLE_GRAY,      // visited, refcount has the internal references subtracted
+    RC_CYCLE_WHITE,     // only referenced from inside the subgraph being examined
+    RC_CYCLE_PURPLE,    // possible root, buffered
+    RC_CYCLE_COLLECTING // garbage, retain/release are ignored while destructors run
+} RuntimeCycleColor;
+
+// per thread, each thread collects the cycles it created.
+static _Thread_local RuntimeObjectBase **cycleRoots = NULL;
+static _Thread_local RuntimeCycleStats cycleStats;
+static _Thread_local bool cycleCollecting = false;
+
+// 0 until the thread allocates, wraps past 65535 threads, which only weakens the owner asserts.
+static RCATOMIC uint32_t runtimeThreadCount = 0;
+static _Thread_local uint16_t runtimeThreadIndex = 0;
+static pthread_key_t runtimeThreadKey; // only there for its destructor
+static void RuntimeThreadExit(void *unused);
+
+#define RuntimeAssertOwner(base) \
+    assert((base)->owner == runtimeThreadIndex && "object used from a thread other than the one that allocated it")
 
 void RuntimeDealloc(void) {
+    StringInternTableFree();
 
 #if RC_RUNTIME_ALLOC_TRACK
     fprintf(stderr, "Leaks: %ld {\n", hmlen(allocationTracking));
     for (int i = 0; i < hmlen(allocationTracking); i++) {
         struct alloc_track entry = allocationTracking[i];
-        fprintf(stderr, "\talloc:%llu, id:%llu type:%s \n", entry.key, entry.value, RuntimeClassName((RuntimeClassID){entry.value}));
+        fprintf(stderr, "\talloc:%p, id:%llu type:%s \n", entry.key, entry.value, RuntimeClassName((RuntimeClassID){entry.value}));
     }
     fprintf(stderr, "}\n");
     hmfree(allocationTracking);
@@ -63,6 +108,15 @@ void RuntimeDealloc(void) {
     // TODO: other cleanup...?
 #if RC_RUNTIME_VERBOSE
     fprintf(stderr, "\nAllocated: %llu. Deallocated: %llu. Constants: %llu. Leaked:%llu\n", allocid, deallocid, constants, allocid - deallocid - constants);
+    if (cycleStats.collections) {
+        fprintf(stderr, "Cycle collections: %llu. Cycles: %llu. Objects: %llu. Bytes: %llu\n", cycleStats.collections, cycleStats.cyclesFound, cycleStats.objectsFreed, cycleStats.bytesFreed);
+    }
+#endif
+    arrfree(cycleRoots);
+    hmfree(hashCache);
+
+#if RC_RUNTIME_ALLOC_REPORT
+    AllocatorPrintReport(stderr);
 #endif
 }
 
@@ -72,7 +126,13 @@ void RuntimeInitialize(void) {
     }
     
     runtimeStatus = AR_RUNTIME_INITIALIZING;
+    pthread_key_create(&runtimeThreadKey, RuntimeThreadExit);
+    
+    // new hash keys for this process, stb_ds tables get their own seed out of them.
+    HashInitialize();
+    stbds_rand_seed((size_t)HashInteger(AR_RUNTIME_HASH_SEED, 0));
     
+    arrsetcap(runtimeClasses, AR_RUNTIME_MAX_CLASSES);
     arrclear(runtimeClasses);
     runtimeRegisteredClassCount = arrlen(runtimeClasses);
     RuntimeRegisteredClassInfo info = { 0 };
@@ -85,10 +145,12 @@ void RuntimeInitialize(void) {
     StringInitialize();
     ArrayInitialize();
     DictionaryInitialize();
+    MapInitialize();
     ObjectPairInitialize();
 }
 
-RuntimeClassID RuntimeRegisterClass(const RuntimeClassDescriptor *klass) {
+// caller holds runtimeClassesLock.
+static RuntimeClassID RuntimeAddClass(const RuntimeClassDescriptor *klass) {
     if (runtimeStatus != AR_RUNTIME_READY) {
         ar_fatal("Runtime not initialized. Call ARRuntimeInitialize...\n");
     }
@@ -97,11 +159,60 @@ RuntimeClassID RuntimeRegisterClass(const RuntimeClassDescriptor *klass) {
         ar_fatal("Can't register NULL class info\n");
     }
     
-    runtimeRegisteredClassCount = arrlen(runtimeClasses);
+    if (arrlen(runtimeClasses) >= AR_RUNTIME_MAX_CLASSES) {
+        ar_fatal("Too many registered classes, max: %d\n", AR_RUNTIME_MAX_CLASSES);
+    }
+    
+    RuntimeClassID classid = { arrlen(runtimeClasses) };
     RuntimeRegisteredClassInfo info = { klass };
     arrput(runtimeClasses, info);
+    runtimeRegisteredClassCount = classid.classID; // publishes the entry, lookups check against the count
     
-    return (RuntimeClassID){ runtimeRegisteredClassCount };
+    return classid;
+}
+
+RuntimeClassID RuntimeRegisterClass(const RuntimeClassDescriptor *klass) {
+    pthread_mutex_lock(&runtimeClassesLock);
+    RuntimeClassID classid = RuntimeAddClass(klass);
+    pthread_mutex_unlock(&runtimeClassesLock);
+    
+    return classid;
+}
+
+RuntimeClassID RuntimeRegisterLazyClass(RuntimeClassID *classid, const RuntimeClassDescriptor *klass, uintptr_t tag) {
+    pthread_mutex_lock(&runtimeClassesLock);
+    if (!__atomic_load_n(&classid->classID, __ATOMIC_ACQUIRE)) {
+        RuntimeClassID registered = RuntimeAddClass(klass);
+        if (tag) {
+            RuntimeRegisterTaggedPointerClass(tag, registered);
+        }
+        __atomic_store_n(&classid->classID, registered.classID, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&runtimeClassesLock);
+    
+    return *classid;
+}
+
+void RuntimeRegisterTaggedPointerClass(uintptr_t tag, RuntimeClassID classid) {
+    if (tag == 0 || tag > AR_RUNTIME_TAG_MASK) {
+        ar_fatal("Invalid tagged pointer tag: %lu\n", (unsigned long)tag);
+    }
+
+    taggedPointerClasses[tag] = classid;
+}
+
+// payload only.
+static size_t RuntimeObjectSize(RuntimeObjectBase *base) {
+    if (base->flags & RC_OBJECT_SIZED) {
+        return *ar_header_size(base);
+    }
+    return runtimeClasses[base->classid].descriptor->size;
+}
+
+// what was asked of the allocator: payload, header and size word if any.
+static size_t RuntimeAllocationSize(RuntimeObjectBase *base) {
+    size_t prefix = (base->flags & RC_OBJECT_SIZED) ? sizeof(size_t) : 0;
+    return prefix + sizeof(RuntimeObjectBase) + RuntimeObjectSize(base);
 }
 
 RCTypeRef RuntimeRCAlloc(size_t size, RuntimeClassID classid) {
@@ -109,24 +220,34 @@ RCTypeRef RuntimeRCAlloc(size_t size, RuntimeClassID classid) {
     // or flooh style typed arrays and return a {type} struct with the idx/offset?
     
     assert(size > 0);
-    assert(classid.classID <= arrlen(runtimeClasses));
+    assert(classid.classID <= runtimeRegisteredClassCount);
+
+    // the common case, a fixed size instance, gets its size from the class.
+    bool sized = classid.classID == AR_RUNTIME_NOT_OBJECT || runtimeClasses[classid.classID].descriptor->size != size;
+    size_t prefix = sized ? sizeof(size_t) : 0;
 
-    size_t allocSize = sizeof(RuntimeObjectBase) + size;
-    RuntimeObjectBase *object = ar_calloc(1, allocSize);
+    char *block = AllocatorAlloc(prefix + sizeof(RuntimeObjectBase) + size);
+    RuntimeObjectBase *object = (RuntimeObjectBase *)(block + prefix);
     
     object->refcount = 1;
-    object->size = allocSize;
-    object->classid = classid;
-    object->allocid = ++allocid;
+    object->classid = (uint32_t)classid.classID;
+    object->owner = RuntimeThreadIndex();
+    if (sized) {
+        object->flags = RC_OBJECT_SIZED;
+        *ar_header_size(object) = size;
+    }
+    allocid++;
     
-    RCTypeRef obj = (char *)object + sizeof(RuntimeObjectBase);
+    RCTypeRef obj = ar_header_object(object);
     
 #if RC_RUNTIME_VERBOSE && RC_PRINT_RETAIN_RELEASE
-    fprintf(stderr, "\033[33mAllocated \033[0mid:%llu s:%zu bytes [%llu]@%p\n", classid.classID, size, object->allocid, obj);
+    fprintf(stderr, "\033[33mAllocated \033[0mid:%llu s:%zu bytes @%p\n", classid.classID, size, obj);
 #endif
 
 #if RC_RUNTIME_ALLOC_TRACK
-    hmput(allocationTracking, object->allocid, classid.classID);
+    pthread_mutex_lock(&allocationTrackingLock);
+    hmput(allocationTracking, obj, classid.classID);
+    pthread_mutex_unlock(&allocationTrackingLock);
 #endif
     
     return obj;
@@ -186,22 +307,30 @@ bool RuntimeIsRegisteredClass(RuntimeClassID classid) {
         return false;
     }
     
-    return classid.classID <= arrlen(runtimeClasses);
+    return classid.classID <= runtimeRegisteredClassCount;
 }
 
 StringRef RuntimeDescription(RCTypeRef obj) {
     if (!obj) {
         return StringWithFormat("(null)");
     }
+
+    if (RuntimeIsTaggedPointer(obj)) {
+        const RuntimeRegisteredClassInfo *klass = RuntimeClassInfo(taggedPointerClasses[RuntimeTaggedPointerTag(obj)]);
+        if (!klass || !klass->descriptor->description) {
+            return StringWithFormat("<tagged %p>", obj);
+        }
+        return StringWithFormat("<%s %p> %s", klass->descriptor->classname, obj, CString(klass->descriptor->description(obj)));
+    }
     
     RuntimeObjectBase *base = ar_object_header(obj);
     assert(base);
     
-    RuntimeClassID classid = base->classid;
+    RuntimeClassID classid = { base->classid };
     const RuntimeRegisteredClassInfo *klass = RuntimeClassInfo(classid);
     
     if (!RuntimeIsRegisteredClass(classid) || !klass || !klass->descriptor->classname) {
-        return StringWithFormat("<%p:%zu bytes>", obj, base->size - sizeof(RuntimeObjectBase));
+        return StringWithFormat("<%p:%zu bytes>", obj, RuntimeObjectSize(base));
     }
     
     StringRef description = NULL;
@@ -217,43 +346,339 @@ StringRef RuntimeDescription(RCTypeRef obj) {
 }
 
 void RuntimeInvalidateHash(RCTypeRef obj) {
-    if (!obj) {
+    if (!obj || RuntimeIsTaggedPointer(obj)) {
         return;
     }
     
     RuntimeObjectBase *base = ar_object_header(obj);
     assert(base);
     
-    base->hash = 0;
+    if (base->flags & RC_OBJECT_HASHED) {
+        hmdel(hashCache, obj);
+        base->flags &= ~RC_OBJECT_HASHED;
+    }
 }
 
 RuntimeHashValue RuntimeHash(RCTypeRef obj) {
     if (!obj) {
         return NO_HASH_VALUE;
     }
+
+    if (RuntimeIsTaggedPointer(obj)) {
+        // immediates are their own hash unless the class says otherwise, nowhere to cache it.
+        RuntimeClassID classid = taggedPointerClasses[RuntimeTaggedPointerTag(obj)];
+        const RuntimeRegisteredClassInfo *klass = RuntimeClassInfo(classid);
+        if (klass && klass->descriptor && klass->descriptor->hash) {
+            return (RuntimeHashValue){classid, klass->descriptor->hash(obj)};
+        }
+        return (RuntimeHashValue){classid, (uint64_t)(uintptr_t)obj};
+    }
     
     RuntimeObjectBase *base = ar_object_header(obj);
     assert(base);
-    
-    if (!base->hash) {
-        const RuntimeRegisteredClassInfo *klass = RuntimeClassInfo(base->classid);
-        if (klass && klass->descriptor->hash) {
-            base->hash = klass->descriptor->hash(obj);
-            
-        } else {
-            base->hash = stbds_hash_bytes(base, base->size, AR_RUNTIME_HASH_SEED);
+
+    RuntimeClassID classid = { base->classid };
+    if (base->flags & RC_OBJECT_HASHED) {
+        RuntimeAssertOwner(base);
+        return (RuntimeHashValue){classid, hmget(hashCache, obj)};
+    }
+
+    uint64_t hash = 0;
+    const RuntimeRegisteredClassInfo *klass = RuntimeClassInfo(classid);
+    if (klass && klass->descriptor && klass->descriptor->hash) {
+        hash = klass->descriptor->hash(obj);
+        if (klass->descriptor->ownsHash) {
+            return (RuntimeHashValue){classid, hash};
         }
+
+    } else {
+        hash = HashBytes(obj, RuntimeObjectSize(base), AR_RUNTIME_HASH_SEED);
+    }
+
+    if (base->refcount < 0) {
+        return (RuntimeHashValue){classid, hash}; // any thread may be asking, and none of their caches would be cleaned up.
     }
+
+    RuntimeAssertOwner(base);
+    hmput(hashCache, obj, hash);
+    base->flags |= RC_OBJECT_HASHED;
     
-    return (RuntimeHashValue){base->classid, base->hash};
+    return (RuntimeHashValue){classid, hash};
+}
+
+static RuntimeClassID RuntimeObjectClassID(RCTypeRef obj) {
+    if (RuntimeIsTaggedPointer(obj)) {
+        return taggedPointerClasses[RuntimeTaggedPointerTag(obj)];
+    }
+    return (RuntimeClassID){ ar_object_header(obj)->classid };
+}
+
+bool RuntimeEquals(RCTypeRef obj, RCTypeRef other) {
+    if (obj == other) {
+        return true;
+    }
+
+    if (!obj || !other) {
+        return false;
+    }
+
+    RuntimeClassID classid = RuntimeObjectClassID(obj);
+    if (classid.classID != RuntimeObjectClassID(other).classID) {
+        return false;
+    }
+
+    const RuntimeRegisteredClassInfo *klass = RuntimeClassInfo(classid);
+    if (klass && klass->descriptor && klass->descriptor->equals) {
+        return klass->descriptor->equals(obj, other);
+    }
+
+    if ((klass && klass->descriptor && klass->descriptor->hash) || RuntimeIsTaggedPointer(obj)) {
+        return false;
+    }
+
+    RuntimeObjectBase *base = ar_object_header(obj);
+    RuntimeObjectBase *otherBase = ar_object_header(other);
+    size_t size = RuntimeObjectSize(base);
+    return size == RuntimeObjectSize(otherBase) && memcmp(obj, other, size) == 0;
 }
 
 #pragma mark - Lifetime management
 
+static traverse_fn *RuntimeClassTraverse(RuntimeObjectBase *base) {
+    if (base->classid == AR_RUNTIME_NOT_OBJECT) {
+        return NULL;
+    }
+    return runtimeClasses[base->classid].descriptor->traverse;
+}
+
+static void RuntimeDestroy(RuntimeObjectBase *base) {
+    RCTypeRef obj = ar_header_object(base);
+    const RuntimeRegisteredClassInfo *klass = RuntimeClassInfo((RuntimeClassID){ base->classid });
+
+    if (klass) {
+        if (klass->descriptor->destructor) {
+            klass->descriptor->destructor(obj);
+        }
+
+#if RC_RUNTIME_VERBOSE && RC_PRINT_RETAIN_RELEASE
+        fprintf(stderr, "\033[31mDeallocating \033[0m%s(%u) @%p\n", klass->descriptor->classname, base->classid, obj);
+    } else {
+        fprintf(stderr, "\033[31mDeallocating \033[0m<unknown:%zu bytes> @%p\n", RuntimeObjectSize(base), obj);
+#endif
+    }
+}
+
+static void RuntimeFree(RuntimeObjectBase *base) {
+#if RC_RUNTIME_ALLOC_TRACK
+    pthread_mutex_lock(&allocationTrackingLock);
+    hmdel(allocationTracking, ar_header_object(base));
+    pthread_mutex_unlock(&allocationTrackingLock);
+#endif
+
+    if (base->flags & RC_OBJECT_HASHED) {
+        hmdel(hashCache, ar_header_object(base));
+    }
+
+    size_t size = RuntimeAllocationSize(base);
+    if (base->flags & RC_OBJECT_SIZED) {
+        AllocatorFree(ar_header_size(base), size);
+
+    } else {
+        AllocatorFree(base, size);
+    }
+    deallocid++;
+}
+
+#pragma mark - Cycle collection
+
+static void RuntimeAddCycleRoot(RuntimeObjectBase *base) {
+    arrput(cycleRoots, base);
+    base->cycleRootIndex = (uint32_t)arrlen(cycleRoots);
+    base->cycleColor = RC_CYCLE_PURPLE;
+}
+
+static void RuntimeRemoveCycleRoot(RuntimeObjectBase *base) {
+    size_t index = base->cycleRootIndex - 1;
+    RuntimeObjectBase *last = arrpop(cycleRoots);
+    if (last != base) {
+        cycleRoots[index] = last;
+        last->cycleRootIndex = (uint32_t)index + 1;
+    }
+    base->cycleRootIndex = 0;
+    base->cycleColor = RC_CYCLE_BLACK;
+}
+
+// constants and immediates never go away, they don't take part.
+static RuntimeObjectBase *RuntimeCycleChild(RCTypeRef child) {
+    if (!child || RuntimeIsTaggedPointer(child)) {
+        return NULL;
+    }
+
+    RuntimeObjectBase *base = ar_object_header(child);
+    return base->refcount < 0 ? NULL : base;
+}
+
+static void RuntimeCycleTraverse(RuntimeObjectBase *base, visitor_fn *visit, void *context) {
+    traverse_fn *traverse = RuntimeClassTraverse(base);
+    if (traverse) {
+        traverse(ar_header_object(base), visit, context);
+    }
+}
+
+static void RuntimeMarkGray(RuntimeObjectBase *base);
+static void RuntimeMarkGrayChild(RCTypeRef child, void *context) {
+    RuntimeObjectBase *base = RuntimeCycleChild(child);
+    if (base) {
+        base->refcount--;
+        RuntimeMarkGray(base);
+    }
+}
+
+static void RuntimeMarkGray(RuntimeObjectBase *base) {
+    if (base->cycleColor == RC_CYCLE_GRAY) {
+        return;
+    }
+    base->cycleColor = RC_CYCLE_GRAY;
+    RuntimeCycleTraverse(base, RuntimeMarkGrayChild, NULL);
+}
+
+static void RuntimeScanBlack(RuntimeObjectBase *base);
+static void RuntimeScanBlackChild(RCTypeRef child, void *context) {
+    RuntimeObjectBase *base = RuntimeCycleChild(child);
+    if (base) {
+        base->refcount++;
+        if (base->cycleColor != RC_CYCLE_BLACK) {
+            RuntimeScanBlack(base);
+        }
+    }
+}
+
+static void RuntimeScanBlack(RuntimeObjectBase *base) {
+    base->cycleColor = RC_CYCLE_BLACK;
+    RuntimeCycleTraverse(base, RuntimeScanBlackChild, NULL);
+}
+
+static void RuntimeScan(RuntimeObjectBase *base);
+static void RuntimeScanChild(RCTypeRef child, void *context) {
+    RuntimeObjectBase *base = RuntimeCycleChild(child);
+    if (base) {
+        RuntimeScan(base);
+    }
+}
+
+static void RuntimeScan(RuntimeObjectBase *base) {
+    if (base->cycleColor != RC_CYCLE_GRAY) {
+        return;
+    }
+
+    if (base->refcount > 0) {
+        RuntimeScanBlack(base); // something outside still points at it, restore the subgraph.
+
+    } else {
+        base->cycleColor = RC_CYCLE_WHITE;
+        RuntimeCycleTraverse(base, RuntimeScanChild, NULL);
+    }
+}
+
+static void RuntimeCollectWhite(RuntimeObjectBase *base, RuntimeObjectBase ***garbage);
+static void RuntimeCollectWhiteChild(RCTypeRef child, void *context) {
+    RuntimeObjectBase *base = RuntimeCycleChild(child);
+    if (base) {
+        RuntimeCollectWhite(base, context);
+    }
+}
+
+static void RuntimeCollectWhite(RuntimeObjectBase *base, RuntimeObjectBase ***garbage) {
+    if (base->cycleColor != RC_CYCLE_WHITE) {
+        return;
+    }
+    base->cycleColor = RC_CYCLE_COLLECTING;
+    arrput(*garbage, base);
+    RuntimeCycleTraverse(base, RuntimeCollectWhiteChild, garbage);
+}
+
+// marking gray took one reference off everything the garbage points at, give back the ones
+// to objects that survive so the destructors can release them like any other.
+static void RuntimeRestoreChild(RCTypeRef child, void *context) {
+    RuntimeObjectBase *base = RuntimeCycleChild(child);
+    if (base && base->cycleColor != RC_CYCLE_COLLECTING) {
+        base->refcount++;
+    }
+}
+
+size_t RuntimeCollectCycles(void) {
+    if (cycleCollecting || !cycleRoots) {
+        return 0;
+    }
+    cycleCollecting = true;
+
+    // take the buffer, anything released from here on starts a new one.
+    RuntimeObjectBase **roots = cycleRoots;
+    cycleRoots = NULL;
+    for (size_t i = 0; i < arrlen(roots); i++) {
+        roots[i]->cycleRootIndex = 0;
+    }
+
+    for (size_t i = 0; i < arrlen(roots); i++) {
+        if (roots[i]->cycleColor == RC_CYCLE_PURPLE) {
+            RuntimeMarkGray(roots[i]);
+        }
+    }
+
+    for (size_t i = 0; i < arrlen(roots); i++) {
+        RuntimeScan(roots[i]);
+    }
+
+    RuntimeObjectBase **garbage = NULL;
+    for (size_t i = 0; i < arrlen(roots); i++) {
+        size_t before = arrlen(garbage);
+        RuntimeCollectWhite(roots[i], &garbage);
+        if (arrlen(garbage) > before) {
+            cycleStats.cyclesFound++;
+        }
+    }
+
+    for (size_t i = 0; i < arrlen(garbage); i++) {
+        RuntimeCycleTraverse(garbage[i], RuntimeRestoreChild, NULL);
+    }
+
+    // destructors release what's outside the garbage normally, what's inside is skipped.
+    for (size_t i = 0; i < arrlen(garbage); i++) {
+        RuntimeDestroy(garbage[i]);
+    }
+
+    for (size_t i = 0; i < arrlen(garbage); i++) {
+        cycleStats.bytesFreed += RuntimeAllocationSize(garbage[i]);
+        RuntimeFree(garbage[i]);
+    }
+
+    size_t freed = arrlen(garbage);
+    cycleStats.collections++;
+    cycleStats.candidates += arrlen(roots);
+    cycleStats.objectsFreed += freed;
+
+    arrfree(garbage);
+    arrfree(roots);
+    cycleCollecting = false;
+    return freed;
+}
+
+size_t RuntimeCycleRootCount(void) {
+    return arrlen(cycleRoots);
+}
+
+RuntimeCycleStats RuntimeGetCycleStats(void) {
+    return cycleStats;
+}
+
 int64_t RuntimeRefCount(RCTypeRef obj) {
     if (!obj) {
         return 0;
     }
+
+    if (RuntimeIsTaggedPointer(obj)) {
+        return AR_RUNTIME_REFCOUNT_UNRELEASABLE;
+    }
     
     RuntimeObjectBase *base = ar_object_header(obj);
     assert(base);
@@ -264,14 +689,19 @@ RCTypeRef RCRetain(RCTypeRef obj) {
     if (!obj) {
         return NULL;
     }
+
+    if (RuntimeIsTaggedPointer(obj)) {
+        return obj;
+    }
     
     RuntimeObjectBase *base = ar_object_header(obj);
     assert(base);
     
-    if (base->refcount < 0) {
+    if (base->refcount < 0 || base->cycleColor == RC_CYCLE_COLLECTING) {
         return obj;
     }
     
+    RuntimeAssertOwner(base);
     base->refcount++;
     return obj;
 }
@@ -280,45 +710,58 @@ RCTypeRef RCRelease(RCTypeRef obj) {
     if (!obj) {
         return NULL;
     }
+
+    if (RuntimeIsTaggedPointer(obj)) {
+        return obj;
+    }
     
     RuntimeObjectBase *base = ar_object_header(obj);
     assert(base);
     
-    if (base->refcount < 0) {
+    if (base->refcount < 0 || base->cycleColor == RC_CYCLE_COLLECTING) {
         return obj;
     }
     
+    RuntimeAssertOwner(base);
     assert(base->refcount > 0);
     base->refcount--;
     if (base->refcount == 0) {
-        const RuntimeRegisteredClassInfo *klass = RuntimeClassInfo(base->classid);
-        
-        if (klass) {
-            if (klass->descriptor->destructor) {
-                klass->descriptor->destructor(obj);
-            }
-            
-#if RC_RUNTIME_VERBOSE && RC_PRINT_RETAIN_RELEASE
-            fprintf(stderr, "\033[31mDeallocating \033[0m%s(%llu) [%llu]@%p\n", klass->descriptor->classname, base->classid.classID, base->allocid, obj);
-        } else {
-            fprintf(stderr, "\033[31mDeallocating \033[0m<unknown:%zu bytes> [%llu]@%p\n", base->size - sizeof(RuntimeObjectBase), base->allocid, obj);
-#endif
+        if (base->cycleRootIndex) {
+            RuntimeRemoveCycleRoot(base);
         }
 
-#if RC_RUNTIME_ALLOC_TRACK
-        hmdel(allocationTracking, base->allocid);
-#endif
-
-        free(base);
-        deallocid++;
+        RuntimeDestroy(base);
+        RuntimeFree(base);
         return NULL;
     }
+
+    if (!base->cycleRootIndex && RuntimeClassTraverse(base)) {
+        RuntimeAddCycleRoot(base);
+    }
     
     return obj;
 }
+
+// one pass over a buffer of references, immediates and NULLs are skipped without a call each.
+void RCRetainObjects(RCTypeRef *objects, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (objects[i] && !RuntimeIsTaggedPointer(objects[i])) {
+            RCRetain(objects[i]);
+        }
+    }
+}
+
+void RCReleaseObjects(RCTypeRef *objects, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (objects[i] && !RuntimeIsTaggedPointer(objects[i])) {
+            RCRelease(objects[i]);
+        }
+    }
+}
+
 RCTypeRef RCAutorelease(RCTypeRef obj) {
-    if (!obj) {
-        return NULL;
+    if (!obj || RuntimeIsTaggedPointer(obj)) {
+        return obj;
     }
     AutoreleasePoolRef pool = CurrentAutoreleasePool();
     if (pool) {
@@ -328,12 +771,12 @@ RCTypeRef RCAutorelease(RCTypeRef obj) {
         RuntimeObjectBase *base = ar_object_header(obj);
         assert(base);
         
-        RuntimeClassID classid = base->classid;
+        RuntimeClassID classid = { base->classid };
         if (RuntimeIsRegisteredClass(classid)) {
             const RuntimeRegisteredClassInfo *klass = RuntimeClassInfo(classid);
             assert(klass);
             
-            fprintf(stderr, "\033[31mAutoreleasing object '%s' with no pool in place. Leaking %zu bytes.\n", klass->descriptor->classname, base->size);
+            fprintf(stderr, "\033[31mAutoreleasing object '%s' with no pool in place. Leaking %zu bytes.\n", klass->descriptor->classname, RuntimeAllocationSize(base));
         }
     }
     
@@ -341,13 +784,33 @@ RCTypeRef RCAutorelease(RCTypeRef obj) {
 }
 
 RCTypeRef RuntimeMakeConstant(RCTypeRef obj) {
-    if (obj) {
+    if (obj && !RuntimeIsTaggedPointer(obj)) {
         RuntimeObjectBase *base = ar_object_header(obj);
         assert(base);
         
+        RuntimeInvalidateHash(obj); // constants aren't cached, see RuntimeHash
         base->refcount = AR_RUNTIME_REFCOUNT_UNRELEASABLE;
         constants++;
     }
     return obj;
 }
 
+#pragma mark - Threads
+
+// runs as the thread exits. Whatever is still alive leaked, what's left of it stays where it is.
+static void RuntimeThreadExit(void *unused) {
+    StringInternTableFree();
+    RuntimeCollectCycles();
+    arrfree(cycleRoots);
+    hmfree(hashCache);
+    AllocatorThreadExit();
+}
+
+uint16_t RuntimeThreadIndex(void) {
+    if (!runtimeThreadIndex) {
+        runtimeThreadIndex = (uint16_t)(runtimeThreadCount++ % UINT16_MAX) + 1;
+        pthread_setspecific(runtimeThreadKey, &runtimeThreadIndex);
+        stbds_rand_seed((size_t)HashInteger(AR_RUNTIME_HASH_SEED, runtimeThreadIndex)); // the seed is per thread too
+    }
+    return runtimeThreadIndex;
+}
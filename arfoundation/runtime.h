@@ -32,14 +32,23 @@ typedef struct {
 } RuntimeClassID;
 static const RuntimeClassID NO_CLASS_ID = { 0 };
 
+// Sits right before every object. The payload size comes from the class descriptor, allocations
+// that don't match it (classless or variable sized) keep their size in a word in front of the header.
+// Cached hashes live in a side table, see RuntimeHash.
+//
+// Objects are confined to the thread that allocated them: retain, release, hash and autorelease
+// them only there, one interpreter per thread. Constants are the exception, see RuntimeMakeConstant.
+// Debug builds assert it, that's what the owner is for.
 typedef struct {
     // I can add a _isa_ here which points to RuntimeClassDescriptor? if none, add one?
-    RCATOMIC int64_t     refcount;
-    uint64_t            allocid;
-    size_t              size; // allocation size (base + descriptor.size)
-    RuntimeClassID      classid;
-    uint64_t            hash;
+    RCATOMIC int32_t    refcount;
+    uint32_t            classid;
+    uint32_t            cycleRootIndex; // 1 based slot in the possible roots buffer, 0 if not buffered
+    uint8_t             cycleColor;
+    uint8_t             flags;
+    uint16_t            owner;          // allocating thread, see RuntimeThreadIndex
 } RuntimeObjectBase;
+_Static_assert(sizeof(RuntimeObjectBase) == 16, "object header should stay 16 bytes");
 
 typedef struct {
     RuntimeClassID id;
@@ -49,6 +58,21 @@ typedef struct {
 // RC as in refcounted?
 typedef void *RCTypeRef;
 
+// Tagged pointers: heap objects are at least 8 byte aligned, so a reference with any of the low
+// AR_RUNTIME_TAG_BITS set isn't an address but an immediate value carried in the pointer itself.
+// There is no header behind it, retain/release/autorelease are no-ops and it's never freed.
+// Clients pick a tag and register the class used for its hash and description.
+#define AR_RUNTIME_TAG_BITS 3
+#define AR_RUNTIME_TAG_MASK ((uintptr_t)((1 << AR_RUNTIME_TAG_BITS) - 1))
+
+AR_INLINE bool RuntimeIsTaggedPointer(RCTypeRef obj) {
+    return ((uintptr_t)obj & AR_RUNTIME_TAG_MASK) != 0;
+}
+
+AR_INLINE uintptr_t RuntimeTaggedPointerTag(RCTypeRef obj) {
+    return (uintptr_t)obj & AR_RUNTIME_TAG_MASK;
+}
+
 // called after alloc
 typedef RCTypeRef constructor_fn(RCTypeRef obj);
 
@@ -59,6 +83,14 @@ typedef void destructor_fn(RCTypeRef obj);
 typedef StringRef description_fn(RCTypeRef obj);
 typedef uint64_t hash_fn(RCTypeRef obj);
 
+// only called with two objects of the same class, see RuntimeEquals.
+typedef bool equals_fn(RCTypeRef obj, RCTypeRef other);
+
+// reports every strong reference obj holds by calling visit on it, used by the cycle collector.
+// classes that can't be part of a cycle (strings, numbers...) leave it NULL.
+typedef void visitor_fn(RCTypeRef child, void *context);
+typedef void traverse_fn(RCTypeRef obj, visitor_fn *visit, void *context);
+
 typedef struct {
     const char      *classname;
     size_t          size; // data/class size only
@@ -66,7 +98,9 @@ typedef struct {
     destructor_fn   *destructor;
     description_fn  *description;
     hash_fn         *hash;
-    // equals?
+    traverse_fn     *traverse;
+    equals_fn       *equals;
+    bool            ownsHash; // instances keep their own hash, RuntimeHash calls hash every time instead of caching it.
 } RuntimeClassDescriptor;
 
 typedef struct {
@@ -80,7 +114,9 @@ void RuntimeDealloc(void) __attribute__((destructor));
 RCTypeRef RCRetain(RCTypeRef obj);      // increments refcount
 RCTypeRef RCRelease(RCTypeRef obj);     // decrements refcount + release if 0
 RCTypeRef RCAutorelease(RCTypeRef obj); // decrements refcount at a later stage when the current pool is drained.
-RCTypeRef RuntimeMakeConstant(RCTypeRef obj); // makes obj unreleasable.
+void RCRetainObjects(RCTypeRef *objects, size_t count); // RCRetain on each, NULLs included
+void RCReleaseObjects(RCTypeRef *objects, size_t count);
+RCTypeRef RuntimeMakeConstant(RCTypeRef obj); // makes obj unreleasable, and usable from any thread once published.
 
 RCTypeRef RuntimeRCAlloc(size_t size, RuntimeClassID classid); // {0} class id adds refcnt header to any alloc.
 AR_INLINE RCTypeRef RCAlloc(size_t size) {
@@ -88,6 +124,24 @@ AR_INLINE RCTypeRef RCAlloc(size_t size) {
 }
 
 RuntimeClassID RuntimeRegisterClass(const RuntimeClassDescriptor *klass);
+void RuntimeRegisterTaggedPointerClass(uintptr_t tag, RuntimeClassID classid); // tag in 1...AR_RUNTIME_TAG_MASK
+
+// Classes registered on first use, from whichever thread gets there first. Registers klass into *classid
+// once, callers racing for it wait and see the same id. tag 0 for classes without tagged pointers.
+RuntimeClassID RuntimeRegisterLazyClass(RuntimeClassID *classid, const RuntimeClassDescriptor *klass, uintptr_t tag);
+AR_INLINE RuntimeClassID RuntimeRegisterClassOnce(RuntimeClassID *classid, const RuntimeClassDescriptor *klass) {
+    if (__atomic_load_n(&classid->classID, __ATOMIC_ACQUIRE)) {
+        return *classid;
+    }
+    return RuntimeRegisterLazyClass(classid, klass, 0);
+}
+
+AR_INLINE RuntimeClassID RuntimeRegisterTaggedPointerClassOnce(RuntimeClassID *classid, const RuntimeClassDescriptor *klass, uintptr_t tag) {
+    if (__atomic_load_n(&classid->classID, __ATOMIC_ACQUIRE)) {
+        return *classid;
+    }
+    return RuntimeRegisterLazyClass(classid, klass, tag);
+}
 bool RuntimeIsRegisteredClass(RuntimeClassID classid);
 const RuntimeRegisteredClassInfo *RuntimeClassInfo(RuntimeClassID classid);
 
@@ -99,4 +153,30 @@ StringRef RuntimeDescription(RCTypeRef obj);
 RuntimeHashValue RuntimeHash(RCTypeRef obj);
 void RuntimeInvalidateHash(RCTypeRef obj);
 
+// Same object, or same class and the class' equals says so. Classes without a hash function compare
+// their payload bytes (that's what they hash), classes with a hash function but no equals compare by identity.
+bool RuntimeEquals(RCTypeRef obj, RCTypeRef other);
+
+// Cycle collection (synchronous trial deletion, Bacon & Rajan 2001).
+// Releasing an object of a class with a traverse function without freeing it buffers it as a
+// possible cycle root. RuntimeCollectCycles subtracts the references each buffered subgraph holds
+// on itself, whatever ends up with no outside references is garbage: destructors run with
+// retain/release on the other members of the garbage ignored, then the memory is freed.
+// Only call it at a safe point, where no unretained pointers are held on the stack.
+typedef struct {
+    uint64_t    collections;
+    uint64_t    candidates;     // possible roots examined
+    uint64_t    cyclesFound;    // garbage subgraphs reclaimed
+    uint64_t    objectsFreed;
+    uint64_t    bytesFreed;     // including headers
+} RuntimeCycleStats;
+
+size_t RuntimeCollectCycles(void); // returns number of objects freed, this thread's cycles only
+size_t RuntimeCycleRootCount(void);
+RuntimeCycleStats RuntimeGetCycleStats(void);
+
+// Small per thread index stamped in the objects a thread allocates, assigned on first use.
+// A thread's leftovers (cycles, cached hashes, allocator pages) are cleaned up when it exits.
+uint16_t RuntimeThreadIndex(void);
+
 #endif /* arruntime_h */
@@ -6,18 +6,123 @@
 #include "string.h"
 
 #include <assert.h>
+#include <string.h>
 
+#include "allocator.h"
+#include "common.h"
+#include "hash.h"
 #include "runtime.h"
 #include "stb_ds_x.h"
 
+// Concatenating long strings doesn't copy them, it links both pieces in a rope that gets
+// flattened into contiguous bytes the first time they're needed (CString, hashing, appending...).
+// Pieces are shared, strings handed to StringCreateByConcatenating must not be appended to afterwards.
+//
+// A view borrows bytes from another object (a lexer's input, a monkey string...) and keeps it alive.
+// It's a rope with a single piece: nothing is copied until a C string is needed.
+
+typedef struct ARStringRope {
+    size_t length;
+    RCTypeRef owner; // views only
+    union {
+        struct {
+            StringRef left;
+            StringRef right;
+        };
+        const char *bytes; // view
+    };
+} ARStringRope;
+
 struct ARString {
-    char *cstr; // add a small [4-8] internal storage and an immutable flag for small strings?
+    char *cstr; // NULL while the string is a rope or a view
+    union {
+        uint64_t hash;      // interned strings only, 0 for the rest
+        ARStringRope *rope; // when cstr is NULL
+    };
 };
 
 static RuntimeClassID ARStringClassID = { 0 };
 
+static inline bool ARStringIsRope(StringRef str) {
+    return !str->cstr && str->rope && !str->rope->owner;
+}
+
+static inline bool ARStringIsView(StringRef str) {
+    return !str->cstr && str->rope && str->rope->owner;
+}
+
+static inline bool ARStringIsFlat(StringRef str) {
+    return str->cstr || !str->rope;
+}
+
+static inline bool ARStringIsInterned(StringRef str) {
+    return str->cstr && str->hash;
+}
+
+// pieces that would be freed along with it are unlinked first, long ropes would blow the stack otherwise.
+static void ARStringRopeFree(ARStringRope *rope) {
+    ARStringRope **pending = NULL;
+    arrput(pending, rope);
+    
+    while (arrlen(pending) > 0) {
+        rope = arrpop(pending);
+        if (rope->owner) {
+            RCRelease(rope->owner);
+            AllocatorFree(rope, sizeof(ARStringRope));
+            continue;
+        }
+
+        StringRef pieces[] = { rope->left, rope->right };
+        for (int i = 0; i < 2; i++) {
+            if (ARStringIsRope(pieces[i]) && RuntimeRefCount(pieces[i]) == 1) {
+                arrput(pending, pieces[i]->rope);
+                pieces[i]->rope = NULL;
+            }
+            RCRelease(pieces[i]);
+        }
+        AllocatorFree(rope, sizeof(ARStringRope));
+    }
+    arrfree(pending);
+}
+
+static void ARStringFlatten(StringRef self) {
+    if (ARStringIsFlat(self)) {
+        return;
+    }
+    
+    ARStringRope *rope = self->rope;
+    char *cstr = NULL;
+    arrsetcap(cstr, rope->length + 1);
+    
+    StringRef *stack = NULL;
+    arrput(stack, self);
+    while (arrlen(stack) > 0) {
+        StringRef piece = arrpop(stack);
+        if (ARStringIsRope(piece)) {
+            arrput(stack, piece->rope->right);
+            arrput(stack, piece->rope->left);
+            continue;
+        }
+        
+        size_t length = StringLength(piece);
+        if (length) {
+            memcpy(cstr + arrlen(cstr), ARStringIsView(piece) ? piece->rope->bytes : piece->cstr, length);
+        }
+        arrsetlen(cstr, arrlen(cstr) + length);
+    }
+    arrfree(stack);
+    cstr[rope->length] = '\0';
+    
+    self->cstr = cstr;
+    self->rope = NULL;
+    ARStringRopeFree(rope);
+}
+
 static void ARStringDestructor(RCTypeRef str) {
     StringRef self = str;
+    if (!ARStringIsFlat(self)) {
+        ARStringRopeFree(self->rope);
+    }
     arrfree(self->cstr);
 }
 
@@ -25,9 +130,35 @@ static StringRef ARStringDescription(RCTypeRef str) {
     return str;
 }
 
+// never 0, so a non zero hash field can mark a string as interned.
+uint64_t StringHashBytes(const char *bytes, size_t length) {
+    assert(bytes || length == 0);
+    uint64_t hash = HashBytes(bytes, length, AR_RUNTIME_HASH_SEED);
+    return hash ? hash : 1;
+}
+
 static uint64_t ARStringHash(RCTypeRef str) {
     StringRef self = str;
-    return stbds_hash_string(self->cstr ? (char *)self->cstr : "", AR_RUNTIME_HASH_SEED);
+    if (ARStringIsInterned(self)) {
+        return self->hash;
+    }
+    return StringHashBytes(StringBytes(self), StringLength(self));
+}
+
+uint64_t StringHash(StringRef str) {
+    assert(str);
+    return ARStringHash(str);
+}
+
+static bool ARStringEquals(RCTypeRef str, RCTypeRef other) {
+    StringRef self = str;
+    StringRef that = other;
+    if (ARStringIsInterned(self) && ARStringIsInterned(that)) {
+        return false; // two interned strings are only equal if they are the same instance
+    }
+    
+    size_t length = StringLength(self);
+    return length == StringLength(that) && (length == 0 || memcmp(StringBytes(self), StringBytes(that), length) == 0);
 }
 
 static RuntimeClassDescriptor ARStringClass = {
@@ -36,7 +167,9 @@ static RuntimeClassDescriptor ARStringClass = {
     NULL, // const
     ARStringDestructor,
     ARStringDescription,
-    ARStringHash
+    ARStringHash,
+    NULL, // traverse
+    ARStringEquals
 };
 
 void StringInitialize(void) {
@@ -76,6 +209,11 @@ StringRef StringWithFormat(const char *fmt, ...) {
 
 void StringAppendFormat(StringRef str, const char *fmt, ...) {
     assert(str);
+    if (ARStringIsInterned(str)) {
+        ar_fatal("Can't modify interned string '%s'\n", str->cstr);
+    }
+    ARStringFlatten(str);
+    
     va_list args;
     va_start(args, fmt);
     sarrvprintf(str->cstr, fmt, args);
@@ -84,29 +222,125 @@ void StringAppendFormat(StringRef str, const char *fmt, ...) {
     RuntimeInvalidateHash(str);
 }
 
+#pragma mark - no format
+
+// plain copies don't need vsnprintf's format parsing, or its second pass when the buffer is short.
+void StringAppendBytes(StringRef str, const char *bytes, size_t length) {
+    assert(str);
+    if (ARStringIsInterned(str)) {
+        ar_fatal("Can't modify interned string '%s'\n", str->cstr);
+    }
+    ARStringFlatten(str);
+    
+    size_t current = arrlen(str->cstr);
+    if (bytes >= str->cstr && bytes < str->cstr + current) {
+        // appending (part of) itself, the buffer can move.
+        size_t offset = bytes - str->cstr;
+        arrsetcap(str->cstr, current + length + 1);
+        bytes = str->cstr + offset;
+    }
+    arrsetcap(str->cstr, current + length + 1);
+    if (length) {
+        memcpy(str->cstr + current, bytes, length);
+    }
+    arrsetlen(str->cstr, current + length);
+    str->cstr[current + length] = '\0';
+    
+    RuntimeInvalidateHash(str);
+}
+
+StringRef StringCreateWithBytes(const char *bytes, size_t length) {
+    StringRef instance = RuntimeCreateInstance(ARStringClassID);
+    if (!instance) {
+        return NULL;
+    }
+    
+    arrsetcap(instance->cstr, length + 1);
+    if (length) {
+        memcpy(instance->cstr, bytes, length);
+    }
+    arrsetlen(instance->cstr, length);
+    instance->cstr[length] = '\0';
+    return instance;
+}
+
+StringRef StringWithBytes(const char *bytes, size_t length) {
+    return RCAutorelease(StringCreateWithBytes(bytes, length));
+}
+
+static const char ARStringDigitPairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// writes the digits right aligned into buffer, returns where they start. Two digits per division.
+static char *ARStringFormatInt64(char buffer[AR_STRING_INT64_MAX_LENGTH], int64_t value) {
+    char *cursor = buffer + AR_STRING_INT64_MAX_LENGTH;
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    
+    while (magnitude >= 100) {
+        uint64_t pair = (magnitude % 100) * 2;
+        magnitude /= 100;
+        cursor -= 2;
+        memcpy(cursor, ARStringDigitPairs + pair, 2);
+    }
+    
+    if (magnitude >= 10) {
+        cursor -= 2;
+        memcpy(cursor, ARStringDigitPairs + magnitude * 2, 2);
+    } else {
+        *--cursor = (char)('0' + magnitude);
+    }
+    
+    if (value < 0) {
+        *--cursor = '-';
+    }
+    return cursor;
+}
+
+void StringAppendInteger(StringRef str, int64_t value) {
+    char buffer[AR_STRING_INT64_MAX_LENGTH];
+    char *digits = ARStringFormatInt64(buffer, value);
+    StringAppendBytes(str, digits, buffer + AR_STRING_INT64_MAX_LENGTH - digits);
+}
+
+StringRef StringWithInteger(int64_t value) {
+    char buffer[AR_STRING_INT64_MAX_LENGTH];
+    char *digits = ARStringFormatInt64(buffer, value);
+    return StringWithBytes(digits, buffer + AR_STRING_INT64_MAX_LENGTH - digits);
+}
+
 void StringAppendString(StringRef str, StringRef append) {
-    StringAppendFormat(str, "%s", CString(append));
+    // flattening str would let go of the bytes it's viewing.
+    StringAppendBytes(str, append == str ? CString(append) : StringBytes(append), StringLength(append));
 }
 
 StringRef String(void) {
     // make this immutable, constant, interned...
-    return StringWithFormat("");
+    return StringWithBytes("", 0);
 }
 
 StringRef StringWithChars(const char *str) {
-    return StringWithFormat("%s", str);
+    return StringWithBytes(str, str ? strlen(str) : 0);
 }
 
 StringRef StringWithString(StringRef str) {
-    return StringWithChars(CString(str));
+    return StringWithBytes(StringBytes(str), StringLength(str));
 }
 
 void StringAppendChars(StringRef str, const char *chars) {
-    return StringAppendFormat(str, "%s", chars);
+    StringAppendBytes(str, chars, chars ? strlen(chars) : 0);
 }
 
 StringRef StringCreateWithChars(const char *chars) {
-    return StringCreateWithFormat("%s", chars);
+    return StringCreateWithBytes(chars, chars ? strlen(chars) : 0);
 }
 
 size_t StringLength(StringRef str) {
@@ -114,6 +348,9 @@ size_t StringLength(StringRef str) {
         return 0;
     }
 
+    if (!ARStringIsFlat(str)) {
+        return str->rope->length;
+    }
     return arrlen(str->cstr);
 }
 
@@ -122,6 +359,153 @@ const char *CString(StringRef str) {
         return NULL;
     }
 
+    ARStringFlatten(str);
     return (const char *)str->cstr;
 }
 
+const char *StringBytes(StringRef str) {
+    if (str && ARStringIsView(str)) {
+        return str->rope->bytes;
+    }
+    return CString(str);
+}
+
+StringRef StringCreateByConcatenating(StringRef left, StringRef right) {
+    assert(left && right);
+    size_t length = StringLength(left) + StringLength(right);
+    if (length < AR_STRING_ROPE_MIN_LENGTH) {
+        StringRef instance = StringCreateWithBytes(StringBytes(left), StringLength(left));
+        StringAppendString(instance, right);
+        return instance;
+    }
+    
+    ARStringRope *rope = AllocatorAlloc(sizeof(ARStringRope));
+    rope->left = RCRetain(left);
+    rope->right = RCRetain(right);
+    rope->length = length;
+    
+    StringRef instance = RuntimeCreateInstance(ARStringClassID);
+    instance->rope = rope;
+    return instance;
+}
+
+StringRef StringByConcatenating(StringRef left, StringRef right) {
+    return RCAutorelease(StringCreateByConcatenating(left, right));
+}
+
+#pragma mark - views
+
+StringRef StringCreateWithView(RCTypeRef owner, const char *bytes, size_t length) {
+    assert(owner);
+    assert(bytes || length == 0);
+    
+    ARStringRope *view = AllocatorAlloc(sizeof(ARStringRope));
+    view->length = length;
+    view->owner = RCRetain(owner);
+    view->bytes = bytes;
+    
+    StringRef instance = RuntimeCreateInstance(ARStringClassID);
+    instance->rope = view;
+    return instance;
+}
+
+StringRef StringWithView(RCTypeRef owner, const char *bytes, size_t length) {
+    return RCAutorelease(StringCreateWithView(owner, bytes, length));
+}
+
+StringRef StringWithSubstring(StringRef str, size_t start, size_t length) {
+    assert(str);
+    assert(start + length <= StringLength(str));
+    
+    if (length < AR_STRING_ROPE_MIN_LENGTH) {
+        return StringWithBytes(StringBytes(str) + start, length);
+    }
+    
+    // views of views point straight at the original owner, no chains.
+    if (ARStringIsView(str)) {
+        return StringWithView(str->rope->owner, str->rope->bytes + start, length);
+    }
+    return StringWithView(str, CString(str) + start, length);
+}
+
+
+#pragma mark - interning
+
+// open addressing, linear probing. Per thread, like the strings in it: the table holds a reference
+// to each one until the thread exits, see StringInternTableFree.
+static _Thread_local StringRef *internTable = NULL;
+static _Thread_local size_t internCapacity = 0;
+static _Thread_local size_t internCount = 0;
+
+static size_t StringInternSlot(const char *chars, size_t length) {
+    size_t mask = internCapacity - 1;
+    size_t slot = StringHashBytes(chars, length) & mask;
+    while (internTable[slot]) {
+        StringRef str = internTable[slot];
+        if (StringLength(str) == length && memcmp(str->cstr, chars, length) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static void StringInternGrow(void) {
+    StringRef *table = internTable;
+    size_t capacity = internCapacity;
+    
+    internCapacity = capacity ? capacity * 2 : 256;
+    internTable = ar_calloc(internCapacity, sizeof(StringRef));
+    for (size_t i = 0; i < capacity; i++) {
+        if (table[i]) {
+            internTable[StringInternSlot(table[i]->cstr, StringLength(table[i]))] = table[i];
+        }
+    }
+    free(table);
+}
+
+StringRef StringInternChars(const char *chars, size_t length) {
+    assert(chars || length == 0);
+    
+    if ((internCount + 1) * 4 > internCapacity * 3) {
+        StringInternGrow();
+    }
+    
+    size_t slot = StringInternSlot(chars ? chars : "", length);
+    StringRef str = internTable[slot];
+    if (!str) {
+        str = StringCreateWithBytes(chars, length);
+        str->hash = StringHashBytes(str->cstr, length);
+        internTable[slot] = str;
+        internCount++;
+    }
+    
+    return str;
+}
+
+void StringInternTableFree(void) {
+    StringRef *table = internTable;
+    size_t capacity = internCapacity;
+    internTable = NULL;
+    internCapacity = 0;
+    internCount = 0;
+    
+    for (size_t i = 0; i < capacity; i++) {
+        if (table[i] && RuntimeRefCount(table[i]) > 1) {
+            table[i]->hash = 0; // outlives the table, equal strings interned later are other instances.
+        }
+        RCRelease(table[i]);
+    }
+    free(table);
+}
+
+StringRef StringIntern(StringRef str) {
+    if (!str || ARStringIsInterned(str)) {
+        return str;
+    }
+    return StringInternChars(StringBytes(str), StringLength(str));
+}
+
+bool StringIsInterned(StringRef str) {
+    return str && ARStringIsInterned(str);
+}
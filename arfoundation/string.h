@@ -7,6 +7,8 @@
 #define _arstring_h_
 
 #include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 #include "range.h"
 
@@ -26,7 +28,39 @@ void StringAppendFormat(StringRef str, const char *fmt, ...) __printflike(2, 3);
 void StringAppendString(StringRef str, StringRef append);
 void StringAppendChars(StringRef str, const char *chars);
 
+// straight copies, no format parsing.
+#define AR_STRING_INT64_MAX_LENGTH 20 // "-9223372036854775808" without the terminator
+StringRef StringCreateWithBytes(const char *bytes, size_t length);
+StringRef StringWithBytes(const char *bytes, size_t length);
+StringRef StringWithInteger(int64_t value);
+void StringAppendBytes(StringRef str, const char *bytes, size_t length);
+void StringAppendInteger(StringRef str, int64_t value);
+
+// Long results link both strings instead of copying them, see string.c.
+#define AR_STRING_ROPE_MIN_LENGTH 64 // shorter results are just copied
+StringRef StringCreateByConcatenating(StringRef left, StringRef right);
+StringRef StringByConcatenating(StringRef left, StringRef right);
+
+// A view of bytes that belong to owner: it's retained and must not change them. Nothing is copied
+// until a C string is needed. Substrings are views of str when long enough, str must not be appended to.
+StringRef StringCreateWithView(void *owner, const char *bytes, size_t length);
+StringRef StringWithView(void *owner, const char *bytes, size_t length);
+StringRef StringWithSubstring(StringRef str, size_t start, size_t length);
+
 size_t StringLength(StringRef str);
 const char *CString(StringRef str);
+const char *StringBytes(StringRef str); // StringLength bytes without copying a view, not NUL terminated then.
+
+// Same value RuntimeHash gives a string with these bytes, without going through its cache. Never 0.
+uint64_t StringHashBytes(const char *bytes, size_t length);
+uint64_t StringHash(StringRef str);
+
+// The canonical instance for the given characters: immutable and with its hash computed up front.
+// Equal interned strings are the same pointer. For names (identifiers, hash keys), not data: the
+// thread's table owns them until StringInternTableFree, which runs when the thread exits.
+StringRef StringInternChars(const char *chars, size_t length);
+StringRef StringIntern(StringRef str);
+bool StringIsInterned(StringRef str);
+void StringInternTableFree(void); // releases this thread's interned strings, the ones still referenced live on uninterned
 
 #endif /* arstring_h */
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
 #include "../vendor/utest.h"
 #include "../arfoundation.h"
 
@@ -108,6 +110,102 @@ UTEST(arfoundation, autoreleasePool) {
     ASSERT_TRUE(str);
 }
 
+UTEST(arfoundation, autoreleasePoolPages) {
+    AutoreleasePoolRef ap = AutoreleasePoolCreate();
+    
+    // enough objects to span several pages, with inner pools starting and ending across page boundaries.
+    StringRef strings[3000];
+    for (int i = 0; i < 3000; i++) {
+        strings[i] = RCRetain(StringWithFormat("%d", i));
+        ASSERT_EQ(2, RuntimeRefCount(strings[i]));
+        
+        if (i % 700 == 0) {
+            AutoreleasePoolRef inner = AutoreleasePoolCreate();
+            StringRef kept = RCRetain(StringWithFormat("inner %d", i));
+            for (int j = 0; j < 600; j++) {
+                StringWithFormat("%d", j);
+            }
+            ASSERT_EQ(2, RuntimeRefCount(kept));
+            RCRelease(inner);
+            
+            ASSERT_EQ(ap, CurrentAutoreleasePool());
+            ASSERT_EQ(1, RuntimeRefCount(kept));
+            RCRelease(kept);
+        }
+    }
+    
+    AutoreleasePoolDrain(ap);
+    for (int i = 0; i < 3000; i++) {
+        ASSERT_EQ(1, RuntimeRefCount(strings[i]));
+        RCRelease(strings[i]);
+    }
+    
+    // the pool keeps working after a drain.
+    StringRef str = RCRetain(StringWithFormat("after drain"));
+    RCRelease(ap);
+    ASSERT_EQ(1, RuntimeRefCount(str));
+    RCRelease(str);
+    ASSERT_EQ(NULL, CurrentAutoreleasePool());
+}
+
+typedef struct {
+    AutoreleasePoolRef outer;
+    AutoreleasePoolRef inner;
+    bool innerWasCurrent;
+    bool outerWasCurrent;
+    bool emptyAfter;
+    int64_t refcount;
+} PoolThreadResult;
+
+static void *poolThread(void *context) {
+    PoolThreadResult *result = context;
+    if (CurrentAutoreleasePool() != NULL) {
+        return NULL; // stacks are not inherited
+    }
+    
+    result->outer = AutoreleasePoolCreate();
+    for (int i = 0; i < 1000; i++) {
+        result->inner = AutoreleasePoolCreate();
+        result->innerWasCurrent = result->inner == CurrentAutoreleasePool();
+        
+        ArrayRef array = Array();
+        StringRef str = StringWithFormat("thread %d", i);
+        ArrayAppend(array, str);
+        result->refcount = RuntimeRefCount(str);
+        RCRelease(result->inner);
+    }
+    result->outerWasCurrent = result->outer == CurrentAutoreleasePool();
+    RCRelease(result->outer);
+    result->emptyAfter = CurrentAutoreleasePool() == NULL;
+    return NULL;
+}
+
+UTEST(arfoundation, autoreleasePoolThreads) {
+    AutoreleasePoolRef ap = AutoreleasePoolCreate();
+    
+    pthread_t threads[2];
+    PoolThreadResult results[2] = { 0 };
+    for (int i = 0; i < 2; i++) {
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, poolThread, &results[i]));
+    }
+    for (int i = 0; i < 2; i++) {
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+    }
+    
+    // the workers' pools never showed up on this thread's stack.
+    ASSERT_EQ(ap, CurrentAutoreleasePool());
+    for (int i = 0; i < 2; i++) {
+        ASSERT_TRUE(results[i].outer);
+        ASSERT_TRUE(results[i].innerWasCurrent);
+        ASSERT_TRUE(results[i].outerWasCurrent);
+        ASSERT_TRUE(results[i].emptyAfter);
+        ASSERT_EQ(2, results[i].refcount);
+    }
+    
+    RCRelease(ap);
+    ASSERT_EQ(NULL, CurrentAutoreleasePool());
+}
+
 UTEST(arfoundation, containers) {
     AutoreleasePoolRef ap = AutoreleasePoolCreate();
     
@@ -181,6 +279,918 @@ UTEST(arfoundation, containers) {
     ASSERT_EQ(NULL, another);
 }
 
+UTEST(arfoundation, persistentArrays) {
+    AutoreleasePoolRef ap = AutoreleasePoolCreate();
+    enum { count = 2000 };
+    StringRef strings[count];
+    ArrayRef array = Array();
+    for (int i = 0; i < count; i++) {
+        strings[i] = StringWithFormat("%d", i);
+        ArrayAppend(array, strings[i]);
+    }
+    ASSERT_EQ(count, ArrayCount(array));
+    ASSERT_EQ(strings[0], ArrayFirst(array));
+    for (int i = 0; i < count; i++) {
+        ASSERT_EQ(strings[i], ArrayObjectAt(array, i));
+    }
+    ASSERT_EQ(NULL, ArrayObjectAt(array, count));
+
+    // copies share the nodes holding the elements, appending to one leaves the other alone.
+    ArrayRef copy = RCAutorelease(ArrayCreateWithArray(array));
+    ASSERT_EQ(2, RuntimeRefCount(strings[0]));
+    ArrayAppend(copy, strings[0]);
+    ASSERT_EQ(count + 1, ArrayCount(copy));
+    ASSERT_EQ(count, ArrayCount(array));
+    ASSERT_EQ(NULL, ArrayObjectAt(array, count));
+    ASSERT_EQ(strings[0], ArrayObjectAt(copy, count));
+    ArrayAppend(array, strings[1]);
+    ASSERT_EQ(strings[1], ArrayObjectAt(array, count));
+    ASSERT_EQ(strings[0], ArrayObjectAt(copy, count));
+
+    // rests too, dropping more and more of the front.
+    ArrayRef rest = array;
+    for (int i = 1; i < count; i++) {
+        rest = RCAutorelease(ArrayCreateWithRest(rest, 1));
+        ASSERT_EQ(count + 1 - i, ArrayCount(rest));
+        ASSERT_EQ(strings[i], ArrayFirst(rest));
+        ASSERT_EQ(strings[count - 1], ArrayObjectAt(rest, count - 1 - i));
+    }
+    ASSERT_EQ(0, ArrayCount(RCAutorelease(ArrayCreateWithRest(array, count + 1))));
+
+    ArrayRemoveAt(copy, count);
+    ArrayRemoveAt(copy, 40);
+    ASSERT_EQ(count - 1, ArrayCount(copy));
+    ASSERT_EQ(strings[39], ArrayObjectAt(copy, 39));
+    ASSERT_EQ(strings[41], ArrayObjectAt(copy, 40));
+    ASSERT_EQ(strings[count - 1], ArrayObjectAt(copy, count - 2));
+    ASSERT_EQ(strings[40], ArrayObjectAt(array, 40));
+
+    ArrayRemoveAll(array);
+    ASSERT_EQ(0, ArrayCount(array));
+    rest = RCAutorelease(ArrayCreateWithRest(copy, 39));
+    ASSERT_EQ(strings[41], ArrayObjectAt(rest, 1));
+    RCRelease(ap);
+
+    // cycles through the trie's nodes get collected.
+    ArrayRef cyclic = ArrayCreate();
+    for (int i = 0; i < 100; i++) {
+        ArrayAppend(cyclic, cyclic);
+    }
+    RCRelease(cyclic);
+    ASSERT_GT(RuntimeCollectCycles(), 3);
+}
+
+UTEST(arfoundation, arrayRanges) {
+    AutoreleasePoolRef ap = AutoreleasePoolCreate();
+    enum { count = 1100 };
+    StringRef strings[count];
+    ArrayRef array = Array();
+    for (int i = 0; i < count; i++) {
+        strings[i] = StringWithFormat("%d", i);
+        ArrayAppend(array, strings[i]);
+    }
+
+    // ranges starting and ending on either side of leaf, level and tail boundaries.
+    size_t starts[] = { 0, 1, 31, 32, 33, 500, 1023, 1024, 1050, 1087, 1088, 1099, 1100 };
+    size_t lengths[] = { 0, 1, 31, 32, 33, 64, 100, 1000, SIZE_MAX };
+    StringRef extra = StringWithChars("extra");
+    AutoreleasePoolRef inner = AutoreleasePoolCreate();
+    for (int i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+        for (int j = 0; j < sizeof(lengths) / sizeof(lengths[0]); j++) {
+            size_t start = starts[i];
+            size_t length = start >= count ? 0 : MIN(lengths[j], count - start);
+            ArrayRef range = RCAutorelease(ArrayCreateWithRange(array, start, lengths[j]));
+            ASSERT_EQ(length, ArrayCount(range));
+            for (size_t k = 0; k < length; k++) {
+                ASSERT_EQ(strings[start + k], ArrayObjectAt(range, k));
+            }
+            ASSERT_EQ(NULL, ArrayObjectAt(range, length));
+
+            // appends land after the range, not over what followed it in the original.
+            for (size_t k = 0; k < 100; k++) {
+                ArrayAppend(range, extra);
+            }
+            ASSERT_EQ(length + 100, ArrayCount(range));
+            if (length > 0) {
+                ASSERT_EQ(strings[start + length - 1], ArrayObjectAt(range, length - 1));
+            }
+            ASSERT_EQ(extra, ArrayObjectAt(range, length + 99));
+            ASSERT_EQ(count, ArrayCount(array));
+            if (start + length < count) {
+                ASSERT_EQ(strings[start + length], ArrayObjectAt(array, start + length));
+            }
+        }
+    }
+
+    RCRelease(inner);
+
+    // a short range doesn't keep the rest of a long array alive, on either side.
+    ArrayRef parent = ArrayCreateWithArray(array);
+    ArrayRef range = ArrayCreateWithRange(parent, 500, 10);
+    size_t before = RuntimeRefCount(strings[40]);
+    size_t after = RuntimeRefCount(strings[count - 40]);
+    ArrayRemoveAll(array);
+    RCRelease(parent);
+    ASSERT_EQ(before - 1, RuntimeRefCount(strings[40]));
+    ASSERT_EQ(after - 1, RuntimeRefCount(strings[count - 40]));
+    ASSERT_EQ(strings[505], ArrayObjectAt(range, 5));
+    RCRelease(range);
+    RCRelease(ap);
+}
+
+UTEST(arfoundation, bulkArrays) {
+    AutoreleasePoolRef ap = AutoreleasePoolCreate();
+    RCTypeRef objects[100];
+    for (int i = 0; i < 100; i++) {
+        objects[i] = StringWithFormat("%d", i);
+    }
+
+    // the same elements as appending one at a time, whatever the array held before.
+    for (int prefix = 0; prefix <= 40; prefix += 5) {
+        for (int count = 0; count <= 100; count += 9) {
+            ArrayRef bulk = RCAutorelease(ArrayCreateWithCapacity(prefix + count));
+            ArrayRef single = Array();
+            for (int i = 0; i < prefix; i++) {
+                ArrayAppend(bulk, objects[99 - i]);
+                ArrayAppend(single, objects[99 - i]);
+            }
+            ArrayAppendObjects(bulk, objects, count);
+            for (int i = 0; i < count; i++) {
+                ArrayAppend(single, objects[i]);
+            }
+
+            ASSERT_EQ(ArrayCount(single), ArrayCount(bulk));
+            for (size_t i = 0; i < ArrayCount(single); i++) {
+                ASSERT_EQ(ArrayObjectAt(single, i), ArrayObjectAt(bulk, i));
+            }
+        }
+    }
+
+    // ranges come out a leaf at a time, from a rest too, cut at the end.
+    ArrayRef array = Array();
+    ArrayAppendObjects(array, objects, 100);
+    ArrayRef rest = RCAutorelease(ArrayCreateWithRest(array, 7));
+    RCTypeRef copied[100];
+    ASSERT_EQ(93, ArrayCopyRange(rest, 0, 100, copied));
+    for (int i = 0; i < 93; i++) {
+        ASSERT_EQ(objects[i + 7], copied[i]);
+    }
+    ASSERT_EQ(40, ArrayCopyRange(array, 30, 40, copied));
+    ASSERT_EQ(objects[30], copied[0]);
+    ASSERT_EQ(objects[69], copied[39]);
+    ASSERT_EQ(0, ArrayCopyRange(array, 100, 1, copied));
+    ASSERT_EQ(0, ArrayCopyRange(NULL, 0, 1, copied));
+
+    // one more reference each, NULLs are skipped.
+    int64_t before = RuntimeRefCount(objects[5]);
+    RCRetainObjects(objects, 10);
+    ASSERT_EQ(before + 1, RuntimeRefCount(objects[5]));
+    RCReleaseObjects(objects, 10);
+    ASSERT_EQ(before, RuntimeRefCount(objects[5]));
+    RCTypeRef mixed[] = { NULL, objects[5], NULL };
+    RCRetainObjects(mixed, 3);
+    ASSERT_EQ(before + 1, RuntimeRefCount(objects[5]));
+    RCReleaseObjects(mixed, 3);
+    ASSERT_EQ(before, RuntimeRefCount(objects[5]));
+
+    RCRelease(ap);
+}
+
+// every instance hashes the same, only equals tells them apart.
+typedef struct {
+    int value;
+} Collider;
+
+static uint64_t ColliderHash(RCTypeRef obj) {
+    return 42;
+}
+
+static bool ColliderEquals(RCTypeRef obj, RCTypeRef other) {
+    return ((Collider *)obj)->value == ((Collider *)other)->value;
+}
+
+static RuntimeClassDescriptor ColliderClass = {
+    .classname = "Collider",
+    .size = sizeof(Collider),
+    .hash = ColliderHash,
+    .equals = ColliderEquals
+};
+
+UTEST(arfoundation, dictionary) {
+    AutoreleasePoolRef ap = AutoreleasePoolCreate();
+    RuntimeClassID colliderClassID = RuntimeRegisterClass(&ColliderClass);
+    
+    // same hash, different keys.
+    DictionaryRef dict = Dictionary();
+    Collider *colliders[100];
+    for (int i = 0; i < 100; i++) {
+        colliders[i] = RCAutorelease(RuntimeCreateInstance(colliderClassID));
+        colliders[i]->value = i;
+        DictionarySetObjectForKey(dict, colliders[i], StringWithFormat("%d", i));
+    }
+    ASSERT_EQ(100, DictionaryCount(dict));
+    
+    Collider *probe = RCAutorelease(RuntimeCreateInstance(colliderClassID));
+    for (int i = 0; i < 100; i++) {
+        probe->value = i;
+        ASSERT_STREQ(CString(StringWithFormat("%d", i)), CString(DictionaryObjectForKey(dict, probe)));
+    }
+    probe->value = 100;
+    ASSERT_EQ(NULL, DictionaryObjectForKey(dict, probe));
+    
+    for (int i = 0; i < 100; i += 2) {
+        DictionaryRemoveObjectForKey(dict, colliders[i]);
+    }
+    ASSERT_EQ(50, DictionaryCount(dict));
+    for (int i = 0; i < 100; i++) {
+        StringRef value = DictionaryObjectForKey(dict, colliders[i]);
+        if (i % 2 == 0) {
+            ASSERT_EQ(NULL, value);
+        } else {
+            ASSERT_STREQ(CString(StringWithFormat("%d", i)), CString(value));
+        }
+    }
+    
+    // equal strings are the same key, whichever instance is used.
+    dict = Dictionary();
+    for (int i = 0; i < 5000; i++) {
+        DictionarySetObjectForKey(dict, StringWithFormat("key %d", i), StringWithFormat("value %d", i));
+    }
+    for (int i = 0; i < 5000; i += 3) {
+        DictionaryRemoveObjectForKey(dict, StringWithFormat("key %d", i));
+    }
+    for (int i = 0; i < 5000; i += 6) {
+        DictionarySetObjectForKey(dict, StringWithFormat("key %d", i), StringWithFormat("again %d", i));
+    }
+    
+    size_t expected = 0;
+    for (int i = 0; i < 5000; i++) {
+        StringRef value = DictionaryObjectForKey(dict, StringWithFormat("key %d", i));
+        if (i % 6 == 0) {
+            ASSERT_STREQ(CString(StringWithFormat("again %d", i)), CString(value));
+        } else if (i % 3 == 0) {
+            ASSERT_EQ(NULL, value);
+            continue;
+        } else {
+            ASSERT_STREQ(CString(StringWithFormat("value %d", i)), CString(value));
+        }
+        expected++;
+    }
+    ASSERT_EQ(expected, DictionaryCount(dict));
+    
+    // entries stay reachable by index.
+    for (size_t i = 0; i < DictionaryCount(dict); i++) {
+        ObjectPairRef pair = DictionaryKeyValueAtIndex(dict, i);
+        ASSERT_EQ(objectPairSecond(pair), DictionaryObjectForKey(dict, objectPairFirst(pair)));
+    }
+    
+    RCRelease(ap);
+}
+
+static void collectMapKeys(RCTypeRef key, RCTypeRef value, void *context) {
+    StringAppendFormat(context, "%s=%s ", CString(key), CString(value));
+}
+
+UTEST(arfoundation, persistentMaps) {
+    AutoreleasePoolRef ap = AutoreleasePoolCreate();
+    RuntimeClassID colliderClassID = RuntimeRegisterClass(&ColliderClass);
+
+    // full hash collisions share a node past the last level.
+    MapRef colliding = Map();
+    Collider *colliders[100];
+    for (int i = 0; i < 100; i++) {
+        colliders[i] = RCAutorelease(RuntimeCreateInstance(colliderClassID));
+        colliders[i]->value = i;
+        MapSetObjectForKey(colliding, colliders[i], StringWithFormat("%d", i));
+    }
+    ASSERT_EQ(100, MapCount(colliding));
+    MapRef fewer = RCAutorelease(MapCreateWithMap(colliding));
+    for (int i = 0; i < 100; i += 2) {
+        MapRemoveObjectForKey(fewer, colliders[i]);
+    }
+    ASSERT_EQ(50, MapCount(fewer));
+    ASSERT_EQ(100, MapCount(colliding));
+    for (int i = 0; i < 100; i++) {
+        ASSERT_STREQ(CString(StringWithFormat("%d", i)), CString(MapObjectForKey(colliding, colliders[i])));
+        ASSERT_EQ(i % 2 ? MapObjectForKey(colliding, colliders[i]) : NULL, MapObjectForKey(fewer, colliders[i]));
+    }
+
+    // copies share their nodes, changes to one never show up in the other.
+    MapRef map = Map();
+    for (int i = 0; i < 5000; i++) {
+        MapSetObjectForKey(map, StringWithFormat("key %d", i), StringWithFormat("value %d", i));
+    }
+    MapRef copy = RCAutorelease(MapCreateWithMap(map));
+    for (int i = 0; i < 5000; i += 3) {
+        MapRemoveObjectForKey(copy, StringWithFormat("key %d", i));
+    }
+    for (int i = 0; i < 5000; i += 6) {
+        MapSetObjectForKey(copy, StringWithFormat("key %d", i), StringWithFormat("again %d", i));
+    }
+    MapSetObjectForKey(copy, StringWithFormat("key %d", 1), StringWithFormat("changed"));
+
+    size_t expected = 0;
+    for (int i = 0; i < 5000; i++) {
+        StringRef key = StringWithFormat("key %d", i);
+        ASSERT_STREQ(CString(StringWithFormat("value %d", i)), CString(MapObjectForKey(map, key)));
+
+        StringRef value = MapObjectForKey(copy, key);
+        if (i == 1) {
+            ASSERT_STREQ("changed", CString(value));
+        } else if (i % 6 == 0) {
+            ASSERT_STREQ(CString(StringWithFormat("again %d", i)), CString(value));
+        } else if (i % 3 == 0) {
+            ASSERT_EQ(NULL, value);
+            continue;
+        } else {
+            ASSERT_STREQ(CString(StringWithFormat("value %d", i)), CString(value));
+        }
+        expected++;
+    }
+    ASSERT_EQ(expected, MapCount(copy));
+    ASSERT_EQ(5000, MapCount(map));
+
+    for (int i = 0; i < 5000; i++) {
+        MapRemoveObjectForKey(copy, StringWithFormat("key %d", i));
+    }
+    ASSERT_EQ(0, MapCount(copy));
+    ASSERT_EQ(NULL, MapObjectForKey(copy, StringWithFormat("key %d", 1)));
+
+    // enumeration follows insertion, replacing a value keeps the key's place.
+    MapRef ordered = Map();
+    MapSetObjectForKey(ordered, StringWithChars("b"), StringWithChars("1"));
+    MapSetObjectForKey(ordered, StringWithChars("a"), StringWithChars("2"));
+    MapSetObjectForKey(ordered, StringWithChars("c"), StringWithChars("3"));
+    MapSetObjectForKey(ordered, StringWithChars("b"), StringWithChars("4"));
+    MapRemoveObjectForKey(ordered, StringWithChars("a"));
+    MapSetObjectForKey(ordered, StringWithChars("a"), StringWithChars("5"));
+    StringRef keys = String();
+    MapEnumerate(ordered, collectMapKeys, keys);
+    ASSERT_STREQ("b=4 c=3 a=5 ", CString(keys));
+
+    // cycles through the nodes get collected, keys included.
+    MapRef cyclic = MapCreate();
+    for (int i = 0; i < 100; i++) {
+        MapSetObjectForKey(cyclic, StringWithFormat("%d", i), cyclic);
+    }
+    RCRelease(cyclic);
+    RCRelease(ap);
+    ASSERT_GT(RuntimeCollectCycles(), 100);
+}
+
+UTEST(arfoundation, smallContainers) {
+    AutoreleasePoolRef ap = AutoreleasePoolCreate();
+    RuntimeClassID colliderClassID = RuntimeRegisterClass(&ColliderClass);
+
+    // arrays keep their first elements inline, copies and removals work on both sides of the limit.
+    for (int length = 0; length <= 40; length++) {
+        ArrayRef array = Array();
+        for (int i = 0; i < length; i++) {
+            ArrayAppend(array, StringWithFormat("%d", i));
+        }
+        ArrayRef copy = RCAutorelease(ArrayCreateWithArray(array));
+        if (length > 2) {
+            ArrayRemoveAt(copy, 1);
+            ArrayRemoveAt(copy, ArrayCount(copy) - 1);
+            ASSERT_EQ(length - 2, ArrayCount(copy));
+            for (int i = 0; i < length - 2; i++) {
+                ASSERT_EQ(ArrayObjectAt(array, i ? i + 1 : 0), ArrayObjectAt(copy, i));
+            }
+        }
+        ASSERT_EQ(length, ArrayCount(array));
+        for (int i = 0; i < length; i++) {
+            ASSERT_STREQ(CString(StringWithFormat("%d", i)), CString(ArrayObjectAt(array, i)));
+        }
+    }
+
+    // dictionaries and maps scan a few entries, past those they build a table or a trie.
+    for (int size = 1; size <= 20; size++) {
+        DictionaryRef dict = Dictionary();
+        MapRef map = Map();
+        MapRef half = NULL;
+        for (int i = 0; i < size; i++) {
+            StringRef key = StringWithFormat("k%d", i);
+            DictionarySetObjectForKey(dict, key, StringWithFormat("%d", i));
+            MapSetObjectForKey(map, key, StringWithFormat("%d", i));
+            if (i == size / 2) {
+                half = RCAutorelease(MapCreateWithMap(map));
+            }
+        }
+        DictionaryRemoveObjectForKey(dict, StringWithChars("k0"));
+        MapRemoveObjectForKey(map, StringWithChars("k0"));
+        if (size > 1) {
+            MapSetObjectForKey(map, StringWithChars("k1"), StringWithChars("changed"));
+        }
+        ASSERT_EQ(size - 1, DictionaryCount(dict));
+        ASSERT_EQ(size - 1, MapCount(map));
+        ASSERT_EQ(size / 2 + 1, MapCount(half));
+
+        for (int i = 0; i < size; i++) {
+            StringRef key = StringWithFormat("k%d", i);
+            StringRef value = StringWithFormat("%d", i);
+            if (i == 0) {
+                ASSERT_EQ(NULL, DictionaryObjectForKey(dict, key));
+                ASSERT_EQ(NULL, MapObjectForKey(map, key));
+            } else {
+                ASSERT_STREQ(CString(value), CString(DictionaryObjectForKey(dict, key)));
+                ASSERT_STREQ((i == 1 ? "changed" : CString(value)), CString(MapObjectForKey(map, key)));
+            }
+
+            if (i <= size / 2) {
+                ASSERT_STREQ(CString(value), CString(MapObjectForKey(half, key)));
+            } else {
+                ASSERT_EQ(NULL, MapObjectForKey(half, key));
+            }
+        }
+    }
+
+    // insertion order carries over into the trie.
+    MapRef ordered = Map();
+    const char *names[] = { "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l" };
+    for (int i = 0; i < 6; i++) {
+        MapSetObjectForKey(ordered, StringWithChars(names[i]), StringWithFormat("%d", i));
+    }
+    MapRemoveObjectForKey(ordered, StringWithChars("c"));
+    MapSetObjectForKey(ordered, StringWithChars("b"), StringWithChars("x"));
+    for (int i = 6; i < 12; i++) {
+        MapSetObjectForKey(ordered, StringWithChars(names[i]), StringWithFormat("%d", i));
+    }
+    StringRef keys = String();
+    MapEnumerate(ordered, collectMapKeys, keys);
+    ASSERT_STREQ("a=0 b=x d=3 e=4 f=5 g=6 h=7 i=8 j=9 k=10 l=11 ", CString(keys));
+
+    // colliding keys, in the list and after it.
+    DictionaryRef dict = Dictionary();
+    MapRef map = Map();
+    Collider *colliders[12];
+    for (int i = 0; i < 12; i++) {
+        colliders[i] = RCAutorelease(RuntimeCreateInstance(colliderClassID));
+        colliders[i]->value = i;
+        DictionarySetObjectForKey(dict, colliders[i], StringWithFormat("%d", i));
+        MapSetObjectForKey(map, colliders[i], StringWithFormat("%d", i));
+        for (int j = 0; j <= i; j++) {
+            ASSERT_STREQ(CString(StringWithFormat("%d", j)), CString(DictionaryObjectForKey(dict, colliders[j])));
+            ASSERT_STREQ(CString(StringWithFormat("%d", j)), CString(MapObjectForKey(map, colliders[j])));
+        }
+    }
+
+    RCRelease(ap);
+}
+
+static void sumArrayElements(RCTypeRef obj, size_t index, void *context) {
+    int64_t *sum = context;
+    *sum += atoi(CString(obj)) * (int64_t)(index + 1);
+}
+
+static void sumPairs(RCTypeRef key, RCTypeRef value, void *context) {
+    int64_t *sum = context;
+    *sum += atoi(CString(key)) * atoi(CString(value));
+}
+
+UTEST(arfoundation, iteration) {
+    AutoreleasePoolRef ap = AutoreleasePoolCreate();
+
+    // the iterator walks trie and tail, from wherever a rest starts.
+    ArrayRef array = Array();
+    for (int i = 0; i < 1000; i++) {
+        ArrayAppend(array, StringWithFormat("%d", i));
+    }
+    ArrayRef rest = RCAutorelease(ArrayCreateWithRest(array, 45));
+    ArrayIterator iterator = ArrayIteratorMake(rest);
+    RCTypeRef obj;
+    size_t count = 0;
+    while (ArrayIteratorNext(&iterator, &obj)) {
+        ASSERT_EQ(ArrayObjectAt(rest, count), obj);
+        count++;
+    }
+    ASSERT_EQ(ArrayCount(rest), count);
+    ASSERT_FALSE(ArrayIteratorNext(&iterator, &obj));
+
+    iterator = ArrayIteratorMake(NULL);
+    ASSERT_FALSE(ArrayIteratorNext(&iterator, &obj));
+
+    int64_t sum = 0, expected = 0;
+    for (int64_t i = 0; i < 1000; i++) {
+        expected += i * (i + 1);
+    }
+    ArrayForEach(array, sumArrayElements, &sum);
+    ASSERT_EQ(expected, sum);
+
+    DictionaryRef dict = Dictionary();
+    MapRef map = Map();
+    for (int i = 0; i < 1000; i++) {
+        DictionarySetObjectForKey(dict, StringWithFormat("%d", i), StringWithFormat("%d", i % 7));
+        MapSetObjectForKey(map, StringWithFormat("%d", i), StringWithFormat("%d", i % 7));
+    }
+    DictionaryRemoveObjectForKey(dict, StringWithChars("500"));
+    MapRemoveObjectForKey(map, StringWithChars("500"));
+    expected = 0;
+    for (int64_t i = 0; i < 1000; i++) {
+        expected += i == 500 ? 0 : i * (i % 7);
+    }
+
+    // nothing gets allocated or autoreleased along the way.
+    AllocatorStats before = AllocatorGetStats();
+    size_t cursor = 0;
+    RCTypeRef key, value;
+    count = 0;
+    while (DictionaryNext(dict, &cursor, &key, &value)) {
+        ASSERT_EQ(DictionaryObjectForKey(dict, key), value);
+        count++;
+    }
+    ASSERT_EQ(DictionaryCount(dict), count);
+
+    sum = 0;
+    DictionaryForEach(dict, sumPairs, &sum);
+    ASSERT_EQ(expected, sum);
+
+    sum = 0;
+    MapForEach(map, sumPairs, &sum);
+    ASSERT_EQ(expected, sum);
+    ASSERT_EQ(before.allocations, AllocatorGetStats().allocations);
+
+    cursor = 0;
+    ASSERT_FALSE(DictionaryNext(NULL, &cursor, &key, &value));
+
+    RCRelease(ap);
+}
+
+typedef struct {
+    bool sameWhileInterned;
+    bool internedAfter;
+    bool newInstanceAfter;
+    int64_t refcountAfter;
+} InternThreadResult;
+
+static void *internThread(void *context) {
+    InternThreadResult *result = context;
+    AutoreleasePoolRef ap = AutoreleasePoolCreate();
+    
+    StringRef kept = RCRetain(StringInternChars("kept", 4));
+    result->sameWhileInterned = kept == StringInternChars("kept", 4);
+    StringInternChars("dropped", 7);
+    
+    // what the table owned alone goes away, the rest stays around as plain strings.
+    StringInternTableFree();
+    result->internedAfter = StringIsInterned(kept);
+    result->refcountAfter = RuntimeRefCount(kept);
+    result->newInstanceAfter = kept != StringInternChars("kept", 4) && RuntimeEquals(kept, StringInternChars("kept", 4));
+    RCRelease(kept);
+    
+    RCRelease(ap);
+    return NULL;
+}
+
+UTEST(arfoundation, stringInterning) {
+    AutoreleasePoolRef ap = AutoreleasePoolCreate();
+    
+    StringRef interned = StringInternChars("monkey business", 6);
+    ASSERT_STREQ("monkey", CString(interned));
+    ASSERT_TRUE(StringIsInterned(interned));
+    ASSERT_EQ(1, RuntimeRefCount(interned)); // the table's
+    ASSERT_EQ(interned, StringInternChars("monkey", 6));
+    
+    // equal strings intern to the same instance, and hash the same as any other equal string.
+    StringRef plain = StringWithChars("monkey");
+    ASSERT_FALSE(StringIsInterned(plain));
+    ASSERT_EQ(interned, StringIntern(plain));
+    ASSERT_EQ(RuntimeHash(plain).hash, RuntimeHash(interned).hash);
+    ASSERT_TRUE(RuntimeEquals(plain, interned));
+    ASSERT_NE(interned, StringInternChars("monkey!", 7));
+    ASSERT_EQ(StringInternChars("", 0), StringIntern(String()));
+    
+    // enough to grow the table.
+    for (int i = 0; i < 1000; i++) {
+        StringRef str = StringWithFormat("interned %d", i);
+        ASSERT_EQ(StringIntern(str), StringIntern(StringWithFormat("interned %d", i)));
+    }
+    ASSERT_EQ(interned, StringInternChars("monkey", 6));
+    
+    // tables are per thread, each one released as its thread exits.
+    pthread_t thread;
+    InternThreadResult result = { 0 };
+    ASSERT_EQ(0, pthread_create(&thread, NULL, internThread, &result));
+    ASSERT_EQ(0, pthread_join(thread, NULL));
+    ASSERT_TRUE(result.sameWhileInterned);
+    ASSERT_FALSE(result.internedAfter);
+    ASSERT_EQ(1, result.refcountAfter);
+    ASSERT_TRUE(result.newInstanceAfter);
+    
+    RCRelease(ap);
+}
+
+UTEST(arfoundation, stringRopes) {
+    AutoreleasePoolRef ap = AutoreleasePoolCreate();
+    
+    // left and right leaning, deep enough that recursing over the pieces would overflow the stack.
+    char *expected = NULL;
+    StringRef left = StringCreateWithChars("");
+    StringRef right = StringCreateWithChars("");
+    for (int i = 0; i < 100000; i++) {
+        StringRef fragment = StringWithFormat("%d,", i % 10);
+        StringRef next = StringCreateByConcatenating(left, fragment);
+        RCRelease(left);
+        left = next;
+        
+        fragment = StringWithFormat("%d,", (99999 - i) % 10);
+        next = StringCreateByConcatenating(fragment, right);
+        RCRelease(right);
+        right = next;
+        sarrprintf(expected, "%d,", i % 10);
+    }
+    ASSERT_EQ(200000, StringLength(left));
+    ASSERT_EQ(200000, StringLength(right));
+    
+    StringRef flat = StringWithChars(expected);
+    ASSERT_EQ(RuntimeHash(flat).hash, RuntimeHash(left).hash);
+    ASSERT_TRUE(RuntimeEquals(left, right));
+    ASSERT_STREQ(expected, CString(right));
+    RCRelease(right);
+    
+    // shared pieces survive their parent being flattened or released first.
+    StringRef head = StringByConcatenating(flat, StringWithChars("head"));
+    StringRef tail = StringCreateByConcatenating(head, StringWithChars("tail"));
+    ASSERT_EQ(StringLength(flat) + 4, StringLength(head));
+    ASSERT_EQ(StringLength(flat) + 8, StringLength(tail));
+    ASSERT_TRUE(strncmp(CString(tail) + StringLength(flat), "headtail", 8) == 0);
+    ASSERT_TRUE(strncmp(CString(head) + StringLength(flat), "head", 5) == 0);
+    
+    // appending flattens first.
+    StringAppendChars(tail, "!");
+    ASSERT_EQ(StringLength(flat) + 9, StringLength(tail));
+    ASSERT_TRUE(strncmp(CString(tail) + StringLength(flat), "headtail!", 10) == 0);
+    RCRelease(tail);
+    
+    // short results are plain copies.
+    StringRef shortString = StringByConcatenating(StringWithChars("mon"), StringWithChars("key"));
+    ASSERT_STREQ("monkey", CString(shortString));
+    
+    RCRelease(left);
+    arrfree(expected);
+    RCRelease(ap);
+}
+
+UTEST(arfoundation, stringViews) {
+    AutoreleasePoolRef ap = AutoreleasePoolCreate();
+    
+    const char *text = "the quick brown fox jumps over the lazy dog, the quick brown fox jumps over the lazy dog";
+    size_t length = strlen(text);
+    char *buffer = RCAlloc(length);
+    memcpy(buffer, text, length);
+    
+    // borrowed, not copied, and the owner stays alive as long as the view.
+    StringRef view = StringCreateWithView(buffer, buffer, length);
+    ASSERT_EQ(2, RuntimeRefCount(buffer));
+    ASSERT_EQ(length, StringLength(view));
+    ASSERT_TRUE(StringBytes(view) == buffer);
+    
+    StringRef flat = StringWithChars(text);
+    ASSERT_EQ(RuntimeHash(flat).hash, RuntimeHash(view).hash);
+    ASSERT_TRUE(RuntimeEquals(view, flat));
+    ASSERT_TRUE(StringBytes(view) == buffer);
+    
+    // substrings point at the original owner.
+    StringRef fox = StringWithSubstring(view, 16, 70);
+    ASSERT_EQ(70, StringLength(fox));
+    ASSERT_TRUE(StringBytes(fox) == buffer + 16);
+    ASSERT_EQ(3, RuntimeRefCount(buffer));
+    ASSERT_STREQ("fox", CString(StringWithSubstring(fox, 0, 3)));
+    
+    // ropes copy from the view when flattened.
+    StringRef joined = StringByConcatenating(view, StringWithChars("!"));
+    ASSERT_EQ(length + 1, StringLength(joined));
+    ASSERT_TRUE(strncmp(CString(joined), text, length) == 0);
+    ASSERT_TRUE(StringBytes(view) == buffer);
+    
+    // a C string needs a copy, the owner is let go.
+    ASSERT_STREQ(text, CString(view));
+    ASSERT_TRUE(StringBytes(view) != buffer);
+    ASSERT_EQ(2, RuntimeRefCount(buffer));
+    
+    StringRef twice = StringCreateWithView(buffer, buffer, length);
+    StringAppendString(twice, twice);
+    ASSERT_EQ(length * 2, StringLength(twice));
+    ASSERT_TRUE(strncmp(CString(twice) + length, text, length) == 0);
+    
+    RCRelease(twice);
+    RCRelease(view);
+    RCRelease(buffer);
+    RCRelease(ap);
+}
+
+UTEST(arfoundation, stringAppends) {
+    AutoreleasePoolRef ap = AutoreleasePoolCreate();
+    
+    int64_t values[] = { 0, 7, -7, 9, 10, 99, 100, 101, -100, 123456789, 1000000000000, INT64_MAX, INT64_MIN, INT64_MIN + 1 };
+    StringRef all = String();
+    StringRef expected = String();
+    for (int i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%lld", (long long)values[i]);
+        ASSERT_STREQ(buffer, CString(StringWithInteger(values[i])));
+        
+        StringAppendInteger(all, values[i]);
+        StringAppendChars(all, " ");
+        StringAppendFormat(expected, "%lld ", (long long)values[i]);
+    }
+    ASSERT_STREQ(CString(expected), CString(all));
+    ASSERT_EQ(StringLength(expected), StringLength(all));
+    
+    StringRef bytes = StringWithBytes("monkey\0business", 15);
+    ASSERT_EQ(15, StringLength(bytes));
+    ASSERT_STREQ("monkey", CString(bytes));
+    
+    StringRef str = StringWithChars("abc");
+    StringAppendString(str, str);
+    StringAppendBytes(str, CString(str) + 1, 2);
+    ASSERT_STREQ("abcabcbc", CString(str));
+    
+    ASSERT_STREQ("", CString(StringWithChars(NULL)));
+    ASSERT_EQ(0, StringLength(String()));
+    
+    // appends invalidate the cached hash, same as StringAppendFormat.
+    StringRef hashed = StringWithChars("hello");
+    uint64_t hash = RuntimeHash(hashed).hash;
+    StringAppendBytes(hashed, " world", 6);
+    ASSERT_NE(hash, RuntimeHash(hashed).hash);
+    ASSERT_EQ(RuntimeHash(StringWithChars("hello world")).hash, RuntimeHash(hashed).hash);
+    
+    RCRelease(ap);
+}
+
+UTEST(arfoundation, hashing) {
+    enum { length = 4 * 1024 + 67 };
+    static uint8_t bytes[length + 8];
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        bytes[i] = (uint8_t)(i * 7919 >> 3);
+    }
+    
+    // vector and portable paths agree, at every length and alignment, crossing the short/long boundary and blocks.
+    for (size_t count = 0; count <= length; count += count < 300 ? 1 : 61) {
+        for (size_t offset = 0; offset < 8; offset += 3) {
+            ASSERT_EQ(HashBytesPortable(bytes + offset, count, 0), HashBytes(bytes + offset, count, 0));
+            ASSERT_EQ(HashBytesPortable(bytes + offset, count, 42), HashBytes(bytes + offset, count, 42));
+        }
+    }
+    
+    // every byte counts, so does the seed.
+    size_t lengths[] = { 1, 3, 8, 16, 17, 48, 49, 255, 256, 1024, 1025, length };
+    for (int i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        size_t count = lengths[i];
+        uint64_t hash = HashBytes(bytes, count, 0);
+        ASSERT_NE(hash, HashBytes(bytes, count, 1));
+        ASSERT_NE(hash, HashBytes(bytes, count - 1, 0));
+        for (size_t position = 0; position < count; position += 1 + count / 16) {
+            bytes[position] ^= 1;
+            ASSERT_NE(hash, HashBytes(bytes, count, 0));
+            bytes[position] ^= 1;
+        }
+        ASSERT_EQ(hash, HashBytes(bytes, count, 0));
+    }
+    ASSERT_EQ(HashBytes(NULL, 0, 0), HashBytes("", 0, 0));
+
+    // integers get the keyed mix too, values that only differ in their high bits still spread out.
+    ASSERT_EQ(HashInteger(42, 7), HashInteger(42, 7));
+    ASSERT_NE(HashInteger(42, 7), HashInteger(42, 8));
+    ASSERT_NE(HashInteger(42, 7), HashInteger(43, 7));
+    bool buckets[1024] = { false };
+    int used = 0;
+    for (uint64_t i = 0; i < 1024; i++) {
+        size_t bucket = (HashInteger(i << 40, 0) >> 7) & 1023;
+        used += !buckets[bucket];
+        buckets[bucket] = true;
+    }
+    ASSERT_GT(used, 512);
+}
+
+UTEST(arfoundation, objectHeader) {
+    // fixed size instances are just the header and the payload (an array's is its trie root, tail, four counts,
+    // a shift and room for 8 elements).
+    size_t expected = sizeof(RuntimeObjectBase) + 15 * sizeof(void *);
+#if AR_ALLOCATOR_ENABLED
+    expected = (AllocatorSizeClassIndex(expected) + 1) * AR_ALLOCATOR_GRANULARITY;
+#endif
+    AllocatorStats stats = AllocatorGetStats();
+    ArrayRef array = ArrayCreate();
+    ASSERT_EQ(expected, AllocatorGetStats().bytesInUse - stats.bytesInUse);
+    RCRelease(array);
+
+    // classless allocations keep their size in front of the header.
+    stats = AllocatorGetStats();
+    char *bytes = RCAlloc(100);
+    memset(bytes, 'x', 100);
+    ASSERT_EQ(1, RuntimeRefCount(bytes));
+    RCRelease(bytes);
+    ASSERT_EQ(stats.bytesInUse, AllocatorGetStats().bytesInUse);
+
+    // cached hashes follow mutations.
+    StringRef string = StringCreateWithChars("hello");
+    StringRef other = StringCreateWithChars("hello world");
+    uint64_t hash = RuntimeHash(string).hash;
+    ASSERT_EQ(hash, RuntimeHash(string).hash);
+    StringAppendChars(string, " world");
+    ASSERT_NE(hash, RuntimeHash(string).hash);
+    ASSERT_EQ(RuntimeHash(other).hash, RuntimeHash(string).hash);
+    RCRelease(string);
+    RCRelease(other);
+}
+
+UTEST(arfoundation, cycleCollector) {
+    RuntimeCollectCycles();
+    RuntimeCycleStats before = RuntimeGetCycleStats();
+
+    // a -> b -> a, plus a string hanging off the cycle.
+    ArrayRef a = ArrayCreate();
+    ArrayRef b = ArrayCreate();
+    StringRef payload = StringCreateWithChars("payload");
+    ArrayAppend(a, b);
+    ArrayAppend(b, a);
+    ArrayAppend(b, payload);
+    RCRelease(payload);
+
+    // kept alive from the outside, nothing to collect.
+    RCRelease(b);
+    ASSERT_EQ(1, RuntimeCycleRootCount());
+    ASSERT_EQ(0, RuntimeCollectCycles());
+    ASSERT_EQ(2, RuntimeRefCount(a));
+    ASSERT_EQ(1, RuntimeRefCount(b));
+
+    RCRelease(a);
+    ASSERT_EQ(1, RuntimeCycleRootCount());
+    ASSERT_EQ(3, RuntimeCollectCycles());
+    ASSERT_EQ(0, RuntimeCycleRootCount());
+
+    RuntimeCycleStats after = RuntimeGetCycleStats();
+    ASSERT_EQ(before.collections + 2, after.collections);
+    ASSERT_EQ(before.cyclesFound + 1, after.cyclesFound);
+    ASSERT_EQ(before.objectsFreed + 3, after.objectsFreed);
+    ASSERT_GT(after.bytesFreed, before.bytesFreed);
+
+    // possible roots freed by plain refcounting leave the buffer.
+    ArrayRef c = ArrayCreate();
+    RCRetain(c);
+    RCRelease(c);
+    ASSERT_EQ(1, RuntimeCycleRootCount());
+    RCRelease(c);
+    ASSERT_EQ(0, RuntimeCycleRootCount());
+}
+
+#if AR_ALLOCATOR_ENABLED
+UTEST(arfoundation, allocator) {
+    ASSERT_EQ(0, AllocatorSizeClassIndex(1));
+    ASSERT_EQ(0, AllocatorSizeClassIndex(16));
+    ASSERT_EQ(1, AllocatorSizeClassIndex(17));
+    ASSERT_EQ(AR_ALLOCATOR_SIZE_CLASSES - 1, AllocatorSizeClassIndex(AR_ALLOCATOR_MAX_SIZE));
+    ASSERT_EQ(-1, AllocatorSizeClassIndex(AR_ALLOCATOR_MAX_SIZE + 1));
+
+    int index = AllocatorSizeClassIndex(48);
+    AllocatorSizeClassStats before = AllocatorSizeClassStatsAt(index);
+
+    char *first = AllocatorAlloc(48);
+    memset(first, 0xff, 48);
+    AllocatorFree(first, 48);
+
+    // freed blocks are handed out again, zeroed.
+    char *second = AllocatorAlloc(40);
+    ASSERT_EQ(first, second);
+    for (int i = 0; i < 48; i++) {
+        ASSERT_EQ(0, second[i]);
+    }
+
+    AllocatorSizeClassStats after = AllocatorSizeClassStatsAt(index);
+    ASSERT_EQ(48, after.blockSize);
+    ASSERT_EQ(before.inUse + 1, after.inUse);
+    ASSERT_EQ(before.allocations + 2, after.allocations);
+    AllocatorFree(second, 40);
+
+    // each page worth of blocks costs a single trip to the system allocator.
+    uint64_t perPage = AR_ALLOCATOR_PAGE_SIZE / 48;
+    void *blocks[AR_ALLOCATOR_PAGE_SIZE / 48 * 2];
+    AllocatorStats stats = AllocatorGetStats();
+    for (int i = 0; i < perPage * 2; i++) {
+        blocks[i] = AllocatorAlloc(48);
+    }
+    ASSERT_LE(AllocatorGetStats().systemAllocations - stats.systemAllocations, 2);
+    for (int i = 0; i < perPage * 2; i++) {
+        AllocatorFree(blocks[i], 48);
+    }
+    ASSERT_EQ(before.inUse, AllocatorSizeClassStatsAt(index).inUse);
+
+    // runtime objects come out of the size classes too.
+    stats = AllocatorGetStats();
+    StringRef string = StringCreateWithChars("slab");
+    ASSERT_GT(AllocatorGetStats().allocations, stats.allocations);
+    RCRelease(string);
+
+    // larger requests bypass them.
+    stats = AllocatorGetStats();
+    void *large = AllocatorAlloc(AR_ALLOCATOR_MAX_SIZE + 1);
+    ASSERT_EQ(stats.systemAllocations + 1, AllocatorGetStats().systemAllocations);
+    AllocatorFree(large, AR_ALLOCATOR_MAX_SIZE + 1);
+    ASSERT_EQ(stats.systemFrees + 1, AllocatorGetStats().systemFrees);
+}
+#endif
+
 #ifndef AR_COMPOUND_TEST
 UTEST_MAIN();
 #endif
@@ -76,7 +76,8 @@ astidentifier_t *identifierCreate(token_t token, charslice_t value) {
     astidentifier_t *identifier = calloc(1, sizeof(*identifier));
     identifier->super.node = astnodeMake(AST_IDENTIFIER, identifierTokenLiteral, identifierString);
     identifier->token = token;
-    identifier->value = ARStringWithSlice(value);
+    identifier->value = ARStringInternSlice(value);
+    identifier->depth = AST_DEPTH_UNRESOLVED;
     return identifier;
 }
 
@@ -403,11 +404,28 @@ static StringRef stringLiteralTokenLiteral(astnode_t *node) {
     return ARStringWithSlice(self->token.literal);
 }
 
-aststringliteral_t *stringLiteralCreate(token_t token, charslice_t value) {
+// literals are data, they live as long as the ast (which is never freed). Long ones borrow the
+// source buffer instead of copying it.
+#define AST_STRING_VIEW_MIN_LENGTH 256
+
+aststringliteral_t *stringLiteralCreate(token_t token, charslice_t value, RCTypeRef source) {
+    aststringliteral_t *string = calloc(1, sizeof(*string));
+    string->super.node = astnodeMake(AST_STRING, stringLiteralTokenLiteral, stringLiteralTokenLiteral);
+    string->token = token;
+    if (source && value.length >= AST_STRING_VIEW_MIN_LENGTH) {
+        string->value = RuntimeMakeConstant(ARStringCreateWithSliceView(value, source));
+    } else {
+        string->value = RuntimeMakeConstant(ARStringCreateWithSlice(value));
+    }
+    return string;
+}
+
+// keys are names, not data. interned so lookups compare pointers.
+aststringliteral_t *stringLiteralCreateInterned(token_t token, charslice_t value) {
     aststringliteral_t *string = calloc(1, sizeof(*string));
     string->super.node = astnodeMake(AST_STRING, stringLiteralTokenLiteral, stringLiteralTokenLiteral);
     string->token = token;
-    string->value = ARStringWithSlice(value);
+    string->value = ARStringInternSlice(value);
     return string;
 }
 
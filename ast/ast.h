@@ -69,15 +69,23 @@ typedef struct {
 astprogram_t *programCreate(void);
 void programRelease(astprogram_t **program);
 
+#define AST_DEPTH_UNRESOLVED -1
+#define AST_DEPTH_BUILTIN -2 // slot is the builtin's index
+
 // node < expression < astidentifier
-typedef struct {
+typedef struct astidentifier {
 	union {
 		astnode_t node;
 		astexpression_t expression;
 	} super; // could be anonymous instead, but is it 'simpler/easier'? ->super.xxx vs ->xxx? ¯\_(ツ)_/¯
 	
 	token_t token;
-	StringRef value;
+	StringRef value; // interned
+
+	// set by the resolver: environments to walk up and the slot to read in that one.
+	int depth;
+	int slot;
+	struct astidentifier *fallback; // read when that slot may be unset and is, NULL if it's always set
 } astidentifier_t;
 astidentifier_t *identifierCreate(token_t token, charslice_t value);
 
@@ -199,6 +207,7 @@ typedef struct {
     token_t token;
     astidentifier_t **parameters;
     astblockstatement_t *body;
+    int slotCount; // parameters + lets in the body, set by the resolver
 } astfunctionliteral_t;
 astfunctionliteral_t *functionLiteralCreate(token_t token);
 
@@ -220,9 +229,10 @@ typedef struct {
     } super;
 
     token_t token;
-    StringRef value;
+    StringRef value; // a copy, a view into source when long, interned when it's a key
 } aststringliteral_t;
-aststringliteral_t *stringLiteralCreate(token_t token, charslice_t value);
+aststringliteral_t *stringLiteralCreate(token_t token, charslice_t value, RCTypeRef source);
+aststringliteral_t *stringLiteralCreateInterned(token_t token, charslice_t value);
 
 typedef struct {
     union {
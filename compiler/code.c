@@ -0,0 +1,116 @@
+//
+//  code.c
+//  conkey
+//
+
+#include "code.h"
+
+#include <assert.h>
+#include <stdarg.h>
+
+#include "../arfoundation/arfoundation.h"
+
+#define OP(name, count, ...) [OP_##name] = { #name, count, { __VA_ARGS__ } },
+static const opdefinition_t definitions[OP_COUNT] = {
+    OPCODE_DEFS
+};
+#undef OP
+
+const opdefinition_t *codeLookup(opcode_t op) {
+    if (op >= OP_COUNT) {
+        return NULL;
+    }
+    return &definitions[op];
+}
+
+static size_t codeEmitv(instructions_t *instructions, opcode_t op, va_list args) {
+    const opdefinition_t *def = codeLookup(op);
+    assert(def);
+
+    size_t offset = arrlen(*instructions);
+    arrput(*instructions, (uint8_t)op);
+
+    for (int i = 0; i < def->operandCount; i++) {
+        int operand = va_arg(args, int);
+        switch (def->operandWidths[i]) {
+            case 2: {
+                uint8_t *ins = arraddnptr(*instructions, 2);
+                codePutUint16(ins, (uint16_t)operand);
+            }
+                break;
+
+            case 1:
+                arrput(*instructions, (uint8_t)operand);
+                break;
+
+            default:
+                ar_fatal("unsupported operand width %d for %s", def->operandWidths[i], def->name);
+                break;
+        }
+    }
+
+    return offset;
+}
+
+size_t codeEmit(instructions_t *instructions, opcode_t op, ...) {
+    va_list args;
+    va_start(args, op);
+    size_t offset = codeEmitv(instructions, op, args);
+    va_end(args);
+    return offset;
+}
+
+instructions_t codeMake(opcode_t op, ...) {
+    instructions_t instructions = NULL;
+
+    va_list args;
+    va_start(args, op);
+    codeEmitv(&instructions, op, args);
+    va_end(args);
+
+    return instructions;
+}
+
+size_t codeReadOperands(const opdefinition_t *def, const uint8_t *ins, int *operands) {
+    size_t offset = 0;
+    for (int i = 0; i < def->operandCount; i++) {
+        switch (def->operandWidths[i]) {
+            case 2:
+                operands[i] = codeReadUint16(ins + offset);
+                break;
+
+            case 1:
+                operands[i] = codeReadUint8(ins + offset);
+                break;
+        }
+        offset += def->operandWidths[i];
+    }
+    return offset;
+}
+
+StringRef codeInstructionsString(instructions_t instructions) {
+    StringRef out = String();
+
+    size_t i = 0;
+    while (i < arrlen(instructions)) {
+        const opdefinition_t *def = codeLookup(instructions[i]);
+        if (!def) {
+            StringAppendFormat(out, "ERROR: unknown opcode %d\n", instructions[i]);
+            i++;
+            continue;
+        }
+
+        int operands[CODE_MAX_OPERANDS] = { 0 };
+        size_t read = codeReadOperands(def, &instructions[i + 1], operands);
+
+        StringAppendFormat(out, "%04zu %s", i, def->name);
+        for (int op = 0; op < def->operandCount; op++) {
+            StringAppendFormat(out, " %d", operands[op]);
+        }
+        StringAppendChars(out, "\n");
+
+        i += 1 + read;
+    }
+
+    return out;
+}
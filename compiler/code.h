@@ -0,0 +1,97 @@
+//
+//  code.h
+//  conkey
+//
+//  Bytecode definitions shared by the compiler and the vm.
+//  Operands are encoded big endian right after the opcode.
+
+#ifndef _code_h_
+#define _code_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../arfoundation/arfoundation.h"
+
+// OP(name, operand count, operand widths...)
+#define OPCODE_DEFS \
+    OP(CONSTANT,         1, 2) \
+    OP(POP,              0) \
+    OP(ADD,              0) \
+    OP(SUB,              0) \
+    OP(MUL,              0) \
+    OP(DIV,              0) \
+    OP(TRUE,             0) \
+    OP(FALSE,            0) \
+    OP(EQUAL,            0) \
+    OP(NOT_EQUAL,        0) \
+    OP(GREATER_THAN,     0) \
+    OP(LESS_THAN,        0) \
+    OP(MINUS,            0) \
+    OP(BANG,             0) \
+    OP(JUMP_NOT_TRUTHY,  1, 2) \
+    OP(JUMP,             1, 2) \
+    OP(NULL,             0) \
+    OP(GET_GLOBAL,       1, 2) \
+    OP(SET_GLOBAL,       1, 2) \
+    OP(GET_GLOBAL_OR,    2, 2, 2) /* pushes a set global and jumps to the first operand, past its fallback */ \
+    OP(ARRAY,            1, 2) \
+    OP(HASH,             1, 2) \
+    OP(INDEX,            0) \
+    OP(CALL,             1, 1) \
+    OP(RETURN_VALUE,     0) \
+    OP(RETURN,           0) \
+    OP(GET_LOCAL,        1, 1) \
+    OP(SET_LOCAL,        1, 1) \
+    OP(MOVE_LOCAL,       1, 1) /* a local's last read, its reference moves to the stack */ \
+    OP(GET_LOCAL_OR,     2, 2, 1) /* GET_GLOBAL_OR for a local */ \
+    OP(GET_BUILTIN,      1, 1) \
+    OP(CLOSURE,          2, 2, 1) \
+    OP(GET_FREE,         1, 1) \
+    OP(CURRENT_CLOSURE,  0) \
+    OP(HALT,             0) // appended by the vm, never emitted by the compiler
+
+#define OP(name, ...) OP_##name,
+typedef enum {
+    OPCODE_DEFS
+
+    // count
+    OP_COUNT
+} opcode_t;
+#undef OP
+
+#define CODE_MAX_OPERANDS 2
+
+typedef struct {
+    const char *name;
+    int operandCount;
+    int operandWidths[CODE_MAX_OPERANDS];
+} opdefinition_t;
+
+// stb_ds array of bytes.
+typedef uint8_t *instructions_t;
+
+const opdefinition_t *codeLookup(opcode_t op);
+
+// appends `op` and its operands to `instructions`, returns the offset of the new instruction.
+size_t codeEmit(instructions_t *instructions, opcode_t op, ...);
+// number of operands must match the definition, returns a new stb_ds array.
+instructions_t codeMake(opcode_t op, ...);
+// decodes the operands of the instruction whose operands start at `ins`, returns bytes read.
+size_t codeReadOperands(const opdefinition_t *def, const uint8_t *ins, int *operands);
+StringRef codeInstructionsString(instructions_t instructions);
+
+AR_INLINE uint16_t codeReadUint16(const uint8_t *ins) {
+    return (uint16_t)((ins[0] << 8) | ins[1]);
+}
+
+AR_INLINE uint8_t codeReadUint8(const uint8_t *ins) {
+    return ins[0];
+}
+
+AR_INLINE void codePutUint16(uint8_t *ins, uint16_t value) {
+    ins[0] = (uint8_t)(value >> 8);
+    ins[1] = (uint8_t)(value & 0xff);
+}
+
+#endif /* _code_h_ */
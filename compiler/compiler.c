@@ -0,0 +1,664 @@
+//
+//  compiler.c
+//  conkey
+//
+
+#include "compiler.h"
+
+#include <assert.h>
+#include <stdarg.h>
+
+#include "../arfoundation/arfoundation.h"
+#include "../evaluator/builtins.h"
+#include "../object/object.h"
+
+static bool compile(compiler_t *compiler, astnode_t *node);
+
+static void compilerDealloc(RCTypeRef obj) {
+    compiler_t *self = obj;
+    for (int i = 0; i < arrlen(self->scopes); i++) {
+        arrfree(self->scopes[i].instructions);
+    }
+    arrfree(self->scopes);
+
+    self->constants = RCRelease(self->constants);
+    self->symbolTable = RCRelease(self->symbolTable);
+    self->errors = RCRelease(self->errors);
+}
+
+static RuntimeClassID MkyCompilerClassID = { 0 };
+static RuntimeClassDescriptor MkyCompilerClass = {
+    "MkyCompiler",
+    sizeof(struct compiler_t),
+    NULL, // const
+    compilerDealloc,
+    NULL,
+    NULL
+};
+
+compiler_t *compilerCreateWithState(symboltable_t *symbolTable, ArrayRef constants) {
+    RuntimeRegisterClassOnce(&MkyCompilerClassID, &MkyCompilerClass);
+
+    compiler_t *compiler = RuntimeCreateInstance(MkyCompilerClassID);
+    compiler->constants = RCRetain(constants);
+    compiler->symbolTable = RCRetain(symbolTable);
+    compiler->errors = ArrayCreate();
+
+    compilationscope_t main = { 0 };
+    arrput(compiler->scopes, main);
+    compiler->scopeIndex = 0;
+
+    return RCAutorelease(compiler);
+}
+
+compiler_t *compilerCreate(void) {
+    symboltable_t *symbolTable = symbolTableCreate();
+    for (size_t i = 0; i < builtinCount(); i++) {
+        symbolTableDefineBuiltin(symbolTable, (int)i, builtinNameAtIndex(i));
+    }
+
+    ArrayRef constants = ArrayCreate();
+    compiler_t *compiler = compilerCreateWithState(symbolTable, constants);
+
+    RCRelease(symbolTable);
+    RCRelease(constants);
+    return compiler;
+}
+
+bytecode_t compilerBytecode(compiler_t *compiler) {
+    return (bytecode_t){
+        compiler->scopes[compiler->scopeIndex].instructions,
+        compiler->constants,
+        compiler->symbolTable
+    };
+}
+
+#pragma mark - Errors
+
+static bool compilerError(compiler_t *compiler, StringRef message) {
+    ArrayAppend(compiler->errors, message);
+    RCRelease(message);
+    return false;
+}
+
+#pragma mark - Emitting
+
+static compilationscope_t *currentScope(compiler_t *compiler) {
+    return &compiler->scopes[compiler->scopeIndex];
+}
+
+static instructions_t currentInstructions(compiler_t *compiler) {
+    return currentScope(compiler)->instructions;
+}
+
+// what runs out when an operand of op doesn't fit.
+static const char *operandLimitName(opcode_t op, int operand) {
+    switch (op) {
+        case OP_CONSTANT: return "constants";
+        case OP_JUMP:
+        case OP_JUMP_NOT_TRUTHY: return "instructions in a function";
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL: return "globals";
+        case OP_GET_GLOBAL_OR: return operand == 0 ? "instructions in a function" : "globals";
+        case OP_GET_LOCAL_OR: return operand == 0 ? "instructions in a function" : "locals";
+        case OP_ARRAY: return "array elements";
+        case OP_HASH: return "hash pairs";
+        case OP_CALL: return "arguments";
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_MOVE_LOCAL: return "locals";
+        case OP_GET_FREE: return "free variables";
+        case OP_CLOSURE: return operand == 0 ? "constants" : "free variables";
+        default: return "operands";
+    }
+}
+
+// operands are truncated to their width, the compilation fails instead of running the wrong code.
+static void checkOperand(compiler_t *compiler, opcode_t op, int operand, int value) {
+    int width = codeLookup(op)->operandWidths[operand];
+    if (value < 0 || value >= (1 << (width * 8))) {
+        StringRef message = StringCreateWithFormat("too many %s", operandLimitName(op, operand));
+        size_t count = ArrayCount(compiler->errors);
+        if (count && RuntimeEquals(ArrayObjectAt(compiler->errors, count - 1), message)) {
+            RCRelease(message); // once is enough, every use of a local past the limit would repeat it
+            return;
+        }
+        compilerError(compiler, message);
+    }
+}
+
+static size_t emit(compiler_t *compiler, opcode_t op, ...) {
+    compilationscope_t *scope = currentScope(compiler);
+    const opdefinition_t *def = codeLookup(op);
+
+    va_list args;
+    va_start(args, op);
+    int operands[CODE_MAX_OPERANDS] = { 0 };
+    for (int i = 0; i < def->operandCount; i++) {
+        operands[i] = va_arg(args, int);
+        checkOperand(compiler, op, i, operands[i]);
+    }
+    va_end(args);
+
+    size_t position = codeEmit(&scope->instructions, op, operands[0], operands[1]);
+
+    scope->previousInstruction = scope->lastInstruction;
+    scope->lastInstruction = (emittedinstruction_t){ op, position };
+    return position;
+}
+
+static int addConstant(compiler_t *compiler, MkyObject *obj) {
+    ArrayAppend(compiler->constants, obj);
+    return (int)ArrayCount(compiler->constants) - 1;
+}
+
+static bool lastInstructionIs(compiler_t *compiler, opcode_t op) {
+    if (arrlen(currentInstructions(compiler)) == 0) {
+        return false;
+    }
+    return currentScope(compiler)->lastInstruction.opcode == op;
+}
+
+static void removeLastPop(compiler_t *compiler) {
+    compilationscope_t *scope = currentScope(compiler);
+    arrsetlen(scope->instructions, scope->lastInstruction.position);
+    scope->lastInstruction = scope->previousInstruction;
+}
+
+static void replaceLastPopWithReturn(compiler_t *compiler) {
+    compilationscope_t *scope = currentScope(compiler);
+    size_t position = scope->lastInstruction.position;
+    scope->instructions[position] = OP_RETURN_VALUE;
+    scope->lastInstruction.opcode = OP_RETURN_VALUE;
+}
+
+static void changeOperand(compiler_t *compiler, size_t position, int operand) {
+    instructions_t instructions = currentInstructions(compiler);
+    assert(codeLookup(instructions[position])->operandWidths[0] == 2);
+    checkOperand(compiler, instructions[position], 0, operand);
+    codePutUint16(&instructions[position + 1], (uint16_t)operand);
+}
+
+static void enterScope(compiler_t *compiler) {
+    compilationscope_t scope = { 0 };
+    arrput(compiler->scopes, scope);
+    compiler->scopeIndex++;
+
+    symboltable_t *enclosed = symbolTableCreateEnclosedIn(compiler->symbolTable);
+    RCRelease(compiler->symbolTable);
+    compiler->symbolTable = enclosed;
+}
+
+static instructions_t leaveScope(compiler_t *compiler) {
+    instructions_t instructions = currentInstructions(compiler);
+    arrpop(compiler->scopes);
+    compiler->scopeIndex--;
+
+    symboltable_t *outer = RCRetain(symbolTableOuter(compiler->symbolTable));
+    RCRelease(compiler->symbolTable);
+    compiler->symbolTable = outer;
+
+    return instructions; // caller owns it
+}
+
+static symboltable_t *globalSymbolTable(compiler_t *compiler) {
+    symboltable_t *globals = compiler->symbolTable;
+    while (symbolTableOuter(globals)) {
+        globals = symbolTableOuter(globals);
+    }
+    return globals;
+}
+
+static void loadSymbol(compiler_t *compiler, symbol_t symbol);
+
+// a let in a branch may not have run, the read checks and else loads what the name meant before it,
+// like the evaluator going on to the enclosing environments. With nothing before it the name isn't found.
+static void loadConditionalSymbol(compiler_t *compiler, symbol_t symbol) {
+    bool global = symbol.scope == SYMBOL_SCOPE_GLOBAL;
+    symbol_t fallback;
+    if (!symbolTableResolveFallback(global ? globalSymbolTable(compiler) : compiler->symbolTable, symbol.name, &fallback)) {
+        if (global) {
+            emit(compiler, OP_GET_GLOBAL, symbol.index);
+            return;
+        }
+        fallback = symbolTableDefine(globalSymbolTable(compiler), StringWithChars(symbol.name));
+    }
+
+    size_t position = emit(compiler, global ? OP_GET_GLOBAL_OR : OP_GET_LOCAL_OR, 9999, symbol.index);
+    loadSymbol(compiler, fallback);
+    changeOperand(compiler, position, (int)arrlen(currentInstructions(compiler)));
+}
+
+static void loadSymbol(compiler_t *compiler, symbol_t symbol) {
+    if (symbol.conditional) {
+        loadConditionalSymbol(compiler, symbol);
+        return;
+    }
+
+    switch (symbol.scope) {
+        case SYMBOL_SCOPE_GLOBAL:
+            emit(compiler, OP_GET_GLOBAL, symbol.index);
+            break;
+
+        case SYMBOL_SCOPE_LOCAL:
+            emit(compiler, OP_GET_LOCAL, symbol.index);
+            break;
+
+        case SYMBOL_SCOPE_BUILTIN:
+            emit(compiler, OP_GET_BUILTIN, symbol.index);
+            break;
+
+        case SYMBOL_SCOPE_FREE:
+            emit(compiler, OP_GET_FREE, symbol.index);
+            break;
+
+        case SYMBOL_SCOPE_FUNCTION:
+            emit(compiler, OP_CURRENT_CLOSURE);
+            break;
+    }
+}
+
+#pragma mark - Last reads
+
+// a bit per local, there are at most 256.
+typedef struct {
+    uint64_t bits[4];
+} localset_t;
+
+static inline void localSetUnion(localset_t *set, const localset_t *other) {
+    for (int i = 0; i < 4; i++) {
+        set->bits[i] |= other->bits[i];
+    }
+}
+
+// Turns every read of a local that's the last one on all paths into a move, so a value only that local held
+// reaches a builtin uniquely referenced and can be changed in place. Monkey has no loops, every jump goes
+// forward, so one backward pass over the instructions finds what's still read after each of them.
+static void markLastLocalReads(instructions_t instructions) {
+    size_t length = arrlen(instructions);
+    localset_t *liveIn = calloc(length + 1, sizeof(localset_t)); // locals read later, before being set again
+
+    size_t *starts = NULL;
+    int operands[CODE_MAX_OPERANDS];
+    for (size_t ip = 0; ip < length; ip += 1 + codeReadOperands(codeLookup(instructions[ip]), &instructions[ip + 1], operands)) {
+        arrput(starts, ip);
+    }
+
+    for (ptrdiff_t i = arrlen(starts) - 1; i >= 0; i--) {
+        size_t ip = starts[i];
+        opcode_t op = instructions[ip];
+        size_t next = i + 1 < arrlen(starts) ? starts[i + 1] : length;
+
+        localset_t live = { 0 };
+        switch (op) {
+            case OP_RETURN:
+            case OP_RETURN_VALUE:
+                break;
+            case OP_JUMP:
+                live = liveIn[codeReadUint16(&instructions[ip + 1])];
+                break;
+            case OP_JUMP_NOT_TRUTHY:
+            case OP_GET_LOCAL_OR:
+            case OP_GET_GLOBAL_OR:
+                live = liveIn[codeReadUint16(&instructions[ip + 1])];
+                localSetUnion(&live, &liveIn[next]);
+                break;
+            default:
+                live = liveIn[next];
+                break;
+        }
+
+        if (op == OP_GET_LOCAL_OR) {
+            uint8_t index = codeReadUint8(&instructions[ip + 3]);
+            live.bits[index >> 6] |= (uint64_t)1 << (index & 63); // only ever a read, the fallback may follow it
+
+        } else if (op == OP_GET_LOCAL || op == OP_SET_LOCAL) {
+            uint8_t index = codeReadUint8(&instructions[ip + 1]);
+            uint64_t bit = (uint64_t)1 << (index & 63);
+            if (op == OP_SET_LOCAL) {
+                live.bits[index >> 6] &= ~bit;
+            } else {
+                if (!(live.bits[index >> 6] & bit)) {
+                    instructions[ip] = OP_MOVE_LOCAL;
+                }
+                live.bits[index >> 6] |= bit;
+            }
+        }
+        liveIn[ip] = live;
+    }
+
+    arrfree(starts);
+    free(liveIn);
+}
+
+#pragma mark - Compiling
+
+static bool compileStatements(compiler_t *compiler, aststatement_t **statements) {
+    for (int i = 0; i < arrlen(statements); i++) {
+        if (!compile(compiler, AS_NODE(statements[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool compileExpressions(compiler_t *compiler, astexpression_t **expressions) {
+    for (int i = 0; i < arrlen(expressions); i++) {
+        if (!compile(compiler, AS_NODE(expressions[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool compileFunctionLiteral(compiler_t *compiler, astfunctionliteral_t *fn, StringRef name) {
+    enterScope(compiler);
+
+    if (name) {
+        symbolTableDefineFunctionName(compiler->symbolTable, name);
+    }
+
+    for (int i = 0; i < arrlen(fn->parameters); i++) {
+        symbolTableDefine(compiler->symbolTable, fn->parameters[i]->value);
+    }
+
+    if (fn->body && !compile(compiler, AS_NODE(fn->body))) {
+        arrfree(currentScope(compiler)->instructions);
+        leaveScope(compiler);
+        return false;
+    }
+
+    if (lastInstructionIs(compiler, OP_POP)) {
+        replaceLastPopWithReturn(compiler);
+    }
+
+    if (!lastInstructionIs(compiler, OP_RETURN_VALUE)) {
+        emit(compiler, OP_RETURN);
+    }
+    markLastLocalReads(currentInstructions(compiler));
+
+    symboltable_t *symbolTable = compiler->symbolTable;
+    size_t numFree = symbolTableFreeSymbolCount(symbolTable);
+    symbol_t *freeSymbols = NULL;
+    for (size_t i = 0; i < numFree; i++) {
+        arrput(freeSymbols, symbolTableFreeSymbolAt(symbolTable, i));
+    }
+    int numLocals = symbolTableNumDefinitions(symbolTable);
+
+    instructions_t instructions = leaveScope(compiler);
+
+    for (size_t i = 0; i < numFree; i++) {
+        loadSymbol(compiler, freeSymbols[i]);
+    }
+    arrfree(freeSymbols);
+
+    MkyObject *compiled = mkyCompiledFunction(instructions, numLocals, (int)arrlen(fn->parameters));
+    emit(compiler, OP_CLOSURE, addConstant(compiler, compiled), (int)numFree);
+    return true;
+}
+
+static symbol_t defineLet(compiler_t *compiler, StringRef name) {
+    if (currentScope(compiler)->branchDepth > 0) {
+        return symbolTableDefineConditional(compiler->symbolTable, name);
+    }
+    return symbolTableDefine(compiler->symbolTable, name);
+}
+
+static bool compileIfExpression(compiler_t *compiler, astifexpression_t *exp) {
+    if (!compile(compiler, AS_NODE(exp->condition))) {
+        return false;
+    }
+
+    // bogus offsets, patched below.
+    size_t jumpNotTruthyPosition = emit(compiler, OP_JUMP_NOT_TRUTHY, 9999);
+
+    currentScope(compiler)->branchDepth++;
+    bool compiled = !exp->consequence || compile(compiler, AS_NODE(exp->consequence));
+    currentScope(compiler)->branchDepth--;
+    if (!compiled) {
+        return false;
+    }
+
+    if (lastInstructionIs(compiler, OP_POP)) {
+        removeLastPop(compiler);
+
+    } else {
+        emit(compiler, OP_NULL);
+    }
+
+    size_t jumpPosition = emit(compiler, OP_JUMP, 9999);
+    changeOperand(compiler, jumpNotTruthyPosition, (int)arrlen(currentInstructions(compiler)));
+
+    if (!exp->alternative) {
+        emit(compiler, OP_NULL);
+
+    } else {
+        currentScope(compiler)->branchDepth++;
+        compiled = compile(compiler, AS_NODE(exp->alternative));
+        currentScope(compiler)->branchDepth--;
+        if (!compiled) {
+            return false;
+        }
+
+        if (lastInstructionIs(compiler, OP_POP)) {
+            removeLastPop(compiler);
+
+        } else {
+            emit(compiler, OP_NULL);
+        }
+    }
+
+    changeOperand(compiler, jumpPosition, (int)arrlen(currentInstructions(compiler)));
+    return true;
+}
+
+static bool compileInfixExpression(compiler_t *compiler, astinfixexpression_t *exp) {
+    if (!compile(compiler, AS_NODE(exp->left))) {
+        return false;
+    }
+
+    if (!compile(compiler, AS_NODE(exp->right))) {
+        return false;
+    }
+
+    switch (exp->operator) {
+        case TOKEN_PLUS:
+            emit(compiler, OP_ADD);
+            break;
+
+        case TOKEN_MINUS:
+            emit(compiler, OP_SUB);
+            break;
+
+        case TOKEN_ASTERISK:
+            emit(compiler, OP_MUL);
+            break;
+
+        case TOKEN_SLASH:
+            emit(compiler, OP_DIV);
+            break;
+
+        case TOKEN_GT:
+            emit(compiler, OP_GREATER_THAN);
+            break;
+
+        case TOKEN_LT:
+            emit(compiler, OP_LESS_THAN);
+            break;
+
+        case TOKEN_EQ:
+            emit(compiler, OP_EQUAL);
+            break;
+
+        case TOKEN_NOT_EQ:
+            emit(compiler, OP_NOT_EQUAL);
+            break;
+
+        default:
+            return compilerError(compiler, StringCreateWithFormat("unknown operator %s", token_str[exp->operator]));
+    }
+
+    return true;
+}
+
+static bool compile(compiler_t *compiler, astnode_t *node) {
+    if (!node) {
+        return compilerError(compiler, StringCreateWithFormat("can't compile an empty node"));
+    }
+
+    switch (node->type) {
+        case AST_PROGRAM:
+            return compileStatements(compiler, ((astprogram_t *)node)->statements);
+// statements
+        case AST_EXPRESSIONSTMT: {
+            astexpressionstatement_t *stmt = (astexpressionstatement_t *)node;
+            if (!compile(compiler, AS_NODE(stmt->expression))) {
+                return false;
+            }
+            emit(compiler, OP_POP);
+        }
+            break;
+
+        case AST_BLOCKSTMT:
+            return compileStatements(compiler, ((astblockstatement_t *)node)->statements);
+
+        case AST_LET: {
+            astletstatement_t *let = (astletstatement_t *)node;
+            bool compiled = false;
+            symbol_t symbol;
+            if (let->value && AST_TYPE(let->value) == AST_FNLIT) {
+                // defined before the value so functions can refer to themselves.
+                symbol = defineLet(compiler, let->name->value);
+                compiled = compileFunctionLiteral(compiler, (astfunctionliteral_t *)let->value, let->name->value);
+
+            } else {
+                // after it everywhere else, the value reads any outer binding of the same name.
+                compiled = compile(compiler, AS_NODE(let->value));
+                symbol = defineLet(compiler, let->name->value);
+            }
+
+            if (!compiled) {
+                return false;
+            }
+
+            emit(compiler, symbol.scope == SYMBOL_SCOPE_GLOBAL ? OP_SET_GLOBAL : OP_SET_LOCAL, symbol.index);
+        }
+            break;
+
+        case AST_RETURN: {
+            astreturnstatement_t *ret = (astreturnstatement_t *)node;
+            if (!compile(compiler, AS_NODE(ret->returnValue))) {
+                return false;
+            }
+            emit(compiler, OP_RETURN_VALUE);
+        }
+            break;
+// expressions
+        case AST_IDENTIFIER: {
+            astidentifier_t *ident = (astidentifier_t *)node;
+            symbol_t symbol;
+            if (!symbolTableResolve(compiler->symbolTable, ident->value, &symbol)) {
+                // a global a later let may set, like the evaluator the vm reports it as not found if none has.
+                symbol = symbolTableDefine(globalSymbolTable(compiler), ident->value);
+            }
+            loadSymbol(compiler, symbol);
+        }
+            break;
+
+        case AST_INTEGER:
+            emit(compiler, OP_CONSTANT, addConstant(compiler, mkyInteger(((astinteger_t *)node)->value)));
+            break;
+
+        case AST_STRING:
+            emit(compiler, OP_CONSTANT, addConstant(compiler, mkyString(((aststringliteral_t *)node)->value)));
+            break;
+
+        case AST_BOOL:
+            emit(compiler, ((astboolean_t *)node)->value ? OP_TRUE : OP_FALSE);
+            break;
+
+        case AST_PREFIXEXPR: {
+            astprefixexpression_t *exp = (astprefixexpression_t *)node;
+            if (!compile(compiler, AS_NODE(exp->right))) {
+                return false;
+            }
+
+            switch (exp->operator) {
+                case TOKEN_BANG:
+                    emit(compiler, OP_BANG);
+                    break;
+
+                case TOKEN_MINUS:
+                    emit(compiler, OP_MINUS);
+                    break;
+
+                default:
+                    return compilerError(compiler, StringCreateWithFormat("unknown operator %s", token_str[exp->operator]));
+            }
+        }
+            break;
+
+        case AST_INFIXEXPR:
+            return compileInfixExpression(compiler, (astinfixexpression_t *)node);
+
+        case AST_IFEXPR:
+            return compileIfExpression(compiler, (astifexpression_t *)node);
+
+        case AST_FNLIT:
+            return compileFunctionLiteral(compiler, (astfunctionliteral_t *)node, NULL);
+
+        case AST_CALL: {
+            astcallexpression_t *call = (astcallexpression_t *)node;
+            if (!compile(compiler, AS_NODE(call->function))) {
+                return false;
+            }
+
+            if (!compileExpressions(compiler, call->arguments)) {
+                return false;
+            }
+            emit(compiler, OP_CALL, (int)arrlen(call->arguments));
+        }
+            break;
+
+        case AST_ARRAY: {
+            astarrayliteral_t *array = (astarrayliteral_t *)node;
+            if (!compileExpressions(compiler, array->elements)) {
+                return false;
+            }
+            emit(compiler, OP_ARRAY, (int)arrlen(array->elements));
+        }
+            break;
+
+        case AST_HASH: {
+            asthashliteral_t *hash = (asthashliteral_t *)node;
+            for (int i = 0; i < hmlen(hash->pairs); i++) {
+                if (!compile(compiler, AS_NODE(hash->pairs[i].key))
+                    || !compile(compiler, AS_NODE(hash->pairs[i].value))) {
+                    return false;
+                }
+            }
+            emit(compiler, OP_HASH, (int)hmlen(hash->pairs) * 2);
+        }
+            break;
+
+        case AST_INDEXEXP: {
+            astindexexpression_t *exp = (astindexexpression_t *)node;
+            if (!compile(compiler, AS_NODE(exp->left))) {
+                return false;
+            }
+
+            if (!compile(compiler, AS_NODE(exp->index))) {
+                return false;
+            }
+            emit(compiler, OP_INDEX);
+        }
+            break;
+    }
+
+    return true;
+}
+
+bool compilerCompile(compiler_t *compiler, astnode_t *node) {
+    assert(compiler);
+    return compile(compiler, node) && ArrayCount(compiler->errors) == 0;
+}
@@ -0,0 +1,49 @@
+//
+//  compiler.h
+//  conkey
+//
+//  Lowers an astprogram_t to bytecode for the vm.
+
+#ifndef _compiler_h_
+#define _compiler_h_
+
+#include "code.h"
+#include "symboltable.h"
+#include "../ast/ast.h"
+#include "../arfoundation/arfoundation.h"
+
+typedef struct {
+    opcode_t opcode;
+    size_t position;
+} emittedinstruction_t;
+
+typedef struct {
+    instructions_t instructions;
+    emittedinstruction_t lastInstruction;
+    emittedinstruction_t previousInstruction;
+    int branchDepth; // if branches being compiled, lets in them are conditional
+} compilationscope_t;
+
+typedef struct {
+    instructions_t instructions; // owned by the compiler's main scope
+    ArrayRef constants;
+    symboltable_t *symbolTable; // globals, names them in errors
+} bytecode_t;
+
+typedef struct compiler_t compiler_t;
+struct compiler_t {
+    ArrayRef constants;
+    symboltable_t *symbolTable;
+    ArrayRef errors;
+
+    compilationscope_t *scopes;
+    int scopeIndex;
+};
+
+compiler_t *compilerCreate(void); // autoreleased
+compiler_t *compilerCreateWithState(symboltable_t *symbolTable, ArrayRef constants); // keeps globals across runs (repl)
+
+bool compilerCompile(compiler_t *compiler, astnode_t *node); // false on error, see compiler->errors
+bytecode_t compilerBytecode(compiler_t *compiler);
+
+#endif /* _compiler_h_ */
@@ -0,0 +1,423 @@
+//
+//  compiler_test.c
+//  conkey
+//
+
+#include "compiler.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "../macros.h"
+#include "../ast/ast.h"
+#include "../arfoundation/arfoundation.h"
+#include "../lexer/lexer.h"
+#include "../object/object.h"
+#include "../parser/parser.h"
+#include "../arfoundation/vendor/utest.h"
+
+// up to 16 instructions and constants per test case.
+#define COMPILER_TEST_MAX 16
+
+static instructions_t concatInstructions(instructions_t *instructions) {
+    instructions_t out = NULL;
+    for (int i = 0; i < COMPILER_TEST_MAX && instructions[i]; i++) {
+        memcpy(arraddnptr(out, arrlen(instructions[i])), instructions[i], arrlen(instructions[i]));
+        arrfree(instructions[i]);
+    }
+    return out;
+}
+
+static bool testInstructions(instructions_t *expected, instructions_t actual) {
+    instructions_t concatted = concatInstructions(expected);
+    StringRef want = codeInstructionsString(concatted);
+    StringRef got = codeInstructionsString(actual);
+    arrfree(concatted);
+
+    if (strcmp(CString(want), CString(got))) {
+        fprintf(stderr, "wrong instructions.\nwant=\n%s\ngot=\n%s\n", CString(want), CString(got));
+        return false;
+    }
+    return true;
+}
+
+static bool testConstantInteger(MkyObject *obj, int64_t expected) {
+    if (!obj || mkyType(obj) != INTEGER_OBJ) {
+        fprintf(stderr, "constant is not integer. got=%s\n", obj ? MkyObjectTypeNames[mkyType(obj)] : "<nil>");
+        return false;
+    }
+
+    if (mkyIntegerValue(obj) != expected) {
+        fprintf(stderr, "constant has wrong value. got=%lld want %lld\n", mkyIntegerValue(obj), expected);
+        return false;
+    }
+    return true;
+}
+
+static compiler_t *testCompile(const char *input) {
+    lexer_t *lexer = lexerWithInput(input);
+    parser_t *parser = parserWithLexer(lexer);
+    astprogram_t *program = parserParseProgram(parser);
+
+    compiler_t *compiler = compilerCreate();
+    compilerCompile(compiler, AS_NODE(program));
+    programRelease(&program);
+
+    return compiler;
+}
+
+UTEST(code, make) {
+    struct test {
+        instructions_t instruction;
+        uint8_t expected[4];
+        size_t length;
+    } tests[] = {
+        {codeMake(OP_CONSTANT, 65534), {OP_CONSTANT, 255, 254}, 3},
+        {codeMake(OP_ADD), {OP_ADD}, 1},
+        {codeMake(OP_GET_LOCAL, 255), {OP_GET_LOCAL, 255}, 2},
+        {codeMake(OP_CLOSURE, 65534, 255), {OP_CLOSURE, 255, 254, 255}, 4},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        ASSERT_EQ(test.length, arrlen(test.instruction));
+        ASSERT_EQ(0, memcmp(test.expected, test.instruction, test.length));
+        arrfree(test.instruction);
+    }
+}
+
+UTEST(code, instructionsString) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    instructions_t instructions[COMPILER_TEST_MAX] = {
+        codeMake(OP_ADD),
+        codeMake(OP_GET_LOCAL, 1),
+        codeMake(OP_CONSTANT, 2),
+        codeMake(OP_CONSTANT, 65535),
+        codeMake(OP_CLOSURE, 65535, 255),
+    };
+
+    const char *expected =
+    "0000 ADD\n"
+    "0001 GET_LOCAL 1\n"
+    "0003 CONSTANT 2\n"
+    "0006 CONSTANT 65535\n"
+    "0009 CLOSURE 65535 255\n";
+
+    instructions_t concatted = concatInstructions(instructions);
+    ASSERT_STREQ(expected, CString(codeInstructionsString(concatted)));
+    arrfree(concatted);
+    RCRelease(pool);
+}
+
+UTEST(compiler, integerArithmetic) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    struct test {
+        const char *input;
+        int64_t constants[COMPILER_TEST_MAX];
+        size_t constantCount;
+        instructions_t instructions[COMPILER_TEST_MAX];
+    } tests[] = {
+        {"1 + 2", {1, 2}, 2, {
+            codeMake(OP_CONSTANT, 0),
+            codeMake(OP_CONSTANT, 1),
+            codeMake(OP_ADD),
+            codeMake(OP_POP),
+        }},
+        {"1; 2", {1, 2}, 2, {
+            codeMake(OP_CONSTANT, 0),
+            codeMake(OP_POP),
+            codeMake(OP_CONSTANT, 1),
+            codeMake(OP_POP),
+        }},
+        {"2 / 1", {2, 1}, 2, {
+            codeMake(OP_CONSTANT, 0),
+            codeMake(OP_CONSTANT, 1),
+            codeMake(OP_DIV),
+            codeMake(OP_POP),
+        }},
+        {"1 < 2", {1, 2}, 2, {
+            codeMake(OP_CONSTANT, 0),
+            codeMake(OP_CONSTANT, 1),
+            codeMake(OP_LESS_THAN),
+            codeMake(OP_POP),
+        }},
+        {"-1", {1}, 1, {
+            codeMake(OP_CONSTANT, 0),
+            codeMake(OP_MINUS),
+            codeMake(OP_POP),
+        }},
+        {"!true", {0}, 0, {
+            codeMake(OP_TRUE),
+            codeMake(OP_BANG),
+            codeMake(OP_POP),
+        }},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        compiler_t *compiler = testCompile(test.input);
+        ASSERT_EQ(0, ArrayCount(compiler->errors));
+
+        bytecode_t bytecode = compilerBytecode(compiler);
+        ASSERT_TRUE(testInstructions(test.instructions, bytecode.instructions));
+
+        ASSERT_EQ(test.constantCount, ArrayCount(bytecode.constants));
+        for (int c = 0; c < test.constantCount; c++) {
+            ASSERT_TRUE(testConstantInteger(ArrayObjectAt(bytecode.constants, c), test.constants[c]));
+        }
+    }
+    RCRelease(pool);
+}
+
+UTEST(compiler, conditionalsAndGlobals) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    struct test {
+        const char *input;
+        instructions_t instructions[COMPILER_TEST_MAX];
+    } tests[] = {
+        {"if (true) { 10 }; 3333;", {
+            codeMake(OP_TRUE),                // 0000
+            codeMake(OP_JUMP_NOT_TRUTHY, 10), // 0001
+            codeMake(OP_CONSTANT, 0),         // 0004
+            codeMake(OP_JUMP, 11),            // 0007
+            codeMake(OP_NULL),                // 0010
+            codeMake(OP_POP),                 // 0011
+            codeMake(OP_CONSTANT, 1),         // 0012
+            codeMake(OP_POP),                 // 0015
+        }},
+        {"if (true) { 10 } else { 20 }; 3333;", {
+            codeMake(OP_TRUE),                // 0000
+            codeMake(OP_JUMP_NOT_TRUTHY, 10), // 0001
+            codeMake(OP_CONSTANT, 0),         // 0004
+            codeMake(OP_JUMP, 13),            // 0007
+            codeMake(OP_CONSTANT, 1),         // 0010
+            codeMake(OP_POP),                 // 0013
+            codeMake(OP_CONSTANT, 2),         // 0014
+            codeMake(OP_POP),                 // 0017
+        }},
+        {"let one = 1; let two = one; two;", {
+            codeMake(OP_CONSTANT, 0),
+            codeMake(OP_SET_GLOBAL, 0),
+            codeMake(OP_GET_GLOBAL, 0),
+            codeMake(OP_SET_GLOBAL, 1),
+            codeMake(OP_GET_GLOBAL, 1),
+            codeMake(OP_POP),
+        }},
+        {"let one = 1; let one = one + 1;", {
+            codeMake(OP_CONSTANT, 0),
+            codeMake(OP_SET_GLOBAL, 0),
+            codeMake(OP_GET_GLOBAL, 0),
+            codeMake(OP_CONSTANT, 1),
+            codeMake(OP_ADD),
+            codeMake(OP_SET_GLOBAL, 0),
+        }},
+        {"len([]); push([], 1);", {
+            codeMake(OP_GET_BUILTIN, 0),
+            codeMake(OP_ARRAY, 0),
+            codeMake(OP_CALL, 1),
+            codeMake(OP_POP),
+            codeMake(OP_GET_BUILTIN, 5),
+            codeMake(OP_ARRAY, 0),
+            codeMake(OP_CONSTANT, 0),
+            codeMake(OP_CALL, 2),
+            codeMake(OP_POP),
+        }},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        compiler_t *compiler = testCompile(test.input);
+        ASSERT_EQ(0, ArrayCount(compiler->errors));
+        ASSERT_TRUE(testInstructions(test.instructions, compilerBytecode(compiler).instructions));
+    }
+    RCRelease(pool);
+}
+
+UTEST(compiler, functionsAndClosures) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    struct test {
+        const char *input;
+        int constantIndex;
+        instructions_t instructions[COMPILER_TEST_MAX];
+    } tests[] = {
+        {"fn() { return 5 + 10 }", 2, {
+            codeMake(OP_CONSTANT, 0),
+            codeMake(OP_CONSTANT, 1),
+            codeMake(OP_ADD),
+            codeMake(OP_RETURN_VALUE),
+        }},
+        {"fn() { }", 0, {
+            codeMake(OP_RETURN),
+        }},
+        {"fn() { let num = 55; num }", 1, {
+            codeMake(OP_CONSTANT, 0),
+            codeMake(OP_SET_LOCAL, 0),
+            codeMake(OP_MOVE_LOCAL, 0),
+            codeMake(OP_RETURN_VALUE),
+        }},
+        {"fn(a) { fn(b) { a + b } }", 0, {
+            codeMake(OP_GET_FREE, 0),
+            codeMake(OP_MOVE_LOCAL, 0),
+            codeMake(OP_ADD),
+            codeMake(OP_RETURN_VALUE),
+        }},
+        {"fn(a) { fn(b) { a + b } }", 1, {
+            codeMake(OP_MOVE_LOCAL, 0),
+            codeMake(OP_CLOSURE, 0, 1),
+            codeMake(OP_RETURN_VALUE),
+        }},
+        {"let countDown = fn(x) { countDown(x - 1); };", 1, {
+            codeMake(OP_CURRENT_CLOSURE),
+            codeMake(OP_MOVE_LOCAL, 0),
+            codeMake(OP_CONSTANT, 0),
+            codeMake(OP_SUB),
+            codeMake(OP_CALL, 1),
+            codeMake(OP_RETURN_VALUE),
+        }},
+        // a local's last read moves it, one that's read again or set afterwards doesn't count.
+        {"fn(a) { a + a }", 0, {
+            codeMake(OP_GET_LOCAL, 0),
+            codeMake(OP_MOVE_LOCAL, 0),
+            codeMake(OP_ADD),
+            codeMake(OP_RETURN_VALUE),
+        }},
+        {"fn(a) { let a = push(a, 1); a }", 1, {
+            codeMake(OP_GET_BUILTIN, 5),
+            codeMake(OP_MOVE_LOCAL, 0),
+            codeMake(OP_CONSTANT, 0),
+            codeMake(OP_CALL, 2),
+            codeMake(OP_SET_LOCAL, 0),
+            codeMake(OP_MOVE_LOCAL, 0),
+            codeMake(OP_RETURN_VALUE),
+        }},
+        {"fn(a, b) { if (b) { a }; a }", 0, {
+            codeMake(OP_MOVE_LOCAL, 1),
+            codeMake(OP_JUMP_NOT_TRUTHY, 10),
+            codeMake(OP_GET_LOCAL, 0),
+            codeMake(OP_JUMP, 11),
+            codeMake(OP_NULL),
+            codeMake(OP_POP),
+            codeMake(OP_MOVE_LOCAL, 0),
+            codeMake(OP_RETURN_VALUE),
+        }},
+        // a let that may not have run is read with a check, falling back to the global.
+        {"let x = 10; fn(c) { if (c) { let x = 1; }; x }", 2, {
+            codeMake(OP_MOVE_LOCAL, 0),
+            codeMake(OP_JUMP_NOT_TRUTHY, 14),
+            codeMake(OP_CONSTANT, 1),
+            codeMake(OP_SET_LOCAL, 1),
+            codeMake(OP_NULL),
+            codeMake(OP_JUMP, 15),
+            codeMake(OP_NULL),
+            codeMake(OP_POP),
+            codeMake(OP_GET_LOCAL_OR, 23, 1),
+            codeMake(OP_GET_GLOBAL, 0),
+            codeMake(OP_RETURN_VALUE),
+        }},
+        {"fn(a, b) { if (b) { a } else { 1 } }", 1, {
+            codeMake(OP_MOVE_LOCAL, 1),
+            codeMake(OP_JUMP_NOT_TRUTHY, 10),
+            codeMake(OP_MOVE_LOCAL, 0),
+            codeMake(OP_JUMP, 13),
+            codeMake(OP_CONSTANT, 0),
+            codeMake(OP_RETURN_VALUE),
+        }},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        compiler_t *compiler = testCompile(test.input);
+        ASSERT_EQ(0, ArrayCount(compiler->errors));
+
+        MkyObject *fn = ArrayObjectAt(compiler->constants, test.constantIndex);
+        ASSERT_EQ(COMPILED_FUNCTION_OBJ, mkyType(fn));
+        ASSERT_TRUE(testInstructions(test.instructions, mkyCompiledFunctionInstructions((MkyCompiledFunctionRef)fn)));
+    }
+    RCRelease(pool);
+}
+
+UTEST(compiler, errors) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+
+    // unknown names are globals no let has set yet, reading one fails when it runs, like in the evaluator.
+    compiler_t *compiler = testCompile("let a = 1; b");
+    ASSERT_EQ(0, ArrayCount(compiler->errors));
+
+    // operands that don't fit their width fail the compilation, once each.
+    StringRef locals = StringWithChars("fn() { ");
+    for (int i = 0; i < 300; i++) {
+        char name[4] = { 'v', 'a' + i / 26, 'a' + i % 26, '\0' };
+        StringAppendFormat(locals, "let %s = %d; %s; ", name, i, name);
+    }
+    StringAppendChars(locals, "}");
+
+    StringRef arguments = StringWithChars("len(");
+    for (int i = 0; i < 300; i++) {
+        StringAppendFormat(arguments, "%s%d", i ? ", " : "", i);
+    }
+    StringAppendChars(arguments, ")");
+
+    struct test {
+        const char *input;
+        const char *expected;
+    } tests[] = {
+        {CString(locals), "too many locals"},
+        {CString(arguments), "too many arguments"},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        compiler = testCompile(test.input);
+        ASSERT_EQ(1, ArrayCount(compiler->errors));
+        ASSERT_STREQ(test.expected, CString(ArrayObjectAt(compiler->errors, 0)));
+    }
+    RCRelease(pool);
+}
+
+UTEST(symbolTable, resolveNestedAndFree) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    symboltable_t *global = symbolTableCreate();
+    symbolTableDefine(global, StringWithChars("a"));
+    symbolTableDefineBuiltin(global, 3, "len");
+
+    symboltable_t *first = symbolTableCreateEnclosedIn(global);
+    symbolTableDefine(first, StringWithChars("b"));
+
+    symboltable_t *second = symbolTableCreateEnclosedIn(first);
+    symbolTableDefine(second, StringWithChars("c"));
+
+    struct test {
+        const char *name;
+        symbol_scope scope;
+        int index;
+    } tests[] = {
+        {"a", SYMBOL_SCOPE_GLOBAL, 0},
+        {"len", SYMBOL_SCOPE_BUILTIN, 3},
+        {"b", SYMBOL_SCOPE_FREE, 0},
+        {"c", SYMBOL_SCOPE_LOCAL, 0},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        symbol_t symbol;
+        ASSERT_TRUE(symbolTableResolve(second, StringWithChars(test.name), &symbol));
+        ASSERT_STREQ(test.name, symbol.name);
+        ASSERT_EQ(test.scope, symbol.scope);
+        ASSERT_EQ(test.index, symbol.index);
+    }
+
+    ASSERT_EQ(1, symbolTableFreeSymbolCount(second));
+    ASSERT_EQ(SYMBOL_SCOPE_LOCAL, symbolTableFreeSymbolAt(second, 0).scope);
+
+    symbol_t symbol;
+    ASSERT_FALSE(symbolTableResolve(second, StringWithChars("d"), &symbol));
+
+    RCRelease(second);
+    RCRelease(first);
+    RCRelease(global);
+    RCRelease(pool);
+}
+
+#ifndef AR_COMPOUND_TEST
+UTEST_MAIN();
+#endif
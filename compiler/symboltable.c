@@ -0,0 +1,196 @@
+//
+//  symboltable.c
+//  conkey
+//
+
+#include "symboltable.h"
+
+#include <assert.h>
+
+#include "../arfoundation/arfoundation.h"
+
+typedef struct {
+    char *key;
+    symbol_t value;
+} symbol_storage;
+
+struct symboltable_t {
+    symboltable_t *outer;
+    symbol_storage *store;
+    symbol_storage *shadowed; // what conditional symbols replaced, or resolved to in the outer tables
+    symbol_t *freeSymbols;
+    int numDefinitions;
+};
+
+static void symbolTableDealloc(RCTypeRef obj) {
+    symboltable_t *self = obj;
+    shfree(self->store);
+    shfree(self->shadowed);
+    arrfree(self->freeSymbols);
+    self->outer = RCRelease(self->outer);
+}
+
+static RuntimeClassID MkySymbolTableClassID = { 0 };
+static RuntimeClassDescriptor MkySymbolTableClass = {
+    "MkySymbolTable",
+    sizeof(struct symboltable_t),
+    NULL, // const
+    symbolTableDealloc,
+    NULL,
+    NULL
+};
+
+symboltable_t *symbolTableCreate(void) {
+    RuntimeRegisterClassOnce(&MkySymbolTableClassID, &MkySymbolTableClass);
+
+    symboltable_t *table = RuntimeCreateInstance(MkySymbolTableClassID);
+    sh_new_strdup(table->store);
+    sh_new_strdup(table->shadowed);
+    return table;
+}
+
+symboltable_t *symbolTableCreateEnclosedIn(symboltable_t *outer) {
+    symboltable_t *table = symbolTableCreate();
+    table->outer = RCRetain(outer);
+    return table;
+}
+
+symboltable_t *symbolTableOuter(symboltable_t *table) {
+    return table->outer;
+}
+
+static symbol_t symbolTableStore(symboltable_t *table, const char *name, symbol_scope scope, int index) {
+    symbol_t symbol = { NULL, scope, index, false };
+    shput(table->store, name, symbol);
+
+    symbol_storage *stored = shgetp(table->store, name);
+    stored->value.name = stored->key;
+    return stored->value;
+}
+
+symbol_t symbolTableDefine(symboltable_t *table, StringRef name) {
+    assert(table);
+    symbol_scope scope = table->outer ? SYMBOL_SCOPE_LOCAL : SYMBOL_SCOPE_GLOBAL;
+
+    // rebinding a name in the same scope reuses its slot, like the evaluator's environment does.
+    symbol_storage *existing = shgetp_null(table->store, CString(name));
+    if (existing && existing->value.scope == scope) {
+        existing->value.conditional = false;
+        return existing->value;
+    }
+
+    return symbolTableStore(table, CString(name), scope, table->numDefinitions++);
+}
+
+symbol_t symbolTableDefineConditional(symboltable_t *table, StringRef name) {
+    assert(table);
+    symbol_scope scope = table->outer ? SYMBOL_SCOPE_LOCAL : SYMBOL_SCOPE_GLOBAL;
+
+    // a name a let outside of a branch already set stays set.
+    symbol_storage *existing = shgetp_null(table->store, CString(name));
+    if (existing && existing->value.scope == scope) {
+        return existing->value;
+    }
+
+    if (existing) {
+        shput(table->shadowed, existing->key, existing->value);
+    }
+
+    symbolTableStore(table, CString(name), scope, table->numDefinitions++);
+    symbol_storage *stored = shgetp(table->store, CString(name));
+    stored->value.conditional = true;
+    return stored->value;
+}
+
+symbol_t symbolTableDefineBuiltin(symboltable_t *table, int index, const char *name) {
+    assert(table);
+    return symbolTableStore(table, name, SYMBOL_SCOPE_BUILTIN, index);
+}
+
+symbol_t symbolTableDefineFunctionName(symboltable_t *table, StringRef name) {
+    assert(table);
+    return symbolTableStore(table, CString(name), SYMBOL_SCOPE_FUNCTION, 0);
+}
+
+static symbol_t symbolTableDefineFree(symboltable_t *table, symbol_t original) {
+    arrput(table->freeSymbols, original);
+    return symbolTableStore(table, original.name, SYMBOL_SCOPE_FREE, (int)arrlen(table->freeSymbols) - 1);
+}
+
+bool symbolTableResolve(symboltable_t *table, StringRef name, symbol_t *symbol) {
+    assert(table);
+
+    symbol_storage *stored = shgetp_null(table->store, CString(name));
+    if (stored) {
+        *symbol = stored->value;
+        return true;
+    }
+
+    if (!table->outer) {
+        return false;
+    }
+
+    symbol_t outer;
+    if (!symbolTableResolve(table->outer, name, &outer)) {
+        return false;
+    }
+
+    if (outer.scope == SYMBOL_SCOPE_GLOBAL || outer.scope == SYMBOL_SCOPE_BUILTIN) {
+        *symbol = outer;
+        return true;
+    }
+
+    *symbol = symbolTableDefineFree(table, outer);
+    return true;
+}
+
+// the binding a conditional symbol's unset reads go to: the one it replaced in this table, or else the name
+// resolved in the outer tables, captured as a free symbol that doesn't take the name over.
+bool symbolTableResolveFallback(symboltable_t *table, const char *name, symbol_t *symbol) {
+    assert(table);
+
+    symbol_storage *shadowed = shgetp_null(table->shadowed, name);
+    if (shadowed) {
+        *symbol = shadowed->value;
+        return true;
+    }
+
+    symbol_t outer;
+    if (!table->outer || !symbolTableResolve(table->outer, StringWithChars(name), &outer)) {
+        return false;
+    }
+
+    if (outer.scope != SYMBOL_SCOPE_GLOBAL && outer.scope != SYMBOL_SCOPE_BUILTIN) {
+        arrput(table->freeSymbols, outer);
+        outer = (symbol_t){ outer.name, SYMBOL_SCOPE_FREE, (int)arrlen(table->freeSymbols) - 1, false };
+    }
+    shput(table->shadowed, name, outer);
+    *symbol = outer;
+    return true;
+}
+
+const char *symbolTableGlobalName(symboltable_t *table, int index) {
+    if (!table) {
+        return NULL;
+    }
+
+    for (ptrdiff_t i = 0; i < shlen(table->store); i++) {
+        if (table->store[i].value.scope == SYMBOL_SCOPE_GLOBAL && table->store[i].value.index == index) {
+            return table->store[i].key;
+        }
+    }
+    return NULL;
+}
+
+int symbolTableNumDefinitions(symboltable_t *table) {
+    return table->numDefinitions;
+}
+
+size_t symbolTableFreeSymbolCount(symboltable_t *table) {
+    return arrlen(table->freeSymbols);
+}
+
+symbol_t symbolTableFreeSymbolAt(symboltable_t *table, size_t index) {
+    assert(index < arrlen(table->freeSymbols));
+    return table->freeSymbols[index];
+}
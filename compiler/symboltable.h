@@ -0,0 +1,46 @@
+//
+//  symboltable.h
+//  conkey
+//
+
+#ifndef _symboltable_h_
+#define _symboltable_h_
+
+#include <stdbool.h>
+
+#include "../arfoundation/arfoundation.h"
+
+typedef enum {
+    SYMBOL_SCOPE_GLOBAL,
+    SYMBOL_SCOPE_LOCAL,
+    SYMBOL_SCOPE_BUILTIN,
+    SYMBOL_SCOPE_FREE,
+    SYMBOL_SCOPE_FUNCTION,
+} symbol_scope;
+
+typedef struct {
+    const char *name; // owned by the table that defined it
+    symbol_scope scope;
+    int index;
+    bool conditional; // a local or global only some paths have set so far, reads check it
+} symbol_t;
+
+typedef struct symboltable_t symboltable_t;
+
+symboltable_t *symbolTableCreate(void);
+symboltable_t *symbolTableCreateEnclosedIn(symboltable_t *outer);
+symboltable_t *symbolTableOuter(symboltable_t *table);
+
+symbol_t symbolTableDefine(symboltable_t *table, StringRef name);
+symbol_t symbolTableDefineConditional(symboltable_t *table, StringRef name); // a let in an if's branch
+bool symbolTableResolveFallback(symboltable_t *table, const char *name, symbol_t *symbol); // what name was before table defined it
+symbol_t symbolTableDefineBuiltin(symboltable_t *table, int index, const char *name);
+symbol_t symbolTableDefineFunctionName(symboltable_t *table, StringRef name);
+bool symbolTableResolve(symboltable_t *table, StringRef name, symbol_t *symbol);
+const char *symbolTableGlobalName(symboltable_t *table, int index); // NULL if no global has that index, for error messages
+
+int symbolTableNumDefinitions(symboltable_t *table);
+size_t symbolTableFreeSymbolCount(symboltable_t *table);
+symbol_t symbolTableFreeSymbolAt(symboltable_t *table, size_t index);
+
+#endif /* _symboltable_h_ */
@@ -11,8 +11,11 @@
 #include "../object/object.h"
 
 struct MkyEnvironment {
-    DictionaryRef store;
     MkyEnvironmentRef outer;
+    MkyObject **slots; // stb_ds array when growable, otherwise points at inlineSlots
+    size_t count;
+    bool growable;
+    MkyObject *inlineSlots[];
 };
 
 static RuntimeClassID MkyEnvironmentClassID = { 0 };
@@ -20,7 +23,24 @@ static RuntimeClassID MkyEnvironmentClassID = { 0 };
 static void environmentDestructor(RCTypeRef env) {
     MkyEnvironmentRef self = env;
 
-    self->store = RCRelease(self->store);
+    for (size_t i = 0; i < self->count; i++) {
+        RCRelease(self->slots[i]);
+    }
+
+    if (self->growable) {
+        arrfree(self->slots);
+    }
+
+    self->outer = RCRelease(self->outer);
+}
+
+static void environmentTraverse(RCTypeRef env, visitor_fn *visit, void *context) {
+    MkyEnvironmentRef self = env;
+
+    visit(self->outer, context);
+    for (size_t i = 0; i < self->count; i++) {
+        visit(self->slots[i], context);
+    }
 }
 
 static RuntimeClassDescriptor MkyEnvironmentClass = {
@@ -29,43 +49,62 @@ static RuntimeClassDescriptor MkyEnvironmentClass = {
     NULL, // const
     environmentDestructor,
     NULL,
-    NULL
+    NULL,
+    environmentTraverse
 };
 
-static void MkyEnvironmentInitialize(void) {
-    MkyEnvironmentClassID = RuntimeRegisterClass(&MkyEnvironmentClass);
-}
-
 MkyEnvironmentRef environmentCreate(void) {
-    if (MkyEnvironmentClassID.classID == 0) {
-        MkyEnvironmentInitialize();
-    }
+    RuntimeRegisterClassOnce(&MkyEnvironmentClassID, &MkyEnvironmentClass);
 
     MkyEnvironmentRef env = RuntimeCreateInstance(MkyEnvironmentClassID);
 
-    env->store = DictionaryCreate();
+    env->slots = NULL;
+    env->count = 0;
+    env->growable = true;
     env->outer = NULL;
 
     return env;
 }
 
-MkyObject *environmentObjectForKey(MkyEnvironmentRef env, StringRef key) {
-    MkyObject *obj = DictionaryObjectForKey(env->store, key);
+MkyEnvironmentRef environmentCreateEnclosedIn(MkyEnvironmentRef outer, size_t slotCount) {
+    RuntimeRegisterClassOnce(&MkyEnvironmentClassID, &MkyEnvironmentClass);
 
-    if (!obj && env->outer) {
-        obj = environmentObjectForKey(env->outer, key);
-    }
+    // variable sized, slots are stored inline.
+    MkyEnvironmentRef env = RuntimeRCAlloc(sizeof(struct MkyEnvironment) + sizeof(MkyObject *) * slotCount, MkyEnvironmentClassID);
+
+    env->slots = env->inlineSlots;
+    env->count = slotCount;
+    env->growable = false;
+    env->outer = RCRetain(outer); // closures keep their defining environment alive, cycles are left to the collector.
 
-    return obj;
+    return env;
 }
 
-MkyObject *environmentSetObjectForKey(MkyEnvironmentRef env, StringRef key, MkyObject *value) {
-    DictionarySetObjectForKey(env->store, key, value);
-    return value;
+MkyObject *environmentObjectAt(MkyEnvironmentRef env, int depth, int slot) {
+    assert(slot >= 0);
+    while (depth-- > 0) {
+        env = env->outer;
+        assert(env);
+    }
+
+    if (slot >= env->count) {
+        return NULL; // global the resolver knows about but nothing has set yet.
+    }
+    return env->slots[slot];
 }
 
-MkyEnvironmentRef environmentCreateEnclosedIn(MkyEnvironmentRef outer) {
-    MkyEnvironmentRef env = environmentCreate();
-    env->outer = outer; // outer is the enclosing one that will have a reftree to this
-    return env;
+MkyObject *environmentSetObjectAt(MkyEnvironmentRef env, int slot, MkyObject *value) {
+    assert(slot >= 0);
+    if (slot >= env->count) {
+        assert(env->growable);
+        size_t count = slot + 1;
+        arrsetlen(env->slots, count);
+        memset(env->slots + env->count, 0, sizeof(MkyObject *) * (count - env->count));
+        env->count = count;
+    }
+
+    RCRetain(value);
+    RCRelease(env->slots[slot]);
+    env->slots[slot] = value;
+    return value;
 }
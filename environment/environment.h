@@ -6,16 +6,21 @@
 #ifndef environment_h
 #define environment_h
 
+#include <stddef.h>
+
 #include "../token/token.h"
 #include "../arfoundation/string.h"
 
 typedef struct MkyEnvironment *MkyEnvironmentRef;
 
+// bindings live in slots assigned by the resolver, see resolver/resolver.h.
+// the global environment grows as the resolver hands out new slots, function environments are fixed size.
 MkyEnvironmentRef environmentCreate(void);
-MkyEnvironmentRef environmentCreateEnclosedIn(MkyEnvironmentRef outer);
+MkyEnvironmentRef environmentCreateEnclosedIn(MkyEnvironmentRef outer, size_t slotCount);
 
 typedef struct MkyObject MkyObject;
-MkyObject *environmentObjectForKey(MkyEnvironmentRef env, StringRef key);
-MkyObject *environmentSetObjectForKey(MkyEnvironmentRef env, StringRef key, MkyObject *value);
+// NULL if the slot hasn't been set yet.
+MkyObject *environmentObjectAt(MkyEnvironmentRef env, int depth, int slot);
+MkyObject *environmentSetObjectAt(MkyEnvironmentRef env, int slot, MkyObject *value);
 
 #endif /* environment_h */
@@ -6,6 +6,7 @@
 #include "builtins.h"
 
 #include <assert.h>
+#include <pthread.h>
 
 #include "../arfoundation/arfoundation.h"
 
@@ -20,16 +21,20 @@ static MkyObject *lenFn(ArrayRef args) {
     }
 
     MkyObject *container = ArrayFirst(args);
-    if (container->type == STRING_OBJ) {
-        return mkyInteger(StringLength(mkyStringValue(container)));
+    if (mkyType(container) == STRING_OBJ) {
+        return mkyInteger(mkyStringLength(container));
     }
 
-    if (container->type == ARRAY_OBJ) {
+    if (mkyType(container) == ARRAY_OBJ) {
         MkyArrayRef array = (MkyArrayRef)container;
         return mkyInteger(ArrayCount(mkyArrayElements(array)));
     }
 
-    return mkyError(StringWithFormat("argument to 'len' not supported, got %s", MkyObjectTypeNames[container->type]));
+    if (mkyType(container) == HASH_OBJ) {
+        return mkyInteger(mkyHashCount((MkyHashRef)container));
+    }
+
+    return mkyError(StringWithFormat("argument to 'len' not supported, got %s", MkyObjectTypeNames[mkyType(container)]));
 }
 
 static MkyObject *firstFn(ArrayRef args) {
@@ -38,8 +43,8 @@ static MkyObject *firstFn(ArrayRef args) {
     }
 
     MkyObject *container = ArrayFirst(args);
-    if (container->type != ARRAY_OBJ) {
-        return mkyError(StringWithFormat("argument to 'first' must be ARRAY, got %s", MkyObjectTypeNames[container->type]));
+    if (mkyType(container) != ARRAY_OBJ) {
+        return mkyError(StringWithFormat("argument to 'first' must be ARRAY, got %s", MkyObjectTypeNames[mkyType(container)]));
     }
 
     MkyArrayRef array = (MkyArrayRef)container;
@@ -57,8 +62,8 @@ static MkyObject *lastFn(ArrayRef args) {
     }
 
     MkyObject *container = ArrayFirst(args);
-    if (container->type != ARRAY_OBJ) {
-        return mkyError(StringWithFormat("argument to 'last' must be ARRAY, got %s", MkyObjectTypeNames[container->type]));
+    if (mkyType(container) != ARRAY_OBJ) {
+        return mkyError(StringWithFormat("argument to 'last' must be ARRAY, got %s", MkyObjectTypeNames[mkyType(container)]));
     }
 
     MkyArrayRef array = (MkyArrayRef)container;
@@ -76,40 +81,41 @@ static MkyObject *restFn(ArrayRef args) {
     }
 
     MkyObject *container = ArrayFirst(args);
-    if (container->type != ARRAY_OBJ) {
-        return mkyError(StringWithFormat("argument to 'last' must be ARRAY, got %s", MkyObjectTypeNames[container->type]));
+    if (mkyType(container) != ARRAY_OBJ) {
+        return mkyError(StringWithFormat("argument to 'last' must be ARRAY, got %s", MkyObjectTypeNames[mkyType(container)]));
     }
 
     MkyArrayRef array = (MkyArrayRef)container;
     ArrayRef elements = mkyArrayElements(array);
     if (ArrayCount(elements) > 0) {
-        ArrayRef rest = Array();
-        for (int i = 1; i < ArrayCount(elements); i++) {
-            ArrayAppend(rest, ArrayObjectAt(elements, i));
-        }
+        ArrayRef rest = RCAutorelease(ArrayCreateWithRest(elements, 1));
         return mkyArray(rest);
     }
 
     return mkyNull();
 }
 
+// a new array with the element added, or the same array grown in place when args holds the only reference to it
+// (the vm hands a local over on its last read).
 static MkyObject *pushFn(ArrayRef args) {
     if (ArrayCount(args) != 2) {
         return mkyError(StringWithFormat("wrong number of arguments. got=%ld, want=2", ArrayCount(args)));
     }
 
     MkyObject *first = ArrayFirst(args);
-    if (first->type != ARRAY_OBJ) {
-        return mkyError(StringWithFormat("argument to 'last' must be ARRAY, got %s", MkyObjectTypeNames[first->type]));
+    if (mkyType(first) != ARRAY_OBJ) {
+        return mkyError(StringWithFormat("argument to 'last' must be ARRAY, got %s", MkyObjectTypeNames[mkyType(first)]));
     }
 
     MkyArrayRef array = (MkyArrayRef)first;
     ArrayRef source = mkyArrayElements(array);
     if (ArrayCount(source) > 0) {
-        ArrayRef elements = Array();
-        for (int i = 0; i < ArrayCount(source); i++) {
-            ArrayAppend(elements, ArrayObjectAt(source, i));
+        if (mkyArrayIsUnique(array)) {
+            ArrayAppend(source, ArrayObjectAt(args, 1));
+            return first;
         }
+
+        ArrayRef elements = RCAutorelease(ArrayCreateWithArray(source));
         ArrayAppend(elements, ArrayObjectAt(args, 1));
         return mkyArray(elements);
     }
@@ -122,8 +128,9 @@ static MkyObject *putsFn(ArrayRef args) {
         return mkyNull();
     }
 
-    for (int i = 0; i < ArrayCount(args); i++) {
-        MkyObject *obj = ArrayObjectAt(args, i);
+    ArrayIterator iterator = ArrayIteratorMake(args);
+    RCTypeRef obj;
+    while (ArrayIteratorNext(&iterator, &obj)) {
         StringRef inspect = mkyInspect(obj);
         printf("%s\n", CString(inspect));
     }
@@ -131,21 +138,141 @@ static MkyObject *putsFn(ArrayRef args) {
     return mkyNull();
 }
 
-MkyBuiltinRef builtinWithName(StringRef name) {
-    static builtins_storage *_builtins = NULL;
+// slice(string or array, start[, end]). Long string slices are views into the original string,
+// array slices share the original's storage, nothing is copied either way.
+static MkyObject *sliceFn(ArrayRef args) {
+    if (ArrayCount(args) != 2 && ArrayCount(args) != 3) {
+        return mkyError(StringWithFormat("wrong number of arguments. got=%ld, want=2 or 3", ArrayCount(args)));
+    }
+
+    MkyObject *container = ArrayFirst(args);
+    if (mkyType(container) != STRING_OBJ && mkyType(container) != ARRAY_OBJ) {
+        return mkyError(StringWithFormat("argument to 'slice' must be STRING or ARRAY, got %s", MkyObjectTypeNames[mkyType(container)]));
+    }
 
-    if (!_builtins) {
-        shput(_builtins, "len", RCRetain(mkyBuiltIn(lenFn)));
-        shput(_builtins, "first", RCRetain(mkyBuiltIn(firstFn)));
-        shput(_builtins, "last", RCRetain(mkyBuiltIn(lastFn)));
-        shput(_builtins, "rest", RCRetain(mkyBuiltIn(restFn)));
-        shput(_builtins, "push", RCRetain(mkyBuiltIn(pushFn)));
-        shput(_builtins, "puts", RCRetain(mkyBuiltIn(putsFn)));
+    for (int i = 1; i < ArrayCount(args); i++) {
+        MkyObject *index = ArrayObjectAt(args, i);
+        if (mkyType(index) != INTEGER_OBJ) {
+            return mkyError(StringWithFormat("slice bounds must be INTEGER, got %s", MkyObjectTypeNames[mkyType(index)]));
+        }
     }
 
+    ArrayRef elements = mkyType(container) == ARRAY_OBJ ? mkyArrayElements((MkyArrayRef)container) : NULL;
+    int64_t length = mkyType(container) == ARRAY_OBJ ? ArrayCount(elements) : mkyStringLength(container);
+    int64_t start = mkyIntegerValue(ArrayObjectAt(args, 1));
+    int64_t end = ArrayCount(args) == 3 ? mkyIntegerValue(ArrayObjectAt(args, 2)) : length;
+    if (start < 0 || end < start || end > length) {
+        return mkyError(StringWithFormat("slice bounds out of range [%lld:%lld] with length %lld", (long long)start, (long long)end, (long long)length));
+    }
+
+    if (mkyType(container) == ARRAY_OBJ) {
+        return mkyArray(RCAutorelease(elements ? ArrayCreateWithRange(elements, start, end - start) : ArrayCreate()));
+    }
+    return mkyStringSlice(container, start, end - start);
+}
+
+// set and delete return a new hash, sharing all but the path to the key with the one they got.
+// Like push, they change the one they got instead when nothing else can see it.
+static MkyObject *setFn(ArrayRef args) {
+    if (ArrayCount(args) != 3) {
+        return mkyError(StringWithFormat("wrong number of arguments. got=%ld, want=3", ArrayCount(args)));
+    }
+
+    MkyObject *container = ArrayFirst(args);
+    if (mkyType(container) != HASH_OBJ) {
+        return mkyError(StringWithFormat("argument to 'set' must be HASH, got %s", MkyObjectTypeNames[mkyType(container)]));
+    }
+
+    MkyObject *key = ArrayObjectAt(args, 1);
+    if (!mkyIsHashable(key)) {
+        return mkyError(StringWithFormat("unusable as hash key: %s", MkyObjectTypeNames[mkyType(key)]));
+    }
+
+    MkyHashRef hash = mkyHashIsUnique((MkyHashRef)container) ? (MkyHashRef)container : (MkyHashRef)mkyHashCopy((MkyHashRef)container);
+    mkyHashSetObjectForKey(hash, key, ArrayObjectAt(args, 2));
+    return (MkyObject *)hash;
+}
+
+static MkyObject *deleteFn(ArrayRef args) {
+    if (ArrayCount(args) != 2) {
+        return mkyError(StringWithFormat("wrong number of arguments. got=%ld, want=2", ArrayCount(args)));
+    }
+
+    MkyObject *container = ArrayFirst(args);
+    if (mkyType(container) != HASH_OBJ) {
+        return mkyError(StringWithFormat("argument to 'delete' must be HASH, got %s", MkyObjectTypeNames[mkyType(container)]));
+    }
+
+    MkyObject *key = ArrayObjectAt(args, 1);
+    if (!mkyIsHashable(key)) {
+        return mkyError(StringWithFormat("unusable as hash key: %s", MkyObjectTypeNames[mkyType(key)]));
+    }
+
+    if (!mkyHashObjectForKey((MkyHashRef)container, key)) {
+        return container;
+    }
+
+    MkyHashRef hash = mkyHashIsUnique((MkyHashRef)container) ? (MkyHashRef)container : (MkyHashRef)mkyHashCopy((MkyHashRef)container);
+    mkyHashRemoveObjectForKey(hash, key);
+    return (MkyObject *)hash;
+}
+
+// order matters, the compiler refers to builtins by index.
+static const struct {
+    const char *name;
+    builtin_fn *fn;
+} builtinDefinitions[] = {
+    { "len", lenFn },
+    { "puts", putsFn },
+    { "first", firstFn },
+    { "last", lastFn },
+    { "rest", restFn },
+    { "push", pushFn },
+    { "slice", sliceFn },
+    { "set", setFn },
+    { "delete", deleteFn },
+};
+
+static const size_t builtinDefinitionsCount = sizeof(builtinDefinitions) / sizeof(builtinDefinitions[0]);
+
+// constants shared by every thread, built by whichever one asks first.
+static pthread_once_t builtinsOnce = PTHREAD_ONCE_INIT;
+static MkyBuiltinRef *_instances = NULL;
+static builtins_storage *_builtins = NULL;
+
+static void builtinsInitialize(void) {
+    for (size_t i = 0; i < builtinDefinitionsCount; i++) {
+        MkyBuiltinRef builtin = RuntimeMakeConstant(mkyBuiltIn(builtinDefinitions[i].fn));
+        arrput(_instances, builtin);
+        shput(_builtins, builtinDefinitions[i].name, builtin);
+    }
+}
+
+static MkyBuiltinRef *builtinInstances(void) {
+    pthread_once(&builtinsOnce, builtinsInitialize);
+    return _instances;
+}
+
+MkyBuiltinRef builtinWithName(StringRef name) {
+    pthread_once(&builtinsOnce, builtinsInitialize);
+
     const char *key = CString(name);
     MkyBuiltinRef builtin = shget(_builtins, key);
-    assert(!builtin || ((MkyObject *)builtin)->type == BUILTIN_OBJ);
+    assert(!builtin || mkyType((MkyObject *)builtin) == BUILTIN_OBJ);
 
     return builtin;
 }
+
+size_t builtinCount(void) {
+    return builtinDefinitionsCount;
+}
+
+const char *builtinNameAtIndex(size_t index) {
+    assert(index < builtinDefinitionsCount);
+    return builtinDefinitions[index].name;
+}
+
+MkyBuiltinRef builtinAtIndex(size_t index) {
+    assert(index < builtinDefinitionsCount);
+    return builtinInstances()[index];
+}
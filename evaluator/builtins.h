@@ -13,4 +13,8 @@
 
 MkyBuiltinRef builtinWithName(StringRef name);
 
+size_t builtinCount(void);
+const char *builtinNameAtIndex(size_t index);
+MkyBuiltinRef builtinAtIndex(size_t index);
+
 #endif /* builtins_h */
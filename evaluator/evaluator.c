@@ -18,10 +18,10 @@ static MkyObject *evalProgram(astprogram_t *program, MkyEnvironmentRef env) {
 
     for (int i = 0; i < arrlen(program->statements); i++) {
         result = mkyEval((astnode_t *)program->statements[i], env);
-        if (result && result->type == RETURN_VALUE_OBJ) {
+        if (result && mkyType(result) == RETURN_VALUE_OBJ) {
             return mkyReturnValueValue(result);
 
-        } else if (result && result->type == ERROR_OBJ) {
+        } else if (result && mkyType(result) == ERROR_OBJ) {
             return result;
         }
     }
@@ -33,7 +33,7 @@ static MkyObject *evalBlockStatement(astblockstatement_t *block, MkyEnvironmentR
 
     for (int i = 0; i < arrlen(block->statements); i++) {
         result = mkyEval((astnode_t *)block->statements[i], env);
-        if (result && (result->type == RETURN_VALUE_OBJ || result->type == ERROR_OBJ) ) {
+        if (result && (mkyType(result) == RETURN_VALUE_OBJ || mkyType(result) == ERROR_OBJ) ) {
             return result;
         }
     }
@@ -60,9 +60,9 @@ static MkyObject *evalBangOperatorExpression(MkyObject *value) {
 }
 
 static MkyObject *evalMinusPrefixOperatorExpression(MkyObject *right) {
-    if (right->type != INTEGER_OBJ) {
+    if (mkyType(right) != INTEGER_OBJ) {
         return mkyError(StringWithFormat("unknown operator: -%s",
-                                                              MkyObjectTypeNames[right->type]));
+                                                              MkyObjectTypeNames[mkyType(right)]));
     }
 
     int64_t value = mkyIntegerValue(right);
@@ -85,22 +85,26 @@ static MkyObject *evalPrefixExpression(token_type type, MkyObject *right) {
 
     return mkyError(StringWithFormat("unknown operator: %s%s",
                                                           token_str[type],
-                                                          MkyObjectTypeNames[right->type]
+                                                          MkyObjectTypeNames[mkyType(right)]
                                                           ));
 }
 
 static MkyObject *evalStringInfixExpression(token_type type, MkyObject *left, MkyObject *right) {
+    // short literals are interned, comparing two of them is a pointer compare.
+    if (type == TOKEN_EQ || type == TOKEN_NOT_EQ) {
+        bool equal = RuntimeEquals(left, right);
+        return mkyBoolean(type == TOKEN_EQ ? equal : !equal);
+    }
+
     if (type != TOKEN_PLUS) {
         return mkyError(StringWithFormat("unknown operator: %s %s %s",
-                                                              MkyObjectTypeNames[left->type],
+                                                              MkyObjectTypeNames[mkyType(left)],
                                                               token_str[type],
-                                                              MkyObjectTypeNames[right->type]
+                                                              MkyObjectTypeNames[mkyType(right)]
                                                               ));
     }
 
-    StringRef leftVal = mkyStringValue(left);
-    StringRef rightVal = mkyStringValue(right);
-    return mkyString(StringWithFormat("%s%s", CString(leftVal), CString(rightVal)));
+    return mkyStringByConcatenating(left, right);
 }
 
 static MkyObject *evalIntegerInfixExpression(token_type type, MkyObject *left, MkyObject *right) {
@@ -144,18 +148,18 @@ static MkyObject *evalIntegerInfixExpression(token_type type, MkyObject *left, M
             break;
     }
     return mkyError(StringWithFormat("unknown operator: %s %s %s",
-                                                     MkyObjectTypeNames[left->type],
+                                                     MkyObjectTypeNames[mkyType(left)],
                                                      token_str[type],
-                                                     MkyObjectTypeNames[right->type]
+                                                     MkyObjectTypeNames[mkyType(right)]
                                                      ));
 }
 
 static MkyObject *evalInfixExpression(token_type type, MkyObject *left, MkyObject *right) {
-    if (left->type == INTEGER_OBJ && right->type == INTEGER_OBJ) {
+    if (mkyType(left) == INTEGER_OBJ && mkyType(right) == INTEGER_OBJ) {
         return evalIntegerInfixExpression(type, left, right);
     }
 
-    if (left->type == STRING_OBJ && right->type == STRING_OBJ) {
+    if (mkyType(left) == STRING_OBJ && mkyType(right) == STRING_OBJ) {
         return evalStringInfixExpression(type, left, right);
     }
 
@@ -172,24 +176,24 @@ static MkyObject *evalInfixExpression(token_type type, MkyObject *left, MkyObjec
             break;
     }
 
-    if (left->type != right->type) {
+    if (mkyType(left) != mkyType(right)) {
         return mkyError(StringWithFormat("type mismatch: %s %s %s",
-                                                              MkyObjectTypeNames[left->type],
+                                                              MkyObjectTypeNames[mkyType(left)],
                                                               token_str[type],
-                                                              MkyObjectTypeNames[right->type]
+                                                              MkyObjectTypeNames[mkyType(right)]
                                                               ));
     }
 
     return mkyError(StringWithFormat("unknown operator: %s %s %s",
-                                                          MkyObjectTypeNames[left->type],
+                                                          MkyObjectTypeNames[mkyType(left)],
                                                           token_str[type],
-                                                          MkyObjectTypeNames[right->type]
+                                                          MkyObjectTypeNames[mkyType(right)]
                                                           ));
 }
 
 static MkyObject *evalArrayIndexExpression(MkyObject *left, MkyObject *index) {
-    assert(left->type == ARRAY_OBJ);
-    assert(index->type == INTEGER_OBJ);
+    assert(mkyType(left) == ARRAY_OBJ);
+    assert(mkyType(index) == INTEGER_OBJ);
 
     MkyArrayRef array = (MkyArrayRef)left;
     int64_t idx = mkyIntegerValue(index);
@@ -204,16 +208,15 @@ static MkyObject *evalArrayIndexExpression(MkyObject *left, MkyObject *index) {
 }
 
 static MkyObject *evalHashIndexExpression(MkyObject *left, MkyObject *index) {
-    assert(left->type == HASH_OBJ);
+    assert(mkyType(left) == HASH_OBJ);
     MkyHashRef hash = (MkyHashRef)left;
 
     if (!mkyIsHashable(index)) {
         return mkyError(StringWithFormat("unusable as hash key: %s",
-                                         MkyObjectTypeNames[index->type]));
+                                         MkyObjectTypeNames[mkyType(index)]));
     }
 
-    DictionaryRef pairs = mkyHashPairs(hash);
-    MkyObject *data = DictionaryObjectForKey(pairs, index);
+    MkyObject *data = mkyHashObjectForKey(hash, index);
     if (!data) {
         return mkyNull();
     }
@@ -221,41 +224,41 @@ static MkyObject *evalHashIndexExpression(MkyObject *left, MkyObject *index) {
 }
 
 static MkyObject *evalIndexExpression(MkyObject *left, MkyObject *index) {
-    if (left->type == ARRAY_OBJ && index->type == INTEGER_OBJ) {
+    if (mkyType(left) == ARRAY_OBJ && mkyType(index) == INTEGER_OBJ) {
         return evalArrayIndexExpression(left, index);
     }
 
-    if (left->type == HASH_OBJ) {
+    if (mkyType(left) == HASH_OBJ) {
         return evalHashIndexExpression(left, index);
     }
 
     return mkyError(StringWithFormat("index operator not supported: %s",
-                                                          MkyObjectTypeNames[left->type]));
+                                                          MkyObjectTypeNames[mkyType(left)]));
 }
 
 static MkyObject *evalHashLiteral(asthashliteral_t *node, MkyEnvironmentRef env) {
-    DictionaryRef pairs = Dictionary();
+    MkyHashRef hash = (MkyHashRef)mkyHash(NULL);
     for (int i = 0; i < hmlen(node->pairs); i++) {
         pairs_t pair = node->pairs[i];
         MkyObject *key = mkyEval(AS_NODE(pair.key), env);
-        if (key->type == ERROR_OBJ) {
+        if (mkyType(key) == ERROR_OBJ) {
             return key;
         }
 
-        if (!key->hashkey) {
+        if (!mkyIsHashable(key)) {
             return mkyError(StringWithFormat("unusable as hash key: %s",
-                                             MkyObjectTypeNames[key->type]));
+                                             MkyObjectTypeNames[mkyType(key)]));
         }
 
         MkyObject *value = mkyEval(AS_NODE(pair.value), env);
-        if (value->type == ERROR_OBJ) {
+        if (mkyType(value) == ERROR_OBJ) {
             return value;
         }
 
-        DictionarySetObjectForKey(pairs, key, value);        
+        mkyHashSetObjectForKey(hash, key, value);
     }
     
-    return mkyHash(pairs);
+    return (MkyObject *)hash;
 }
 
 static bool isTruthy(MkyObject *value) {
@@ -279,7 +282,7 @@ static bool isTruthy(MkyObject *value) {
 
 static MkyObject *evalIfExpression(astifexpression_t *exp, MkyEnvironmentRef env) {
     MkyObject *condition = mkyEval(AS_NODE(exp->condition), env);
-    if (condition->type == ERROR_OBJ) {
+    if (mkyType(condition) == ERROR_OBJ) {
         return condition;
     }
 
@@ -294,20 +297,20 @@ static MkyObject *evalIfExpression(astifexpression_t *exp, MkyEnvironmentRef env
 }
 
 static MkyObject *unwrapReturnValue(MkyObject *obj) {
-    if (obj && obj->type == RETURN_VALUE_OBJ) {
+    if (obj && mkyType(obj) == RETURN_VALUE_OBJ) {
         return mkyReturnValueValue(obj);
     }
     return obj;
 }
 
 static MkyEnvironmentRef extendFunctionEnv(MkyFunctionRef fn, ArrayRef args) {
-    MkyEnvironmentRef env = environmentCreateEnclosedIn(mkyFunctionEnv(fn));
+    MkyEnvironmentRef env = environmentCreateEnclosedIn(mkyFunctionEnv(fn), mkyFunctionSlotCount(fn));
 
     astidentifier_t **parameters = mkyFunctionParameters(fn);
     if (parameters && args) {
         assert(arrlen(parameters) == ArrayCount(args));
         for (int i = 0; i < arrlen(parameters); i++) {
-            environmentSetObjectForKey(env, parameters[i]->value, ArrayObjectAt(args, i));
+            environmentSetObjectAt(env, parameters[i]->slot, ArrayObjectAt(args, i));
         }
     }
 
@@ -315,26 +318,26 @@ static MkyEnvironmentRef extendFunctionEnv(MkyFunctionRef fn, ArrayRef args) {
 }
 
 static MkyObject *applyFunction(MkyObject *fn, ArrayRef args) {
-    if (fn->type == FUNCTION_OBJ) {
+    if (mkyType(fn) == FUNCTION_OBJ) {
         MkyFunctionRef function = (MkyFunctionRef)fn;
         MkyEnvironmentRef extendedEnv = extendFunctionEnv(function, args);
         MkyObject *evaluated = mkyEval(AS_NODE(mkyFunctionBody(function)), extendedEnv);
         return unwrapReturnValue(evaluated);
 
-    } else if (fn->type == BUILTIN_OBJ) {
+    } else if (mkyType(fn) == BUILTIN_OBJ) {
         return mkyBuiltInFn(fn)(args);
     }
 
-    return mkyError(StringWithFormat("not a function: %s", MkyObjectTypeNames[fn->type]));
+    return mkyError(StringWithFormat("not a function: %s", MkyObjectTypeNames[mkyType(fn)]));
 }
 
 static ArrayRef evalExpressions(astexpression_t **exps, MkyEnvironmentRef env) {
     ArrayRef result = NULL;
     if (exps) {
-        result = Array();
+        result = RCAutorelease(ArrayCreateWithCapacity(arrlen(exps)));
         for (int i = 0; i < arrlen(exps); i++) {
             MkyObject *evaluated = mkyEval(AS_NODE(exps[i]), env);
-            if (evaluated && evaluated->type == ERROR_OBJ) {
+            if (evaluated && mkyType(evaluated) == ERROR_OBJ) {
                 ArrayRemoveAll(result);
                 ArrayAppend(result, evaluated);
                 return result;
@@ -347,14 +350,19 @@ static ArrayRef evalExpressions(astexpression_t **exps, MkyEnvironmentRef env) {
 
 static MkyObject *evalIdentifier(astidentifier_t *ident, MkyEnvironmentRef env) {
     assert(AST_TYPE(ident) == AST_IDENTIFIER);
-    MkyObject *obj = environmentObjectForKey(env, ident->value);
+    assert(ident->depth != AST_DEPTH_UNRESOLVED && "run the resolver before evaluating");
+
+    if (ident->depth == AST_DEPTH_BUILTIN) {
+        return (MkyObject *)builtinAtIndex(ident->slot);
+    }
+
+    MkyObject *obj = environmentObjectAt(env, ident->depth, ident->slot);
     if (obj) {
         return obj;
     }
 
-    MkyBuiltinRef builtin = builtinWithName(ident->value);
-    if (builtin) {
-        return (MkyObject *)builtin;
+    if (ident->fallback) {
+        return evalIdentifier(ident->fallback, env);
     }
 
     return mkyError(StringWithFormat("identifier not found: %s", CString(ident->value)));
@@ -369,11 +377,11 @@ MkyObject *eval(astnode_t *node, MkyEnvironmentRef env) {
         case AST_LET: {
             astletstatement_t *let = (astletstatement_t *)node;
             MkyObject *val = mkyEval(AS_NODE(let->value), env);
-            if (val && val->type == ERROR_OBJ) {
+            if (val && mkyType(val) == ERROR_OBJ) {
                 return val;
             }
             if (val) {
-                environmentSetObjectForKey(env, let->name->value, val);
+                environmentSetObjectAt(env, let->name->slot, val);
             }
         }
             break;
@@ -381,7 +389,7 @@ MkyObject *eval(astnode_t *node, MkyEnvironmentRef env) {
         case AST_RETURN: {
             astexpression_t *rs = ((astreturnstatement_t *)node)->returnValue;
             MkyObject *val = mkyEval(AS_NODE(rs), env);
-            if (val->type == ERROR_OBJ) {
+            if (mkyType(val) == ERROR_OBJ) {
                 return val;
             }
             return mkyReturnValue(val);
@@ -409,7 +417,7 @@ MkyObject *eval(astnode_t *node, MkyEnvironmentRef env) {
         case AST_PREFIXEXPR: {
             astprefixexpression_t *exp = (astprefixexpression_t *)node;
             MkyObject *right = mkyEval(AS_NODE(exp->right), env);
-            if (right->type == ERROR_OBJ) {
+            if (mkyType(right) == ERROR_OBJ) {
                 return right;
             }
             return evalPrefixExpression(exp->token.type, right);
@@ -418,11 +426,11 @@ MkyObject *eval(astnode_t *node, MkyEnvironmentRef env) {
 
         case AST_INFIXEXPR: {
             MkyObject *left = mkyEval(AS_NODE(((astinfixexpression_t *)node)->left), env);
-            if (left->type == ERROR_OBJ) {
+            if (mkyType(left) == ERROR_OBJ) {
                 return left;
             }
             MkyObject *right = mkyEval(AS_NODE(((astinfixexpression_t *)node)->right), env);
-            if (right->type == ERROR_OBJ) {
+            if (mkyType(right) == ERROR_OBJ) {
                 return right;
             }
             return evalInfixExpression(((astinfixexpression_t *)node)->token.type, left, right);
@@ -439,19 +447,19 @@ MkyObject *eval(astnode_t *node, MkyEnvironmentRef env) {
 
         case AST_FNLIT: {
             astfunctionliteral_t *fn = (astfunctionliteral_t *)node;
-            return mkyFunction(fn->parameters, fn->body, env);
+            return mkyFunction(fn->parameters, fn->body, fn->slotCount, env);
         }
             break;
 
         case AST_CALL: {
             astcallexpression_t *call = (astcallexpression_t *)node;
             MkyObject *function = mkyEval(AS_NODE(call->function), env);
-            if (function->type == ERROR_OBJ) {
+            if (mkyType(function) == ERROR_OBJ) {
                 return function;
             }
             ArrayRef args = evalExpressions(call->arguments, env);
             if (args && ArrayCount(args) == 1
-                && ((MkyObject*)ArrayObjectAt(args, 0))->type == ERROR_OBJ) {
+                && mkyType(ArrayObjectAt(args, 0)) == ERROR_OBJ) {
                 return ArrayObjectAt(args, 0);
             }
 
@@ -470,7 +478,7 @@ MkyObject *eval(astnode_t *node, MkyEnvironmentRef env) {
             ArrayRef elements = evalExpressions(array->elements, env);
             if (elements
                 && ArrayCount(elements) == 1
-                && ((MkyObject *)ArrayObjectAt(elements, 0))->type == ERROR_OBJ) {
+                && mkyType(ArrayObjectAt(elements, 0)) == ERROR_OBJ) {
                 return ArrayObjectAt(elements, 0);
             }
             return mkyArray(elements);
@@ -479,11 +487,11 @@ MkyObject *eval(astnode_t *node, MkyEnvironmentRef env) {
         case AST_INDEXEXP: {
             astindexexpression_t *exp = (astindexexpression_t *)node;
             MkyObject *left = mkyEval(AS_NODE(exp->left), env);
-            if (left->type == ERROR_OBJ) {
+            if (mkyType(left) == ERROR_OBJ) {
                 return left;
             }
             MkyObject *idx = mkyEval(AS_NODE(exp->index), env);
-            if (idx->type == ERROR_OBJ) {
+            if (mkyType(idx) == ERROR_OBJ) {
                 return idx;
             }
             return (MkyObject *)evalIndexExpression(left, idx);
@@ -498,9 +506,28 @@ MkyObject *eval(astnode_t *node, MkyEnvironmentRef env) {
     return NULL;
 }
 
+MkyObject *mkyEvalPrefixExpression(token_type op, MkyObject *right) {
+    return evalPrefixExpression(op, right);
+}
+
+MkyObject *mkyEvalInfixExpression(token_type op, MkyObject *left, MkyObject *right) {
+    return evalInfixExpression(op, left, right);
+}
+
+MkyObject *mkyEvalIndexExpression(MkyObject *left, MkyObject *index) {
+    return evalIndexExpression(left, index);
+}
+
+bool mkyIsTruthy(MkyObject *value) {
+    return isTruthy(value);
+}
+
+// every call environment that defines a function is a cycle, don't let them pile up in long running programs.
+#define MKY_EVAL_CYCLE_THRESHOLD 10000
+
 MkyObject *mkyEval(astnode_t *node, MkyEnvironmentRef env) {
 #if 1
-    static uint64_t count = 0;
+    static _Thread_local uint64_t count = 0;
 
     if (count++ % 16 == 0) {
         MkyObject *obj = NULL;
@@ -510,6 +537,10 @@ MkyObject *mkyEval(astnode_t *node, MkyEnvironmentRef env) {
         obj = RCRetain(obj);
 
         RCRelease(pool);
+        if (RuntimeCycleRootCount() >= MKY_EVAL_CYCLE_THRESHOLD) {
+            // obj is retained, anything else further up the stack is owned by an outer pool or a live env.
+            RuntimeCollectCycles();
+        }
         return RCAutorelease(obj);
         
     } else {
@@ -14,4 +14,10 @@
 
 MkyObject *mkyEval(astnode_t *node, MkyEnvironmentRef env);
 
+// operator semantics, shared with the vm so both engines produce identical results.
+MkyObject *mkyEvalPrefixExpression(token_type op, MkyObject *right);
+MkyObject *mkyEvalInfixExpression(token_type op, MkyObject *left, MkyObject *right);
+MkyObject *mkyEvalIndexExpression(MkyObject *left, MkyObject *index);
+bool mkyIsTruthy(MkyObject *value);
+
 #endif /* evaluator_h */
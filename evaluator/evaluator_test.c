@@ -4,6 +4,7 @@
 //
 
 #include "evaluator.h"
+#include "builtins.h"
 
 #include <assert.h>
 
@@ -13,6 +14,7 @@
 #include "../lexer/lexer.h"
 #include "../object/object.h"
 #include "../parser/parser.h"
+#include "../resolver/resolver.h"
 #include "../arfoundation/vendor/utest.h"
 
 
@@ -22,20 +24,23 @@ static MkyObject *testEval(const char *input) {
     lexer_t *lexer = lexerWithInput(input);
     parser_t *parser = parserWithLexer(lexer);
     astprogram_t *program = parserParseProgram(parser);
+    resolverResolve(resolverCreate(), program);
     MkyEnvironmentRef env = environmentCreate();
 
     obj = mkyEval(AS_NODE(program), env);
+    obj = RCAutorelease(RCRetain(obj)); // may only be owned by a binding in env
 
-    env = RCRelease(env);
-    assert(env == NULL);
+    // functions bound in env point back at it, the collector takes care of those.
+    RCRelease(env);
+    RuntimeCollectCycles();
     programRelease(&program);
 
     return obj;
 }
 
 static bool testIntegerObject(MkyObject *obj, int64_t expected) {
-    if (!obj || obj->type != INTEGER_OBJ) {
-        fprintf(stderr, "object is not integer. got=%s\n", obj ? MkyObjectTypeNames[obj->type] : "<nil>");
+    if (!obj || mkyType(obj) != INTEGER_OBJ) {
+        fprintf(stderr, "object is not integer. got=%s\n", obj ? MkyObjectTypeNames[mkyType(obj)] : "<nil>");
         return false;
     }
 
@@ -49,8 +54,8 @@ static bool testIntegerObject(MkyObject *obj, int64_t expected) {
 }
 
 static bool testbooleanObject(MkyObject *obj, bool expected) {
-    if (!obj || obj->type != BOOLEAN_OBJ) {
-        fprintf(stderr, "object is not boolean. got=%s\n", obj ? MkyObjectTypeNames[obj->type] : "<nil>");
+    if (!obj || mkyType(obj) != BOOLEAN_OBJ) {
+        fprintf(stderr, "object is not boolean. got=%s\n", obj ? MkyObjectTypeNames[mkyType(obj)] : "<nil>");
         return false;
     }
 
@@ -65,7 +70,7 @@ static bool testbooleanObject(MkyObject *obj, bool expected) {
 
 static bool testNullObject(MkyObject *obj) {
     if (obj && obj != mkyNull()) {
-        fprintf(stderr, "object is not null. got=%s\n", obj ? MkyObjectTypeNames[obj->type] : "<nil>");
+        fprintf(stderr, "object is not null. got=%s\n", obj ? MkyObjectTypeNames[mkyType(obj)] : "<nil>");
         return false;
     }
     return true;
@@ -302,6 +307,10 @@ UTEST(eval, errorHandling) {
             "foobar",
             "identifier not found: foobar",
         },
+        {
+            "let f = fn(c) { if (c) { let y = 1; }; y }; f(false);",
+            "identifier not found: y",
+        },
         {
             MONKEY("Hello" - "World"),
             "unknown operator: STRING - STRING",
@@ -320,11 +329,11 @@ UTEST(eval, errorHandling) {
      for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
          struct test test = tests[i];
          MkyObject *evaluated = testEval(test.input);
-         if (ERROR_OBJ == evaluated->type) {
+         if (ERROR_OBJ == mkyType(evaluated)) {
              EXPECT_STRNEQ(test.expected, CString(mkyErrorMessage(evaluated)), strlen(test.expected));
 
          } else {
-             EXPECT_STREQ(MkyObjectTypeNames[ERROR_OBJ], MkyObjectTypeNames[evaluated->type]);
+             EXPECT_STREQ(MkyObjectTypeNames[ERROR_OBJ], MkyObjectTypeNames[mkyType(evaluated)]);
          }
      }
      );
@@ -339,7 +348,18 @@ UTEST(eval, letStatements) {
         {"let a = 5; a;", 5},
         {"let a = 5 * 5; a;", 25},
         {"let a = 5; let b = a; b;", 5},
-        {"let a = 5; let b = a; let c = a + b + 5; c;", 15}
+        {"let a = 5; let b = a; let c = a + b + 5; c;", 15},
+        {"let a = 5; let a = a + 1; a;", 6},
+        {"let f = fn() { g() }; let g = fn() { 7 }; f();", 7},
+        {"let f = fn(x) { if (x > 0) { let y = x * 2; } y }; f(4);", 8},
+        {"let x = 5; let f = fn() { let y = x; let x = 10; y }; f();", 5},
+        {"let x = 5; let f = fn() { let x = x + 1; x }; f();", 6},
+        {"let x = 5; let f = fn() { let x = x + 1; x }; f() + x;", 11},
+        {"let f = fn() { let g = fn() { h() }; let h = fn() { 3 }; g() }; f();", 3},
+        {"let x = 10; let f = fn(c) { if (c) { let x = 1; }; x }; f(false);", 10},
+        {"let x = 10; let f = fn(c) { if (c) { let x = 1; }; x }; f(true);", 1},
+        {"let x = 10; let f = fn(c) { if (c) { let x = 1; }; fn() { x } }; f(false)() + f(true)();", 11},
+        {"let f = fn(c) { if (c) { let len = 1; }; len(\"two\") }; f(false);", 3},
     };
 
     for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
@@ -356,7 +376,7 @@ UTEST(eval, functionObject) {
     MkyObject *evaluated = testEval(CString(input));
 
     ASSERT_TRUE(evaluated);
-    ASSERT_STREQ(MkyObjectTypeNames[FUNCTION_OBJ], MkyObjectTypeNames[evaluated->type]);
+    ASSERT_STREQ(MkyObjectTypeNames[FUNCTION_OBJ], MkyObjectTypeNames[mkyType(evaluated)]);
 
     MkyFunctionRef fn = (MkyFunctionRef)evaluated;
     ASSERT_TRUE(mkyFunctionParameters(fn));
@@ -407,12 +427,34 @@ UTEST(eval, testClosures) {
     RCRelease(pool);
 }
 
+UTEST(eval, closureCycles) {
+    RuntimeCycleStats before = RuntimeGetCycleStats();
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    const char *input = MONKEY(
+                               let newAdder = fn(x) {
+                                   fn(y) { x + y };
+                               };
+                               newAdder(3);
+                               );
+    MkyObject *evaluated = testEval(input);
+
+    // the returned closure keeps the environment of the call that made it alive.
+    ASSERT_EQ(FUNCTION_OBJ, mkyType(evaluated));
+    ASSERT_TRUE(testIntegerObject(environmentObjectAt(mkyFunctionEnv((MkyFunctionRef)evaluated), 0, 0), 3));
+
+    // through it the global env <-> newAdder cycle too, until the closure goes.
+    RCRelease(pool);
+    RuntimeCollectCycles();
+    ASSERT_GE(RuntimeGetCycleStats().cyclesFound, before.cyclesFound + 1);
+    ASSERT_EQ(0, RuntimeCycleRootCount());
+}
+
 UTEST(eval, stringLiteral) {
     AutoreleasePoolRef pool = AutoreleasePoolCreate();
     const char *input = "\"Hello World\"";
     MkyObject *evaluated = testEval(input);
     
-    ASSERT_STREQ(MkyObjectTypeNames[STRING_OBJ], MkyObjectTypeNames[evaluated->type]);
+    ASSERT_STREQ(MkyObjectTypeNames[STRING_OBJ], MkyObjectTypeNames[mkyType(evaluated)]);
 
     ASSERT_STREQ("Hello World", CString(mkyStringValue(evaluated)));
     pool = RCRelease(pool);
@@ -423,12 +465,134 @@ UTEST(eval, stringConcatenation) {
     const char *input = MONKEY("Hello" + " " + "World!");
     MkyObject *evaluated = testEval(input);
 
-    ASSERT_STREQ(MkyObjectTypeNames[STRING_OBJ], MkyObjectTypeNames[evaluated->type]);
+    ASSERT_STREQ(MkyObjectTypeNames[STRING_OBJ], MkyObjectTypeNames[mkyType(evaluated)]);
 
     ASSERT_STREQ("Hello World!", CString(mkyStringValue(evaluated)));
     RCRelease(pool);
 }
 
+UTEST(eval, stringComparison) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    struct test {
+        const char *input;
+        bool expected;
+    } tests[] = {
+        {MONKEY("monkey" == "monkey"), true},
+        {MONKEY("monkey" != "monkey"), false},
+        {MONKEY("monkey" == "banana"), false},
+        {MONKEY("monkey" != "banana"), true},
+        {MONKEY("mon" + "key" == "monkey"), true},
+        {MONKEY(let a = "monkey"; let b = "monkey"; a == b), true},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        ASSERT_TRUE(testbooleanObject(testEval(test.input), test.expected));
+    }
+    RCRelease(pool);
+}
+
+UTEST(eval, stringSlices) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    struct test {
+        const char *input;
+        const char *expected;
+    } tests[] = {
+        {MONKEY(slice("monkey", 3)), "key"},
+        {MONKEY(slice("monkey", 0, 3)), "mon"},
+        {MONKEY(slice("monkey", 2, 2)), ""},
+        {MONKEY(let s = "a long string, long enough to be sliced into a view of the original one"; slice(s, 7, 71)), "string, long enough to be sliced into a view of the original one"},
+        {MONKEY(slice("monkey", 4, 3)), "slice bounds out of range [4:3] with length 6"},
+        {MONKEY(slice("monkey", 0, 7)), "slice bounds out of range [0:7] with length 6"},
+        {MONKEY(slice(1, 0)), "argument to 'slice' must be STRING or ARRAY, got INTEGER"},
+        {MONKEY(slice("monkey")), "wrong number of arguments. got=1, want=2 or 3"},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        MkyObject *evaluated = testEval(test.input);
+        if (mkyType(evaluated) == ERROR_OBJ) {
+            EXPECT_STREQ(test.expected, CString(mkyErrorMessage(evaluated)));
+        } else {
+            ASSERT_EQ(STRING_OBJ, mkyType(evaluated));
+            EXPECT_STREQ(test.expected, CString(mkyStringValue(evaluated)));
+        }
+    }
+
+    ASSERT_TRUE(testbooleanObject(testEval(MONKEY(slice("monkey", 3) == "key")), true));
+    RCRelease(pool);
+}
+
+UTEST(eval, arraySlices) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    struct test {
+        const char *input;
+        const char *expected;
+    } tests[] = {
+        {MONKEY(slice([1, 2, 3, 4], 1)), "[2, 3, 4]"},
+        {MONKEY(slice([1, 2, 3, 4], 1, 3)), "[2, 3]"},
+        {MONKEY(slice([1, 2, 3, 4], 2, 2)), "[]"},
+        {MONKEY(slice([], 0)), "[]"},
+        {MONKEY(let a = [1, 2, 3, 4]; let s = push(slice(a, 0, 2), 5); [s, a]), "[[1, 2, 5], [1, 2, 3, 4]]"},
+        {MONKEY(slice([1, 2, 3], 1, 4)), "slice bounds out of range [1:4] with length 3"},
+        {MONKEY(slice([1, 2, 3], "1")), "slice bounds must be INTEGER, got STRING"},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        MkyObject *evaluated = testEval(test.input);
+        if (mkyType(evaluated) == ERROR_OBJ) {
+            EXPECT_STREQ(test.expected, CString(mkyErrorMessage(evaluated)));
+        } else {
+            ASSERT_EQ(ARRAY_OBJ, mkyType(evaluated));
+            EXPECT_STREQ(test.expected, CString(mkyInspect(evaluated)));
+        }
+    }
+    RCRelease(pool);
+}
+
+UTEST(eval, builtinsUpdateInPlace) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+
+    // args holding the only reference, the way the vm hands over a local's last read.
+    AutoreleasePoolRef inner = AutoreleasePoolCreate();
+    ArrayRef elements = Array();
+    ArrayAppend(elements, mkyInteger(1));
+    MkyObject *array = RCRetain(mkyArray(elements));
+    MapRef pairs = Map();
+    MapSetObjectForKey(pairs, mkyInteger(1), mkyInteger(1));
+    MkyObject *hash = RCRetain(mkyHash(pairs));
+    RCRelease(inner);
+
+    ArrayRef args = Array();
+    ArrayAppend(args, array);
+    ArrayAppend(args, mkyInteger(2));
+    RCRelease(array);
+    MkyObject *pushed = mkyBuiltInFn((MkyObject *)builtinWithName(StringWithChars("push")))(args);
+    ASSERT_EQ(array, pushed);
+    ASSERT_STREQ("[1, 2]", CString(mkyInspect(pushed)));
+
+    // a second reference makes it copy.
+    RCRetain(array);
+    pushed = mkyBuiltInFn((MkyObject *)builtinWithName(StringWithChars("push")))(args);
+    ASSERT_NE(array, pushed);
+    ASSERT_STREQ("[1, 2, 2]", CString(mkyInspect(pushed)));
+    ASSERT_STREQ("[1, 2]", CString(mkyInspect(array)));
+    RCRelease(array);
+
+    args = Array();
+    ArrayAppend(args, hash);
+    ArrayAppend(args, mkyInteger(2));
+    ArrayAppend(args, mkyInteger(4));
+    RCRelease(hash);
+    ASSERT_EQ(hash, mkyBuiltInFn((MkyObject *)builtinWithName(StringWithChars("set")))(args));
+    ArrayRemoveAt(args, 2);
+    ASSERT_EQ(hash, mkyBuiltInFn((MkyObject *)builtinWithName(StringWithChars("delete")))(args));
+    ASSERT_STREQ("{1: 1}", CString(mkyInspect(hash)));
+
+    RCRelease(pool);
+}
+
 UTEST(eval, builtinFunctions) {
     struct test {
         const char *input;
@@ -445,6 +609,22 @@ UTEST(eval, builtinFunctions) {
         {MONKEY(len("one", "two")), 1, .string = "wrong number of arguments. got=2, want=1"},
         {MONKEY(len([1, 2, 3])), 0, .value = 3},
         {MONKEY(len([])), 0, .value = 0},
+        {MONKEY(len({1: 2, 3: 4})), 0, .value = 2},
+        {MONKEY(let h = {"a": 1}; let g = set(h, "b", 2); len(h) * 10 + len(g)), 0, .value = 12},
+        {MONKEY(let h = {"a": 1}; set(h, "a", 5)["a"] * 10 + h["a"]), 0, .value = 51},
+        {MONKEY(let h = {"a": 1, "b": 2}; let g = delete(h, "a"); len(g) * 10 + h["a"]), 0, .value = 11},
+        {MONKEY(len(delete({"a": 1}, "b"))), 0, .value = 1},
+        {MONKEY(set(1, 2, 3)), 1, .string = "argument to 'set' must be HASH, got INTEGER"},
+        {MONKEY(set({}, 1)), 1, .string = "wrong number of arguments. got=2, want=3"},
+        {MONKEY(delete({}, [1])), 1, .string = "unusable as hash key: ARRAY"},
+        // push and rest share structure, the arrays they started from don't change.
+        {MONKEY(let build = fn(n, a) { if (n == 0) { a } else { build(n - 1, push(a, n)) } };
+                let big = build(100, [0]); let bigger = push(big, 1); len(big) + len(bigger)), 0, .value = 203},
+        {MONKEY(let build = fn(n, a) { if (n == 0) { a } else { build(n - 1, push(a, n)) } };
+                let sum = fn(a, total) { if (len(a) == 0) { total } else { sum(rest(a), total + first(a)) } };
+                sum(build(100, [0]), 0)), 0, .value = 5050},
+        {MONKEY(let build = fn(n, a) { if (n == 0) { a } else { build(n - 1, push(a, n)) } };
+                let big = build(100, [0]); let tail = rest(rest(big)); tail[97] + last(tail) + big[2]), 0, .value = 102},
     };
 
     AutoreleasePoolRef pool = AutoreleasePoolCreate();
@@ -458,9 +638,9 @@ UTEST(eval, builtinFunctions) {
                 break;
 
             case 1: {
-                EXPECT_STREQ(MkyObjectTypeNames[ERROR_OBJ], MkyObjectTypeNames[evaluated->type]);
+                EXPECT_STREQ(MkyObjectTypeNames[ERROR_OBJ], MkyObjectTypeNames[mkyType(evaluated)]);
 
-                if (evaluated->type == ERROR_OBJ) {                    
+                if (mkyType(evaluated) == ERROR_OBJ) {                    
                     EXPECT_STREQ(test.string, CString(mkyErrorMessage(evaluated)));
                 }
             }
@@ -475,7 +655,7 @@ UTEST(eval, arrayLiteral) {
     const char *input = "[1, 2 * 2, 3 + 3]";
     MkyObject *evaluated = testEval(input);
 
-    ASSERT_STREQ(MkyObjectTypeNames[ARRAY_OBJ], MkyObjectTypeNames[evaluated->type]);
+    ASSERT_STREQ(MkyObjectTypeNames[ARRAY_OBJ], MkyObjectTypeNames[mkyType(evaluated)]);
 
     MkyArrayRef array = (MkyArrayRef)evaluated;
     ASSERT_EQ(3, ArrayCount(mkyArrayElements(array)));
@@ -567,7 +747,7 @@ UTEST(eval, hashLiterals) {
     MkyObject *evaluated = testEval(input);
     ASSERT_TRUE(evaluated);
 
-    ASSERT_STREQ(MkyObjectTypeNames[HASH_OBJ], MkyObjectTypeNames[evaluated->type]);
+    ASSERT_STREQ(MkyObjectTypeNames[HASH_OBJ], MkyObjectTypeNames[mkyType(evaluated)]);
     MkyHashRef hash = (MkyHashRef)evaluated;
 
     DictionaryRef expected = Dictionary();
@@ -578,16 +758,16 @@ UTEST(eval, hashLiterals) {
     DictionarySetObjectForKey(expected, mkyBoolean(true), mkyInteger(5));
     DictionarySetObjectForKey(expected, mkyBoolean(false), mkyInteger(6));
 
-    DictionaryRef pairs = mkyHashPairs(hash);
-    ASSERT_EQ(DictionaryCount(pairs), DictionaryCount(expected));
-
-    for (int i = 0; i < DictionaryCount(expected); i++) {
-        ObjectPairRef kv = DictionaryKeyValueAtIndex(expected, i);
+    MapRef pairs = mkyHashPairs(hash);
+    ASSERT_EQ(MapCount(pairs), DictionaryCount(expected));
 
-        MkyObject *value = DictionaryObjectForKey(pairs, objectPairFirst(kv));
+    size_t cursor = 0;
+    RCTypeRef key, expectedValue;
+    while (DictionaryNext(expected, &cursor, &key, &expectedValue)) {
+        MkyObject *value = MapObjectForKey(pairs, key);
         ASSERT_TRUE(value);
 
-        ASSERT_TRUE(testIntegerObject(value, mkyIntegerValue(objectPairSecond(kv))));
+        ASSERT_TRUE(testIntegerObject(value, mkyIntegerValue(expectedValue)));
     }
 
     RCRelease(pool);
@@ -0,0 +1,976 @@
+//
+//  benchmarks.c
+//  conkey_tests
+//
+//  Side by side timings, included from tests.c when CONKEY_BENCHMARKS is set.
+//
+
+#include <time.h>
+
+#include "../macros.h"
+#include "../ast/ast.h"
+#include "../arfoundation/arfoundation.h"
+#include "../compiler/compiler.h"
+#include "../evaluator/builtins.h"
+#include "../evaluator/evaluator.h"
+#include "../lexer/lexer.h"
+#include "../parser/parser.h"
+#include "../resolver/resolver.h"
+#include "../vm/vm.h"
+#include "../arfoundation/vendor/utest.h"
+
+static double benchmarkNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static astprogram_t *benchmarkParse(const char *input) {
+    lexer_t *lexer = lexerWithInput(input);
+    parser_t *parser = parserWithLexer(lexer);
+    return parserParseProgram(parser);
+}
+
+static double benchmarkEval(const char *input, StringRef *inspected) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    astprogram_t *program = benchmarkParse(input);
+    resolverResolve(resolverCreate(), program);
+    MkyEnvironmentRef env = environmentCreate();
+
+    double start = benchmarkNow();
+    MkyObject *result = mkyEval(AS_NODE(program), env);
+    double elapsed = benchmarkNow() - start;
+
+    *inspected = RCRetain(mkyInspect(result));
+    RCRelease(env);
+    programRelease(&program);
+    RCRelease(pool);
+    RuntimeCollectCycles();
+    return elapsed;
+}
+
+static double benchmarkVM(const char *input, StringRef *inspected) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    astprogram_t *program = benchmarkParse(input);
+
+    // compilation is part of the vm's cost.
+    double start = benchmarkNow();
+    compiler_t *compiler = compilerCreate();
+    compilerCompile(compiler, AS_NODE(program));
+    MkyObject *result = vmRun(vmCreate(), compilerBytecode(compiler));
+    double elapsed = benchmarkNow() - start;
+
+    *inspected = RCRetain(mkyInspect(result));
+    programRelease(&program);
+    RCRelease(pool);
+    return elapsed;
+}
+
+static bool benchmarkEngines(const char *name, const char *input) {
+    StringRef evalResult = NULL;
+    StringRef vmResult = NULL;
+
+    double evalTime = benchmarkEval(input, &evalResult);
+    double vmTime = benchmarkVM(input, &vmResult);
+
+    bool same = !strcmp(CString(evalResult), CString(vmResult));
+    fprintf(stderr, "%-12s eval: %8.2fms  vm: %8.2fms  (%.2fx)  %s\n",
+            name, evalTime * 1000, vmTime * 1000, evalTime / vmTime, same ? CString(vmResult) : "RESULTS DIFFER");
+
+    RCRelease(evalResult);
+    RCRelease(vmResult);
+    return same;
+}
+
+// every runtime object used to be its own calloc/free pair, the size classes only go to the
+// system allocator when they need a new page.
+static void benchmarkAllocations(const char *name, const char *input) {
+    StringRef result = NULL;
+    AllocatorStats before = AllocatorGetStats();
+    benchmarkEval(input, &result);
+    RCRelease(result);
+    AllocatorStats afterEval = AllocatorGetStats();
+    benchmarkVM(input, &result);
+    RCRelease(result);
+    AllocatorStats afterVM = AllocatorGetStats();
+
+    uint64_t evalObjects = afterEval.allocations - before.allocations;
+    uint64_t vmObjects = afterVM.allocations - afterEval.allocations;
+    fprintf(stderr, "%-12s eval: %9llu objects %7llu mallocs %6.1f bytes/object  vm: %9llu objects %7llu mallocs %6.1f bytes/object\n", name,
+            evalObjects, afterEval.systemAllocations - before.systemAllocations,
+            (double)(afterEval.bytesAllocated - before.bytesAllocated) / evalObjects,
+            vmObjects, afterVM.systemAllocations - afterEval.systemAllocations,
+            (double)(afterVM.bytesAllocated - afterEval.bytesAllocated) / vmObjects);
+}
+
+// the dictionary used to be an stb hashmap keyed on the RuntimeHashValue alone, kept here to compare against.
+typedef struct {
+    RuntimeHashValue key;
+    RCTypeRef value;
+} BenchmarkHashOnlyEntry;
+
+static void benchmarkDictionary(const char *name, RCTypeRef *keys, RCTypeRef *lookups, size_t count) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+
+    // hashes are cached per object, compute them up front so neither side pays for it.
+    for (size_t i = 0; i < count; i++) {
+        RuntimeHash(keys[i]);
+        RuntimeHash(lookups[i]);
+    }
+
+    double start = benchmarkNow();
+    BenchmarkHashOnlyEntry *hashOnly = NULL;
+    for (size_t i = 0; i < count; i++) {
+        RuntimeHashValue hash = RuntimeHash(keys[i]);
+        BenchmarkHashOnlyEntry *previous = hmgetp_null(hashOnly, hash);
+        RCRetain(keys[i]);
+        if (previous) {
+            RCRelease(previous->value);
+            previous->value = keys[i];
+        } else {
+            hmput(hashOnly, hash, keys[i]);
+        }
+    }
+    double hashOnlyInsert = benchmarkNow() - start;
+
+    start = benchmarkNow();
+    size_t hashOnlyFound = 0;
+    for (int round = 0; round < 4; round++) {
+        for (size_t i = 0; i < count; i++) {
+            hashOnlyFound += hmgetp_null(hashOnly, RuntimeHash(lookups[i])) != NULL;
+        }
+    }
+    double hashOnlyLookup = benchmarkNow() - start;
+
+    start = benchmarkNow();
+    DictionaryRef dict = DictionaryCreate();
+    for (size_t i = 0; i < count; i++) {
+        DictionarySetObjectForKey(dict, keys[i], keys[i]);
+    }
+    double swissInsert = benchmarkNow() - start;
+
+    start = benchmarkNow();
+    size_t swissFound = 0;
+    for (int round = 0; round < 4; round++) {
+        for (size_t i = 0; i < count; i++) {
+            swissFound += DictionaryObjectForKey(dict, lookups[i]) != NULL;
+        }
+    }
+    double swissLookup = benchmarkNow() - start;
+
+    fprintf(stderr, "%-12s insert: %6.1f Mops/s (hash only: %6.1f)  lookup: %6.1f Mops/s (hash only: %6.1f)  found %zu/%zu\n", name,
+            count / swissInsert / 1e6, count / hashOnlyInsert / 1e6,
+            count * 4 / swissLookup / 1e6, count * 4 / hashOnlyLookup / 1e6,
+            swissFound / 4, hashOnlyFound / 4);
+
+    for (size_t i = 0; i < hmlen(hashOnly); i++) {
+        RCRelease(hashOnly[i].value);
+    }
+    hmfree(hashOnly);
+    RCRelease(dict);
+    RCRelease(pool);
+}
+
+UTEST(bench, engines) {
+    ASSERT_TRUE(benchmarkEngines("fibonacci", MONKEY(
+        let fibonacci = fn(x) {
+            if (x < 2) {
+                return x;
+            }
+            fibonacci(x - 1) + fibonacci(x - 2);
+        };
+        fibonacci(25);
+    )));
+
+    // recursion stays shallow, the vm's stack is fixed size.
+    ASSERT_TRUE(benchmarkEngines("closures", MONKEY(
+        let work = fn(n) {
+            let add = fn(y) { n + y };
+            if (n < 2) {
+                return add(1);
+            }
+            add(work(n - 1)) + work(n - 2);
+        };
+        work(22);
+    )));
+
+    ASSERT_TRUE(benchmarkEngines("arrays", MONKEY(
+        let build = fn(n, arr) {
+            if (n == 0) {
+                return arr;
+            }
+            build(n - 1, push(arr, n));
+        };
+        let sum = fn(arr, acc) {
+            if (len(arr) == 0) {
+                return acc;
+            }
+            sum(rest(arr), acc + first(arr));
+        };
+        let run = fn(n) {
+            if (n == 0) {
+                return sum(build(100, [0]), 0);
+            }
+            run(n - 1) + run(n - 1);
+        };
+        run(7);
+    )));
+
+    ASSERT_TRUE(benchmarkEngines("hashes", MONKEY(
+        let fill = fn(n) {
+            if (n < 2) {
+                let h = {"a": n, "b": n * 2, n: n};
+                return h["a"] + h["b"] + h[n];
+            }
+            fill(n - 1) + fill(n - 2);
+        };
+        fill(20);
+    )));
+
+    ASSERT_TRUE(benchmarkEngines("strings", MONKEY(
+        let words = fn(n) {
+            if (n < 2) {
+                let word = "key" + "word";
+                let h = {word: n, "keyword": 1, "other": 2};
+                return h["keyword"] + h[word] + len(word);
+            }
+            words(n - 1) + words(n - 2);
+        };
+        words(20);
+    )));
+}
+
+UTEST(bench, allocations) {
+    benchmarkAllocations("fibonacci", MONKEY(
+        let fibonacci = fn(x) {
+            if (x < 2) {
+                return x;
+            }
+            fibonacci(x - 1) + fibonacci(x - 2);
+        };
+        fibonacci(25);
+    ));
+
+    benchmarkAllocations("closures", MONKEY(
+        let work = fn(n) {
+            let add = fn(y) { n + y };
+            if (n < 2) {
+                return add(1);
+            }
+            add(work(n - 1)) + work(n - 2);
+        };
+        work(22);
+    ));
+
+    benchmarkAllocations("arrays", MONKEY(
+        let build = fn(n, arr) {
+            if (n == 0) {
+                return arr;
+            }
+            build(n - 1, push(arr, n));
+        };
+        build(500, [0]);
+    ));
+
+    benchmarkAllocations("hashes", MONKEY(
+        let fill = fn(n) {
+            if (n < 2) {
+                let h = {"a": n, "b": n * 2, n: n};
+                return h["a"] + h["b"] + h[n];
+            }
+            fill(n - 1) + fill(n - 2);
+        };
+        fill(20);
+    ));
+
+    benchmarkAllocations("strings", MONKEY(
+        let words = fn(n) {
+            if (n < 2) {
+                let word = "key" + "word";
+                let h = {word: n, "keyword": 1, "other": 2};
+                return h["keyword"] + h[word] + len(word);
+            }
+            words(n - 1) + words(n - 2);
+        };
+        words(20);
+    ));
+
+    AllocatorPrintReport(stderr);
+}
+
+UTEST(bench, dictionary) {
+    enum { count = 200000 };
+    static RCTypeRef keys[count];
+    static RCTypeRef lookups[count];
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = mkyInteger(i * 7);
+        lookups[i] = mkyInteger(((i * 7919) % count) * 7);
+    }
+    benchmarkDictionary("integers", keys, lookups, count);
+
+    // lookups use other, equal, instances.
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = StringWithFormat("key %zu", i);
+        lookups[i] = StringWithFormat("key %zu", (i * 7919) % count);
+    }
+    benchmarkDictionary("strings", keys, lookups, count);
+
+    // monkey strings carry their own hash, no side table.
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = mkyString(StringWithFormat("key %zu", i));
+        lookups[i] = mkyString(StringWithFormat("key %zu", (i * 7919) % count));
+    }
+    benchmarkDictionary("mky strings", keys, lookups, count);
+
+    RCRelease(pool);
+}
+
+// the dictionary used to spread class hashes with a fixed fmix64, integers hash to themselves, so
+// anyone could pick integers that share one probe sequence by running fmix64 backwards.
+// The spreading is keyed per process now, those keys cost what random ones do.
+static uint64_t benchmarkInverse(uint64_t odd) {
+    uint64_t inverse = odd;
+    for (int i = 0; i < 5; i++) {
+        inverse *= 2 - odd * inverse;
+    }
+    return inverse;
+}
+
+static uint64_t benchmarkUnmix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= benchmarkInverse(0xc4ceb9fe1a85ec53ULL);
+    hash ^= hash >> 33;
+    hash *= benchmarkInverse(0xff51afd7ed558ccdULL);
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static void benchmarkFlooding(const char *name, RCTypeRef *keys, size_t count) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+
+    double start = benchmarkNow();
+    DictionaryRef dict = DictionaryCreate();
+    for (size_t i = 0; i < count; i++) {
+        DictionarySetObjectForKey(dict, keys[i], keys[i]);
+    }
+    double insert = benchmarkNow() - start;
+
+    start = benchmarkNow();
+    size_t found = 0;
+    for (size_t i = 0; i < count; i++) {
+        found += DictionaryObjectForKey(dict, keys[(i * 7919) % count]) != NULL;
+    }
+    double lookup = benchmarkNow() - start;
+
+    fprintf(stderr, "%-12s %-12s insert: %8.3f Mops/s  lookup: %8.3f Mops/s  found %zu/%zu\n", "flooding", name,
+            count / insert / 1e6, count / lookup / 1e6, found, count);
+    RCRelease(dict);
+    RCRelease(pool);
+}
+
+UTEST(bench, flooding) {
+    enum { count = 20000 };
+    static RCTypeRef keys[count];
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+
+    uint64_t state = 0x5f3759df;
+    for (size_t i = 0; i < count; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        keys[i] = mkyInteger((int64_t)state); // mostly too big to be immediates, like the crafted ones
+    }
+    benchmarkFlooding("random", keys, count);
+
+    // same low 24 bits under the old mix: same control byte, same first group, for every key.
+    uint64_t classSalt = RuntimeHash(mkyInteger(0)).id.classID * 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = mkyInteger((int64_t)(benchmarkUnmix(((uint64_t)i << 24) | 0x5a5a5a) ^ classSalt));
+    }
+    benchmarkFlooding("adversarial", keys, count);
+
+    RCRelease(pool);
+}
+
+// push and rest used to copy the whole array, accumulating with push or walking an array with rest was quadratic.
+static MkyObject *benchmarkCallBuiltin(const char *name, MkyObject *first, MkyObject *second) {
+    ArrayRef args = Array();
+    ArrayAppend(args, first);
+    if (second) {
+        ArrayAppend(args, second);
+    }
+    return mkyBuiltInFn((MkyObject *)builtinWithName(StringWithChars(name)))(args);
+}
+
+static void benchmarkAccumulate(size_t count, double *push, double *rest) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    ArrayRef seed = Array();
+    ArrayAppend(seed, mkyInteger(0));
+    MkyObject *array = RCRetain(mkyArray(seed));
+
+    double start = benchmarkNow();
+    for (size_t i = 1; i < count; i++) {
+        AutoreleasePoolRef inner = AutoreleasePoolCreate();
+        MkyObject *next = RCRetain(benchmarkCallBuiltin("push", array, mkyInteger(i)));
+        RCRelease(inner);
+        RCRelease(array);
+        array = next;
+    }
+    *push = benchmarkNow() - start;
+
+    start = benchmarkNow();
+    int64_t sum = 0;
+    while (mkyType(array) == ARRAY_OBJ && ArrayCount(mkyArrayElements((MkyArrayRef)array)) > 0) {
+        AutoreleasePoolRef inner = AutoreleasePoolCreate();
+        sum += mkyIntegerValue(benchmarkCallBuiltin("first", array, NULL));
+        MkyObject *next = RCRetain(benchmarkCallBuiltin("rest", array, NULL));
+        RCRelease(inner);
+        RCRelease(array);
+        array = next;
+    }
+    *rest = benchmarkNow() - start;
+
+    assert(sum == (int64_t)count * (count - 1) / 2);
+    RCRelease(array);
+    RCRelease(pool);
+}
+
+UTEST(bench, accumulate) {
+    for (size_t count = 12500; count <= 100000; count *= 2) {
+        double push, rest;
+        benchmarkAccumulate(count, &push, &rest);
+        fprintf(stderr, "%-12s %7zu elements  push: %8.2fms %7.1f ns/element  rest: %8.2fms %7.1f ns/element\n", "accumulate",
+                count, push * 1000, push * 1e9 / count, rest * 1000, rest * 1e9 / count);
+    }
+}
+
+// updating a hash used to mean building a new Dictionary with every entry, set shares all but one path.
+static void benchmarkCopyEntry(RCTypeRef key, RCTypeRef value, void *context) {
+    DictionarySetObjectForKey(context, key, value);
+}
+
+UTEST(bench, hashUpdates) {
+    enum { count = 100000, updates = 10000, rebuilds = 20 };
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    MapRef pairs = Map();
+    for (int64_t i = 0; i < count; i++) {
+        MapSetObjectForKey(pairs, mkyInteger(i), mkyInteger(i));
+    }
+    MkyObject *hash = RCRetain(mkyHash(pairs));
+
+    AllocatorStats before = AllocatorGetStats();
+    double start = benchmarkNow();
+    for (int64_t i = 0; i < updates; i++) {
+        AutoreleasePoolRef inner = AutoreleasePoolCreate();
+        MkyObject *args[] = { hash, mkyInteger((i * 7919) % count), mkyInteger(-i) };
+        ArrayRef list = Array();
+        for (int j = 0; j < 3; j++) {
+            ArrayAppend(list, args[j]);
+        }
+        MkyObject *next = RCRetain(mkyBuiltInFn((MkyObject *)builtinWithName(StringWithChars("set")))(list));
+        RCRelease(inner);
+        RCRelease(hash);
+        hash = next;
+    }
+    double set = benchmarkNow() - start;
+    uint64_t setAllocations = AllocatorGetStats().allocations - before.allocations;
+
+    start = benchmarkNow();
+    for (int64_t i = 0; i < rebuilds; i++) {
+        AutoreleasePoolRef inner = AutoreleasePoolCreate();
+        DictionaryRef copy = Dictionary();
+        MapEnumerate(mkyHashPairs((MkyHashRef)hash), benchmarkCopyEntry, copy);
+        DictionarySetObjectForKey(copy, mkyInteger((i * 7919) % count), mkyInteger(-i));
+        RCRelease(inner);
+    }
+    double rebuild = benchmarkNow() - start;
+
+    bool updated = mkyIntegerValue(MapObjectForKey(mkyHashPairs((MkyHashRef)hash), mkyInteger(((updates - 1) * 7919) % count))) == -(updates - 1);
+    fprintf(stderr, "%-12s %d entries  set: %8.2f us/update %5.1f objects/update  rebuild: %9.2f us/update  %s\n", "hash updates",
+            count, set * 1e6 / updates, (double)setAllocations / updates, rebuild * 1e6 / rebuilds, updated ? "" : "WRONG VALUE");
+    RCRelease(hash);
+    RCRelease(pool);
+    ASSERT_TRUE(updated);
+}
+
+// push used to copy its array every time, now a local's last read hands it over and it grows in place.
+// Reading the array again after the push keeps it shared, which takes the copying path.
+UTEST(bench, inPlacePush) {
+    const char *programs[] = {
+        MONKEY(
+            let fill = fn(a, n) { if (n == 0) { a } else { fill(push(a, n), n - 1) } };
+            let grow = fn(a, k) { if (k == 0) { a } else { grow(fill(a, 250), k - 1) } };
+            len(grow([0], 400))
+        ),
+        MONKEY(
+            let fill = fn(a, n) { if (n == 0) { a } else { fill(push(a, n), n - 1 + len(a) * 0) } };
+            let grow = fn(a, k) { if (k == 0) { a } else { grow(fill(a, 250), k - 1) } };
+            len(grow([0], 400))
+        ),
+    };
+    const char *names[] = { "moved", "shared" };
+    enum { pushes = 250 * 400 };
+
+    double elapsed[2];
+    StringRef results[2];
+    for (int i = 0; i < 2; i++) {
+        AllocatorStats before = AllocatorGetStats();
+        elapsed[i] = benchmarkVM(programs[i], &results[i]);
+        fprintf(stderr, "%-12s %-7s %d pushes: %8.2fms %6.1f ns/push %5.1f objects/push  %s\n", "in place", names[i], pushes,
+                elapsed[i] * 1000, elapsed[i] * 1e9 / pushes, (double)(AllocatorGetStats().allocations - before.allocations) / pushes, CString(results[i]));
+    }
+    ASSERT_STREQ("100001", CString(results[0]));
+    ASSERT_STREQ(CString(results[0]), CString(results[1]));
+    RCRelease(results[0]);
+    RCRelease(results[1]);
+}
+
+// walking a dictionary by index made (and autoreleased) a pair per entry, the cursor hands out its own pointers.
+UTEST(bench, iteration) {
+    enum { count = 100000, rounds = 20 };
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    DictionaryRef dict = Dictionary();
+    for (int64_t i = 0; i < count; i++) {
+        DictionarySetObjectForKey(dict, mkyInteger(i), mkyInteger(i));
+    }
+
+    int64_t pairsSum = 0;
+    AllocatorStats before = AllocatorGetStats();
+    double start = benchmarkNow();
+    for (int round = 0; round < rounds; round++) {
+        AutoreleasePoolRef inner = AutoreleasePoolCreate();
+        for (size_t i = 0; i < DictionaryCount(dict); i++) {
+            pairsSum += mkyIntegerValue(objectPairSecond(DictionaryKeyValueAtIndex(dict, i)));
+        }
+        RCRelease(inner);
+    }
+    double pairs = benchmarkNow() - start;
+    uint64_t pairAllocations = AllocatorGetStats().allocations - before.allocations;
+
+    int64_t cursorSum = 0;
+    before = AllocatorGetStats();
+    start = benchmarkNow();
+    for (int round = 0; round < rounds; round++) {
+        size_t cursor = 0;
+        RCTypeRef value;
+        while (DictionaryNext(dict, &cursor, NULL, &value)) {
+            cursorSum += mkyIntegerValue(value);
+        }
+    }
+    double cursor = benchmarkNow() - start;
+    uint64_t cursorAllocations = AllocatorGetStats().allocations - before.allocations;
+
+    fprintf(stderr, "%-12s %d entries  pairs: %6.2f ns/entry %4.1f objects/entry  cursor: %6.2f ns/entry %4.1f objects/entry  %s\n", "iteration",
+            count, pairs * 1e9 / (count * rounds), (double)pairAllocations / (count * rounds),
+            cursor * 1e9 / (count * rounds), (double)cursorAllocations / (count * rounds), pairsSum == cursorSum ? "" : "WRONG SUM");
+    RCRelease(pool);
+    ASSERT_EQ(pairsSum, cursorSum);
+    ASSERT_EQ(0, cursorAllocations);
+}
+
+static int benchmarkCompareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double benchmarkThreadNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void benchmarkPrintLatencies(const char *name, const char *what, double *latencies, size_t count) {
+    qsort(latencies, count, sizeof(double), benchmarkCompareDoubles);
+    fprintf(stderr, "%-12s %-12s %-13s p50: %6.0f ns  p99: %6.0f ns  p99.99: %8.0f ns  max: %10.0f ns\n",
+            "latency", name, what, latencies[count / 2] * 1e9, latencies[count * 99 / 100] * 1e9,
+            latencies[count * 9999 / 10000] * 1e9, latencies[count - 1] * 1e9);
+}
+
+// times every insert on its own while a monkey hash grows to 1M entries, the way set() and hash literals build them.
+// Consecutive integers stay on the dense array, spread integers and strings go to the map. Wall clock also counts
+// the times the thread is descheduled, the thread's CPU clock does not, and timing lookups the same way shows what
+// this machine does to a loop that allocates nothing.
+UTEST(bench, insertLatency) {
+    enum { count = 1 << 20 };
+    static MkyObject *keys[count];
+    static double wall[count], cpu[count];
+
+    const char *names[] = { "dense", "integers", "strings" };
+    for (int kind = 0; kind < 3; kind++) {
+        AutoreleasePoolRef pool = AutoreleasePoolCreate();
+        for (size_t i = 0; i < count; i++) {
+            keys[i] = kind == 0 ? mkyInteger(i) : kind == 1 ? mkyInteger(i * 7) : mkyString(StringWithFormat("key %zu", i));
+        }
+
+        size_t roots = RuntimeCycleRootCount();
+        MkyHashRef hash = RCRetain(mkyHash(NULL));
+        double total = benchmarkNow();
+        for (size_t i = 0; i < count; i++) {
+            double cpuStart = benchmarkThreadNow();
+            double start = benchmarkNow();
+            mkyHashSetObjectForKey(hash, keys[i], keys[i]);
+            wall[i] = benchmarkNow() - start;
+            cpu[i] = benchmarkThreadNow() - cpuStart;
+        }
+        total = benchmarkNow() - total;
+        ASSERT_EQ(count, mkyHashCount(hash));
+        // nodes replaced on the way down are uniquely held, none of them may end up buffered for the collector
+        ASSERT_EQ(roots, RuntimeCycleRootCount());
+        fprintf(stderr, "%-12s %-12s %d inserts  total: %6.1f ms\n", "latency", names[kind], count, total * 1e3);
+        benchmarkPrintLatencies(names[kind], "insert wall", wall, count);
+        benchmarkPrintLatencies(names[kind], "insert cpu", cpu, count);
+
+        for (size_t i = 0; i < count; i++) {
+            double start = benchmarkNow();
+            MkyObject *value = mkyHashObjectForKey(hash, keys[i]);
+            wall[i] = benchmarkNow() - start;
+            ASSERT_EQ(keys[i], value);
+        }
+        benchmarkPrintLatencies(names[kind], "lookup wall", wall, count);
+        RCRelease(hash);
+        RCRelease(pool);
+    }
+}
+
+// record like values: a few fields written once and read back. Each used to cost a buffer or a table of its own.
+UTEST(bench, smallContainers) {
+    enum { count = 200000, fields = 4 };
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    RCTypeRef keys[fields] = { StringWithChars("x"), StringWithChars("y"), StringWithChars("width"), StringWithChars("height") };
+    RCTypeRef values[fields];
+    for (int f = 0; f < fields; f++) {
+        values[f] = mkyInteger(f + 1);
+    }
+
+    const char *names[] = { "array", "map", "dictionary" };
+    double elapsed[3];
+    uint64_t allocations[3];
+    int64_t sums[3] = { 0 };
+    for (int kind = 0; kind < 3; kind++) {
+        AllocatorStats before = AllocatorGetStats();
+        double start = benchmarkNow();
+        for (size_t i = 0; i < count; i++) {
+            if (kind == 0) {
+                ArrayRef array = ArrayCreate();
+                for (int f = 0; f < fields; f++) {
+                    ArrayAppend(array, values[f]);
+                }
+                for (int f = 0; f < fields; f++) {
+                    sums[kind] += mkyIntegerValue(ArrayObjectAt(array, f));
+                }
+                RCRelease(array);
+
+            } else if (kind == 1) {
+                MapRef map = MapCreate();
+                for (int f = 0; f < fields; f++) {
+                    MapSetObjectForKey(map, keys[f], values[f]);
+                }
+                for (int f = 0; f < fields; f++) {
+                    sums[kind] += mkyIntegerValue(MapObjectForKey(map, keys[f]));
+                }
+                RCRelease(map);
+
+            } else {
+                DictionaryRef dict = DictionaryCreate();
+                for (int f = 0; f < fields; f++) {
+                    DictionarySetObjectForKey(dict, keys[f], values[f]);
+                }
+                for (int f = 0; f < fields; f++) {
+                    sums[kind] += mkyIntegerValue(DictionaryObjectForKey(dict, keys[f]));
+                }
+                RCRelease(dict);
+            }
+        }
+        elapsed[kind] = benchmarkNow() - start;
+        allocations[kind] = AllocatorGetStats().allocations - before.allocations;
+    }
+
+    fprintf(stderr, "%-12s %d fields ", "small", fields);
+    for (int kind = 0; kind < 3; kind++) {
+        fprintf(stderr, " %s: %6.1f ns/record %4.1f objects/record", names[kind], elapsed[kind] * 1e9 / count, (double)allocations[kind] / count);
+    }
+    fprintf(stderr, "\n");
+    RCRelease(pool);
+    ASSERT_EQ(count * 10, sums[0]);
+    ASSERT_EQ(sums[0], sums[1]);
+    ASSERT_EQ(sums[0], sums[2]);
+}
+
+// hashes keyed by consecutive integers: index into their values instead of hashing the key.
+UTEST(bench, denseHashes) {
+    enum { count = 1000, lookups = 1 << 22 };
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    MkyHashRef dense = (MkyHashRef)mkyHash(NULL);
+    for (int64_t i = 0; i < count; i++) {
+        mkyHashSetObjectForKey(dense, mkyInteger(i), mkyInteger(i));
+    }
+    MkyHashRef general = (MkyHashRef)mkyHashCopy(dense);
+    mkyHashPairs(general);
+    ASSERT_TRUE(mkyHashIsDense(dense));
+    ASSERT_FALSE(mkyHashIsDense(general));
+
+    MkyHashRef hashes[] = { dense, general };
+    const char *names[] = { "dense", "map" };
+    double elapsed[2];
+    int64_t sums[2] = { 0 };
+    for (int h = 0; h < 2; h++) {
+        double start = benchmarkNow();
+        for (size_t i = 0; i < lookups; i++) {
+            sums[h] += mkyIntegerValue(mkyHashObjectForKey(hashes[h], mkyInteger((int64_t)((i * 7919) % count))));
+        }
+        elapsed[h] = benchmarkNow() - start;
+    }
+
+    fprintf(stderr, "%-12s %d keys  %s: %6.2f ns/lookup  %s: %6.2f ns/lookup\n", "dense hashes", count,
+            names[0], elapsed[0] * 1e9 / lookups, names[1], elapsed[1] * 1e9 / lookups);
+    RCRelease(pool);
+    ASSERT_EQ(sums[0], sums[1]);
+}
+
+// arrays of a known size built one append (and one retain) at a time, against a single bulk append.
+UTEST(bench, bulkArrays) {
+    enum { total = 1 << 22 };
+    const size_t lengths[] = { 4, 64, 4096 };
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    RCTypeRef *objects = ar_malloc(4096 * sizeof(RCTypeRef));
+    for (int i = 0; i < 4096; i++) {
+        objects[i] = StringWithFormat("%d", i);
+    }
+
+    for (int l = 0; l < 3; l++) {
+        size_t length = lengths[l], rounds = total / length;
+        size_t singleCount = 0, bulkCount = 0;
+        double start = benchmarkNow();
+        for (size_t r = 0; r < rounds; r++) {
+            ArrayRef array = ArrayCreate();
+            for (size_t i = 0; i < length; i++) {
+                ArrayAppend(array, objects[i]);
+            }
+            singleCount += ArrayCount(array);
+            RCRelease(array);
+        }
+        double single = benchmarkNow() - start;
+
+        start = benchmarkNow();
+        for (size_t r = 0; r < rounds; r++) {
+            ArrayRef array = ArrayCreateWithCapacity(length);
+            ArrayAppendObjects(array, objects, length);
+            bulkCount += ArrayCount(array);
+            RCRelease(array);
+        }
+        double bulk = benchmarkNow() - start;
+
+        fprintf(stderr, "%-12s %4zu elements  append: %6.2f ns/element  bulk: %6.2f ns/element\n", "bulk arrays",
+                length, single * 1e9 / total, bulk * 1e9 / total);
+        ASSERT_EQ(singleCount, bulkCount);
+    }
+    free(objects);
+    RCRelease(pool);
+}
+
+// `a + b` on strings used to copy both sides, building a string piece by piece was quadratic.
+static double benchmarkConcatenation(size_t count, bool copying) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    StringRef fragment = StringWithChars("a line of the report\n");
+
+    double start = benchmarkNow();
+    StringRef result = String();
+    for (size_t i = 0; i < count; i++) {
+        if (copying) {
+            result = StringWithFormat("%s%s", CString(result), CString(fragment));
+        } else {
+            result = StringByConcatenating(result, fragment);
+        }
+    }
+    size_t length = strlen(CString(result));
+    double elapsed = benchmarkNow() - start;
+
+    assert(length == count * StringLength(fragment));
+    RCRelease(pool);
+    return elapsed;
+}
+
+UTEST(bench, concatenation) {
+    for (size_t count = 25000; count <= 100000; count *= 2) {
+        double rope = benchmarkConcatenation(count, false);
+        double copying = benchmarkConcatenation(count / 25, true);
+        fprintf(stderr, "%-12s rope: %7zu fragments %8.2fms %6.1f ns/fragment  copying: %7zu fragments %8.2fms %8.1f ns/fragment\n", "concat",
+                count, rope * 1000, rope * 1e9 / count, count / 25, copying * 1000, copying * 1e9 / (count / 25));
+    }
+}
+
+// appends used to go through vsnprintf, plain copies and integers don't need format parsing.
+UTEST(bench, appends) {
+    enum { count = 1000000 };
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+
+    double start = benchmarkNow();
+    StringRef formatted = String();
+    for (int i = 0; i < count; i++) {
+        StringAppendFormat(formatted, "%s", "fragment, ");
+    }
+    double formatChars = benchmarkNow() - start;
+
+    start = benchmarkNow();
+    StringRef copied = String();
+    for (int i = 0; i < count; i++) {
+        StringAppendChars(copied, "fragment, ");
+    }
+    double appendChars = benchmarkNow() - start;
+
+    start = benchmarkNow();
+    StringRef formattedIntegers = String();
+    for (int64_t i = 0; i < count; i++) {
+        StringAppendFormat(formattedIntegers, "%lld", (long long)(i * 7919 - 3000000));
+    }
+    double formatIntegers = benchmarkNow() - start;
+
+    start = benchmarkNow();
+    StringRef integers = String();
+    for (int64_t i = 0; i < count; i++) {
+        StringAppendInteger(integers, i * 7919 - 3000000);
+    }
+    double appendIntegers = benchmarkNow() - start;
+
+    bool same = !strcmp(CString(formatted), CString(copied)) && !strcmp(CString(formattedIntegers), CString(integers));
+    fprintf(stderr, "%-12s chars: %6.1f MB/s (format: %6.1f)  integers: %6.1f M/s (format: %6.1f)  %s\n", "appends",
+            StringLength(copied) / appendChars / 1e6, StringLength(formatted) / formatChars / 1e6,
+            count / appendIntegers / 1e6, count / formatIntegers / 1e6, same ? "" : "RESULTS DIFFER");
+    RCRelease(pool);
+    ASSERT_TRUE(same);
+}
+
+// slices used to be copies, long ones are views into the original string now.
+UTEST(bench, slices) {
+    enum { count = 100000, length = 1 << 20 };
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+
+    char *data = malloc(length);
+    for (size_t i = 0; i < length; i++) {
+        data[i] = 'a' + i % 26;
+    }
+    MkyObject *source = mkyStringWithBytes(data, length);
+    free(data);
+
+    AllocatorStats before = AllocatorGetStats();
+    double start = benchmarkNow();
+    size_t copiedLength = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t offset = (i * 7919) % (length / 2);
+        copiedLength += mkyStringLength(mkyStringWithBytes(mkyStringChars(source) + offset, 4096));
+    }
+    double copying = benchmarkNow() - start;
+    AllocatorStats afterCopying = AllocatorGetStats();
+
+    start = benchmarkNow();
+    size_t viewLength = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t offset = (i * 7919) % (length / 2);
+        viewLength += mkyStringLength(mkyStringSlice(source, offset, 4096));
+    }
+    double views = benchmarkNow() - start;
+    AllocatorStats afterViews = AllocatorGetStats();
+
+    fprintf(stderr, "%-12s views: %6.1f ns/slice %7.1f bytes/slice  copying: %6.1f ns/slice %7.1f bytes/slice\n", "slices",
+            views * 1e9 / count, (double)(afterViews.bytesAllocated - afterCopying.bytesAllocated) / count,
+            copying * 1e9 / count, (double)(afterCopying.bytesAllocated - before.bytesAllocated) / count);
+    RCRelease(pool);
+    ASSERT_EQ(copiedLength, viewLength);
+}
+
+// array slices share the original's trie, only its right edge gets copied.
+UTEST(bench, arraySlices) {
+    enum { count = 10000, length = 1 << 20, sliceLength = 4096 };
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    ArrayRef source = Array();
+    for (int64_t i = 0; i < length; i++) {
+        ArrayAppend(source, mkyInteger(i));
+    }
+
+    AllocatorStats before = AllocatorGetStats();
+    double start = benchmarkNow();
+    size_t copiedLength = 0;
+    for (size_t i = 0; i < count; i++) {
+        AutoreleasePoolRef inner = AutoreleasePoolCreate();
+        size_t offset = (i * 7919) % (length / 2);
+        ArrayRef copy = Array();
+        for (size_t j = 0; j < sliceLength; j++) {
+            ArrayAppend(copy, ArrayObjectAt(source, offset + j));
+        }
+        copiedLength += ArrayCount(copy);
+        RCRelease(inner);
+    }
+    double copying = benchmarkNow() - start;
+    AllocatorStats afterCopying = AllocatorGetStats();
+
+    start = benchmarkNow();
+    size_t sliceTotal = 0;
+    for (size_t i = 0; i < count; i++) {
+        AutoreleasePoolRef inner = AutoreleasePoolCreate();
+        size_t offset = (i * 7919) % (length / 2);
+        sliceTotal += ArrayCount(RCAutorelease(ArrayCreateWithRange(source, offset, sliceLength)));
+        RCRelease(inner);
+    }
+    double slices = benchmarkNow() - start;
+    AllocatorStats afterSlices = AllocatorGetStats();
+
+    fprintf(stderr, "%-12s %d of %d elements  ranges: %8.1f ns/slice %7.1f bytes/slice  copying: %8.1f ns/slice %7.1f bytes/slice\n", "array slices",
+            sliceLength, length, slices * 1e9 / count, (double)(afterSlices.bytesAllocated - afterCopying.bytesAllocated) / count,
+            copying * 1e9 / count, (double)(afterCopying.bytesAllocated - before.bytesAllocated) / count);
+    RCRelease(pool);
+    ASSERT_EQ(copiedLength, sliceTotal);
+}
+
+// strings used to go through stbds_hash_string, one byte at a time.
+UTEST(bench, hashing) {
+    enum { total = 64 << 20 };
+    size_t lengths[] = { 8, 16, 32, 64, 128, 256, 1024, 4096, 65536 };
+    char *bytes = malloc(65536 + 16);
+    for (size_t i = 0; i < 65536; i++) {
+        bytes[i] = 'a' + (i * 7919) % 26;
+    }
+    bytes[65536] = '\0';
+
+    fprintf(stderr, "%-12s long inputs use %s\n", "hashing", HashImplementationName());
+    for (int i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        size_t length = lengths[i];
+        size_t rounds = total / length;
+        volatile uint64_t sink = 0; // keeps the loops from being optimized away
+
+        double start = benchmarkNow();
+        for (size_t round = 0; round < rounds; round++) {
+            sink += HashBytes(bytes + (round & 7), length, AR_RUNTIME_HASH_SEED);
+        }
+        double hashBytes = benchmarkNow() - start;
+
+        start = benchmarkNow();
+        for (size_t round = 0; round < rounds; round++) {
+            sink += HashBytesPortable(bytes + (round & 7), length, AR_RUNTIME_HASH_SEED);
+        }
+        double portable = benchmarkNow() - start;
+
+        start = benchmarkNow();
+        for (size_t round = 0; round < rounds; round++) {
+            sink += stbds_hash_bytes(bytes + (round & 7), length, AR_RUNTIME_HASH_SEED);
+        }
+        double stbBytes = benchmarkNow() - start;
+
+        // the terminator moves with the length, like a string's would.
+        char saved[8];
+        memcpy(saved, bytes + length, 8);
+        for (int offset = 0; offset < 8; offset++) {
+            bytes[length + offset] = '\0';
+        }
+        start = benchmarkNow();
+        for (size_t round = 0; round < rounds; round++) {
+            sink += stbds_hash_string(bytes + (round & 7), AR_RUNTIME_HASH_SEED);
+        }
+        double stbString = benchmarkNow() - start;
+        memcpy(bytes + length, saved, 8);
+
+        double gigabytes = (double)rounds * (length) / 1e9;
+        fprintf(stderr, "%-12s %6zu bytes  hash: %6.2f GB/s  portable: %6.2f GB/s  stb bytes: %6.2f GB/s  stb string: %6.2f GB/s\n", "hashing",
+                length, gigabytes / hashBytes, gigabytes / portable, gigabytes / stbBytes, gigabytes / stbString);
+    }
+    free(bytes);
+}
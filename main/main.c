@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <pwd.h>
 #include <unistd.h>
 
@@ -15,9 +16,18 @@ const char *getUserName(void) {
 
 int main(int argc, char *argv[]) {
     // if argc load file and run that, otherwise repl
+	repl_engine engine = REPL_ENGINE_EVAL;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--vm")) {
+			engine = REPL_ENGINE_VM;
+
+		} else if (!strcmp(argv[i], "--eval")) {
+			engine = REPL_ENGINE_EVAL;
+		}
+	}
 
 	printf("Hello %s! This is the Monkey programming language!\n", getUserName());
-	printf("Feel free to type in commands\n");
-	replStart();
+	printf("Feel free to type in commands (engine: %s)\n", engine == REPL_ENGINE_VM ? "vm" : "eval");
+	replStart(engine);
 }
 
@@ -17,13 +17,27 @@
 #include "../object/object.h"
 #include "../parser/parser.h"
 #include "../evaluator/evaluator.h"
+#include "../resolver/resolver.h"
+#include "../compiler/compiler.h"
+#include "../vm/vm.h"
 
 #include "../arfoundation/tests/arfoundation_test.c"
 #include "../ast/ast_test.c"
+#include "../compiler/compiler_test.c"
 #include "../evaluator/evaluator_test.c"
 #include "../lexer/lexer_test.c"
 #include "../object/object_test.c"
 #include "../parser/parser_test.c"
+#include "../resolver/resolver_test.c"
+#include "../vm/vm_test.c"
+
+#ifndef CONKEY_BENCHMARKS
+#define CONKEY_BENCHMARKS 0
+#endif
+
+#if CONKEY_BENCHMARKS
+#include "benchmarks.c"
+#endif
 
 #if 0
 uint64_t fibs(uint64_t x) {
@@ -55,12 +69,13 @@ UTEST(perf, fibonacciRecursive) {
 	lexer_t *lexer = lexerWithInput(input);
 	parser_t *parser = parserWithLexer(lexer);
 	astprogram_t *program = parserParseProgram(parser);
+	resolverResolve(resolverCreate(), program);
 	MkyEnvironmentRef env = environmentCreate();
 
 	MkyObject *obj = mkyEval(AS_NODE(program), env);    
 
 	if (obj) {
-		printf("%s\n", CString(obj->inspect(obj)));
+		printf("%s\n", CString(mkyInspect(obj)));
 	}
 
     RCRelease(env);
@@ -7,59 +7,71 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "../arfoundation/arfoundation.h"
 
+static StringRef nullInspect(MkyObject *obj);
+static StringRef boolInspect(MkyObject *obj);
+static MkyHashKey boolHashkey(MkyObject *obj);
+static StringRef intInspect(MkyObject *obj);
+static MkyHashKey intHashkey(MkyObject *obj);
+
 StringRef mkyInspect(MkyObject *obj) {
-    return obj->inspect(obj);
+    switch (RuntimeTaggedPointerTag(obj)) {
+        case 0: return obj->inspect(obj);
+        case MKY_TAG_INTEGER: return intInspect(obj);
+        case MKY_TAG_BOOLEAN: return boolInspect(obj);
+        default: return nullInspect(obj);
+    }
 }
 
 MkyHashKey mkyHashKey(MkyObject *obj) {
-    if (!obj || !obj->hashkey) {
+    if (!obj) {
+        return (MkyHashKey){ 0, 0 };
+    }
+
+    switch (RuntimeTaggedPointerTag(obj)) {
+        case 0: break;
+        case MKY_TAG_INTEGER: return intHashkey(obj);
+        case MKY_TAG_BOOLEAN: return boolHashkey(obj);
+        default: return (MkyHashKey){ 0, 0 };
+    }
+
+    if (!obj->hashkey) {
         return (MkyHashKey){ 0, 0 };
     }
     return obj->hashkey(obj);
 }
 
 bool mkyIsHashable(MkyObject *obj) {
-    return obj->hashkey != NULL;
+    switch (RuntimeTaggedPointerTag(obj)) {
+        case 0: return obj->hashkey != NULL;
+        case MKY_TAG_INTEGER:
+        case MKY_TAG_BOOLEAN: return true;
+        default: return false;
+    }
 }
 
 #pragma mark - Null
 
 static StringRef nullInspect(MkyObject *obj) {
-    assert(obj->type == NULL_OBJ);
-    return StringWithFormat("null");
+    assert(mkyType(obj) == NULL_OBJ);
+    return StringWithChars("null");
 }
 
 MkyObject *mkyNull() {
-    static MkyObject *nullObj = NULL;
-    if (!nullObj) {
-        nullObj = RCAlloc(sizeof(*nullObj));
-        nullObj->type = NULL_OBJ;
-        nullObj->inspect = nullInspect;
-        RuntimeMakeConstant(nullObj);
-    }
-    return nullObj;
+    return (MkyObject *)(uintptr_t)MKY_TAG_NULL;
 }
 
 #pragma mark - Bool
 
-struct MkyBoolean {
-    MkyObject super;
-    bool value;
-};
-
 static StringRef boolInspect(MkyObject *obj) {
-    assert(obj->type == BOOLEAN_OBJ);
-    MkyBooleanRef self = (MkyBooleanRef)obj;
-    return StringWithFormat("%s", self->value ? "true" : "false");
+    return StringWithChars(mkyBooleanValue(obj) ? "true" : "false");
 }
 
 static MkyHashKey boolHashkey(MkyObject *obj) {
-    assert(obj->type == BOOLEAN_OBJ);
-    MkyBooleanRef self = (MkyBooleanRef)obj;
-    return (MkyHashKey){.type = obj->type, .value = self->value ? 1 : 0};
+    return (MkyHashKey){.type = BOOLEAN_OBJ, .value = mkyBooleanValue(obj) ? 1 : 0};
 }
 
 static StringRef mkyBoolDescription(RCTypeRef obj) {
@@ -67,14 +79,13 @@ static StringRef mkyBoolDescription(RCTypeRef obj) {
 }
 
 static uint64_t mkyBoolHash(RCTypeRef obj) {
-    MkyBooleanRef self = obj;
-    return self->value ? 1 : 0;
+    return mkyBooleanValue(obj) ? 1 : 0;
 }
 
 static RuntimeClassID MkyBoolClassID = { 0 };
 static RuntimeClassDescriptor MkyBoolClass = {
     "MkyBool",
-    sizeof(struct MkyBoolean),
+    sizeof(uintptr_t), // immediate only, never instantiated
     NULL, // const
     NULL,
     mkyBoolDescription,
@@ -82,60 +93,30 @@ static RuntimeClassDescriptor MkyBoolClass = {
 };
 
 MkyObject *mkyBoolean(bool value) {
-    static MkyBooleanRef boolTrue = NULL;
-    static MkyBooleanRef boolFalse = NULL;
-
-    if (!boolTrue || !boolFalse) {
-        if (MkyBoolClassID.classID == 0) {
-            MkyBoolClassID = RuntimeRegisterClass(&MkyBoolClass);
-        }
-
-        boolTrue = RuntimeCreateInstance(MkyBoolClassID);
-        boolTrue->super = (MkyObject){.type = BOOLEAN_OBJ, .inspect = boolInspect, .hashkey = boolHashkey};
-        boolTrue->value = true;
-        RuntimeMakeConstant(boolTrue);
-
-        boolFalse = RuntimeCreateInstance(MkyBoolClassID);
-        boolFalse->super = (MkyObject){.type = BOOLEAN_OBJ, .inspect = boolInspect, .hashkey = boolHashkey};
-        boolFalse->value = false;
-        RuntimeMakeConstant(boolFalse);
-    }
+    RuntimeRegisterTaggedPointerClassOnce(&MkyBoolClassID, &MkyBoolClass, MKY_TAG_BOOLEAN);
 
-    if (value) {
-        return &boolTrue->super;
-
-    } else {
-        return &boolFalse->super;
-    }
+    return (MkyObject *)(((uintptr_t)value << AR_RUNTIME_TAG_BITS) | MKY_TAG_BOOLEAN);
 }
 
 bool mkyBooleanValue(MkyObject *self) {
-    assert(self->type == BOOLEAN_OBJ);
-    return ((MkyBooleanRef)self)->value;
-}
-
-void mkyBooleanSetValue(MkyObject *self, bool value) {
-    assert(self->type == BOOLEAN_OBJ);
-    ((MkyBooleanRef)self)->value = value;
+    assert(RuntimeTaggedPointerTag(self) == MKY_TAG_BOOLEAN);
+    return ((uintptr_t)self >> AR_RUNTIME_TAG_BITS) != 0;
 }
 
 #pragma mark - Integer
 
+// only used for values that don't fit in an immediate.
 struct MkyInteger {
     MkyObject super;
     int64_t value;
 } ;
 
 static StringRef intInspect(MkyObject *obj) {
-    assert(obj->type == INTEGER_OBJ);
-    MkyIntegerRef self = (MkyIntegerRef)obj;
-    return StringWithFormat("%lld", self->value);
+    return StringWithInteger(mkyIntegerValue(obj));
 }
 
 static MkyHashKey intHashkey(MkyObject *obj) {
-    assert(obj->type == INTEGER_OBJ);
-    MkyIntegerRef self = (MkyIntegerRef)obj;
-    return (MkyHashKey){.type = obj->type, .value = self->value};
+    return (MkyHashKey){.type = INTEGER_OBJ, .value = mkyIntegerValue(obj)};
 }
 
 static StringRef mkyIntDescription(RCTypeRef obj) {
@@ -143,8 +124,11 @@ static StringRef mkyIntDescription(RCTypeRef obj) {
 }
 
 static uint64_t mkyIntHash(RCTypeRef obj) {
-    MkyIntegerRef self = obj;
-    return self->value;
+    return mkyIntegerValue(obj);
+}
+
+static bool mkyIntEquals(RCTypeRef obj, RCTypeRef other) {
+    return mkyIntegerValue(obj) == mkyIntegerValue(other);
 }
 
 static RuntimeClassID MkyIntegerClassID = { 0 };
@@ -154,12 +138,16 @@ static RuntimeClassDescriptor MkyIntegerClass = {
     NULL, // const
     NULL,
     mkyIntDescription,
-    mkyIntHash
+    mkyIntHash,
+    NULL, // traverse
+    mkyIntEquals
 };
 
 MkyObject *mkyInteger(int64_t value) {
-    if (MkyIntegerClassID.classID == 0) {
-        MkyIntegerClassID = RuntimeRegisterClass(&MkyIntegerClass);
+    RuntimeRegisterTaggedPointerClassOnce(&MkyIntegerClassID, &MkyIntegerClass, MKY_TAG_INTEGER);
+
+    if (value >= MKY_IMMEDIATE_INTEGER_MIN && value <= MKY_IMMEDIATE_INTEGER_MAX) {
+        return (MkyObject *)(((uintptr_t)value << AR_RUNTIME_TAG_BITS) | MKY_TAG_INTEGER);
     }
 
     MkyIntegerRef i = RuntimeCreateInstance(MkyIntegerClassID);
@@ -169,19 +157,25 @@ MkyObject *mkyInteger(int64_t value) {
 }
 
 int64_t mkyIntegerValue(MkyObject *self) {
-    assert(self->type == INTEGER_OBJ);
+    if (RuntimeTaggedPointerTag(self) == MKY_TAG_INTEGER) {
+        return (int64_t)(uintptr_t)self >> AR_RUNTIME_TAG_BITS; // arithmetic shift keeps the sign
+    }
+
+    assert(mkyType(self) == INTEGER_OBJ);
     return ((MkyIntegerRef)self)->value;
 }
-void mkyIntegerSetValue(MkyObject *self, int64_t value) {
-    assert(self->type == INTEGER_OBJ);
-    ((MkyIntegerRef)self)->value = value;
-}
 
 #pragma mark - String
 
+// A string is a single allocation: the bytes follow the object, next to their length and hash.
+// Interned literals and long strings (concatenation ropes) are referenced instead of copied,
+// value is only set for those.
 struct MkyString {
     MkyObject super;
-    StringRef value;
+    size_t length;
+    uint64_t hash;      // 0 until first needed
+    StringRef value;    // NULL when the bytes are inline
+    char bytes[];       // NUL terminated
 };
 
 static void mkyStringDealloc(RCTypeRef str) {
@@ -191,21 +185,23 @@ static void mkyStringDealloc(RCTypeRef str) {
 
 static uint64_t mkyStringHash(RCTypeRef str) {
     MkyStringRef self = str;
-    return RuntimeHash(self->value).hash;
+    if (!self->hash) {
+        self->hash = self->value ? StringHash(self->value) : StringHashBytes(self->bytes, self->length);
+    }
+    return self->hash;
 }
 
 static MkyHashKey stringHashkey(MkyObject *obj) {
-    assert(obj->type == STRING_OBJ);
+    assert(mkyType(obj) == STRING_OBJ);
     MkyStringRef self = (MkyStringRef)obj;
 
     uint64_t hash = mkyStringHash(self);
-    return (MkyHashKey){.type = obj->type, .value = hash};
+    return (MkyHashKey){.type = STRING_OBJ, .value = hash};
 }
 
 static StringRef stringInspect(MkyObject *obj) {
-    assert(obj->type == STRING_OBJ);
-    MkyStringRef self = (MkyStringRef)obj;
-    return self->value;
+    assert(mkyType(obj) == STRING_OBJ);
+    return mkyStringValue(obj);
 }
 
 static StringRef mkyStringDescription(RCTypeRef obj) {
@@ -213,6 +209,22 @@ static StringRef mkyStringDescription(RCTypeRef obj) {
     return stringInspect(&self->super);
 }
 
+static bool mkyStringEquals(RCTypeRef str, RCTypeRef other) {
+    MkyStringRef self = str;
+    MkyStringRef that = other;
+    if (self->value && that->value && StringIsInterned(self->value) && StringIsInterned(that->value)) {
+        return self->value == that->value;
+    }
+
+    if (self->length != that->length) {
+        return false;
+    }
+    if (self->hash && that->hash && self->hash != that->hash) {
+        return false;
+    }
+    return memcmp(mkyStringChars(&self->super), mkyStringChars(&that->super), self->length) == 0;
+}
+
 static RuntimeClassID MkyStringClassID = { 0 };
 static RuntimeClassDescriptor MkyStringClass = {
     "MkyString",
@@ -220,34 +232,99 @@ static RuntimeClassDescriptor MkyStringClass = {
     NULL, // const
     mkyStringDealloc,
     mkyStringDescription,
-    mkyStringHash
+    mkyStringHash,
+    NULL, // traverse
+    mkyStringEquals,
+    true // hash is cached in the instance
 };
 
-static void mkyStringInitialize(void) {
-    MkyStringClassID = RuntimeRegisterClass(&MkyStringClass);
+static MkyStringRef mkyStringAlloc(size_t length) {
+    RuntimeRegisterClassOnce(&MkyStringClassID, &MkyStringClass);
+
+    // inline bytes make it a sized instance, referenced strings use the plain class size.
+    size_t size = sizeof(struct MkyString) + (length ? length + 1 : 0);
+    MkyStringRef str = RuntimeRCAlloc(size, MkyStringClassID);
+    str->super = (MkyObject){.type = STRING_OBJ, .inspect = stringInspect, .hashkey = stringHashkey};
+    str->length = length;
+    str->hash = 0;
+    str->value = NULL;
+    return str;
+}
+
+MkyObject *mkyStringWithBytes(const char *bytes, size_t length) {
+    assert(bytes || length == 0);
+
+    MkyStringRef str = mkyStringAlloc(length);
+    if (length) {
+        memcpy(str->bytes, bytes, length);
+        str->bytes[length] = '\0';
+    }
+    return RCAutorelease(str);
 }
 
 MkyObject *mkyString(StringRef value) {
-    if (MkyStringClassID.classID == 0) {
-        mkyStringInitialize();
+    size_t length = StringLength(value);
+    if (!StringIsInterned(value) && length < AR_STRING_ROPE_MIN_LENGTH) {
+        return mkyStringWithBytes(StringBytes(value), length);
     }
 
-    MkyStringRef str = RuntimeCreateInstance(MkyStringClassID);
-    str->super = (MkyObject){.type = STRING_OBJ, .inspect = stringInspect, .hashkey = stringHashkey};
+    MkyStringRef str = mkyStringAlloc(0);
+    str->length = length;
     str->value = RCRetain(value);
     return RCAutorelease(str);
 }
 
+MkyObject *mkyStringByConcatenating(MkyObject *left, MkyObject *right) {
+    assert(mkyType(left) == STRING_OBJ && mkyType(right) == STRING_OBJ);
+    size_t leftLength = mkyStringLength(left);
+    size_t rightLength = mkyStringLength(right);
+
+    if (leftLength + rightLength >= AR_STRING_ROPE_MIN_LENGTH) {
+        return mkyString(StringByConcatenating(mkyStringValue(left), mkyStringValue(right)));
+    }
+
+    MkyStringRef str = mkyStringAlloc(leftLength + rightLength);
+    if (str->length) {
+        memcpy(str->bytes, mkyStringChars(left), leftLength);
+        memcpy(str->bytes + leftLength, mkyStringChars(right), rightLength);
+        str->bytes[str->length] = '\0';
+    }
+    return RCAutorelease(str);
+}
+
+MkyObject *mkyStringSlice(MkyObject *self, size_t start, size_t length) {
+    assert(mkyType(self) == STRING_OBJ);
+    MkyStringRef str = (MkyStringRef)self;
+    assert(start + length <= str->length);
+
+    if (length < AR_STRING_ROPE_MIN_LENGTH) {
+        return mkyStringWithBytes(mkyStringChars(self) + start, length);
+    }
+
+    if (str->value) {
+        return mkyString(StringWithSubstring(str->value, start, length));
+    }
+    return mkyString(StringWithView(str, str->bytes + start, length));
+}
+
 StringRef mkyStringValue(MkyObject *self) {
-    assert(self->type == STRING_OBJ);
-    return ((MkyStringRef)self)->value;
+    assert(mkyType(self) == STRING_OBJ);
+    MkyStringRef str = (MkyStringRef)self;
+    return str->value ? str->value : StringWithBytes(str->bytes, str->length);
 }
 
-void mkyStringSetValue(MkyObject *self, StringRef value) {
-    assert(self->type == STRING_OBJ);
-    RCRetain(value);
-    RCRelease(((MkyStringRef)self)->value);
-    ((MkyStringRef)self)->value = value;
+const char *mkyStringChars(MkyObject *self) {
+    assert(mkyType(self) == STRING_OBJ);
+    MkyStringRef str = (MkyStringRef)self;
+    if (str->value) {
+        return StringBytes(str->value);
+    }
+    return str->length ? str->bytes : "";
+}
+
+size_t mkyStringLength(MkyObject *self) {
+    assert(mkyType(self) == STRING_OBJ);
+    return ((MkyStringRef)self)->length;
 }
 
 #pragma mark - Return Value
@@ -263,7 +340,7 @@ static void mkyReturnDealloc(RCTypeRef obj) {
 }
 
 static StringRef returnInspect(MkyObject *obj) {
-    assert(obj->type == RETURN_VALUE_OBJ);
+    assert(mkyType(obj) == RETURN_VALUE_OBJ);
     MkyReturnValueRef self = (MkyReturnValueRef)obj;
     return mkyInspect(self->value);
 }
@@ -273,6 +350,11 @@ static StringRef mkyReturnDescription(RCTypeRef obj) {
     return returnInspect(&self->super);
 }
 
+static void mkyReturnTraverse(RCTypeRef obj, visitor_fn *visit, void *context) {
+    MkyReturnValueRef self = obj;
+    visit(self->value, context);
+}
+
 static RuntimeClassID MkyReturnClassID = { 0 };
 static RuntimeClassDescriptor MkyReturnClass = {
     "MkyReturnValue",
@@ -280,13 +362,12 @@ static RuntimeClassDescriptor MkyReturnClass = {
     NULL, // const
     mkyReturnDealloc,
     mkyReturnDescription,
-    NULL
+    NULL,
+    mkyReturnTraverse
 };
 
 MkyObject *mkyReturnValue(MkyObject *value) {
-    if (MkyReturnClassID.classID == 0) {
-        MkyReturnClassID = RuntimeRegisterClass(&MkyReturnClass);
-    }
+    RuntimeRegisterClassOnce(&MkyReturnClassID, &MkyReturnClass);
 
     MkyReturnValueRef val = RuntimeCreateInstance(MkyReturnClassID);
     val->super = (MkyObject){.type = RETURN_VALUE_OBJ, .inspect = returnInspect};
@@ -295,11 +376,11 @@ MkyObject *mkyReturnValue(MkyObject *value) {
 }
 
 MkyObject *mkyReturnValueValue(MkyObject *self) {
-    assert(self->type == RETURN_VALUE_OBJ);
+    assert(mkyType(self) == RETURN_VALUE_OBJ);
     return ((MkyReturnValueRef)self)->value;
 }
 void mkyReturnValueSetValue(MkyObject *self, MkyObject *value) {
-    assert(self->type == RETURN_VALUE_OBJ);
+    assert(mkyType(self) == RETURN_VALUE_OBJ);
     RCRetain(value);
     RCRelease(((MkyReturnValueRef)self)->value);
     ((MkyReturnValueRef)self)->value = value;
@@ -318,9 +399,11 @@ static void mkyErrorDealloc(RCTypeRef obj) {
 }
 
 static StringRef errorInspect(MkyObject *obj) {
-    assert(obj->type == ERROR_OBJ);
+    assert(mkyType(obj) == ERROR_OBJ);
     MkyErrorRef error = (MkyErrorRef)obj;
-    return StringWithFormat("ERROR: %s", CString(error->message));
+    StringRef out = StringWithChars("ERROR: ");
+    StringAppendString(out, error->message);
+    return out;
 }
 
 static StringRef mkyErrorDescription(RCTypeRef obj) {
@@ -339,9 +422,7 @@ static RuntimeClassDescriptor MkyErrorClass = {
 };
 
 MkyObject *mkyError(StringRef message) {
-    if (MkyErrorClassID.classID == 0) {
-        MkyErrorClassID = RuntimeRegisterClass(&MkyErrorClass);
-    }
+    RuntimeRegisterClassOnce(&MkyErrorClassID, &MkyErrorClass);
 
     MkyErrorRef error = RuntimeCreateInstance(MkyErrorClassID);
     error->super = (MkyObject){.type = ERROR_OBJ, .inspect = errorInspect};
@@ -350,7 +431,7 @@ MkyObject *mkyError(StringRef message) {
 }
 
 StringRef mkyErrorMessage(MkyObject *self) {
-    assert(self->type == ERROR_OBJ);
+    assert(mkyType(self) == ERROR_OBJ);
     return ((MkyErrorRef)self)->message;
 }
 
@@ -361,18 +442,24 @@ struct MkyFunction {
     MkyEnvironmentRef env;
     astidentifier_t **parameters;
     astblockstatement_t *body;
+    size_t slotCount;
 };
 
 static void mkyFunctionDealloc(RCTypeRef obj) {
     MkyFunctionRef self = obj;
-//    self->env = RCRelease(self->env);
+    self->env = RCRelease(self->env);
 
-    arrfree(self->parameters);
+    // parameters and body belong to the ast, every evaluation of the same literal shares them.
 //    self->body = RCRelease(self->body);
 }
 
+static void mkyFunctionTraverse(RCTypeRef obj, visitor_fn *visit, void *context) {
+    MkyFunctionRef self = obj;
+    visit(self->env, context);
+}
+
 static StringRef functionInspect(MkyObject *obj) {
-    assert(obj->type == FUNCTION_OBJ);
+    assert(mkyType(obj) == FUNCTION_OBJ);
     MkyFunctionRef self = (MkyFunctionRef)obj;
 
     StringRef params = String();
@@ -380,16 +467,16 @@ static StringRef functionInspect(MkyObject *obj) {
         for (int i = 0; i < arrlen(self->parameters); i++) {
             StringAppendString(params, ASTN_STRING(self->parameters[i]));
             if (i < arrlen(self->parameters) - 1) {
-                StringAppendFormat(params, ", ");
+                StringAppendChars(params, ", ");
             }
         }
     }
 
-    StringRef out = StringWithFormat("fn(");
+    StringRef out = StringWithChars("fn(");
     StringAppendString(out, params);
-    StringAppendFormat(out, ") {\n");
+    StringAppendChars(out, ") {\n");
     StringAppendString(out, ASTN_STRING(self->body));
-    StringAppendFormat(out, "\n}");
+    StringAppendChars(out, "\n}");
 
     return out;
 }
@@ -406,14 +493,13 @@ static RuntimeClassDescriptor MkyFunctionClass = {
     NULL, // const
     mkyFunctionDealloc,
     mkyFunctionDescription,
-    NULL
+    NULL,
+    mkyFunctionTraverse
 };
 
-MkyObject *mkyFunction(astidentifier_t **parameters, astblockstatement_t *body, MkyEnvironmentRef env) {
+MkyObject *mkyFunction(astidentifier_t **parameters, astblockstatement_t *body, size_t slotCount, MkyEnvironmentRef env) {
 
-    if (MkyFunctionClassID.classID == 0) {
-        MkyFunctionClassID = RuntimeRegisterClass(&MkyFunctionClass);
-    }
+    RuntimeRegisterClassOnce(&MkyFunctionClassID, &MkyFunctionClass);
 
     MkyFunctionRef fn = RuntimeCreateInstance(MkyFunctionClassID);
     fn->super = (MkyObject){.type = FUNCTION_OBJ, .inspect = functionInspect};
@@ -421,8 +507,9 @@ MkyObject *mkyFunction(astidentifier_t **parameters, astblockstatement_t *body,
 #warning FIXME: when ast nodes are refcounted...
     fn->parameters = parameters;
     fn->body = body;
+    fn->slotCount = slotCount;
 
-    fn->env = env; // do not retain environment as it will contain this fn.
+    fn->env = RCRetain(env); // usually a cycle, the env ends up holding this fn. see RuntimeCollectCycles.
     return RCAutorelease(fn);
 }
 
@@ -434,6 +521,10 @@ astblockstatement_t *mkyFunctionBody(MkyFunctionRef self) {
     return self->body;
 }
 
+size_t mkyFunctionSlotCount(MkyFunctionRef self) {
+    return self->slotCount;
+}
+
 MkyEnvironmentRef mkyFunctionEnv(MkyFunctionRef self) {
     return self->env;
 }
@@ -446,8 +537,8 @@ struct MkyBuiltin {
 };
 
 static StringRef builtinInspect(MkyObject *obj) {
-    assert(obj->type == BUILTIN_OBJ);
-    return StringWithFormat("builtin function");
+    assert(mkyType(obj) == BUILTIN_OBJ);
+    return StringWithChars("builtin function");
 }
 
 MkyObject *mkyBuiltIn(builtin_fn *builtin_f) {
@@ -458,7 +549,7 @@ MkyObject *mkyBuiltIn(builtin_fn *builtin_f) {
 }
 
 builtin_fn *mkyBuiltInFn(MkyObject *self) {
-    assert(self->type == BUILTIN_OBJ);
+    assert(mkyType(self) == BUILTIN_OBJ);
     return ((MkyBuiltinRef)self)->fn;
 }
 
@@ -474,24 +565,32 @@ static void mkyArrayDealloc(RCTypeRef obj) {
     self->elements = RCRelease(self->elements);
 }
 
+// integers and strings are written straight into out, no intermediate string.
+static void appendInspect(StringRef out, MkyObject *obj) {
+    if (RuntimeTaggedPointerTag(obj) == MKY_TAG_INTEGER) {
+        StringAppendInteger(out, mkyIntegerValue(obj));
+    } else if (mkyType(obj) == STRING_OBJ) {
+        StringAppendBytes(out, mkyStringChars(obj), mkyStringLength(obj));
+    } else {
+        StringAppendString(out, mkyInspect(obj));
+    }
+}
+
 static StringRef arrayInspect(MkyObject *obj) {
-    assert(obj->type == ARRAY_OBJ);
+    assert(mkyType(obj) == ARRAY_OBJ);
     MkyArrayRef self = (MkyArrayRef)obj;
 
-    StringRef elements = NULL;
-    if (self->elements) {
-        elements = String();
-
-        for (int i = 0; i < ArrayCount(self->elements); i++) {
-            StringRef str = mkyInspect(ArrayObjectAt(self->elements, i));
-            StringAppendString(elements, str);
-            if (i < ArrayCount(self->elements) - 1) {
-                StringAppendFormat(elements, ", ");
-            }
+    StringRef out = StringWithChars("[");
+    ArrayIterator elements = ArrayIteratorMake(self->elements);
+    RCTypeRef element;
+    for (bool first = true; ArrayIteratorNext(&elements, &element); first = false) {
+        if (!first) {
+            StringAppendChars(out, ", ");
         }
+        appendInspect(out, element);
     }
 
-    StringRef out = StringWithFormat("[%s]", elements ? CString(elements) : "");
+    StringAppendChars(out, "]");
     return out;
 }
 
@@ -499,6 +598,11 @@ static StringRef mkyArrayDescription(RCTypeRef obj) {
     return arrayInspect(obj);
 }
 
+static void mkyArrayTraverse(RCTypeRef obj, visitor_fn *visit, void *context) {
+    MkyArrayRef self = obj;
+    visit(self->elements, context);
+}
+
 static RuntimeClassID MkyArrayClassID = { 0 };
 static RuntimeClassDescriptor MkyArrayClass = {
     "MkyArray",
@@ -506,13 +610,12 @@ static RuntimeClassDescriptor MkyArrayClass = {
     NULL, // const
     mkyArrayDealloc,
     mkyArrayDescription,
-    NULL
+    NULL,
+    mkyArrayTraverse
 };
 
 MkyObject *mkyArray(ArrayRef elements) {
-    if (MkyArrayClassID.classID == 0) {
-        MkyArrayClassID = RuntimeRegisterClass(&MkyArrayClass);
-    }
+    RuntimeRegisterClassOnce(&MkyArrayClassID, &MkyArrayClass);
 
     MkyArrayRef array = RuntimeCreateInstance(MkyArrayClassID);
     array->super = (MkyObject){.type = ARRAY_OBJ, .inspect = arrayInspect};
@@ -524,40 +627,70 @@ ArrayRef mkyArrayElements(MkyArrayRef self) {
     return self->elements;
 }
 
+bool mkyArrayIsUnique(MkyArrayRef self) {
+    return RuntimeRefCount(self) == 1 && self->elements && RuntimeRefCount(self->elements) == 1;
+}
+
 #pragma mark - Hash
 
+// Hashes whose keys so far were consecutive integers, each one added after the last (`{0: a, 1: b}`, ids),
+// keep just their values in an array: a lookup is a subtraction and a bounds check. Keys in key order are
+// also the insertion order. Any other key, or removing one but the last, turns the hash into a map for good.
 struct MkyHash {
     MkyObject super;
-    DictionaryRef pairs; // mkyhashkey / pair
+    MapRef pairs;   // NULL while dense
+    ArrayRef dense; // values for keys base..<base + count
+    int64_t base;
 };
 
 static void mkyHashDealloc(RCTypeRef obj) {
     MkyHashRef self = obj;
     self->pairs = RCRelease(self->pairs);
+    self->dense = RCRelease(self->dense);
 }
 
-static StringRef hashInspect(MkyObject *obj) {
-    assert(obj->type == HASH_OBJ);
-    MkyHashRef self = (MkyHashRef)obj;
+// index in the dense values, -1 when key can't be one.
+static int64_t mkyHashDenseIndex(MkyHashRef self, MkyObject *key) {
+    if (mkyType(key) != INTEGER_OBJ) {
+        return -1;
+    }
 
-    StringRef pairs = NULL;
-    if (self->pairs) {
-        pairs = String();
+    int64_t index;
+    if (__builtin_sub_overflow(mkyIntegerValue(key), self->base, &index) || index < 0) {
+        return -1;
+    }
+    return index;
+}
 
-        for (int i = 0; i < DictionaryCount(self->pairs); i++) {
-            ObjectPairRef pair = DictionaryKeyValueAtIndex(self->pairs, i);
-            
-            StringRef key = mkyInspect(objectPairFirst(pair));
-            StringRef value = mkyInspect(objectPairSecond(pair));
-            StringAppendFormat(pairs, "%s: %s", CString(key), CString(value));
+// the map form, pairs go in key order.
+static void mkyHashMakeGeneral(MkyHashRef self) {
+    MapRef pairs = MapCreate();
+    ArrayIterator values = ArrayIteratorMake(self->dense);
+    RCTypeRef value;
+    for (int64_t key = self->base; ArrayIteratorNext(&values, &value); key++) {
+        MapSetObjectForKey(pairs, mkyInteger(key), value);
+    }
+    RCRelease(self->dense);
+    self->dense = NULL;
+    self->pairs = pairs;
+}
 
-            if (i < DictionaryCount(self->pairs) - 1) {
-                StringAppendFormat(pairs, ", ");
-            }
-        }
+static void hashInspectPair(RCTypeRef key, RCTypeRef value, void *context) {
+    StringRef out = context;
+    if (StringLength(out) > 1) {
+        StringAppendChars(out, ", ");
     }
+    appendInspect(out, key);
+    StringAppendChars(out, ": ");
+    appendInspect(out, value);
+}
+
+static StringRef hashInspect(MkyObject *obj) {
+    assert(mkyType(obj) == HASH_OBJ);
 
-    StringRef out = StringWithFormat("{%s}", pairs ? CString(pairs) : "");
+    StringRef out = StringWithChars("{");
+    mkyHashEnumerate((MkyHashRef)obj, hashInspectPair, out);
+    StringAppendChars(out, "}");
     return out;
 }
 
@@ -565,6 +698,16 @@ static StringRef mkyHashDescription(RCTypeRef obj) {
     return hashInspect(obj);
 }
 
+static void mkyHashTraverse(RCTypeRef obj, visitor_fn *visit, void *context) {
+    MkyHashRef self = obj;
+    if (self->pairs) {
+        visit(self->pairs, context);
+    }
+    if (self->dense) {
+        visit(self->dense, context);
+    }
+}
+
 static RuntimeClassID MkyHashClassID = { 0 };
 static RuntimeClassDescriptor MkyHashClass = {
     "MkyHash",
@@ -572,19 +715,249 @@ static RuntimeClassDescriptor MkyHashClass = {
     NULL, // const
     mkyHashDealloc,
     mkyHashDescription,
-    NULL
+    NULL,
+    mkyHashTraverse
 };
 
-MkyObject *mkyHash(DictionaryRef pairs) {
-    if (MkyHashClassID.classID == 0) {
-        MkyHashClassID = RuntimeRegisterClass(&MkyHashClass);
-    }
+MkyObject *mkyHash(MapRef pairs) {
+    RuntimeRegisterClassOnce(&MkyHashClassID, &MkyHashClass);
     MkyHashRef hash = RuntimeCreateInstance(MkyHashClassID);
     hash->super = (MkyObject){.type = HASH_OBJ, .inspect = hashInspect};
     hash->pairs = RCRetain(pairs);
     return RCAutorelease(hash);
 }
 
-DictionaryRef mkyHashPairs(MkyHashRef self) {
+MkyObject *mkyHashCopy(MkyHashRef self) {
+    MkyHashRef copy = (MkyHashRef)mkyHash(self->pairs);
+    copy->dense = RCRetain(self->dense);
+    copy->base = self->base;
+    return (MkyObject *)copy;
+}
+
+MkyObject *mkyHashObjectForKey(MkyHashRef self, MkyObject *key) {
+    if (self->pairs) {
+        return MapObjectForKey(self->pairs, key);
+    }
+
+    int64_t index = mkyHashDenseIndex(self, key);
+    return index >= 0 && self->dense ? ArrayObjectAt(self->dense, (size_t)index) : NULL;
+}
+
+// storage another hash shares is copied before self changes it.
+static void mkyHashOwnStorage(MkyHashRef self) {
+    if (self->pairs && RuntimeRefCount(self->pairs) > 1) {
+        MapRef pairs = MapCreateWithMap(self->pairs);
+        RCRelease(self->pairs);
+        self->pairs = pairs;
+    }
+
+    if (self->dense && RuntimeRefCount(self->dense) > 1) {
+        ArrayRef dense = ArrayCreateWithArray(self->dense);
+        RCRelease(self->dense);
+        self->dense = dense;
+    }
+}
+
+void mkyHashSetObjectForKey(MkyHashRef self, MkyObject *key, MkyObject *value) {
+    if (!self->pairs && !self->dense && mkyType(key) == INTEGER_OBJ) {
+        self->dense = ArrayCreate();
+        self->base = mkyIntegerValue(key);
+    }
+
+    int64_t index = self->pairs ? -1 : mkyHashDenseIndex(self, key);
+    if (!self->pairs && (index < 0 || (uint64_t)index > ArrayCount(self->dense))) {
+        mkyHashMakeGeneral(self);
+    }
+
+    mkyHashOwnStorage(self);
+    if (self->pairs) {
+        MapSetObjectForKey(self->pairs, key, value);
+    } else if ((uint64_t)index == ArrayCount(self->dense)) {
+        ArrayAppend(self->dense, value);
+    } else {
+        ArraySetObjectAt(self->dense, (size_t)index, value);
+    }
+}
+
+void mkyHashRemoveObjectForKey(MkyHashRef self, MkyObject *key) {
+    if (!mkyHashObjectForKey(self, key)) {
+        return;
+    }
+
+    if (!self->pairs && (uint64_t)mkyHashDenseIndex(self, key) + 1 < ArrayCount(self->dense)) {
+        mkyHashMakeGeneral(self);
+    }
+
+    mkyHashOwnStorage(self);
+    if (self->pairs) {
+        MapRemoveObjectForKey(self->pairs, key);
+        return;
+    }
+
+    ArrayRemoveAt(self->dense, ArrayCount(self->dense) - 1);
+    if (ArrayCount(self->dense) == 0) {
+        // the next key starts over.
+        RCRelease(self->dense);
+        self->dense = NULL;
+    }
+}
+
+size_t mkyHashCount(MkyHashRef self) {
+    return self->pairs ? MapCount(self->pairs) : ArrayCount(self->dense);
+}
+
+void mkyHashEnumerate(MkyHashRef self, pair_visitor_fn *visit, void *context) {
+    if (self->pairs) {
+        MapEnumerate(self->pairs, visit, context);
+        return;
+    }
+
+    ArrayIterator values = ArrayIteratorMake(self->dense);
+    RCTypeRef value;
+    for (int64_t key = self->base; ArrayIteratorNext(&values, &value); key++) {
+        visit(mkyInteger(key), value, context);
+    }
+}
+
+MapRef mkyHashPairs(MkyHashRef self) {
+    if (!self->pairs) {
+        if (self->dense) {
+            mkyHashMakeGeneral(self);
+        } else {
+            self->pairs = MapCreate();
+        }
+    }
     return self->pairs;
 }
+
+bool mkyHashIsDense(MkyHashRef self) {
+    return !self->pairs;
+}
+
+bool mkyHashIsUnique(MkyHashRef self) {
+    RCTypeRef storage = self->pairs ? (RCTypeRef)self->pairs : (RCTypeRef)self->dense;
+    return RuntimeRefCount(self) == 1 && (!storage || RuntimeRefCount(storage) == 1);
+}
+
+#pragma mark - Compiled Function
+
+struct MkyCompiledFunction {
+    MkyObject super;
+    instructions_t instructions;
+    int numLocals;
+    int numParameters;
+};
+
+static void mkyCompiledFunctionDealloc(RCTypeRef obj) {
+    MkyCompiledFunctionRef self = obj;
+    arrfree(self->instructions);
+}
+
+static StringRef compiledFunctionInspect(MkyObject *obj) {
+    assert(mkyType(obj) == COMPILED_FUNCTION_OBJ);
+    return StringWithFormat("CompiledFunction[%p]", obj);
+}
+
+static StringRef mkyCompiledFunctionDescription(RCTypeRef obj) {
+    return compiledFunctionInspect(obj);
+}
+
+static RuntimeClassID MkyCompiledFunctionClassID = { 0 };
+static RuntimeClassDescriptor MkyCompiledFunctionClass = {
+    "MkyCompiledFunction",
+    sizeof(struct MkyCompiledFunction),
+    NULL, // const
+    mkyCompiledFunctionDealloc,
+    mkyCompiledFunctionDescription,
+    NULL
+};
+
+MkyObject *mkyCompiledFunction(instructions_t instructions, int numLocals, int numParameters) {
+    RuntimeRegisterClassOnce(&MkyCompiledFunctionClassID, &MkyCompiledFunctionClass);
+
+    MkyCompiledFunctionRef fn = RuntimeCreateInstance(MkyCompiledFunctionClassID);
+    fn->super = (MkyObject){.type = COMPILED_FUNCTION_OBJ, .inspect = compiledFunctionInspect};
+    fn->instructions = instructions;
+    fn->numLocals = numLocals;
+    fn->numParameters = numParameters;
+    return RCAutorelease(fn);
+}
+
+instructions_t mkyCompiledFunctionInstructions(MkyCompiledFunctionRef self) {
+    return self->instructions;
+}
+
+int mkyCompiledFunctionNumLocals(MkyCompiledFunctionRef self) {
+    return self->numLocals;
+}
+
+int mkyCompiledFunctionNumParameters(MkyCompiledFunctionRef self) {
+    return self->numParameters;
+}
+
+#pragma mark - Closure
+
+struct MkyClosure {
+    MkyObject super;
+    MkyCompiledFunctionRef fn;
+    size_t numFree;
+    MkyObject *free[];
+};
+
+static void mkyClosureDealloc(RCTypeRef obj) {
+    MkyClosureRef self = obj;
+    for (size_t i = 0; i < self->numFree; i++) {
+        RCRelease(self->free[i]);
+    }
+    self->fn = RCRelease(self->fn);
+}
+
+static StringRef closureInspect(MkyObject *obj) {
+    assert(mkyType(obj) == CLOSURE_OBJ);
+    return StringWithFormat("Closure[%p]", obj);
+}
+
+static StringRef mkyClosureDescription(RCTypeRef obj) {
+    return closureInspect(obj);
+}
+
+static void mkyClosureTraverse(RCTypeRef obj, visitor_fn *visit, void *context) {
+    MkyClosureRef self = obj;
+    for (size_t i = 0; i < self->numFree; i++) {
+        visit(self->free[i], context);
+    }
+}
+
+static RuntimeClassID MkyClosureClassID = { 0 };
+static RuntimeClassDescriptor MkyClosureClass = {
+    "MkyClosure",
+    sizeof(struct MkyClosure),
+    NULL, // const
+    mkyClosureDealloc,
+    mkyClosureDescription,
+    NULL,
+    mkyClosureTraverse
+};
+
+MkyObject *mkyClosure(MkyCompiledFunctionRef fn, MkyObject **free, size_t numFree) {
+    RuntimeRegisterClassOnce(&MkyClosureClassID, &MkyClosureClass);
+
+    // variable sized, free variables are stored inline.
+    MkyClosureRef closure = RuntimeRCAlloc(sizeof(struct MkyClosure) + sizeof(MkyObject *) * numFree, MkyClosureClassID);
+    closure->super = (MkyObject){.type = CLOSURE_OBJ, .inspect = closureInspect};
+    closure->fn = RCRetain(fn);
+    closure->numFree = numFree;
+    for (size_t i = 0; i < numFree; i++) {
+        closure->free[i] = RCRetain(free[i]);
+    }
+    return RCAutorelease(closure);
+}
+
+MkyCompiledFunctionRef mkyClosureFunction(MkyClosureRef self) {
+    return self->fn;
+}
+
+MkyObject *mkyClosureFreeAt(MkyClosureRef self, size_t index) {
+    assert(index < self->numFree);
+    return self->free[index];
+}
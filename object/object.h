@@ -10,6 +10,7 @@
 
 #include "../arfoundation/arfoundation.h"
 #include "../ast/ast.h"
+#include "../compiler/code.h"
 #include "../environment/environment.h"
 #include "../token/token.h"
 
@@ -23,7 +24,9 @@ OBJ(ARRAY) \
 OBJ(HASH) \
 OBJ(FUNCTION) \
 OBJ(RETURN_VALUE) \
-OBJ(BUILTIN)
+OBJ(BUILTIN) \
+OBJ(COMPILED_FUNCTION) \
+OBJ(CLOSURE)
 
 #define OBJ(type) type##_OBJ,
 typedef enum : uint8_t {
@@ -60,6 +63,25 @@ struct MkyObject {
     hashkey_fn *hashkey;
 };
 
+// Small integers, booleans and null are immediates: the value lives in the MkyObject pointer
+// (see RuntimeIsTaggedPointer) and there's no struct behind it, so never read ->type directly.
+// Integers outside MKY_IMMEDIATE_INTEGER_MIN...MAX fall back to a heap MkyInteger.
+#define MKY_TAG_INTEGER 1
+#define MKY_TAG_BOOLEAN 2
+#define MKY_TAG_NULL    3
+
+#define MKY_IMMEDIATE_INTEGER_MAX (INT64_MAX >> AR_RUNTIME_TAG_BITS)
+#define MKY_IMMEDIATE_INTEGER_MIN (INT64_MIN >> AR_RUNTIME_TAG_BITS)
+
+AR_INLINE MkyObjectType mkyType(MkyObject *obj) {
+    switch (RuntimeTaggedPointerTag(obj)) {
+        case 0: return obj->type;
+        case MKY_TAG_INTEGER: return INTEGER_OBJ;
+        case MKY_TAG_BOOLEAN: return BOOLEAN_OBJ;
+        default: return NULL_OBJ;
+    }
+}
+
 StringRef mkyInspect(MkyObject *obj);
 MkyHashKey mkyHashKey(MkyObject *obj);
 bool mkyIsHashable(MkyObject *obj);
@@ -68,17 +90,19 @@ MkyObject *mkyNull(void);
 typedef struct MkyBoolean *MkyBooleanRef;
 MkyObject *mkyBoolean(bool value);
 bool mkyBooleanValue(MkyObject *self);
-void mkyBooleanSetValue(MkyObject *self, bool value);
 
 typedef struct MkyInteger *MkyIntegerRef;
 MkyObject *mkyInteger(int64_t value);
 int64_t mkyIntegerValue(MkyObject *self);
-void mkyIntegerSetValue(MkyObject *self, int64_t value);
 
 typedef struct MkyString *MkyStringRef;
 MkyObject *mkyString(StringRef value);
-StringRef mkyStringValue(MkyObject *self);
-void mkyStringSetValue(MkyObject *self, StringRef value);
+MkyObject *mkyStringWithBytes(const char *bytes, size_t length);
+MkyObject *mkyStringByConcatenating(MkyObject *left, MkyObject *right);
+MkyObject *mkyStringSlice(MkyObject *self, size_t start, size_t length); // long slices are views into self
+StringRef mkyStringValue(MkyObject *self); // a new string unless the object references one, prefer the accessors below
+const char *mkyStringChars(MkyObject *self); // mkyStringLength bytes, not always NUL terminated
+size_t mkyStringLength(MkyObject *self);
 
 typedef struct MkyReturnValue *MkyReturnValueRef;
 MkyObject *mkyReturnValue(MkyObject *value);
@@ -90,14 +114,16 @@ MkyObject *mkyError(StringRef message);
 StringRef mkyErrorMessage(MkyObject *self);
 
 typedef struct MkyFunction *MkyFunctionRef;
-MkyObject *mkyFunction(astidentifier_t **parameters, astblockstatement_t *body, MkyEnvironmentRef env);
+MkyObject *mkyFunction(astidentifier_t **parameters, astblockstatement_t *body, size_t slotCount, MkyEnvironmentRef env);
 astidentifier_t **mkyFunctionParameters(MkyFunctionRef self);
 astblockstatement_t *mkyFunctionBody(MkyFunctionRef self);
 MkyEnvironmentRef mkyFunctionEnv(MkyFunctionRef self);
+size_t mkyFunctionSlotCount(MkyFunctionRef self);
 
 typedef struct MkyArray *MkyArrayRef;
 MkyObject *mkyArray(ArrayRef elements);
 ArrayRef mkyArrayElements(MkyArrayRef self);
+bool mkyArrayIsUnique(MkyArrayRef self); // nothing else holds it or its elements' array: it can be changed in place
 
 typedef MkyObject *builtin_fn(ArrayRef args);
 typedef struct MkyBuiltin *MkyBuiltinRef;
@@ -105,7 +131,26 @@ MkyObject *mkyBuiltIn(builtin_fn *builtin);
 builtin_fn *mkyBuiltInFn(MkyObject *self);
 
 typedef struct MkyHash *MkyHashRef;
-MkyObject *mkyHash(DictionaryRef pairs);
-DictionaryRef mkyHashPairs(MkyHashRef self);
+MkyObject *mkyHash(MapRef pairs); // NULL for an empty hash
+MkyObject *mkyHashCopy(MkyHashRef self); // shares self's storage until either one changes
+MkyObject *mkyHashObjectForKey(MkyHashRef self, MkyObject *key); // NULL when missing
+void mkyHashSetObjectForKey(MkyHashRef self, MkyObject *key, MkyObject *value); // changes self, for hashes being built or unique ones
+void mkyHashRemoveObjectForKey(MkyHashRef self, MkyObject *key);
+size_t mkyHashCount(MkyHashRef self);
+void mkyHashEnumerate(MkyHashRef self, pair_visitor_fn *visit, void *context); // insertion order
+MapRef mkyHashPairs(MkyHashRef self); // as a map, a dense hash stops being one
+bool mkyHashIsDense(MkyHashRef self); // keys are consecutive integers, values are looked up by index
+bool mkyHashIsUnique(MkyHashRef self); // same for a hash and its storage
+
+typedef struct MkyCompiledFunction *MkyCompiledFunctionRef;
+MkyObject *mkyCompiledFunction(instructions_t instructions, int numLocals, int numParameters); // takes ownership of instructions
+instructions_t mkyCompiledFunctionInstructions(MkyCompiledFunctionRef self);
+int mkyCompiledFunctionNumLocals(MkyCompiledFunctionRef self);
+int mkyCompiledFunctionNumParameters(MkyCompiledFunctionRef self);
+
+typedef struct MkyClosure *MkyClosureRef;
+MkyObject *mkyClosure(MkyCompiledFunctionRef fn, MkyObject **free, size_t numFree);
+MkyCompiledFunctionRef mkyClosureFunction(MkyClosureRef self);
+MkyObject *mkyClosureFreeAt(MkyClosureRef self, size_t index);
 
 #endif /* _object_h_ */
@@ -24,6 +24,168 @@ UTEST(object, stringHashKeys) {
     RCRelease(pool);
 }
 
+UTEST(object, immediates) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+
+    int64_t values[] = { 0, 1, -1, 42, MKY_IMMEDIATE_INTEGER_MAX, MKY_IMMEDIATE_INTEGER_MIN };
+    for (int i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        MkyObject *integer = mkyInteger(values[i]);
+        ASSERT_TRUE(RuntimeIsTaggedPointer(integer));
+        ASSERT_EQ(INTEGER_OBJ, mkyType(integer));
+        ASSERT_EQ(values[i], mkyIntegerValue(integer));
+        ASSERT_EQ(AR_RUNTIME_REFCOUNT_UNRELEASABLE, RuntimeRefCount(integer));
+        ASSERT_EQ(integer, RCRelease(RCRetain(integer)));
+    }
+
+    int64_t large[] = { INT64_MAX, INT64_MIN, MKY_IMMEDIATE_INTEGER_MAX + 1, MKY_IMMEDIATE_INTEGER_MIN - 1 };
+    for (int i = 0; i < sizeof(large) / sizeof(large[0]); i++) {
+        MkyObject *integer = mkyInteger(large[i]);
+        ASSERT_FALSE(RuntimeIsTaggedPointer(integer));
+        ASSERT_EQ(INTEGER_OBJ, mkyType(integer));
+        ASSERT_EQ(large[i], mkyIntegerValue(integer));
+    }
+
+    ASSERT_EQ(BOOLEAN_OBJ, mkyType(mkyBoolean(true)));
+    ASSERT_EQ(BOOLEAN_OBJ, mkyType(mkyBoolean(false)));
+    ASSERT_TRUE(mkyBooleanValue(mkyBoolean(true)));
+    ASSERT_FALSE(mkyBooleanValue(mkyBoolean(false)));
+    ASSERT_EQ(mkyBoolean(true), mkyBoolean(true));
+    ASSERT_EQ(NULL_OBJ, mkyType(mkyNull()));
+    ASSERT_FALSE(mkyIsHashable(mkyNull()));
+
+    ASSERT_STREQ("-7", CString(mkyInspect(mkyInteger(-7))));
+    ASSERT_STREQ("true", CString(mkyInspect(mkyBoolean(true))));
+    ASSERT_STREQ("null", CString(mkyInspect(mkyNull())));
+
+    RCRelease(pool);
+}
+
+UTEST(object, immediateHashKeys) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+
+    DictionaryRef dict = Dictionary();
+    DictionarySetObjectForKey(dict, mkyInteger(7), mkyString(StringWithFormat("seven")));
+    DictionarySetObjectForKey(dict, mkyInteger(INT64_MAX), mkyString(StringWithFormat("max")));
+    DictionarySetObjectForKey(dict, mkyBoolean(true), mkyString(StringWithFormat("true")));
+
+    ASSERT_EQ(3, DictionaryCount(dict));
+    ASSERT_STREQ("seven", CString(mkyInspect(DictionaryObjectForKey(dict, mkyInteger(7)))));
+    ASSERT_STREQ("max", CString(mkyInspect(DictionaryObjectForKey(dict, mkyInteger(INT64_MAX)))));
+    ASSERT_STREQ("true", CString(mkyInspect(DictionaryObjectForKey(dict, mkyBoolean(true)))));
+    ASSERT_TRUE(NULL == DictionaryObjectForKey(dict, mkyInteger(1)));
+
+    RCRelease(pool);
+}
+
+UTEST(object, strings) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+
+    const char *text = "a string long enough to be referenced instead of copied into the object";
+    MkyObject *empty = mkyStringWithBytes(NULL, 0);
+    MkyObject *small = mkyStringWithBytes("Hello World", 11);
+    MkyObject *copied = mkyString(StringWithChars("Hello World"));
+    MkyObject *interned = mkyString(StringInternChars("Hello World", 11));
+    MkyObject *large = mkyStringWithBytes(text, strlen(text));
+    MkyObject *referenced = mkyString(StringWithChars(text));
+
+    ASSERT_EQ(0, mkyStringLength(empty));
+    ASSERT_STREQ("", mkyStringChars(empty));
+    ASSERT_EQ(11, mkyStringLength(small));
+    ASSERT_STREQ("Hello World", mkyStringChars(small));
+    ASSERT_STREQ("Hello World", CString(mkyInspect(small)));
+    ASSERT_EQ(strlen(text), mkyStringLength(referenced));
+
+    // same bytes, same hash and equal, however they're stored.
+    ASSERT_TRUE(RuntimeEquals(small, copied));
+    ASSERT_TRUE(RuntimeEquals(small, interned));
+    ASSERT_TRUE(RuntimeEquals(interned, mkyString(StringInternChars("Hello World", 11))));
+    ASSERT_TRUE(RuntimeEquals(large, referenced));
+    ASSERT_FALSE(RuntimeEquals(small, large));
+    ASSERT_FALSE(RuntimeEquals(small, mkyStringWithBytes("Hello world", 11)));
+    ASSERT_TRUE(HashkeyEquals(mkyHashKey(small), mkyHashKey(interned)));
+    ASSERT_TRUE(HashkeyEquals(mkyHashKey(large), mkyHashKey(referenced)));
+    ASSERT_EQ(RuntimeHash(small).hash, RuntimeHash(interned).hash);
+
+    DictionaryRef dict = Dictionary();
+    DictionarySetObjectForKey(dict, interned, mkyInteger(1));
+    DictionarySetObjectForKey(dict, large, mkyInteger(2));
+    ASSERT_EQ(1, mkyIntegerValue(DictionaryObjectForKey(dict, small)));
+    ASSERT_EQ(2, mkyIntegerValue(DictionaryObjectForKey(dict, referenced)));
+
+    // short results are copied inline, long ones link both strings.
+    MkyObject *joined = mkyStringByConcatenating(small, mkyStringWithBytes("!", 1));
+    ASSERT_STREQ("Hello World!", mkyStringChars(joined));
+    joined = mkyStringByConcatenating(joined, referenced);
+    ASSERT_EQ(12 + strlen(text), mkyStringLength(joined));
+    ASSERT_EQ(0, strncmp("Hello World!a string", mkyStringChars(joined), 20));
+    ASSERT_TRUE(RuntimeEquals(joined, mkyString(StringWithFormat("Hello World!%s", text))));
+
+    RCRelease(pool);
+}
+
+UTEST(object, denseHashes) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+
+    // consecutive integer keys are looked up by index, from whichever key came first.
+    MkyHashRef hash = (MkyHashRef)mkyHash(NULL);
+    for (int64_t i = 0; i < 100; i++) {
+        mkyHashSetObjectForKey(hash, mkyInteger(i - 10), mkyInteger(i * i));
+    }
+    ASSERT_TRUE(mkyHashIsDense(hash));
+    ASSERT_EQ(100, mkyHashCount(hash));
+    ASSERT_EQ(0, mkyIntegerValue(mkyHashObjectForKey(hash, mkyInteger(-10))));
+    ASSERT_EQ(99 * 99, mkyIntegerValue(mkyHashObjectForKey(hash, mkyInteger(89))));
+    ASSERT_EQ(NULL, mkyHashObjectForKey(hash, mkyInteger(-11)));
+    ASSERT_EQ(NULL, mkyHashObjectForKey(hash, mkyInteger(90)));
+    ASSERT_EQ(NULL, mkyHashObjectForKey(hash, mkyInteger(INT64_MIN)));
+    ASSERT_EQ(NULL, mkyHashObjectForKey(hash, mkyStringWithBytes("1", 1)));
+
+    // copies share the values, replacing one or dropping the last key keeps them dense.
+    MkyHashRef copy = (MkyHashRef)mkyHashCopy(hash);
+    mkyHashSetObjectForKey(copy, mkyInteger(0), mkyInteger(-1));
+    mkyHashRemoveObjectForKey(copy, mkyInteger(89));
+    ASSERT_TRUE(mkyHashIsDense(copy));
+    ASSERT_EQ(99, mkyHashCount(copy));
+    ASSERT_EQ(-1, mkyIntegerValue(mkyHashObjectForKey(copy, mkyInteger(0))));
+    ASSERT_EQ(100, mkyIntegerValue(mkyHashObjectForKey(hash, mkyInteger(0))));
+    ASSERT_EQ(100, mkyHashCount(hash));
+
+    // a gap, another type or a removal in the middle makes it a map, in the same order.
+    MkyHashRef gap = (MkyHashRef)mkyHashCopy(hash);
+    mkyHashSetObjectForKey(gap, mkyInteger(1000), mkyInteger(1));
+    MkyHashRef mixed = (MkyHashRef)mkyHashCopy(hash);
+    mkyHashSetObjectForKey(mixed, mkyStringWithBytes("key", 3), mkyInteger(1));
+    MkyHashRef removed = (MkyHashRef)mkyHashCopy(hash);
+    mkyHashRemoveObjectForKey(removed, mkyInteger(0));
+    MkyHashRef changed[] = { gap, mixed, removed };
+    for (int i = 0; i < 3; i++) {
+        ASSERT_FALSE(mkyHashIsDense(changed[i]));
+        ASSERT_EQ(i == 2 ? 99 : 101, mkyHashCount(changed[i]));
+        ASSERT_EQ(99 * 99, mkyIntegerValue(mkyHashObjectForKey(changed[i], mkyInteger(89))));
+    }
+    ASSERT_TRUE(mkyHashIsDense(hash));
+    ASSERT_EQ(NULL, mkyHashObjectForKey(removed, mkyInteger(0)));
+
+    MkyHashRef small = (MkyHashRef)mkyHash(NULL);
+    mkyHashSetObjectForKey(small, mkyInteger(1), mkyStringWithBytes("a", 1));
+    mkyHashSetObjectForKey(small, mkyInteger(2), mkyStringWithBytes("b", 1));
+    ASSERT_STREQ("{1: a, 2: b}", CString(mkyInspect((MkyObject *)small)));
+    mkyHashSetObjectForKey(small, mkyInteger(0), mkyStringWithBytes("c", 1));
+    ASSERT_FALSE(mkyHashIsDense(small));
+    ASSERT_STREQ("{1: a, 2: b, 0: c}", CString(mkyInspect((MkyObject *)small)));
+
+    // emptied out, the next key is a new start.
+    MkyHashRef single = (MkyHashRef)mkyHash(NULL);
+    mkyHashSetObjectForKey(single, mkyInteger(INT64_MAX), mkyInteger(1));
+    mkyHashRemoveObjectForKey(single, mkyInteger(INT64_MAX));
+    mkyHashSetObjectForKey(single, mkyInteger(INT64_MIN), mkyInteger(2));
+    ASSERT_TRUE(mkyHashIsDense(single));
+    ASSERT_EQ(NULL, mkyHashObjectForKey(single, mkyInteger(INT64_MAX)));
+    ASSERT_EQ(2, mkyIntegerValue(mkyHashObjectForKey(single, mkyInteger(INT64_MIN))));
+
+    RCRelease(pool);
+}
+
 #ifndef AR_COMPOUND_TEST
 UTEST_MAIN();
 #endif
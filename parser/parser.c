@@ -209,10 +209,18 @@ static astexpression_t *parserParseCallExpression(parser_t *parser, astexpressio
     return (astexpression_t *)call;
 }
 
+// a string literal on its own as a hash key or index is a name, those are interned. see StringIntern.
+static astexpression_t *parserParseKey(parser_t *parser, token_type end) {
+    if (parserCurTokenIs(parser, TOKEN_STRING) && parserPeekTokenIs(parser, end)) {
+        return (astexpression_t *)stringLiteralCreateInterned(parser->currentToken, parser->currentToken.literal);
+    }
+    return parserParseExpression(parser, PREC_LOWEST);
+}
+
 static astexpression_t *parserParseIndexExpression(parser_t *parser, astexpression_t *left) {
     astindexexpression_t *idx = indexExpressionCreate(parser->currentToken, left);
     parserNextToken(parser); //[
-    idx->index = parserParseExpression(parser, PREC_LOWEST);
+    idx->index = parserParseKey(parser, TOKEN_RBRACKET);
     if (!parserExpectPeek(parser, TOKEN_RBRACKET)) {
         return NULL;
     }
@@ -336,7 +344,7 @@ static astexpression_t *parserParseFunctionLiteral(parser_t *parser) {
 }
 
 static astexpression_t *parserParseStringLiteral(parser_t *parser) {
-    aststringliteral_t *str = stringLiteralCreate(parser->currentToken, parser->currentToken.literal);
+    aststringliteral_t *str = stringLiteralCreate(parser->currentToken, parser->currentToken.literal, parser->lexer);
     return (astexpression_t *)str;
 }
 
@@ -351,7 +359,7 @@ static astexpression_t *parserParseHashLiteral(parser_t *parser) {
 
     while (!parserPeekTokenIs(parser, TOKEN_RBRACE)) {
         parserNextToken(parser);
-        astexpression_t *key = parserParseExpression(parser, PREC_LOWEST);
+        astexpression_t *key = parserParseKey(parser, TOKEN_COLON);
 
         if (!parserExpectPeek(parser, TOKEN_COLON)) {
             return NULL;
@@ -406,9 +414,7 @@ static RuntimeClassDescriptor MkyParserClass = {
 };
 
 parser_t *parserWithLexer(lexer_t *lexer) {
-    if (MkyParserClassID.classID == 0) {
-        MkyParserClassID = RuntimeRegisterClass(&MkyParserClass);
-    }
+    RuntimeRegisterClassOnce(&MkyParserClassID, &MkyParserClass);
 
     parser_t *parser = RuntimeCreateInstance(MkyParserClassID);
     parser->lexer = RCRetain(lexer);
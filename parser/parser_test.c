@@ -292,6 +292,7 @@ UTEST(parser, identifierExpression) {
     astidentifier_t *ident = (astidentifier_t *)stmt->expression;
 
     ASSERT_STREQ("foobar", CString(ident->value));
+    ASSERT_EQ(StringInternChars("foobar", 6), ident->value);
 
     StringRef lit = ASTN_TOKLIT(ident);
     ASSERT_STREQ("foobar", CString(lit));
@@ -816,6 +817,36 @@ UTEST(parser, stringLiteralExpressions) {
     aststringliteral_t *str = (aststringliteral_t *)stmt->expression;
 
     ASSERT_STREQ("Hello World", CString(str->value));
+    ASSERT_FALSE(StringIsInterned(str->value)); // data
+
+    // keys are names, those are interned.
+    lexer = lexerWithInput("{\"key\": \"value\"}[\"key\"]");
+    parser = parserWithLexer(lexer);
+    program = parserParseProgram(parser);
+    ASSERT_FALSE(checkParserErrors(parser));
+
+    astindexexpression_t *index = (astindexexpression_t *)((astexpressionstatement_t *)program->statements[0])->expression;
+    ASSERT_EQ(AST_INDEXEXP, AST_TYPE(index));
+    asthashliteral_t *hash = (asthashliteral_t *)index->left;
+    StringRef key = ((aststringliteral_t *)hash->pairs[0].key)->value;
+    ASSERT_TRUE(StringIsInterned(key));
+    ASSERT_FALSE(StringIsInterned(((aststringliteral_t *)hash->pairs[0].value)->value));
+    ASSERT_EQ(key, ((aststringliteral_t *)index->index)->value);
+
+    // long literals point into the lexer's input.
+    StringRef data = String();
+    for (int i = 0; i < 64; i++) {
+        StringAppendChars(data, "data");
+    }
+    lexer = lexerWithInput(CString(StringWithFormat("\"%s\"", CString(data))));
+    parser = parserWithLexer(lexer);
+    program = parserParseProgram(parser);
+    ASSERT_FALSE(checkParserErrors(parser));
+
+    str = (aststringliteral_t *)((astexpressionstatement_t *)program->statements[0])->expression;
+    ASSERT_FALSE(StringIsInterned(str->value));
+    ASSERT_TRUE(StringBytes(str->value) == lexer->input + 1);
+    ASSERT_TRUE(RuntimeEquals(data, str->value));
     RCRelease(autoreleasepool);
 }
 
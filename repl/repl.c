@@ -5,11 +5,14 @@
 #include "../macros.h"
 #include "../ast/ast.h"
 #include "../arfoundation/arfoundation.h"
+#include "../compiler/compiler.h"
 #include "../environment/environment.h"
 #include "../evaluator/evaluator.h"
 #include "../lexer/lexer.h"
 #include "../parser/parser.h"
+#include "../resolver/resolver.h"
 #include "../token/token.h"
+#include "../vm/vm.h"
 
 #include "../arfoundation/arfoundation.h"
 
@@ -35,11 +38,23 @@ void printParserErrors(ArrayRef errors) {
     }
 }
 
-void replStart() {
+void printCompilerErrors(ArrayRef errors) {
+    printf("Woops! Compilation failed:\n");
+    for (int i = 0; i < ArrayCount(errors); i++) {
+        printf("\t%s\n", CString(ArrayObjectAt(errors, i)));
+    }
+}
+
+void replStart(repl_engine engine) {
     char line[1024];
     MkyEnvironmentRef env = environmentCreate();
 
     AutoreleasePoolRef autoreleasepool = AutoreleasePoolCreate();
+
+    // engine state that has to outlive each line.
+    resolver_t *resolver = RCRetain(resolverCreate());
+    compiler_t *compiler = RCRetain(compilerCreate());
+    vm_t *vm = RCRetain(vmCreate());
     while (true) {        
         // printf("\033[32m>> \033[0m");
         printf(">> ");
@@ -57,14 +72,33 @@ void replStart() {
             continue;
         }
 
-        MkyObject *evaluated = mkyEval(AS_NODE(program), env);
+        MkyObject *evaluated = NULL;
+        if (engine == REPL_ENGINE_VM) {
+            compiler_t *lineCompiler = compilerCreateWithState(compiler->symbolTable, compiler->constants);
+            if (!compilerCompile(lineCompiler, AS_NODE(program))) {
+                printCompilerErrors(lineCompiler->errors);
+                AutoreleasePoolDrain(autoreleasepool);
+                continue;
+            }
+            evaluated = vmRun(vm, compilerBytecode(lineCompiler));
+
+        } else {
+            resolverResolve(resolver, program);
+            evaluated = mkyEval(AS_NODE(program), env);
+        }
+
         if (evaluated) {
-            printf("%s\n", CString(evaluated->inspect(evaluated)));
+            printf("%s\n", CString(mkyInspect(evaluated)));
         }
        
         AutoreleasePoolDrain(autoreleasepool);
+        RuntimeCollectCycles(); // nothing from this line is on the stack anymore.
     }
 
+    RCRelease(vm);
+    RCRelease(compiler);
+    RCRelease(resolver);
     RCRelease(env);
     autoreleasepool = RCRelease(autoreleasepool);
+    RuntimeCollectCycles();
 }
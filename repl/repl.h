@@ -1,6 +1,11 @@
 #ifndef _repl_h_
 #define _repl_h_
 
-void replStart(void);
+typedef enum {
+    REPL_ENGINE_EVAL, // tree walking evaluator
+    REPL_ENGINE_VM,   // bytecode compiler + vm
+} repl_engine;
+
+void replStart(repl_engine engine);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,327 @@
+//
+//  resolver.c
+//  conkey
+//
+
+#include "resolver.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "../arfoundation/arfoundation.h"
+#include "../evaluator/builtins.h"
+
+typedef struct {
+    StringRef key; // interned, compared by pointer
+    int value;
+    bool declared; // its let has run, reads in the same scope before that go to the enclosing ones
+    bool conditional; // only on some paths (an if's branch), reads check the slot and fall back when it's unset
+} resolverbinding_t;
+
+typedef struct {
+    resolverbinding_t *bindings;
+    int count;
+} resolverscope_t;
+
+struct resolver_t {
+    resolverscope_t *scopes; // scopes[0] holds the globals and outlives each program
+    int branchDepth; // if branches entered in the current function
+};
+
+typedef void visit_fn(resolver_t *resolver, astnode_t *node);
+
+static void resolverDealloc(RCTypeRef obj) {
+    resolver_t *self = obj;
+    for (int i = 0; i < arrlen(self->scopes); i++) {
+        hmfree(self->scopes[i].bindings);
+    }
+    arrfree(self->scopes);
+}
+
+static RuntimeClassID MkyResolverClassID = { 0 };
+static RuntimeClassDescriptor MkyResolverClass = {
+    "MkyResolver",
+    sizeof(struct resolver_t),
+    NULL, // const
+    resolverDealloc,
+    NULL,
+    NULL
+};
+
+static void pushScope(resolver_t *resolver) {
+    resolverscope_t scope = { 0 };
+    arrput(resolver->scopes, scope);
+}
+
+static resolverscope_t popScope(resolver_t *resolver) {
+    resolverscope_t scope = arrpop(resolver->scopes);
+    hmfree(scope.bindings);
+    return scope;
+}
+
+static resolverscope_t *currentScope(resolver_t *resolver) {
+    return &arrlast(resolver->scopes);
+}
+
+resolver_t *resolverCreate(void) {
+    RuntimeRegisterClassOnce(&MkyResolverClassID, &MkyResolverClass);
+
+    resolver_t *resolver = RuntimeCreateInstance(MkyResolverClassID);
+    pushScope(resolver);
+    return RCAutorelease(resolver);
+}
+
+int resolverGlobalCount(resolver_t *resolver) {
+    return resolver->scopes[0].count;
+}
+
+// slot for name, rebinding a name in the same scope reuses its slot.
+static resolverbinding_t *binding(resolverscope_t *scope, StringRef name) {
+    name = StringIntern(name);
+    ptrdiff_t index = hmgeti(scope->bindings, name);
+    if (index < 0) {
+        resolverbinding_t binding = { name, scope->count++, false };
+        hmputs(scope->bindings, binding);
+        index = hmgeti(scope->bindings, name);
+    }
+    return &scope->bindings[index];
+}
+
+// a let in a branch only declares what no let outside of one already has.
+static int define(resolverscope_t *scope, StringRef name, bool conditional) {
+    resolverbinding_t *defined = binding(scope, name);
+    defined->conditional = conditional ? defined->conditional || !defined->declared : false;
+    defined->declared = true;
+    return defined->value;
+}
+
+static int builtinIndex(StringRef name) {
+    for (size_t i = 0; i < builtinCount(); i++) {
+        const char *builtin = builtinNameAtIndex(i);
+        if (StringInternChars(builtin, strlen(builtin)) == name) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static void visitChildren(resolver_t *resolver, astnode_t *node, visit_fn *visit) {
+    switch (node->type) {
+        case AST_PROGRAM: {
+            astprogram_t *program = (astprogram_t *)node;
+            for (int i = 0; i < arrlen(program->statements); i++) {
+                visit(resolver, AS_NODE(program->statements[i]));
+            }
+        }
+            break;
+
+        case AST_LET:
+            visit(resolver, AS_NODE(((astletstatement_t *)node)->value));
+            break;
+
+        case AST_RETURN:
+            visit(resolver, AS_NODE(((astreturnstatement_t *)node)->returnValue));
+            break;
+
+        case AST_EXPRESSIONSTMT:
+            visit(resolver, AS_NODE(((astexpressionstatement_t *)node)->expression));
+            break;
+
+        case AST_BLOCKSTMT: {
+            astblockstatement_t *block = (astblockstatement_t *)node;
+            for (int i = 0; i < arrlen(block->statements); i++) {
+                visit(resolver, AS_NODE(block->statements[i]));
+            }
+        }
+            break;
+
+        case AST_PREFIXEXPR:
+            visit(resolver, AS_NODE(((astprefixexpression_t *)node)->right));
+            break;
+
+        case AST_INFIXEXPR:
+            visit(resolver, AS_NODE(((astinfixexpression_t *)node)->left));
+            visit(resolver, AS_NODE(((astinfixexpression_t *)node)->right));
+            break;
+
+        case AST_IFEXPR: {
+            astifexpression_t *exp = (astifexpression_t *)node;
+            visit(resolver, AS_NODE(exp->condition));
+            visit(resolver, AS_NODE(exp->consequence));
+            if (exp->alternative) {
+                visit(resolver, AS_NODE(exp->alternative));
+            }
+        }
+            break;
+
+        case AST_FNLIT:
+            visit(resolver, AS_NODE(((astfunctionliteral_t *)node)->body));
+            break;
+
+        case AST_CALL: {
+            astcallexpression_t *call = (astcallexpression_t *)node;
+            visit(resolver, AS_NODE(call->function));
+            for (int i = 0; i < arrlen(call->arguments); i++) {
+                visit(resolver, AS_NODE(call->arguments[i]));
+            }
+        }
+            break;
+
+        case AST_ARRAY: {
+            astarrayliteral_t *array = (astarrayliteral_t *)node;
+            for (int i = 0; i < arrlen(array->elements); i++) {
+                visit(resolver, AS_NODE(array->elements[i]));
+            }
+        }
+            break;
+
+        case AST_INDEXEXP:
+            visit(resolver, AS_NODE(((astindexexpression_t *)node)->left));
+            visit(resolver, AS_NODE(((astindexexpression_t *)node)->index));
+            break;
+
+        case AST_HASH: {
+            asthashliteral_t *hash = (asthashliteral_t *)node;
+            for (int i = 0; i < hmlen(hash->pairs); i++) {
+                visit(resolver, AS_NODE(hash->pairs[i].key));
+                visit(resolver, AS_NODE(hash->pairs[i].value));
+            }
+        }
+            break;
+
+        case AST_IDENTIFIER:
+        case AST_INTEGER:
+        case AST_BOOL:
+        case AST_STRING:
+            break;
+    }
+}
+
+// collects the lets of the current function so functions using them ahead of them, like mutual recursion, resolve.
+// Reads in the function itself only see a let once it has run, like they would in a dictionary.
+static void hoist(resolver_t *resolver, astnode_t *node) {
+    if (!node) {
+        return;
+    }
+
+    if (node->type == AST_FNLIT) {
+        return; // its own scope, hoisted when it gets resolved.
+    }
+
+    if (node->type == AST_LET) {
+        binding(currentScope(resolver), ((astletstatement_t *)node)->name->value);
+    }
+
+    visitChildren(resolver, node, hoist);
+}
+
+// the identifier to address next, a binding that may be unset gets the enclosing one as its fallback.
+static astidentifier_t *nextAddress(astidentifier_t *ident) {
+    if (ident->depth == AST_DEPTH_UNRESOLVED) {
+        return ident;
+    }
+    ident->fallback = identifierCreate(ident->token, ident->token.literal);
+    return ident->fallback;
+}
+
+// Lets that ran on some paths only, and the lets of enclosing functions that hadn't run yet where the function
+// is defined, may have left their slot unset. Reads of them fall back to the binding a dictionary lookup would
+// have found next, down to a builtin or the name not being found.
+static void resolveIdentifier(resolver_t *resolver, astidentifier_t *ident) {
+    StringRef name = StringIntern(ident->value);
+    int top = (int)arrlen(resolver->scopes) - 1;
+    astidentifier_t *address = ident;
+    for (int i = top; i >= 0; i--) {
+        resolverscope_t *scope = &resolver->scopes[i];
+        ptrdiff_t index = hmgeti(scope->bindings, name);
+        if (index < 0 || (i == top && !scope->bindings[index].declared)) {
+            continue;
+        }
+
+        address = nextAddress(address);
+        address->depth = top - i;
+        address->slot = scope->bindings[index].value;
+        if (scope->bindings[index].declared && !scope->bindings[index].conditional) {
+            return;
+        }
+    }
+
+    int builtin = builtinIndex(name);
+    if (builtin >= 0) {
+        address = nextAddress(address);
+        address->depth = AST_DEPTH_BUILTIN;
+        address->slot = builtin;
+        return;
+    }
+
+    if (address->depth != AST_DEPTH_UNRESOLVED) {
+        return; // the last binding that may be unset reports the name as not found.
+    }
+
+    // unknown names become globals that are never set, reading one reports it as not found.
+    ident->depth = top;
+    ident->slot = binding(&resolver->scopes[0], ident->value)->value;
+}
+
+static void resolve(resolver_t *resolver, astnode_t *node) {
+    if (!node) {
+        return;
+    }
+
+    switch (node->type) {
+        case AST_IDENTIFIER:
+            resolveIdentifier(resolver, (astidentifier_t *)node);
+            break;
+
+        case AST_LET: {
+            astletstatement_t *let = (astletstatement_t *)node;
+            visitChildren(resolver, node, resolve);
+            let->name->depth = 0;
+            let->name->slot = define(currentScope(resolver), let->name->value, resolver->branchDepth > 0);
+        }
+            break;
+
+        case AST_IFEXPR: {
+            astifexpression_t *exp = (astifexpression_t *)node;
+            resolve(resolver, AS_NODE(exp->condition));
+            resolver->branchDepth++;
+            resolve(resolver, AS_NODE(exp->consequence));
+            if (exp->alternative) {
+                resolve(resolver, AS_NODE(exp->alternative));
+            }
+            resolver->branchDepth--;
+        }
+            break;
+
+        case AST_FNLIT: {
+            astfunctionliteral_t *fn = (astfunctionliteral_t *)node;
+            pushScope(resolver);
+            int branchDepth = resolver->branchDepth;
+            resolver->branchDepth = 0;
+
+            for (int i = 0; i < arrlen(fn->parameters); i++) {
+                fn->parameters[i]->depth = 0;
+                fn->parameters[i]->slot = define(currentScope(resolver), fn->parameters[i]->value, false);
+            }
+
+            hoist(resolver, AS_NODE(fn->body));
+            visitChildren(resolver, node, resolve);
+
+            resolver->branchDepth = branchDepth;
+            fn->slotCount = popScope(resolver).count;
+        }
+            break;
+
+        default:
+            visitChildren(resolver, node, resolve);
+            break;
+    }
+}
+
+void resolverResolve(resolver_t *resolver, astprogram_t *program) {
+    assert(resolver);
+    assert(arrlen(resolver->scopes) == 1);
+
+    hoist(resolver, AS_NODE(program));
+    resolve(resolver, AS_NODE(program));
+}
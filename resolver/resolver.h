@@ -0,0 +1,23 @@
+//
+//  resolver.h
+//  conkey
+//
+//  Lexical addressing pass for the evaluator: annotates every identifier with the
+//  (depth, slot) of its binding so environments can be flat arrays.
+//  Let names are hoisted to the top of their function, blocks don't introduce scopes.
+//  Reads of a let in an if's branch fall back to the enclosing binding when it didn't run.
+
+#ifndef _resolver_h_
+#define _resolver_h_
+
+#include <stdbool.h>
+
+#include "../ast/ast.h"
+
+typedef struct resolver_t resolver_t;
+
+resolver_t *resolverCreate(void); // autoreleased, keeps global slots across programs (repl)
+void resolverResolve(resolver_t *resolver, astprogram_t *program);
+int resolverGlobalCount(resolver_t *resolver);
+
+#endif /* _resolver_h_ */
@@ -0,0 +1,134 @@
+//
+//  resolver_test.c
+//  conkey
+//
+
+#include "resolver.h"
+
+#include "../macros.h"
+#include "../ast/ast.h"
+#include "../arfoundation/arfoundation.h"
+#include "../lexer/lexer.h"
+#include "../parser/parser.h"
+#include "../arfoundation/vendor/utest.h"
+
+static astprogram_t *testResolve(resolver_t *resolver, const char *input) {
+    lexer_t *lexer = lexerWithInput(input);
+    parser_t *parser = parserWithLexer(lexer);
+    astprogram_t *program = parserParseProgram(parser);
+    resolverResolve(resolver, program);
+    return program;
+}
+
+static astexpression_t *testStatementExpression(aststatement_t *statement) {
+    if (AST_TYPE(statement) == AST_LET) {
+        return ((astletstatement_t *)statement)->value;
+    }
+    return ((astexpressionstatement_t *)statement)->expression;
+}
+
+static bool testResolvedIdentifier(astexpression_t *exp, int depth, int slot) {
+    if (!exp || AST_TYPE(exp) != AST_IDENTIFIER) {
+        fprintf(stderr, "expression is not an identifier\n");
+        return false;
+    }
+
+    astidentifier_t *ident = (astidentifier_t *)exp;
+    if (ident->depth != depth || ident->slot != slot) {
+        fprintf(stderr, "%s resolved to (%d, %d) want (%d, %d)\n", CString(ident->value), ident->depth, ident->slot, depth, slot);
+        return false;
+    }
+    return true;
+}
+
+UTEST(resolver, globalsAndBuiltins) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    astprogram_t *program = testResolve(resolverCreate(), "let a = 1; let b = a; let a = 2; len; a;");
+
+    ASSERT_TRUE(testResolvedIdentifier(testStatementExpression(program->statements[1]), 0, 0));
+    ASSERT_EQ(0, ((astletstatement_t *)program->statements[2])->name->slot);
+    ASSERT_TRUE(testResolvedIdentifier(testStatementExpression(program->statements[3]), AST_DEPTH_BUILTIN, 0));
+    ASSERT_TRUE(testResolvedIdentifier(testStatementExpression(program->statements[4]), 0, 0));
+
+    programRelease(&program);
+    RCRelease(pool);
+}
+
+UTEST(resolver, functionsAndClosures) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    astprogram_t *program = testResolve(resolverCreate(), MONKEY(
+        let g = 1;
+        fn(x, y) {
+            if (x) { let z = 1; }
+            fn() { x + g };
+        };
+    ));
+
+    astfunctionliteral_t *outer = (astfunctionliteral_t *)testStatementExpression(program->statements[1]);
+    ASSERT_EQ(3, outer->slotCount); // x, y and the hoisted z.
+
+    aststatement_t *last = outer->body->statements[1];
+    astfunctionliteral_t *inner = (astfunctionliteral_t *)testStatementExpression(last);
+    ASSERT_EQ(0, inner->slotCount);
+
+    astinfixexpression_t *sum = (astinfixexpression_t *)testStatementExpression(inner->body->statements[0]);
+    ASSERT_TRUE(testResolvedIdentifier(sum->left, 1, 0));  // x, one function up
+    ASSERT_TRUE(testResolvedIdentifier(sum->right, 2, 0)); // g, global
+
+    programRelease(&program);
+    RCRelease(pool);
+}
+
+UTEST(resolver, conditionalLets) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    astprogram_t *program = testResolve(resolverCreate(), MONKEY(
+        let x = 1;
+        fn(c) {
+            if (c) { let x = 2; }
+            x;
+            let x = 3;
+            x;
+        };
+    ));
+
+    astfunctionliteral_t *fn = (astfunctionliteral_t *)testStatementExpression(program->statements[1]);
+
+    // the branch may not have run, the global is read when the local is unset.
+    astidentifier_t *maybe = (astidentifier_t *)testStatementExpression(fn->body->statements[1]);
+    ASSERT_TRUE(testResolvedIdentifier(AS_EXPR(maybe), 0, 1));
+    ASSERT_TRUE(testResolvedIdentifier(AS_EXPR(maybe->fallback), 1, 0));
+    ASSERT_EQ(NULL, maybe->fallback->fallback);
+
+    // after a let outside of a branch it's always set.
+    astidentifier_t *set = (astidentifier_t *)testStatementExpression(fn->body->statements[3]);
+    ASSERT_TRUE(testResolvedIdentifier(AS_EXPR(set), 0, 1));
+    ASSERT_EQ(NULL, set->fallback);
+
+    programRelease(&program);
+    RCRelease(pool);
+}
+
+UTEST(resolver, hoistingAndReplState) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    resolver_t *resolver = resolverCreate();
+
+    // g is used before its let.
+    astprogram_t *program = testResolve(resolver, "let f = fn() { g }; let g = 2;");
+    astfunctionliteral_t *f = (astfunctionliteral_t *)testStatementExpression(program->statements[0]);
+    ASSERT_TRUE(testResolvedIdentifier(testStatementExpression(f->body->statements[0]), 1, 1));
+    programRelease(&program);
+
+    // globals from previous programs keep their slots.
+    program = testResolve(resolver, "let h = 3; g; unknown;");
+    ASSERT_EQ(2, ((astletstatement_t *)program->statements[0])->name->slot);
+    ASSERT_TRUE(testResolvedIdentifier(testStatementExpression(program->statements[1]), 0, 1));
+    ASSERT_TRUE(testResolvedIdentifier(testStatementExpression(program->statements[2]), 0, 3));
+    ASSERT_EQ(4, resolverGlobalCount(resolver));
+    programRelease(&program);
+
+    RCRelease(pool);
+}
+
+#ifndef AR_COMPOUND_TEST
+UTEST_MAIN();
+#endif
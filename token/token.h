@@ -79,15 +79,24 @@ token_type tokenLookupIdentifier(charslice_t ident);
 void tokenPrint(token_t token);
 
 AR_INLINE StringRef ARStringCreateWithSlice(charslice_t slice) {
-    return StringCreateWithFormat("%.*s", (int)slice.length, slice.src);
+    return StringCreateWithBytes(slice.src, slice.length);
 }
 
 AR_INLINE StringRef ARStringWithSlice(charslice_t slice) {
-    return StringWithFormat("%.*s", (int)slice.length, slice.src);
+    return StringWithBytes(slice.src, slice.length);
+}
+
+AR_INLINE StringRef ARStringInternSlice(charslice_t slice) {
+    return StringInternChars(slice.src, slice.length);
+}
+
+// no copy, owner holds the bytes slice points to.
+AR_INLINE StringRef ARStringCreateWithSliceView(charslice_t slice, void *owner) {
+    return StringCreateWithView(owner, slice.src, slice.length);
 }
 
 AR_INLINE void ARStringAppendSlice(StringRef str, charslice_t slice) {
-    StringAppendFormat(str, "%.*s", (int)slice.length, slice.src);
+    StringAppendBytes(str, slice.src, slice.length);
 }
 
 #endif
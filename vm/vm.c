@@ -0,0 +1,612 @@
+//
+//  vm.c
+//  conkey
+//
+
+#include "vm.h"
+
+#include <assert.h>
+
+#include "../arfoundation/arfoundation.h"
+#include "../evaluator/builtins.h"
+#include "../evaluator/evaluator.h"
+
+// labels as values are a gcc/clang extension, fall back to a plain switch elsewhere.
+#ifndef VM_COMPUTED_GOTO
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+#endif
+
+// everything the vm keeps alive is retained by the stack, the globals or the constants,
+// so the vm's own pool can be drained every so often without losing anything.
+#define VM_POOL_DRAIN_INTERVAL 1024
+
+#define VM_APPEND_BATCH 32 // stack slots copied into an RCTypeRef buffer per ArrayAppendObjects
+
+typedef struct {
+    MkyClosureRef closure;
+    uint8_t *ip;
+    int basePointer;
+} vmframe_t;
+
+struct vm_t {
+    MkyObject **stack;
+    int stackSize;
+    MkyObject **globals;
+    vmframe_t *frames;
+    int framesSize;
+    MkyObject *lastPopped;
+};
+
+static void vmDealloc(RCTypeRef obj) {
+    vm_t *self = obj;
+    for (int i = 0; i < self->stackSize; i++) {
+        RCRelease(self->stack[i]);
+    }
+    free(self->stack);
+    free(self->frames);
+
+    for (int i = 0; i < VM_GLOBALS_SIZE; i++) {
+        RCRelease(self->globals[i]);
+    }
+    free(self->globals);
+
+    self->lastPopped = RCRelease(self->lastPopped);
+}
+
+static RuntimeClassID MkyVMClassID = { 0 };
+static RuntimeClassDescriptor MkyVMClass = {
+    "MkyVM",
+    sizeof(struct vm_t),
+    NULL, // const
+    vmDealloc,
+    NULL,
+    NULL
+};
+
+vm_t *vmCreate(void) {
+    RuntimeRegisterClassOnce(&MkyVMClassID, &MkyVMClass);
+
+    vm_t *vm = RuntimeCreateInstance(MkyVMClassID);
+    vm->globals = calloc(VM_GLOBALS_SIZE, sizeof(MkyObject *));
+    vm->stack = ar_calloc(VM_STACK_SIZE, sizeof(MkyObject *));
+    vm->stackSize = VM_STACK_SIZE;
+    vm->frames = ar_malloc(VM_FRAMES_SIZE * sizeof(vmframe_t));
+    vm->framesSize = VM_FRAMES_SIZE;
+    return RCAutorelease(vm);
+}
+
+// doubles the stack until `needed` slots fit, false when that's more than VM_MAX_STACK_SIZE.
+static bool vmGrowStack(vm_t *vm, int needed) {
+    if (needed > VM_MAX_STACK_SIZE) {
+        return false;
+    }
+
+    int size = vm->stackSize;
+    while (size < needed) {
+        size *= 2;
+    }
+    vm->stack = ar_realloc(vm->stack, size * sizeof(MkyObject *));
+    memset(vm->stack + vm->stackSize, 0, (size - vm->stackSize) * sizeof(MkyObject *));
+    vm->stackSize = size;
+    return true;
+}
+
+static bool vmGrowFrames(vm_t *vm) {
+    if (vm->framesSize >= VM_MAX_FRAMES) {
+        return false;
+    }
+
+    vm->framesSize *= 2;
+    vm->frames = ar_realloc(vm->frames, vm->framesSize * sizeof(vmframe_t));
+    return true;
+}
+
+MkyObject *vmLastPoppedStackElem(vm_t *vm) {
+    return vm->lastPopped;
+}
+
+static token_type infixOperatorForOpcode(opcode_t op) {
+    switch (op) {
+        case OP_ADD: return TOKEN_PLUS;
+        case OP_SUB: return TOKEN_MINUS;
+        case OP_MUL: return TOKEN_ASTERISK;
+        case OP_DIV: return TOKEN_SLASH;
+        case OP_EQUAL: return TOKEN_EQ;
+        case OP_NOT_EQUAL: return TOKEN_NOT_EQ;
+        case OP_GREATER_THAN: return TOKEN_GT;
+        case OP_LESS_THAN: return TOKEN_LT;
+        default:
+            break;
+    }
+    ar_fatal("%s is not an infix operator", codeLookup(op)->name);
+    return TOKEN_ILLEGAL;
+}
+
+static MkyObject *executeBinaryOperation(opcode_t op, MkyObject *left, MkyObject *right) {
+    if (mkyType(left) == INTEGER_OBJ && mkyType(right) == INTEGER_OBJ) {
+        int64_t leftVal = mkyIntegerValue(left);
+        int64_t rightVal = mkyIntegerValue(right);
+
+        switch (op) {
+            case OP_ADD: return mkyInteger(leftVal + rightVal);
+            case OP_SUB: return mkyInteger(leftVal - rightVal);
+            case OP_MUL: return mkyInteger(leftVal * rightVal);
+            case OP_DIV: return mkyInteger(leftVal / rightVal);
+            case OP_EQUAL: return mkyBoolean(leftVal == rightVal);
+            case OP_NOT_EQUAL: return mkyBoolean(leftVal != rightVal);
+            case OP_GREATER_THAN: return mkyBoolean(leftVal > rightVal);
+            case OP_LESS_THAN: return mkyBoolean(leftVal < rightVal);
+            default:
+                break;
+        }
+    }
+
+    // everything else shares the evaluator's semantics and error messages.
+    return mkyEvalInfixExpression(infixOperatorForOpcode(op), left, right);
+}
+
+// a call that produced no value leaves NULL on the stack, as an operand that's null.
+static inline void nullifyMissingValues(MkyObject **values, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!values[i]) {
+            values[i] = mkyNull();
+        }
+    }
+}
+
+// the stack holds MkyObject pointers, they go through an RCTypeRef buffer rather than being passed as one.
+static void appendStackValues(ArrayRef array, MkyObject **values, int count) {
+    RCTypeRef batch[VM_APPEND_BATCH];
+    for (int done = 0; done < count; done += VM_APPEND_BATCH) {
+        int length = MIN(count - done, VM_APPEND_BATCH);
+        for (int i = 0; i < length; i++) {
+            batch[i] = values[done + i];
+        }
+        ArrayAppendObjects(array, batch, length);
+    }
+}
+
+static MkyObject *buildHash(MkyObject **pairs, int count) {
+    MkyHashRef hash = (MkyHashRef)mkyHash(NULL);
+    for (int i = 0; i < count; i += 2) {
+        MkyObject *key = pairs[i];
+        if (!mkyIsHashable(key)) {
+            return mkyError(StringWithFormat("unusable as hash key: %s", MkyObjectTypeNames[mkyType(key)]));
+        }
+        mkyHashSetObjectForKey(hash, key, pairs[i + 1]);
+    }
+    return (MkyObject *)hash;
+}
+
+MkyObject *vmRun(vm_t *vm, bytecode_t bytecode) {
+    assert(vm);
+
+#if VM_COMPUTED_GOTO
+#define OP(name, ...) &&op_##name,
+    static void *dispatchTable[OP_COUNT] = {
+        OPCODE_DEFS
+    };
+#undef OP
+#define VM_DISPATCH() goto *dispatchTable[*ip++]
+#define VM_CASE(name) op_##name:
+#else
+#define VM_DISPATCH() goto dispatch
+#define VM_CASE(name) case OP_##name:
+#endif
+
+#define VM_FAIL(error) do { result = (error); goto halt; } while (0)
+#define VM_RESERVE(count) do { \
+    if (sp + (count) > vm->stackSize) { \
+        if (!vmGrowStack(vm, sp + (count))) { \
+            VM_FAIL(mkyError(StringWithFormat("stack overflow"))); \
+        } \
+        stack = vm->stack; \
+    } \
+} while (0)
+#define VM_PUSH(value) do { \
+    VM_RESERVE(1); \
+    MkyObject *_old = stack[sp]; \
+    stack[sp++] = RCRetain(value); \
+    RCRelease(_old); \
+} while (0)
+// NULL, a call that produced no value, is null to everything but a let or the program's result.
+#define VM_POP() (stack[--sp] ? stack[sp] : mkyNull())
+// pops the top's reference along with it, nothing stale is left holding on to the value.
+#define VM_TAKE(into) do { \
+    into = stack[--sp]; \
+    stack[sp] = mkyNull(); \
+} while (0)
+
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+
+    instructions_t mainInstructions = NULL;
+    arrsetlen(mainInstructions, arrlen(bytecode.instructions));
+    memcpy(mainInstructions, bytecode.instructions, arrlen(bytecode.instructions));
+    codeEmit(&mainInstructions, OP_HALT);
+    MkyCompiledFunctionRef mainFn = (MkyCompiledFunctionRef)mkyCompiledFunction(mainInstructions, 0, 0);
+    MkyClosureRef mainClosure = RCRetain(mkyClosure(mainFn, NULL, 0));
+
+    ArrayRef constants = bytecode.constants;
+    MkyObject **stack = vm->stack;
+    MkyObject **globals = vm->globals;
+    MkyObject *result = NULL;
+    uint64_t calls = 0;
+
+    RCRelease(vm->lastPopped);
+    vm->lastPopped = NULL;
+
+    int framesIndex = 0;
+    vmframe_t *frame = &vm->frames[framesIndex++];
+    *frame = (vmframe_t){ mainClosure, mainInstructions, 0 };
+
+    uint8_t *ip = frame->ip;
+    int sp = 0;
+
+#if VM_COMPUTED_GOTO
+    VM_DISPATCH();
+#else
+dispatch:
+    switch (*ip++) {
+#endif
+
+    VM_CASE(CONSTANT) {
+        uint16_t index = codeReadUint16(ip);
+        ip += 2;
+        VM_PUSH(ArrayObjectAt(constants, index));
+    }
+        VM_DISPATCH();
+
+    VM_CASE(POP) {
+        RCRelease(vm->lastPopped);
+        VM_TAKE(vm->lastPopped);
+    }
+        VM_DISPATCH();
+
+    VM_CASE(ADD)
+    VM_CASE(SUB)
+    VM_CASE(MUL)
+    VM_CASE(DIV)
+    VM_CASE(EQUAL)
+    VM_CASE(NOT_EQUAL)
+    VM_CASE(GREATER_THAN)
+    VM_CASE(LESS_THAN) {
+        opcode_t op = ip[-1];
+        MkyObject *right = VM_POP();
+        MkyObject *left = VM_POP();
+        MkyObject *value = executeBinaryOperation(op, left, right);
+        if (mkyType(value) == ERROR_OBJ) {
+            VM_FAIL(value);
+        }
+        VM_PUSH(value);
+    }
+        VM_DISPATCH();
+
+    VM_CASE(TRUE)
+        VM_PUSH(mkyBoolean(true));
+        VM_DISPATCH();
+
+    VM_CASE(FALSE)
+        VM_PUSH(mkyBoolean(false));
+        VM_DISPATCH();
+
+    VM_CASE(NULL)
+        VM_PUSH(mkyNull());
+        VM_DISPATCH();
+
+    VM_CASE(MINUS)
+    VM_CASE(BANG) {
+        opcode_t op = ip[-1];
+        MkyObject *right = VM_POP();
+        MkyObject *value = NULL;
+        if (op == OP_MINUS && mkyType(right) == INTEGER_OBJ) {
+            value = mkyInteger(-mkyIntegerValue(right));
+
+        } else {
+            value = mkyEvalPrefixExpression(op == OP_MINUS ? TOKEN_MINUS : TOKEN_BANG, right);
+        }
+
+        if (mkyType(value) == ERROR_OBJ) {
+            VM_FAIL(value);
+        }
+        VM_PUSH(value);
+    }
+        VM_DISPATCH();
+
+    VM_CASE(JUMP) {
+        uint16_t target = codeReadUint16(ip);
+        ip = mkyCompiledFunctionInstructions(mkyClosureFunction(frame->closure)) + target;
+    }
+        VM_DISPATCH();
+
+    VM_CASE(JUMP_NOT_TRUTHY) {
+        uint16_t target = codeReadUint16(ip);
+        ip += 2;
+
+        MkyObject *condition = VM_POP();
+        if (!mkyIsTruthy(condition)) {
+            ip = mkyCompiledFunctionInstructions(mkyClosureFunction(frame->closure)) + target;
+        }
+    }
+        VM_DISPATCH();
+
+    VM_CASE(SET_GLOBAL) {
+        uint16_t index = codeReadUint16(ip);
+        ip += 2;
+
+        // like the evaluator, a let of no value binds nothing and a program ending in a let has no result.
+        MkyObject *value;
+        VM_TAKE(value);
+        if (value) {
+            RCRelease(globals[index]);
+            globals[index] = value;
+        }
+        RCRelease(vm->lastPopped);
+        vm->lastPopped = NULL;
+    }
+        VM_DISPATCH();
+
+    VM_CASE(GET_GLOBAL) {
+        uint16_t index = codeReadUint16(ip);
+        ip += 2;
+
+        // names used before, or without, a let and lets that failed at runtime.
+        if (!globals[index]) {
+            const char *name = symbolTableGlobalName(bytecode.symbolTable, index);
+            VM_FAIL(mkyError(StringWithFormat("identifier not found: %s", name ? name : "?")));
+        }
+        VM_PUSH(globals[index]);
+    }
+        VM_DISPATCH();
+
+    VM_CASE(GET_GLOBAL_OR) {
+        uint16_t target = codeReadUint16(ip);
+        uint16_t index = codeReadUint16(ip + 2);
+        ip += 4;
+
+        if (globals[index]) {
+            VM_PUSH(globals[index]);
+            ip = mkyCompiledFunctionInstructions(mkyClosureFunction(frame->closure)) + target;
+        }
+    }
+        VM_DISPATCH();
+
+    VM_CASE(SET_LOCAL) {
+        uint8_t index = codeReadUint8(ip);
+        ip += 1;
+
+        MkyObject *value;
+        VM_TAKE(value);
+        if (value) {
+            RCRelease(stack[frame->basePointer + index]);
+            stack[frame->basePointer + index] = value;
+        }
+    }
+        VM_DISPATCH();
+
+    VM_CASE(GET_LOCAL) {
+        uint8_t index = codeReadUint8(ip);
+        ip += 1;
+        MkyObject *local = stack[frame->basePointer + index];
+        VM_PUSH(local ? local : mkyNull()); // a let of no value left it unset
+    }
+        VM_DISPATCH();
+
+    VM_CASE(GET_LOCAL_OR) {
+        uint16_t target = codeReadUint16(ip);
+        uint8_t index = codeReadUint8(ip + 2);
+        ip += 3;
+
+        MkyObject *local = stack[frame->basePointer + index];
+        if (local) {
+            VM_PUSH(local);
+            ip = mkyCompiledFunctionInstructions(mkyClosureFunction(frame->closure)) + target;
+        }
+    }
+        VM_DISPATCH();
+
+    VM_CASE(MOVE_LOCAL) {
+        uint8_t index = codeReadUint8(ip);
+        ip += 1;
+        VM_RESERVE(1);
+
+        // nothing reads the local after this, the stack takes its reference instead of another one.
+        MkyObject **local = &stack[frame->basePointer + index];
+        RCRelease(stack[sp]);
+        stack[sp++] = *local ? *local : mkyNull();
+        *local = mkyNull();
+    }
+        VM_DISPATCH();
+
+    VM_CASE(GET_BUILTIN) {
+        uint8_t index = codeReadUint8(ip);
+        ip += 1;
+        VM_PUSH((MkyObject *)builtinAtIndex(index));
+    }
+        VM_DISPATCH();
+
+    VM_CASE(GET_FREE) {
+        uint8_t index = codeReadUint8(ip);
+        ip += 1;
+        VM_PUSH(mkyClosureFreeAt(frame->closure, index));
+    }
+        VM_DISPATCH();
+
+    VM_CASE(CURRENT_CLOSURE)
+        VM_PUSH((MkyObject *)frame->closure);
+        VM_DISPATCH();
+
+    VM_CASE(ARRAY) {
+        uint16_t count = codeReadUint16(ip);
+        ip += 2;
+
+        nullifyMissingValues(&stack[sp - count], count);
+        ArrayRef elements = RCAutorelease(ArrayCreateWithCapacity(count));
+        appendStackValues(elements, &stack[sp - count], count);
+        sp -= count;
+        VM_PUSH(mkyArray(elements));
+    }
+        VM_DISPATCH();
+
+    VM_CASE(HASH) {
+        uint16_t count = codeReadUint16(ip);
+        ip += 2;
+
+        nullifyMissingValues(&stack[sp - count], count);
+        MkyObject *hash = buildHash(&stack[sp - count], count);
+        if (mkyType(hash) == ERROR_OBJ) {
+            VM_FAIL(hash);
+        }
+        sp -= count;
+        VM_PUSH(hash);
+    }
+        VM_DISPATCH();
+
+    VM_CASE(INDEX) {
+        MkyObject *index = VM_POP();
+        MkyObject *left = VM_POP();
+        MkyObject *value = mkyEvalIndexExpression(left, index);
+        if (mkyType(value) == ERROR_OBJ) {
+            VM_FAIL(value);
+        }
+        VM_PUSH(value);
+    }
+        VM_DISPATCH();
+
+    VM_CASE(CALL) {
+        uint8_t numArgs = codeReadUint8(ip);
+        ip += 1;
+
+        if (++calls % VM_POOL_DRAIN_INTERVAL == 0) {
+            AutoreleasePoolDrain(pool);
+        }
+
+        nullifyMissingValues(&stack[sp - 1 - numArgs], numArgs + 1);
+        MkyObject *callee = stack[sp - 1 - numArgs];
+        if (mkyType(callee) == CLOSURE_OBJ) {
+            MkyClosureRef closure = (MkyClosureRef)callee;
+            MkyCompiledFunctionRef fn = mkyClosureFunction(closure);
+
+            int numParameters = mkyCompiledFunctionNumParameters(fn);
+            if (numArgs != numParameters) {
+                VM_FAIL(mkyError(StringWithFormat("wrong number of arguments: want=%d, got=%d", numParameters, numArgs)));
+            }
+
+            if (framesIndex >= vm->framesSize) {
+                if (!vmGrowFrames(vm)) {
+                    VM_FAIL(mkyError(StringWithFormat("stack overflow")));
+                }
+                frame = &vm->frames[framesIndex - 1];
+            }
+
+            int basePointer = sp - numArgs;
+            int numLocals = mkyCompiledFunctionNumLocals(fn);
+            VM_RESERVE(numLocals - numArgs);
+
+            // locals that aren't parameters start out unset, reads of a let that may not have run check for it.
+            for (int i = numArgs; i < numLocals; i++) {
+                VM_PUSH(NULL);
+            }
+
+            frame->ip = ip;
+            frame = &vm->frames[framesIndex++];
+            *frame = (vmframe_t){ closure, mkyCompiledFunctionInstructions(fn), basePointer };
+            ip = frame->ip;
+
+        } else if (mkyType(callee) == BUILTIN_OBJ) {
+            // the arguments move from the stack to args, a value nothing else holds can be changed in place.
+            ArrayRef args = ArrayCreateWithCapacity(numArgs);
+            appendStackValues(args, &stack[sp - numArgs], numArgs);
+            for (int i = sp - numArgs; i < sp; i++) {
+                RCRelease(stack[i]);
+                stack[i] = mkyNull();
+            }
+
+            MkyObject *value = mkyBuiltInFn(callee)(args);
+            if (value && mkyType(value) == ERROR_OBJ) {
+                RCRelease(args);
+                VM_FAIL(value);
+            }
+
+            sp -= numArgs + 1;
+            VM_PUSH(value ? value : mkyNull());
+            RCRelease(args);
+
+        } else {
+            VM_FAIL(mkyError(StringWithFormat("not a function: %s", MkyObjectTypeNames[mkyType(callee)])));
+        }
+    }
+        VM_DISPATCH();
+
+    VM_CASE(RETURN_VALUE)
+    VM_CASE(RETURN) {
+        MkyObject *value = NULL; // a body without a value gives none, same as the evaluator
+        if (ip[-1] == OP_RETURN_VALUE) {
+            VM_TAKE(value);
+        }
+
+        if (framesIndex == 1) {
+            // a top level return stops the program, same as the evaluator.
+            RCRelease(vm->lastPopped);
+            vm->lastPopped = value;
+            goto halt;
+        }
+
+        sp = frame->basePointer - 1;
+        frame = &vm->frames[--framesIndex - 1];
+        ip = frame->ip;
+
+        VM_PUSH(value);
+        RCRelease(value);
+    }
+        VM_DISPATCH();
+
+    VM_CASE(HALT)
+        goto halt;
+
+    VM_CASE(CLOSURE) {
+        uint16_t index = codeReadUint16(ip);
+        uint8_t numFree = codeReadUint8(ip + 2);
+        ip += 3;
+
+        MkyCompiledFunctionRef fn = ArrayObjectAt(constants, index);
+        MkyObject *closure = mkyClosure(fn, &stack[sp - numFree], numFree);
+        sp -= numFree;
+        VM_PUSH(closure);
+    }
+        VM_DISPATCH();
+
+#if !VM_COMPUTED_GOTO
+        default:
+            ar_fatal("unknown opcode %d", ip[-1]);
+            break;
+    }
+#endif
+
+halt:
+    if (!result) {
+        result = vm->lastPopped;
+    }
+    result = RCRetain(result);
+
+    // values left behind by an error don't outlive the run.
+    for (int i = 0; i < vm->stackSize; i++) {
+        RCRelease(stack[i]);
+        stack[i] = NULL;
+    }
+
+    RCRelease(mainClosure);
+    RCRelease(pool);
+
+    return RCAutorelease(result);
+
+#undef VM_POP
+#undef VM_TAKE
+#undef VM_PUSH
+#undef VM_FAIL
+#undef VM_CASE
+#undef VM_DISPATCH
+}
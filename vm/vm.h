@@ -0,0 +1,29 @@
+//
+//  vm.h
+//  conkey
+//
+//  Stack based virtual machine that runs the compiler's bytecode.
+//  Globals survive between runs so the repl can keep its bindings.
+
+#ifndef _vm_h_
+#define _vm_h_
+
+#include "../compiler/compiler.h"
+#include "../object/object.h"
+
+// the stack and frames start small and double as calls nest, recursion is how monkey loops.
+#define VM_STACK_SIZE 2048
+#define VM_MAX_STACK_SIZE (1 << 22) // slots, "stack overflow" past this
+#define VM_GLOBALS_SIZE 65536
+#define VM_FRAMES_SIZE 256
+#define VM_MAX_FRAMES (1 << 18)
+
+typedef struct vm_t vm_t;
+
+vm_t *vmCreate(void); // autoreleased
+
+// runs `bytecode` to completion, returns the last popped value or the error that halted the vm.
+MkyObject *vmRun(vm_t *vm, bytecode_t bytecode);
+MkyObject *vmLastPoppedStackElem(vm_t *vm);
+
+#endif /* _vm_h_ */
@@ -0,0 +1,461 @@
+//
+//  vm_test.c
+//  conkey
+//
+
+#include "vm.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "../macros.h"
+#include "../ast/ast.h"
+#include "../arfoundation/arfoundation.h"
+#include "../compiler/compiler.h"
+#include "../evaluator/evaluator.h"
+#include "../lexer/lexer.h"
+#include "../object/object.h"
+#include "../parser/parser.h"
+#include "../resolver/resolver.h"
+#include "../arfoundation/vendor/utest.h"
+
+static MkyObject *testRun(const char *input) {
+    lexer_t *lexer = lexerWithInput(input);
+    parser_t *parser = parserWithLexer(lexer);
+    astprogram_t *program = parserParseProgram(parser);
+
+    compiler_t *compiler = compilerCreate();
+    bool compiled = compilerCompile(compiler, AS_NODE(program));
+    programRelease(&program);
+
+    if (!compiled) {
+        return mkyError(StringWithString(ArrayObjectAt(compiler->errors, 0)));
+    }
+
+    vm_t *vm = vmCreate();
+    return vmRun(vm, compilerBytecode(compiler));
+}
+
+// the same program through the evaluator, both engines have to agree.
+static MkyObject *testRunEvaluator(const char *input) {
+    lexer_t *lexer = lexerWithInput(input);
+    parser_t *parser = parserWithLexer(lexer);
+    astprogram_t *program = parserParseProgram(parser);
+    resolverResolve(resolverCreate(), program);
+    MkyEnvironmentRef env = environmentCreate();
+
+    // closures are autoreleased, drain them before collecting or their cycles outlive the run.
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    MkyObject *result = RCRetain(mkyEval(AS_NODE(program), env));
+    RCRelease(env);
+    RCRelease(pool);
+    RuntimeCollectCycles();
+    programRelease(&program);
+    return RCAutorelease(result);
+}
+
+static bool testVMIntegerObject(MkyObject *obj, int64_t expected) {
+    if (!obj || mkyType(obj) != INTEGER_OBJ) {
+        fprintf(stderr, "object is not integer. got=%s\n", obj ? MkyObjectTypeNames[mkyType(obj)] : "<nil>");
+        return false;
+    }
+
+    int64_t objVal = mkyIntegerValue(obj);
+    if (objVal != expected) {
+        fprintf(stderr, "object has wrong value. got=%lld want %lld", objVal, expected);
+        return false;
+    }
+
+    return true;
+}
+
+static bool testVMBooleanObject(MkyObject *obj, bool expected) {
+    if (!obj || mkyType(obj) != BOOLEAN_OBJ) {
+        fprintf(stderr, "object is not boolean. got=%s\n", obj ? MkyObjectTypeNames[mkyType(obj)] : "<nil>");
+        return false;
+    }
+
+    if (mkyBooleanValue(obj) != expected) {
+        fprintf(stderr, "object has wrong value. got=%s want %s", !expected ? "true" : "false", expected ? "true" : "false");
+        return false;
+    }
+
+    return true;
+}
+
+static bool testVMStringObject(MkyObject *obj, const char *expected) {
+    if (!obj || mkyType(obj) != STRING_OBJ) {
+        fprintf(stderr, "object is not string. got=%s\n", obj ? MkyObjectTypeNames[mkyType(obj)] : "<nil>");
+        return false;
+    }
+
+    if (strcmp(CString(mkyStringValue(obj)), expected)) {
+        fprintf(stderr, "object has wrong value. got=%s want %s", CString(mkyStringValue(obj)), expected);
+        return false;
+    }
+
+    return true;
+}
+
+UTEST(vm, integerArithmetic) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    struct test {
+        const char *input;
+        int64_t expected;
+    } tests[] = {
+        {"1", 1},
+        {"1 + 2", 3},
+        {"1 - 2", -1},
+        {"4 / 2", 2},
+        {"50 / 2 * 2 + 10 - 5", 55},
+        {"5 * (2 + 10)", 60},
+        {"-50 + 100 + -50", 0},
+        {"(5 + 10 * 2 + 15 / 3) * 2 + -10", 50},
+        {"let one = 1; let two = one + one; one + two", 3},
+        {"let a = 1; let a = a + 1; a", 2},
+        {"if (1 > 2) { 10 } else { 20 }", 20},
+        {"if (1 < 2) { 10 }", 10},
+        {"if ((if (false) { 10 })) { 10 } else { 20 }", 20},
+        {"return 10; 9;", 10},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        ASSERT_TRUE(testVMIntegerObject(testRun(test.input), test.expected));
+    }
+    RCRelease(pool);
+}
+
+UTEST(vm, booleanExpressions) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    struct test {
+        const char *input;
+        bool expected;
+    } tests[] = {
+        {"true", true},
+        {"1 < 2", true},
+        {"1 > 2", false},
+        {"1 == 1", true},
+        {"1 != 1", false},
+        {"true != false", true},
+        {"(1 < 2) == true", true},
+        {"!5", false},
+        {"!!true", true},
+        {"!(if (false) { 5; })", true},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        ASSERT_TRUE(testVMBooleanObject(testRun(test.input), test.expected));
+    }
+
+    MkyObject *null = testRun("if (false) { 10 }");
+    ASSERT_TRUE(null == mkyNull());
+    RCRelease(pool);
+}
+
+UTEST(vm, stringsArraysAndHashes) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    ASSERT_TRUE(testVMStringObject(testRun("\"mon\" + \"key\" + \"banana\""), "monkeybanana"));
+
+    MkyObject *array = testRun("[1, 2 * 2, 3 + 3]");
+    ASSERT_EQ(ARRAY_OBJ, mkyType(array));
+    ASSERT_STREQ("[1, 4, 6]", CString(mkyInspect(array)));
+
+    MkyObject *hash = testRun("{1 + 1: 2 * 2, 3 + 3: 4 * 4}");
+    ASSERT_EQ(HASH_OBJ, mkyType(hash));
+    ASSERT_EQ(2, MapCount(mkyHashPairs((MkyHashRef)hash)));
+    ASSERT_STREQ("{b: 1, a: 2, c: 3}", CString(mkyInspect(testRun("set({\"b\": 1, \"a\": 2}, \"c\", 3)"))));
+
+    // consecutive integer keys stay dense until one doesn't follow.
+    MkyObject *dense = testRun("set({0: \"a\", 1: \"b\"}, 2, \"c\")");
+    ASSERT_TRUE(mkyHashIsDense((MkyHashRef)dense));
+    ASSERT_STREQ("{0: a, 1: b, 2: c}", CString(mkyInspect(dense)));
+    MkyObject *sparse = testRun("delete(set({0: \"a\", 1: \"b\"}, 5, \"c\"), 0)");
+    ASSERT_FALSE(mkyHashIsDense((MkyHashRef)sparse));
+    ASSERT_STREQ("{1: b, 5: c}", CString(mkyInspect(sparse)));
+
+    struct test {
+        const char *input;
+        int64_t expected;
+    } tests[] = {
+        {"[1, 2, 3][1]", 2},
+        {"[[1, 1, 1]][0][0]", 1},
+        {"{1: 1, 2: 2}[2]", 2},
+        {"{0: 5, 1: 6, 2: 7}[2] + {0: 5}[0]", 12},
+        {"let h = {\"one\": 1}; h[\"one\"]", 1},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        ASSERT_TRUE(testVMIntegerObject(testRun(test.input), test.expected));
+    }
+
+    ASSERT_TRUE(testVMBooleanObject(testRun("\"mon\" + \"key\" == \"monkey\""), true));
+    ASSERT_TRUE(testVMBooleanObject(testRun("\"monkey\" != \"monkey\""), false));
+    ASSERT_TRUE(testVMStringObject(testRun("slice(\"monkey\", 3)"), "key"));
+    ASSERT_STREQ("[2, 3]", CString(mkyInspect(testRun("slice([1, 2, 3, 4], 1, 3)"))));
+
+    ASSERT_TRUE(testRun("[1, 2, 3][99]") == mkyNull());
+    ASSERT_TRUE(testRun("{1: 1}[0]") == mkyNull());
+    RCRelease(pool);
+}
+
+UTEST(vm, functionsAndClosures) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    struct test {
+        const char *input;
+        int64_t expected;
+    } tests[] = {
+        {"let fivePlusTen = fn() { 5 + 10; }; fivePlusTen();", 15},
+        {"let earlyExit = fn() { return 99; 100; }; earlyExit();", 99},
+        {"let identity = fn(a) { a; }; identity(4);", 4},
+        {"let sum = fn(a, b) { let c = a + b; c; }; sum(1, 2) + sum(3, 4);", 10},
+        {"let globalSeed = 50; let minusOne = fn() { let num = 1; globalSeed - num; }; minusOne();", 49},
+        {"let newAdder = fn(x) { fn(y) { x + y } }; let addTwo = newAdder(2); addTwo(2);", 4},
+        {MONKEY(
+            let newClosure = fn(a, b) {
+                let one = fn() { a; };
+                let two = fn() { b; };
+                fn() { one() + two(); };
+            };
+            let closure = newClosure(9, 90);
+            closure();
+        ), 99},
+        {MONKEY(
+            let fibonacci = fn(x) {
+                if (x == 0) { return 0; }
+                if (x == 1) { return 1; }
+                fibonacci(x - 1) + fibonacci(x - 2);
+            };
+            fibonacci(15);
+        ), 610},
+        {MONKEY(
+            let wrapper = fn() {
+                let countDown = fn(x) {
+                    if (x == 0) { return 0; }
+                    countDown(x - 1);
+                };
+                countDown(1);
+            };
+            wrapper();
+        ), 0},
+        {"len(\"four\")", 4},
+        {"len(push([1, 2], 3))", 3},
+        {"last(rest([1, 2, 3]))", 3},
+        {"let h = {1: 1}; let g = set(h, 2, 2); len(h) * 10 + len(g) + g[2]", 14},
+        {"let h = {1: 1, 2: 2}; let g = delete(h, 1); len(g) * 10 + h[1]", 11},
+        {"let x = 5; let g = fn() { let x = x + 1; x }; g() + x", 11},
+        {"let x = 5; let f = fn() { let y = x; let x = 10; y }; f()", 5},
+        {"let x = 5; let f = fn(x) { let g = fn() { let x = x * 2; x }; g() }; f(21)", 42},
+        {"let f = fn() { g() }; let g = fn() { 7 }; f();", 7},
+        {"let x = 1; let x = fn() { }(); x", 1},
+        {"let f = fn() { }; len([f(), f()])", 2},
+        {"let x = 10; let f = fn(c) { if (c) { let x = 1; }; x }; f(false)", 10},
+        {"let x = 10; let f = fn(c) { if (c) { let x = 1; }; x }; f(true)", 1},
+        {"let x = 10; let f = fn(c) { if (c) { let x = 1; }; fn() { x } }; f(false)() + f(true)()", 11},
+        {"let f = fn(c) { if (c) { let len = 1; }; len(\"two\") }; f(false)", 3},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        ASSERT_TRUE(testVMIntegerObject(testRun(test.input), test.expected));
+    }
+
+    // no value, like the evaluator, the repl prints nothing.
+    ASSERT_EQ(NULL, testRun("let noReturn = fn() { }; noReturn();"));
+    ASSERT_EQ(NULL, testRun("fn() { }()"));
+    ASSERT_EQ(NULL, testRun("1; let a = 2;"));
+    RCRelease(pool);
+}
+
+UTEST(vm, inPlaceUpdates) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    struct test {
+        const char *input;
+        const char *expected;
+    } tests[] = {
+        // only values nothing else can see are changed in place.
+        {"let f = fn(a) { let b = push(a, 4); [a, b] }; f([1, 2, 3])", "[[1, 2, 3], [1, 2, 3, 4]]"},
+        {"let f = fn(a) { push(a, 4) }; let x = [1, 2, 3]; [f(x), x]", "[[1, 2, 3, 4], [1, 2, 3]]"},
+        {"let f = fn(a) { let g = fn() { a }; [push(a, 4), g()] }; f([1])", "[[1, 4], [1]]"},
+        {"let f = fn(a) { let a = push(a, 2); let a = push(a, 3); a }; f([1])", "[1, 2, 3]"},
+        {"let f = fn(h) { let g = set(h, 2, 2); [h, delete(g, 1)] }; f({1: 1})", "[{1: 1}, {2: 2}]"},
+        {MONKEY(
+            let build = fn(a, n) { if (n == 0) { a } else { build(push(a, n), n - 1) } };
+            let fill = fn(h, n) { if (n == 0) { h } else { fill(set(h, n, n * n), n - 1) } };
+            [build([0], 5), fill({}, 3)]
+        ), "[[0, 5, 4, 3, 2, 1], {3: 9, 2: 4, 1: 1}]"},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        EXPECT_STREQ(test.expected, CString(mkyInspect(testRun(test.input))));
+    }
+    RCRelease(pool);
+}
+
+UTEST(vm, errorHandling) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    struct test {
+        const char *input;
+        const char *expected;
+    } tests[] = {
+        {"5 + true;", "type mismatch: INTEGER + BOOLEAN"},
+        {"5 + true; 5;", "type mismatch: INTEGER + BOOLEAN"},
+        {"-true", "unknown operator: -BOOLEAN"},
+        {"true + false + true + false;", "unknown operator: BOOLEAN + BOOLEAN"},
+        {"if (10 > 1) { if (10 > 1) { return true + false; } return 1; }", "unknown operator: BOOLEAN + BOOLEAN"},
+        {"\"Hello\" - \"World\"", "unknown operator: STRING - STRING"},
+        {"foobar", "identifier not found: foobar"},
+        {"{\"name\": \"Monkey\"}[fn(x) { x }];", "unusable as hash key: CLOSURE"},
+        {"fn() { 1; }(1);", "wrong number of arguments: want=0, got=1"},
+        {"len(1)", "argument to 'len' not supported, got INTEGER"},
+        {"1(1)", "not a function: INTEGER"},
+        {"null", "identifier not found: null"},
+        {"let f = fn() { later }; f()", "identifier not found: later"},
+        {"let y = x; let x = 1;", "identifier not found: x"},
+        {"let f = fn(c) { if (c) { let y = 1; }; y }; f(false)", "identifier not found: y"},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        MkyObject *result = testRun(test.input);
+        ASSERT_EQ(ERROR_OBJ, mkyType(result));
+        ASSERT_STREQ(test.expected, CString(mkyErrorMessage(result)));
+    }
+    RCRelease(pool);
+}
+
+UTEST(vm, globalsSurviveRuns) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    const char *lines[] = {
+        "let a = 40;",
+        "let add = fn(x) { a + x };",
+        "add(2)",
+    };
+
+    compiler_t *compiler = compilerCreate();
+    vm_t *vm = vmCreate();
+    MkyObject *result = NULL;
+
+    for (int i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        lexer_t *lexer = lexerWithInput(lines[i]);
+        parser_t *parser = parserWithLexer(lexer);
+        astprogram_t *program = parserParseProgram(parser);
+
+        compiler = compilerCreateWithState(compiler->symbolTable, compiler->constants);
+        ASSERT_TRUE(compilerCompile(compiler, AS_NODE(program)));
+        programRelease(&program);
+
+        result = vmRun(vm, compilerBytecode(compiler));
+    }
+
+    ASSERT_TRUE(testVMIntegerObject(result, 42));
+
+    // a let that failed at runtime binds nothing, the name stays unknown.
+    const char *failed[] = {
+        "let b = 1 + \"x\";",
+        "b[0]",
+    };
+    for (int i = 0; i < sizeof(failed) / sizeof(failed[0]); i++) {
+        lexer_t *lexer = lexerWithInput(failed[i]);
+        parser_t *parser = parserWithLexer(lexer);
+        astprogram_t *program = parserParseProgram(parser);
+
+        compiler = compilerCreateWithState(compiler->symbolTable, compiler->constants);
+        ASSERT_TRUE(compilerCompile(compiler, AS_NODE(program)));
+        programRelease(&program);
+
+        result = vmRun(vm, compilerBytecode(compiler));
+    }
+    ASSERT_STREQ("identifier not found: b", CString(mkyErrorMessage(result)));
+    RCRelease(pool);
+}
+
+// monkey has no loops, recursion is as deep as a script iterates.
+UTEST(vm, deepRecursion) {
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    struct test {
+        const char *input;
+        const char *expected;
+    } tests[] = {
+        {"let build = fn(a, n) { if (n == 0) { a } else { build(push(a, n), n - 1) } }; len(build([0], 3000))", "3001"},
+        {"let count = fn(n) { if (n == 0) { 0 } else { 1 + count(n - 1) } }; count(3000)", "3000"},
+        {"let sum = fn(total, n) { if (n == 0) { total } else { sum(total + n, n - 1) } }; sum(0, 3000)", "4501500"},
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(struct test); i++) {
+        struct test test = tests[i];
+        const char *evaluated = CString(mkyInspect(testRunEvaluator(test.input)));
+        const char *run = CString(mkyInspect(testRun(test.input)));
+        EXPECT_STREQ(test.expected, evaluated);
+        EXPECT_STREQ(test.expected, run);
+    }
+
+    // past what the evaluator's C stack allows, the vm's stack grows.
+    ASSERT_TRUE(testVMIntegerObject(testRun("let count = fn(n) { if (n == 0) { 0 } else { 1 + count(n - 1) } }; count(100000)"), 100000));
+
+    MkyObject *result = testRun("let forever = fn(n) { 1 + forever(n + 1) }; forever(0)");
+    ASSERT_EQ(ERROR_OBJ, mkyType(result));
+    ASSERT_STREQ("stack overflow", CString(mkyErrorMessage(result)));
+    RCRelease(pool);
+}
+
+// one interpreter per thread, nothing but constants shared between them.
+static const struct {
+    const char *input;
+    const char *expected;
+} concurrentTests[] = {
+    {"let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }; fib(15)", "610"},
+    {"let people = {\"ann\": 1, \"bob\": 2}; let greet = fn(name) { \"hi \" + name }; greet(\"bob\") + \" \" + greet(\"ann\")", "hi bob hi ann"},
+    {"let h = {\"a\": [1, 2], \"b\": [3]}; len(h[\"a\"]) + len(push(h[\"b\"], 4))", "4"},
+    {"let adder = fn(x) { fn(y) { x + y } }; let addTwo = adder(2); addTwo(40)", "42"},
+};
+
+typedef struct {
+    int runs;
+    int failures;
+} InterpreterThreadResult;
+
+static void *interpreterThread(void *context) {
+    InterpreterThreadResult *result = context;
+    for (int i = 0; i < 50; i++) {
+        AutoreleasePoolRef pool = AutoreleasePoolCreate();
+        for (int j = 0; j < sizeof(concurrentTests) / sizeof(concurrentTests[0]); j++) {
+            const char *evaluated = CString(mkyInspect(testRunEvaluator(concurrentTests[j].input)));
+            const char *run = CString(mkyInspect(testRun(concurrentTests[j].input)));
+            result->failures += strcmp(concurrentTests[j].expected, evaluated) != 0;
+            result->failures += strcmp(concurrentTests[j].expected, run) != 0;
+            result->runs += 2;
+        }
+        RCRelease(pool);
+    }
+    return NULL;
+}
+
+UTEST(vm, concurrentInterpreters) {
+    pthread_t threads[4];
+    InterpreterThreadResult results[4] = { 0 };
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, interpreterThread, &results[i]));
+    }
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+    }
+
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(50 * 2 * sizeof(concurrentTests) / sizeof(concurrentTests[0]), results[i].runs);
+        ASSERT_EQ(0, results[i].failures);
+    }
+
+    // the workers' pages went back or were left for this thread, it keeps working.
+    AutoreleasePoolRef pool = AutoreleasePoolCreate();
+    ASSERT_STREQ("610", CString(mkyInspect(testRun(concurrentTests[0].input))));
+    RCRelease(pool);
+}
+
+#ifndef AR_COMPOUND_TEST
+UTEST_MAIN();
+#endif